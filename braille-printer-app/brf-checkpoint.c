@@ -0,0 +1,569 @@
+//
+// Output checkpoints for the Braille Printer Application
+//
+// Copyright © 2022 Chandresh Soni
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// When an embosser jams or runs out of paper in the middle of a long job,
+// the job fails and everything has to be converted and embossed again.  The
+// device-ready output of every job is therefore kept in the spool directory
+// while it is sent, and the number of pages the device has taken is recorded
+// at each page boundary in a small checkpoint file next to it:
+//
+//   resume-PRINTER-JOB.brf       Device-ready output
+//   resume-PRINTER-JOB.brf.ckpt  "pages=N bytes=M", rewritten in place
+//   resume-PRINTER-JOB.brf.pgx   Page index, saved when the job fails
+//
+// The files are removed when the job completes.  After a failure they stay
+// for BRF_CKPT_MAX_AGE seconds, and the "/brf-resume" page of the web
+// interface lists them.  Resuming a job there queues the kept output from
+// the first page that didn't come out as a new BRF job, which goes straight
+// to the driver without any conversion.  Output beyond BRF_CKPT_MAX_SIZE
+// megabytes isn't kept, such a job can't be resumed.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+
+//
+// Local types...
+//
+
+struct brf_ckpt_s			// Output checkpoint
+{
+  pappl_job_t		*job;		// Job
+  int			fd,		// Kept output
+			ckptfd;		// Checkpoint file
+  int			pages;		// Pages sent to the device
+  off_t			bytes,		// Bytes sent to the device
+			size;		// Bytes of kept output
+  char			filename[1024];	// Kept output filename
+};
+
+
+//
+// Local functions...
+//
+
+static void	brf_ckpt_remove(brf_ckpt_t *ckpt);
+static bool	brf_ckpt_resume(pappl_system_t *system, pappl_client_t *client, int printer_id, int job_id, int page, char *message, size_t msgsize);
+static bool	brf_ckpt_resume_cb(pappl_client_t *client, pappl_system_t *system);
+static void	brf_ckpt_save(brf_ckpt_t *ckpt);
+static void	brf_ckpt_unlink(const char *filename);
+
+
+//
+// Local globals...
+//
+
+static char	brf_ckpt_directory[1024] = "";
+					// Spool directory
+
+
+//
+// 'brfCheckpointCleanup()' - Remove kept output of old failed jobs.
+//
+
+void
+brfCheckpointCleanup(
+    const char *directory)		// I - Spool directory
+{
+  DIR		*dir;			// Directory
+  struct dirent	*dent;			// Directory entry
+  char		filename[1024];		// Kept output filename
+  struct stat	info;			// File information
+  time_t	expire = time(NULL) - BRF_CKPT_MAX_AGE;
+					// Oldest time to keep
+
+
+  if ((dir = opendir(directory)) == NULL)
+    return;
+
+  while ((dent = readdir(dir)) != NULL)
+  {
+    if (strncmp(dent->d_name, "resume-", 7))
+      continue;
+
+    snprintf(filename, sizeof(filename), "%s/%s", directory, dent->d_name);
+
+    if (!stat(filename, &info) && info.st_mtime < expire)
+      unlink(filename);
+  }
+
+  closedir(dir);
+}
+
+
+//
+// 'brfCheckpointCreate()' - Start keeping the output of a job.
+//
+
+brf_ckpt_t *				// O - Checkpoint or `NULL` on error
+brfCheckpointCreate(
+    pappl_job_t *job,			// I - Job
+    const char  *directory)		// I - Spool directory
+{
+  brf_ckpt_t	*ckpt;			// Checkpoint
+  char		ckptname[1100];		// Checkpoint filename
+
+
+  if ((ckpt = (brf_ckpt_t *)calloc(1, sizeof(brf_ckpt_t))) == NULL)
+    return (NULL);
+
+  ckpt->job = job;
+
+  snprintf(ckpt->filename, sizeof(ckpt->filename), "%s/resume-%d-%d.brf", directory, papplPrinterGetID(papplJobGetPrinter(job)), papplJobGetID(job));
+  snprintf(ckptname, sizeof(ckptname), "%s.ckpt", ckpt->filename);
+
+  if ((ckpt->fd = open(ckpt->filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0 || (ckpt->ckptfd = open(ckptname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_WARN, "Unable to keep output for resuming the job: %s", strerror(errno));
+
+    if (ckpt->fd >= 0)
+    {
+      close(ckpt->fd);
+      unlink(ckpt->filename);
+    }
+
+    free(ckpt);
+    return (NULL);
+  }
+
+  brf_ckpt_save(ckpt);
+
+  return (ckpt);
+}
+
+
+//
+// 'brfCheckpointFinish()' - Finish the output of a job.
+//
+// The kept output is removed when the job was sent completely or canceled.
+// Otherwise it stays, with its page index, for resuming the job.
+//
+
+void
+brfCheckpointFinish(
+    brf_ckpt_t    *ckpt,		// I - Checkpoint
+    brf_pgindex_t *idx,			// I - Page index of the output
+    off_t         sent,			// I - Bytes sent to the device
+    bool          ok)			// I - Job sent completely?
+{
+  int	count;				// Number of pages
+
+
+  if (!ckpt)
+    return;
+
+  if (ok || papplJobIsCanceled(ckpt->job) || ckpt->fd < 0)
+  {
+    brf_ckpt_remove(ckpt);
+    return;
+  }
+
+  brfCheckpointUpdate(ckpt, idx, sent);
+
+  close(ckpt->fd);
+  close(ckpt->ckptfd);
+
+  count = brfPageIndexGetCount(idx);
+
+  if (ckpt->pages >= count || !brfPageIndexSave(idx, ckpt->filename))
+  {
+    // Nothing left to resume...
+    ckpt->fd = ckpt->ckptfd = -1;
+    brf_ckpt_remove(ckpt);
+    return;
+  }
+
+  papplLogJob(ckpt->job, PAPPL_LOGLEVEL_ERROR, "Stopped after %d of %d pages, the job can be resumed from page %d on the /brf-resume page.", ckpt->pages, count, ckpt->pages + 1);
+
+  free(ckpt);
+}
+
+
+//
+// 'brfCheckpointInit()' - Add the page for resuming failed jobs.
+//
+
+void
+brfCheckpointInit(pappl_system_t *system)// I - System
+{
+  papplSystemGetSpoolDirectory(system, brf_ckpt_directory, sizeof(brf_ckpt_directory));
+  papplSystemAddResourceCallback(system, "/brf-resume", "text/html", (pappl_resource_cb_t)brf_ckpt_resume_cb, system);
+}
+
+
+//
+// 'brfCheckpointUpdate()' - Record the pages the device has taken.
+//
+// Call this at page boundaries.  Only complete pages count.
+//
+
+void
+brfCheckpointUpdate(
+    brf_ckpt_t    *ckpt,		// I - Checkpoint
+    brf_pgindex_t *idx,			// I - Page index of the output
+    off_t         sent)			// I - Bytes sent to the device
+{
+  int	pages;				// Complete pages sent
+
+
+  if (!ckpt || ckpt->fd < 0)
+    return;
+
+  if ((pages = brfPageIndexGetPagesBefore(idx, sent)) > ckpt->pages)
+  {
+    ckpt->pages = pages;
+    ckpt->bytes = sent;
+
+    brf_ckpt_save(ckpt);
+  }
+}
+
+
+//
+// 'brfCheckpointWrite()' - Keep output of a job.
+//
+// A write error or output beyond BRF_CKPT_MAX_SIZE only stops keeping the
+// output, the job goes on.
+//
+
+void
+brfCheckpointWrite(brf_ckpt_t *ckpt,	// I - Checkpoint
+                   const void *buffer,	// I - Output
+                   size_t     bytes)	// I - Number of bytes
+{
+  if (!ckpt || ckpt->fd < 0)
+    return;
+
+  if ((ckpt->size += (off_t)bytes) > (off_t)BRF_CKPT_MAX_SIZE * 1048576)
+  {
+    papplLogJob(ckpt->job, PAPPL_LOGLEVEL_INFO, "Output is larger than %dMB, not keeping it for resuming the job.", BRF_CKPT_MAX_SIZE);
+
+    close(ckpt->fd);
+    ckpt->fd = -1;
+
+    // Don't leave a partial copy behind...
+    unlink(ckpt->filename);
+  }
+  else if (write(ckpt->fd, buffer, bytes) != (ssize_t)bytes)
+  {
+    papplLogJob(ckpt->job, PAPPL_LOGLEVEL_WARN, "Unable to keep output for resuming the job: %s", strerror(errno));
+
+    close(ckpt->fd);
+    ckpt->fd = -1;
+  }
+}
+
+
+//
+// 'brf_ckpt_remove()' - Remove the kept output and free the checkpoint.
+//
+
+static void
+brf_ckpt_remove(brf_ckpt_t *ckpt)	// I - Checkpoint
+{
+  if (ckpt->fd >= 0)
+    close(ckpt->fd);
+  if (ckpt->ckptfd >= 0)
+    close(ckpt->ckptfd);
+
+  brf_ckpt_unlink(ckpt->filename);
+
+  free(ckpt);
+}
+
+
+//
+// 'brf_ckpt_resume()' - Queue the rest of a failed job.
+//
+// The job resumes from the given page, or after the last page the device
+// took when `page` is 0.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_ckpt_resume(
+    pappl_system_t *system,		// I - System
+    pappl_client_t *client,		// I - Client
+    int            printer_id,		// I - Printer ID
+    int            job_id,		// I - Job ID
+    int            page,		// I - First page to print or `0` for the checkpoint
+    char           *message,		// O - Result message
+    size_t         msgsize)		// I - Size of message buffer
+{
+  pappl_printer_t	*printer;	// Printer
+  pappl_pr_driver_data_t driver_data;	// Driver data
+  pappl_job_t		*job;		// New job
+  brf_pgindex_t		*idx;		// Page index of kept output
+  char			filename[1024],	// Kept output filename
+			tempfile[1100],	// Rest of the job
+			title[256],	// Job name
+			record[64],	// Checkpoint record
+			buffer[65536];	// Copy buffer
+  int			fd,		// Kept output or checkpoint file
+			tempfd,		// Rest of the job
+			pages = 0;	// Pages the device has taken
+  off_t			start,		// Start of the first page left
+			end;		// End of the last page
+  ssize_t		bytes;		// Bytes read
+
+
+  snprintf(filename, sizeof(filename), "%s/resume-%d-%d.brf", brf_ckpt_directory, printer_id, job_id);
+
+  if ((printer = papplSystemFindPrinter(system, NULL, printer_id, NULL)) == NULL)
+  {
+    snprintf(message, msgsize, "The printer of job %d no longer exists.", job_id);
+    return (false);
+  }
+
+  // Only failed jobs have a page index next to the kept output...
+  snprintf(tempfile, sizeof(tempfile), "%s" BRF_PGX_EXT, filename);
+
+  if (access(tempfile, F_OK) || (idx = brfPageIndexLoad(filename, false)) == NULL)
+  {
+    snprintf(message, msgsize, "Job %d can't be resumed.", job_id);
+    return (false);
+  }
+
+  snprintf(tempfile, sizeof(tempfile), "%s.ckpt", filename);
+
+  if ((fd = open(tempfile, O_RDONLY)) >= 0)
+  {
+    if ((bytes = read(fd, record, sizeof(record) - 1)) > 0)
+    {
+      record[bytes] = '\0';
+      sscanf(record, "pages=%d", &pages);
+    }
+
+    close(fd);
+  }
+
+  if (page <= 0)
+    page = pages + 1;
+
+  if (!brfPageIndexGetRange(idx, page, INT_MAX, &start, &end))
+  {
+    brfPageIndexDelete(idx);
+
+    if (page > pages + 1)
+      snprintf(message, msgsize, "Job %d has no page %d.", job_id, page);
+    else
+      snprintf(message, msgsize, "No pages of job %d are left to print.", job_id);
+    return (false);
+  }
+
+  brfPageIndexDelete(idx);
+
+  // Copy the pages that didn't come out to a new document, which the new job
+  // takes over...
+  snprintf(tempfile, sizeof(tempfile), "%s/resumed-%d-%d.brf", brf_ckpt_directory, printer_id, job_id);
+
+  if ((fd = open(filename, O_RDONLY | O_CLOEXEC)) < 0)
+  {
+    snprintf(message, msgsize, "Unable to open output of job %d: %s", job_id, strerror(errno));
+    return (false);
+  }
+
+  if ((tempfd = open(tempfile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0)
+  {
+    snprintf(message, msgsize, "Unable to create '%s': %s", tempfile, strerror(errno));
+    close(fd);
+    return (false);
+  }
+
+  while (start < end && (bytes = pread(fd, buffer, (size_t)(end - start) < sizeof(buffer) ? (size_t)(end - start) : sizeof(buffer), start)) > 0)
+  {
+    if (write(tempfd, buffer, (size_t)bytes) != bytes)
+      break;
+
+    start += bytes;
+  }
+
+  close(fd);
+
+  if (close(tempfd) || start < end)
+  {
+    snprintf(message, msgsize, "Unable to copy output of job %d.", job_id);
+    unlink(tempfile);
+    return (false);
+  }
+
+  papplPrinterGetDriverData(printer, &driver_data);
+  snprintf(title, sizeof(title), "Job %d from page %d", job_id, page);
+
+  if ((job = papplJobCreateWithFile(printer, papplClientGetUsername(client), driver_data.format, title, 0, NULL, tempfile)) == NULL)
+  {
+    snprintf(message, msgsize, "Unable to queue the rest of job %d.", job_id);
+    unlink(tempfile);
+    return (false);
+  }
+
+  papplLogJob(job, PAPPL_LOGLEVEL_INFO, "Resuming job %d from page %d.", job_id, page);
+  snprintf(message, msgsize, "Job %d resumes job %d from page %d.", papplJobGetID(job), job_id, page);
+
+  // The job can only be resumed once...
+  brf_ckpt_unlink(filename);
+
+  return (true);
+}
+
+
+//
+// 'brf_ckpt_resume_cb()' - Show failed jobs and resume them.
+//
+
+static bool				// O - `true` if handled
+brf_ckpt_resume_cb(
+    pappl_client_t *client,		// I - Client
+    pappl_system_t *system)		// I - System
+{
+  int			num_form = 0;	// Number of form variables
+  cups_option_t		*form = NULL;	// Form variables
+  const char		*value;		// Form value
+  int			printer_id,	// Printer ID
+			job_id,		// Job ID
+			page,		// First page to print
+			pages,		// Pages the device has taken
+			count = 0;	// Number of failed jobs
+  char			message[1024] = "",
+					// Result message
+			name[64],	// Page form variable
+			filename[1100],	// Checkpoint filename
+			record[64];	// Checkpoint record
+  DIR			*dir;		// Spool directory
+  struct dirent		*dent;		// Directory entry
+  pappl_printer_t	*printer;	// Printer
+  int			fd;		// Checkpoint file
+  ssize_t		bytes;		// Bytes read
+
+
+  if (!papplClientHTMLAuthorize(client))
+    return (true);
+
+  if (papplClientGetMethod(client) == HTTP_STATE_POST)
+  {
+    num_form = papplClientGetForm(client, &form);
+
+    if (!papplClientIsValidForm(client, num_form, form))
+      papplCopyString(message, "Invalid form submission.", sizeof(message));
+    else if ((value = cupsGetOption("job", num_form, form)) == NULL || sscanf(value, "%d-%d", &printer_id, &job_id) != 2)
+      papplCopyString(message, "Missing job.", sizeof(message));
+    else
+    {
+      // Each job has its own page field, which defaults to the checkpoint...
+      snprintf(name, sizeof(name), "page-%d-%d", printer_id, job_id);
+
+      if ((value = cupsGetOption(name, num_form, form)) == NULL || !*value)
+        page = 0;
+      else
+        page = (int)strtol(value, NULL, 10);
+
+      if (value && *value && page < 1)
+        snprintf(message, sizeof(message), "Bad page number \"%s\".", value);
+      else
+        brf_ckpt_resume(system, client, printer_id, job_id, page, message, sizeof(message));
+    }
+
+    cupsFreeOptions(num_form, form);
+  }
+
+  papplClientHTMLHeader(client, "Resume Jobs", 0);
+  papplClientHTMLPuts(client, "<div class=\"content\"><div class=\"row\"><div class=\"col-12\"><h1 class=\"title\">Resume Jobs</h1>\n");
+
+  if (message[0])
+    papplClientHTMLPrintf(client, "<div class=\"banner\">%s</div>\n", message);
+
+  papplClientHTMLStartForm(client, "/brf-resume", false);
+  papplClientHTMLPuts(client, "<table class=\"list\"><tbody>\n");
+
+  // Failed jobs are the ones with a page index next to the kept output...
+  if ((dir = opendir(brf_ckpt_directory)) != NULL)
+  {
+    while ((dent = readdir(dir)) != NULL)
+    {
+      if (sscanf(dent->d_name, "resume-%d-%d.brf", &printer_id, &job_id) != 2 || strcmp(dent->d_name + strlen(dent->d_name) - strlen(".brf" BRF_PGX_EXT), ".brf" BRF_PGX_EXT))
+        continue;
+
+      if ((printer = papplSystemFindPrinter(system, NULL, printer_id, NULL)) == NULL)
+        continue;
+
+      pages = 0;
+
+      snprintf(filename, sizeof(filename), "%s/resume-%d-%d.brf.ckpt", brf_ckpt_directory, printer_id, job_id);
+
+      if ((fd = open(filename, O_RDONLY)) >= 0)
+      {
+        if ((bytes = read(fd, record, sizeof(record) - 1)) > 0)
+        {
+          record[bytes] = '\0';
+          sscanf(record, "pages=%d", &pages);
+        }
+
+        close(fd);
+      }
+
+      papplClientHTMLPrintf(client, "<tr><td>%s</td><td>Job %d</td><td>Stopped after %d pages</td><td><label>From page <input type=\"number\" name=\"page-%d-%d\" min=\"1\" value=\"%d\"></label> <button type=\"submit\" name=\"job\" value=\"%d-%d\">Resume</button></td></tr>\n", papplPrinterGetName(printer), job_id, pages, printer_id, job_id, pages + 1, printer_id, job_id);
+      count ++;
+    }
+
+    closedir(dir);
+  }
+
+  if (!count)
+    papplClientHTMLPuts(client, "<tr><td>No failed jobs can be resumed.</td></tr>\n");
+
+  papplClientHTMLPuts(client, "</tbody></table></form></div></div></div>\n");
+  papplClientHTMLFooter(client);
+
+  return (true);
+}
+
+
+//
+// 'brf_ckpt_save()' - Write the checkpoint file.
+//
+// The record has a fixed length so it can be rewritten in place.
+//
+
+static void
+brf_ckpt_save(brf_ckpt_t *ckpt)		// I - Checkpoint
+{
+  char	record[64];			// Checkpoint record
+  int	length;				// Length of record
+
+
+  length = snprintf(record, sizeof(record), "pages=%-10d bytes=%-20ld\n", ckpt->pages, (long)ckpt->bytes);
+
+  if (pwrite(ckpt->ckptfd, record, (size_t)length, 0) != length)
+    papplLogJob(ckpt->job, PAPPL_LOGLEVEL_WARN, "Unable to save checkpoint: %s", strerror(errno));
+}
+
+
+//
+// 'brf_ckpt_unlink()' - Remove kept output and its sidecar files.
+//
+
+static void
+brf_ckpt_unlink(const char *filename)	// I - Kept output filename
+{
+  char	sidecar[1100];			// Sidecar filename
+
+
+  unlink(filename);
+
+  snprintf(sidecar, sizeof(sidecar), "%s.ckpt", filename);
+  unlink(sidecar);
+
+  snprintf(sidecar, sizeof(sidecar), "%s" BRF_PGX_EXT, filename);
+  unlink(sidecar);
+}
@@ -0,0 +1,504 @@
+//
+// CPU token pool for the Braille Printer Application
+//
+// Copyright © 2022 Chandresh Soni
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// When many embossers start jobs at the same time, every job starts its own
+// PDF text extraction, lou_translate, FreeDots, and external filter work, and
+// the host ends up with far more busy processes than processors.  Each
+// CPU-intensive stage therefore takes a token from a pool shared by the whole
+// server before it runs and returns it when done.  Stages that wait are
+// served by "job-priority", then in the order they came.
+//
+// The pool lives in shared memory with a process-shared mutex, so filter
+// chains forked from the server draw from the same tokens.  Tokens and wait
+// slots of processes that died, for example because their job was canceled,
+// are taken back.  The "/brf-cpu.json" page of the web interface returns the
+// number of tokens in use and how long stages had to wait.
+//
+// Stages must not hold a token while they wait for another stage, or the
+// pool can run dry: take it for the work and return it before blocking on
+// output that another stage reads, which brfCPUWrite() does.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+
+//
+// Local types...
+//
+
+typedef struct brf_cpu_waiter_s		// Stage waiting for a token
+{
+  int			pid,		// Process ID or 0 if slot is free
+			job_id,		// Job ID
+			priority;	// Job priority
+  unsigned		seq;		// Order of arrival
+} brf_cpu_waiter_t;
+
+typedef struct brf_cpu_pool_s		// Token pool in shared memory
+{
+  pthread_mutex_t	mutex;		// Mutex for pool
+  pthread_cond_t	cond;		// Condition for released tokens
+  int			num_tokens;	// Number of tokens
+  int			holders[BRF_CPU_MAX_TOKENS];
+					// Process holding each token or 0
+  brf_cpu_waiter_t	waiters[BRF_CPU_WAITERS];
+					// Stages waiting for a token
+  unsigned		seq;		// Next arrival number
+  unsigned long		acquired,	// Tokens handed out
+			waited;		// Tokens that stages had to wait for
+  uint64_t		wait_total,	// Total wait time in nanoseconds
+			wait_max;	// Longest wait time in nanoseconds
+} brf_cpu_pool_t;
+
+
+//
+// Local functions...
+//
+
+static bool	brf_cpu_cb(pappl_client_t *client, void *data);
+static bool	brf_cpu_dead(int pid);
+static void	brf_cpu_lock(void);
+static uint64_t	brf_cpu_now(void);
+static int	brf_cpu_missing(int w);
+static void	brf_cpu_reclaim(void);
+
+
+//
+// Local globals...
+//
+
+static brf_cpu_pool_t	*brf_cpu_pool = NULL;
+					// Token pool or `NULL` if unlimited
+
+
+//
+// 'brfCPUAcquire()' - Take a token for a CPU-intensive stage.
+//
+// Waits until a token is free and no stage of a more urgent or earlier job
+// is waiting.  `token` is set to -1 when the pool is disabled.  Pass it to
+// brfCPURelease() when the stage is done.
+//
+
+bool					// O - `true` on success, `false` if canceled
+brfCPUAcquire(cf_filter_data_t *data,	// I - Job and printer data
+              int              *token)	// O - Token
+{
+  const char	*val;			// Job priority option
+  int		i,			// Looping var
+		w = -1,			// Wait slot
+		pid = getpid(),		// Process ID
+		priority = 50;		// Job priority
+  bool		waited = false,		// Had to wait?
+		ret = true;		// Return value
+  uint64_t	start,			// Start of wait
+		wait;			// Wait time
+  struct timespec timeout;		// Timeout for condition
+
+
+  *token = -1;
+
+  if (!brf_cpu_pool)
+    return (true);
+
+  if ((val = cupsGetOption("job-priority", data->num_options, data->options)) != NULL)
+    priority = atoi(val);
+
+  start = brf_cpu_now();
+
+  brf_cpu_lock();
+
+  for (;;)
+  {
+    if (w < 0)
+    {
+      // Get in line...
+      for (i = 0; i < BRF_CPU_WAITERS; i ++)
+      {
+        if (!brf_cpu_pool->waiters[i].pid)
+        {
+          w = i;
+          brf_cpu_pool->waiters[w].pid      = pid;
+          brf_cpu_pool->waiters[w].job_id   = data->job_id;
+          brf_cpu_pool->waiters[w].priority = priority;
+          brf_cpu_pool->waiters[w].seq      = brf_cpu_pool->seq ++;
+          break;
+        }
+      }
+    }
+
+    if (w >= 0 && brf_cpu_missing(w) == 0)
+    {
+      // Take a free token, if any...
+      for (i = 0; i < brf_cpu_pool->num_tokens; i ++)
+      {
+        if (!brf_cpu_pool->holders[i])
+        {
+          brf_cpu_pool->holders[i] = pid;
+          *token = i;
+          break;
+        }
+      }
+
+      if (*token >= 0)
+        break;
+    }
+
+    if (data->iscanceledfunc && (data->iscanceledfunc)(data->iscanceleddata))
+    {
+      ret = false;
+      break;
+    }
+
+    if (!waited)
+    {
+      waited = true;
+      brfTraceBegin("cpu-wait", data->job_id);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &timeout);
+    timeout.tv_sec ++;
+
+    if (pthread_cond_timedwait(&brf_cpu_pool->cond, &brf_cpu_pool->mutex, &timeout) == EOWNERDEAD)
+      pthread_mutex_consistent(&brf_cpu_pool->mutex);
+
+    brf_cpu_reclaim();
+  }
+
+  if (w >= 0)
+  {
+    // Leave the line, the next stage may be first now...
+    brf_cpu_pool->waiters[w].pid = 0;
+    pthread_cond_broadcast(&brf_cpu_pool->cond);
+  }
+
+  wait = brf_cpu_now() - start;
+
+  if (ret)
+  {
+    brf_cpu_pool->acquired ++;
+
+    if (waited)
+    {
+      brf_cpu_pool->waited ++;
+      brf_cpu_pool->wait_total += wait;
+
+      if (wait > brf_cpu_pool->wait_max)
+        brf_cpu_pool->wait_max = wait;
+    }
+  }
+
+  pthread_mutex_unlock(&brf_cpu_pool->mutex);
+
+  if (waited)
+  {
+    brfTraceEnd("cpu-wait", data->job_id);
+
+    if (data->logfunc)
+      data->logfunc(data->logdata, CF_LOGLEVEL_DEBUG, "Waited %.3f seconds for a CPU token.", wait / 1000000000.0);
+  }
+
+  return (ret);
+}
+
+
+//
+// 'brfCPUInit()' - Set up the CPU token pool.
+//
+// `num_tokens` of -1 uses the number of processors, 0 disables the pool.
+//
+
+bool					// O - `true` on success, `false` on error
+brfCPUInit(pappl_system_t *system,	// I - System
+           int            num_tokens)	// I - Number of tokens
+{
+  void			*pool;		// Shared memory
+  pthread_mutexattr_t	mattr;		// Mutex attributes
+  pthread_condattr_t	cattr;		// Condition attributes
+
+
+  if (num_tokens < 0 && (num_tokens = (int)sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+    num_tokens = 1;
+
+  if (num_tokens == 0)
+    return (true);
+
+  if (num_tokens > BRF_CPU_MAX_TOKENS)
+    num_tokens = BRF_CPU_MAX_TOKENS;
+
+  if ((pool = mmap(NULL, sizeof(brf_cpu_pool_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+  {
+    papplLog(system, PAPPL_LOGLEVEL_ERROR, "Unable to allocate CPU token pool: %s", strerror(errno));
+    return (false);
+  }
+
+  brf_cpu_pool = (brf_cpu_pool_t *)pool;
+  brf_cpu_pool->num_tokens = num_tokens;
+
+  pthread_mutexattr_init(&mattr);
+  pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&brf_cpu_pool->mutex, &mattr);
+  pthread_mutexattr_destroy(&mattr);
+
+  pthread_condattr_init(&cattr);
+  pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+  pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+  pthread_cond_init(&brf_cpu_pool->cond, &cattr);
+  pthread_condattr_destroy(&cattr);
+
+  papplSystemAddResourceCallback(system, "/brf-cpu.json", "application/json", brf_cpu_cb, NULL);
+
+  papplLog(system, PAPPL_LOGLEVEL_INFO, "Running up to %d CPU-intensive job stages at a time.", num_tokens);
+
+  return (true);
+}
+
+
+//
+// 'brfCPURelease()' - Return a token.
+//
+
+void
+brfCPURelease(int token)		// I - Token from brfCPUAcquire()
+{
+  if (!brf_cpu_pool || token < 0 || token >= brf_cpu_pool->num_tokens)
+    return;
+
+  brf_cpu_lock();
+
+  brf_cpu_pool->holders[token] = 0;
+  pthread_cond_broadcast(&brf_cpu_pool->cond);
+
+  pthread_mutex_unlock(&brf_cpu_pool->mutex);
+}
+
+
+//
+// 'brfCPUWrite()' - Write the output of a stage holding a token.
+//
+// While the next stage doesn't read, the token is returned and taken again
+// once the output can be written.  `token` is -1 when taking it again failed
+// because the job was canceled.
+//
+
+bool					// O - `true` on success, `false` on error
+brfCPUWrite(cf_filter_data_t *data,	// I - Job and printer data
+            int              *token,	// IO - Token
+            int              fd,	// I - Output file descriptor
+            const void       *buffer,	// I - Data
+            size_t           bytes)	// I - Number of bytes
+{
+  const char	*ptr = (const char *)buffer;
+					// Pointer into data
+  size_t	count;			// Bytes to write
+  ssize_t	written;		// Bytes written
+  struct pollfd	pfd;			// Output to poll
+  int		ready;			// Output ready?
+
+
+  pfd.fd     = fd;
+  pfd.events = POLLOUT;
+
+  while (bytes > 0)
+  {
+    if (brf_cpu_pool && *token >= 0 && poll(&pfd, 1, 0) == 0)
+    {
+      // The next stage is behind, let other stages run in the meantime...
+      brfCPURelease(*token);
+      *token = -1;
+
+      brfTraceBegin("output-wait", data->job_id);
+
+      while ((ready = poll(&pfd, 1, 1000)) == 0 || (ready < 0 && errno == EINTR))
+      {
+        if (data->iscanceledfunc && (data->iscanceledfunc)(data->iscanceleddata))
+          break;
+      }
+
+      brfTraceEnd("output-wait", data->job_id);
+
+      if (ready <= 0 || !brfCPUAcquire(data, token))
+        return (false);
+    }
+
+    // A writable pipe has room for PIPE_BUF bytes, so this doesn't block
+    // while we hold the token...
+    if ((count = bytes) > PIPE_BUF && brf_cpu_pool && *token >= 0)
+      count = PIPE_BUF;
+
+    if ((written = write(fd, ptr, count)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      return (false);
+    }
+
+    ptr   += written;
+    bytes -= (size_t)written;
+  }
+
+  return (true);
+}
+
+
+//
+// 'brf_cpu_cb()' - Export the pool usage as JSON.
+//
+
+static bool				// O - `true` if handled
+brf_cpu_cb(pappl_client_t *client,	// I - Client
+           void           *data)	// I - Callback data (unused)
+{
+  int		i,			// Looping var
+		in_use = 0,		// Tokens in use
+		waiting = 0;		// Stages waiting
+  char		json[1024];		// JSON output
+  size_t	used;			// Bytes used in output
+
+
+  (void)data;
+
+  if (!papplClientHTMLAuthorize(client))
+    return (true);
+
+  brf_cpu_lock();
+
+  for (i = 0; i < brf_cpu_pool->num_tokens; i ++)
+    if (brf_cpu_pool->holders[i])
+      in_use ++;
+
+  for (i = 0; i < BRF_CPU_WAITERS; i ++)
+    if (brf_cpu_pool->waiters[i].pid)
+      waiting ++;
+
+  used = (size_t)snprintf(json, sizeof(json), "{\"tokens\":%d,\"in-use\":%d,\"waiting\":%d,\"acquired\":%lu,\"waited\":%lu,\"wait-total-ms\":%llu,\"wait-max-ms\":%llu}\n", brf_cpu_pool->num_tokens, in_use, waiting, brf_cpu_pool->acquired, brf_cpu_pool->waited, (unsigned long long)(brf_cpu_pool->wait_total / 1000000), (unsigned long long)(brf_cpu_pool->wait_max / 1000000));
+
+  pthread_mutex_unlock(&brf_cpu_pool->mutex);
+
+  papplClientRespond(client, HTTP_STATUS_OK, NULL, "application/json", 0, used);
+  httpWrite2(papplClientGetHTTP(client), json, used);
+
+  return (true);
+}
+
+
+//
+// 'brf_cpu_dead()' - Check whether a process has exited.
+//
+
+static bool				// O - `true` if process is gone
+brf_cpu_dead(int pid)			// I - Process ID
+{
+  return (pid != getpid() && kill(pid, 0) && errno == ESRCH);
+}
+
+
+//
+// 'brf_cpu_lock()' - Lock the pool.
+//
+// A process that died while holding the lock leaves the pool consistent,
+// every change is a single store.
+//
+
+static void
+brf_cpu_lock(void)
+{
+  if (pthread_mutex_lock(&brf_cpu_pool->mutex) == EOWNERDEAD)
+    pthread_mutex_consistent(&brf_cpu_pool->mutex);
+}
+
+
+//
+// 'brf_cpu_now()' - Get the monotonic time in nanoseconds.
+//
+
+static uint64_t				// O - Time in nanoseconds
+brf_cpu_now(void)
+{
+  struct timespec	now;		// Current time
+
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return ((uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec);
+}
+
+
+//
+// 'brf_cpu_missing()' - Count the free tokens left after the waiters ahead.
+//
+// Returns 0 when a token is free for waiter `w`, otherwise the number of
+// tokens missing.
+//
+
+static int				// O - Tokens missing
+brf_cpu_missing(int w)			// I - Wait slot
+{
+  brf_cpu_waiter_t	*waiter = brf_cpu_pool->waiters + w,
+					// This waiter
+			*other;		// Other waiter
+  int			i,		// Looping var
+			ahead = 0,	// Waiters ahead of this one
+			avail = 0;	// Free tokens
+
+
+  for (i = 0; i < brf_cpu_pool->num_tokens; i ++)
+    if (!brf_cpu_pool->holders[i])
+      avail ++;
+
+  for (i = 0, other = brf_cpu_pool->waiters; i < BRF_CPU_WAITERS; i ++, other ++)
+  {
+    if (i == w || !other->pid)
+      continue;
+
+    if (other->priority > waiter->priority || (other->priority == waiter->priority && (int)(other->seq - waiter->seq) < 0))
+      ahead ++;
+  }
+
+  return (ahead < avail ? 0 : ahead - avail + 1);
+}
+
+
+//
+// 'brf_cpu_reclaim()' - Take back tokens and wait slots of exited processes.
+//
+
+static void
+brf_cpu_reclaim(void)
+{
+  int	i;				// Looping var
+
+
+  for (i = 0; i < brf_cpu_pool->num_tokens; i ++)
+  {
+    if (brf_cpu_pool->holders[i] && brf_cpu_dead(brf_cpu_pool->holders[i]))
+    {
+      brf_cpu_pool->holders[i] = 0;
+      pthread_cond_broadcast(&brf_cpu_pool->cond);
+    }
+  }
+
+  for (i = 0; i < BRF_CPU_WAITERS; i ++)
+  {
+    if (brf_cpu_pool->waiters[i].pid && brf_cpu_dead(brf_cpu_pool->waiters[i].pid))
+    {
+      brf_cpu_pool->waiters[i].pid = 0;
+      pthread_cond_broadcast(&brf_cpu_pool->cond);
+    }
+  }
+}
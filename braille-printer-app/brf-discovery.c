@@ -0,0 +1,551 @@
+//
+// Device discovery for the Braille Printer Application
+//
+// Copyright © 2022 Chandresh Soni
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// The IEEE-1284 device ID match strings of all drivers are parsed once and
+// kept in an index sorted by manufacturer, so scoring a discovered device
+// only parses the device's own ID and only looks at drivers for the same
+// manufacturer.  Each kind of device (USB, DNS-SD, SNMP) is probed on its own
+// thread with a common deadline.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+#include <strings.h>
+
+
+//
+// Local types...
+//
+
+typedef struct brf_did_entry_s		// Precompiled driver device ID
+{
+  const char	*name;			// Driver name
+  const char	*mfg,			// Manufacturer (MFG/MANUFACTURER) or `NULL`
+		*mdl,			// Model (MDL/MODEL) or `NULL`
+		*cmd;			// Command set (CMD/COMMAND SET) or `NULL`
+  int		num_pairs;		// Number of key/value pairs
+  cups_option_t	*pairs;			// All key/value pairs
+} brf_did_entry_t;
+
+typedef struct brf_discovery_s		// Discovery run shared by all probes
+{
+  pthread_mutex_t	mutex;		// Mutex for this structure
+  pthread_cond_t	cond;		// Condition for finished probes
+  int			num_running,	// Number of running probes
+			num_callbacks,	// Number of device callbacks in progress
+			refcount;	// Reference count
+  bool			abandoned;	// Caller stopped waiting?
+  time_t		deadline;	// Time to stop probing
+  pappl_device_cb_t	cb;		// Device callback
+  void			*cb_data;	// Device callback data
+  pappl_system_t	*system;	// System (for logging)
+} brf_discovery_t;
+
+typedef struct brf_probe_s		// Discovery probe
+{
+  brf_discovery_t	*discovery;	// Discovery run
+  pappl_devtype_t	type;		// Device type to probe
+  const char		*label;		// Type label for logging
+} brf_probe_t;
+
+
+//
+// Local globals...
+//
+
+static int		brf_did_num_entries = 0;
+					// Number of index entries
+static brf_did_entry_t	*brf_did_entries = NULL;
+					// Index entries, sorted by manufacturer
+static int		brf_did_num_drivers = 0;
+					// Number of drivers to index
+static pappl_pr_driver_t *brf_did_drivers = NULL;
+					// Drivers to index
+static pthread_once_t	brf_did_once = PTHREAD_ONCE_INIT;
+					// Index is built once on first use
+
+
+//
+// Local functions...
+//
+
+static int	brf_did_compare(const brf_did_entry_t *a, const brf_did_entry_t *b);
+static void	brf_did_create(void);
+static const char *brf_did_get(int num_pairs, cups_option_t *pairs, const char *name, const char *alt);
+static bool	brf_did_field_match(const char *value, const char *match);
+static int	brf_did_score(int num_did, cups_option_t *did, const char *mdl, const char *cmd, brf_did_entry_t *entry);
+static bool	brf_probe_device_cb(const char *device_info, const char *device_uri, const char *device_id, brf_probe_t *probe);
+static void	brf_discovery_release(brf_discovery_t *discovery);
+static void	*brf_probe_run(brf_probe_t *probe);
+
+
+//
+// 'brfDeviceIDIndexCreate()' - Set the drivers for device ID matching.
+//
+// The device ID match strings are only parsed on the first call to
+// brfDeviceIDMatch(), so a server that never auto-adds a printer doesn't pay
+// for them.  The driver array must stay valid while the program runs.
+//
+
+bool					// O - `true` on success, `false` on error
+brfDeviceIDIndexCreate(
+    int               num_drivers,	// I - Number of drivers
+    pappl_pr_driver_t *drivers)		// I - Drivers
+{
+  if (num_drivers < 0 || (num_drivers > 0 && !drivers))
+    return (false);
+
+  brf_did_num_drivers = num_drivers;
+  brf_did_drivers     = drivers;
+
+  return (true);
+}
+
+
+//
+// 'brfDeviceIDMatch()' - Find the best driver for a device ID.
+//
+// The score is 2 for each exact match and 1 for a partial match in a comma-
+// delimited field.  Drivers whose match string has a field the device ID
+// does not match are not considered.
+//
+
+const char *				// O - Driver name or `NULL` for none
+brfDeviceIDMatch(const char *device_id,	// I - IEEE-1284 device ID
+                 int        *score)	// O - Best score or `NULL`
+{
+  int			num_did,	// Number of device ID key/value pairs
+			best_score = 0,	// Best score
+			cur_score;	// Current score
+  cups_option_t		*did;		// Device ID key/value pairs
+  brf_did_entry_t	key,		// Search key
+			*entry,		// Current entry
+			*end;		// End of entries
+  const char		*mdl,		// Model of device
+			*cmd,		// Command set of device
+			*best_name = NULL;
+					// Best driver
+
+
+  if (score)
+    *score = 0;
+
+  if (!device_id || !*device_id)
+    return (NULL);
+
+  pthread_once(&brf_did_once, brf_did_create);
+
+  if (brf_did_num_entries == 0)
+    return (NULL);
+
+  num_did = papplDeviceParseID(device_id, &did);
+  mdl     = brf_did_get(num_did, did, "MDL", "MODEL");
+  cmd     = brf_did_get(num_did, did, "CMD", "COMMAND SET");
+
+  // Drivers without a manufacturer sort first and are always checked, then
+  // only the drivers for the same manufacturer...
+  end = brf_did_entries + brf_did_num_entries;
+
+  for (entry = brf_did_entries; entry < end && !entry->mfg; entry ++)
+  {
+    if ((cur_score = brf_did_score(num_did, did, mdl, cmd, entry)) > best_score)
+    {
+      best_score = cur_score;
+      best_name  = entry->name;
+    }
+  }
+
+  if ((key.mfg = brf_did_get(num_did, did, "MFG", "MANUFACTURER")) != NULL && entry < end)
+  {
+    brf_did_entry_t *match;		// Matching entry
+
+    if ((match = (brf_did_entry_t *)bsearch(&key, entry, (size_t)(end - entry), sizeof(brf_did_entry_t), (int (*)(const void *, const void *))brf_did_compare)) != NULL)
+    {
+      // Back up to the first entry for this manufacturer...
+      while (match > entry && !brf_did_compare(match - 1, &key))
+        match --;
+
+      for (; match < end && !brf_did_compare(match, &key); match ++)
+      {
+        if ((cur_score = brf_did_score(num_did, did, mdl, cmd, match)) > best_score)
+	{
+	  best_score = cur_score;
+	  best_name  = match->name;
+	}
+      }
+    }
+  }
+
+  cupsFreeOptions(num_did, did);
+
+  if (score)
+    *score = best_score;
+
+  return (best_name);
+}
+
+
+//
+// 'brfDiscoverDevices()' - Probe several kinds of devices in parallel.
+//
+// Each device type in "types" is listed on its own thread.  The callback may
+// be called concurrently from several threads and must return `true` to stop
+// listing devices of that type.  Probes still running after "timeout" seconds
+// are abandoned and their late results ignored, but callbacks that already
+// started are waited for, so "cb_data" can be freed after this returns.
+//
+
+void
+brfDiscoverDevices(
+    pappl_system_t    *system,		// I - System (for logging)
+    pappl_devtype_t   types,		// I - Device types to probe
+    int               timeout,		// I - Timeout in seconds
+    pappl_device_cb_t cb,		// I - Device callback
+    void              *cb_data)		// I - Device callback data
+{
+  static const struct
+  {
+    pappl_devtype_t	type;		// Device type
+    const char		*label;		// Label for logging
+  }			probes[] =	// Supported probes
+  {
+    { PAPPL_DEVTYPE_USB,    "USB" },
+    { PAPPL_DEVTYPE_DNS_SD, "DNS-SD" },
+    { PAPPL_DEVTYPE_SNMP,   "SNMP" }
+  };
+  size_t		i;		// Looping var
+  brf_discovery_t	*discovery;	// Discovery run
+  brf_probe_t		*probe;		// Current probe
+  pthread_t		tid;		// Probe thread
+  int			err;		// Thread creation error
+  struct timespec	abstime;	// Deadline for waiting
+
+
+  // The shared state is reference counted since abandoned probes outlive
+  // this function...
+  if ((discovery = (brf_discovery_t *)calloc(1, sizeof(brf_discovery_t))) == NULL)
+    return;
+
+  pthread_mutex_init(&discovery->mutex, NULL);
+  pthread_cond_init(&discovery->cond, NULL);
+
+  discovery->refcount = 1;
+  discovery->deadline = time(NULL) + timeout;
+  discovery->cb       = cb;
+  discovery->cb_data  = cb_data;
+  discovery->system   = system;
+
+  for (i = 0; i < (sizeof(probes) / sizeof(probes[0])); i ++)
+  {
+    if (!(types & probes[i].type))
+      continue;
+
+    if ((probe = (brf_probe_t *)calloc(1, sizeof(brf_probe_t))) == NULL)
+      break;
+
+    probe->discovery = discovery;
+    probe->type      = probes[i].type;
+    probe->label     = probes[i].label;
+
+    pthread_mutex_lock(&discovery->mutex);
+    discovery->num_running ++;
+    discovery->refcount ++;
+    pthread_mutex_unlock(&discovery->mutex);
+
+    if ((err = pthread_create(&tid, NULL, (void *(*)(void *))brf_probe_run, probe)) != 0)
+    {
+      papplLog(system, PAPPL_LOGLEVEL_ERROR, "Unable to start %s discovery: %s", probes[i].label, strerror(err));
+
+      pthread_mutex_lock(&discovery->mutex);
+      discovery->num_running --;
+      discovery->refcount --;
+      pthread_mutex_unlock(&discovery->mutex);
+      free(probe);
+      continue;
+    }
+
+    pthread_detach(tid);
+  }
+
+  // Wait for the probes to finish or the deadline to pass...
+  abstime.tv_sec  = discovery->deadline;
+  abstime.tv_nsec = 0;
+
+  pthread_mutex_lock(&discovery->mutex);
+
+  while (discovery->num_running > 0)
+  {
+    if (pthread_cond_timedwait(&discovery->cond, &discovery->mutex, &abstime) == ETIMEDOUT)
+    {
+      papplLog(system, PAPPL_LOGLEVEL_WARN, "Device discovery timed out with %d probe(s) still running.", discovery->num_running);
+      break;
+    }
+  }
+
+  discovery->abandoned = true;
+
+  while (discovery->num_callbacks > 0)
+    pthread_cond_wait(&discovery->cond, &discovery->mutex);
+
+  pthread_mutex_unlock(&discovery->mutex);
+
+  brf_discovery_release(discovery);
+}
+
+
+//
+// 'brf_did_compare()' - Compare two index entries by manufacturer.
+//
+
+static int				// O - Result of comparison
+brf_did_compare(const brf_did_entry_t *a,// I - First entry
+                const brf_did_entry_t *b)// I - Second entry
+{
+  if (!a->mfg)
+    return (b->mfg ? -1 : 0);
+  else if (!b->mfg)
+    return (1);
+  else
+    return (strcasecmp(a->mfg, b->mfg));
+}
+
+
+//
+// 'brf_did_create()' - Precompile the device ID match strings of the drivers.
+//
+
+static void
+brf_did_create(void)
+{
+  int			i;		// Looping var
+  brf_did_entry_t	*entry;		// Current entry
+
+
+  if ((brf_did_entries = (brf_did_entry_t *)calloc((size_t)brf_did_num_drivers + 1, sizeof(brf_did_entry_t))) == NULL)
+    return;
+
+  for (i = 0, entry = brf_did_entries; i < brf_did_num_drivers; i ++)
+  {
+    // Drivers without a match string are never auto-selected...
+    if (!brf_did_drivers[i].device_id)
+      continue;
+
+    if ((entry->num_pairs = papplDeviceParseID(brf_did_drivers[i].device_id, &entry->pairs)) == 0)
+      continue;
+
+    entry->name = brf_did_drivers[i].name;
+    entry->mfg  = brf_did_get(entry->num_pairs, entry->pairs, "MFG", "MANUFACTURER");
+    entry->mdl  = brf_did_get(entry->num_pairs, entry->pairs, "MDL", "MODEL");
+    entry->cmd  = brf_did_get(entry->num_pairs, entry->pairs, "CMD", "COMMAND SET");
+
+    entry ++;
+  }
+
+  brf_did_num_entries = (int)(entry - brf_did_entries);
+
+  if (brf_did_num_entries > 1)
+    qsort(brf_did_entries, (size_t)brf_did_num_entries, sizeof(brf_did_entry_t), (int (*)(const void *, const void *))brf_did_compare);
+}
+
+
+//
+// 'brf_did_field_match()' - Check whether a match value equals or is one of
+//                           the comma-delimited values of a device ID field.
+//
+
+static bool				// O - `true` on match
+brf_did_field_match(const char *value,	// I - Device ID value
+                    const char *match)	// I - Match value
+{
+  const char	*valptr;		// Pointer into value
+  size_t	mlen = strlen(match);	// Length of match value
+
+
+  if (!strcasecmp(match, value))
+    return (true);
+
+  // Compare each comma-delimited value, ignoring case like the full match...
+  for (valptr = value; valptr; valptr = strchr(valptr, ','))
+  {
+    if (*valptr == ',')
+      valptr ++;
+
+    if (!strncasecmp(valptr, match, mlen) && (!valptr[mlen] || valptr[mlen] == ','))
+      return (true);
+  }
+
+  return (false);
+}
+
+
+//
+// 'brf_did_get()' - Get a device ID value using its short or long key.
+//
+
+static const char *			// O - Value or `NULL`
+brf_did_get(int           num_pairs,	// I - Number of key/value pairs
+            cups_option_t *pairs,	// I - Key/value pairs
+            const char    *name,	// I - Short key
+            const char    *alt)		// I - Long key
+{
+  const char	*value;			// Value
+
+
+  if ((value = cupsGetOption(name, num_pairs, pairs)) == NULL)
+    value = cupsGetOption(alt, num_pairs, pairs);
+
+  return (value);
+}
+
+
+//
+// 'brf_did_score()' - Score a device ID against a precompiled match string.
+//
+
+static int				// O - Score
+brf_did_score(int             num_did,	// I - Number of device ID key/value pairs
+              cups_option_t   *did,	// I - Device ID key/value pairs
+              const char      *mdl,	// I - Model of device or `NULL`
+              const char      *cmd,	// I - Command set of device or `NULL`
+              brf_did_entry_t *entry)	// I - Index entry
+{
+  int		i,			// Looping var
+		score = 0;		// Score
+  cups_option_t	*current;		// Current key/value pair
+  const char	*value;			// Device ID value
+
+
+  // Reject on the model and command set first since they differ the most
+  // between drivers of the same manufacturer...
+  if (entry->mdl && (!mdl || !brf_did_field_match(mdl, entry->mdl)))
+    return (0);
+  if (entry->cmd && (!cmd || !brf_did_field_match(cmd, entry->cmd)))
+    return (0);
+
+  for (i = entry->num_pairs, current = entry->pairs; i > 0; i --, current ++)
+  {
+    if ((value = cupsGetOption(current->name, num_did, did)) == NULL)
+    {
+      // No match
+      return (0);
+    }
+
+    if (!strcasecmp(current->value, value))
+    {
+      // Full match!
+      score += 2;
+    }
+    else if (brf_did_field_match(value, current->value))
+    {
+      // Partial match!
+      score ++;
+    }
+    else
+    {
+      // No match
+      return (0);
+    }
+  }
+
+  return (score);
+}
+
+
+//
+// 'brf_discovery_release()' - Release a reference to a discovery run.
+//
+
+static void
+brf_discovery_release(
+    brf_discovery_t *discovery)		// I - Discovery run
+{
+  bool	last;				// Last reference?
+
+
+  pthread_mutex_lock(&discovery->mutex);
+  last = --discovery->refcount == 0;
+  pthread_mutex_unlock(&discovery->mutex);
+
+  if (last)
+  {
+    pthread_cond_destroy(&discovery->cond);
+    pthread_mutex_destroy(&discovery->mutex);
+    free(discovery);
+  }
+}
+
+
+//
+// 'brf_probe_device_cb()' - Pass a discovered device on unless the probe has
+//                           run out of time.
+//
+
+static bool				// O - `true` to stop listing
+brf_probe_device_cb(
+    const char  *device_info,		// I - Device information
+    const char  *device_uri,		// I - Device URI
+    const char  *device_id,		// I - IEEE-1284 device ID
+    brf_probe_t *probe)			// I - Probe
+{
+  brf_discovery_t	*discovery = probe->discovery;
+					// Discovery run
+  bool			ret;		// Return value
+
+
+  // Count the callback under the mutex, brfDiscoverDevices() waits for it
+  // before returning...
+  pthread_mutex_lock(&discovery->mutex);
+
+  if (discovery->abandoned || time(NULL) >= discovery->deadline)
+  {
+    pthread_mutex_unlock(&discovery->mutex);
+    return (true);
+  }
+
+  discovery->num_callbacks ++;
+  pthread_mutex_unlock(&discovery->mutex);
+
+  ret = (discovery->cb)(device_info, device_uri, device_id, discovery->cb_data);
+
+  pthread_mutex_lock(&discovery->mutex);
+  discovery->num_callbacks --;
+  pthread_cond_broadcast(&discovery->cond);
+  pthread_mutex_unlock(&discovery->mutex);
+
+  return (ret);
+}
+
+
+//
+// 'brf_probe_run()' - List devices of one type.
+//
+
+static void *				// O - Thread exit status (unused)
+brf_probe_run(brf_probe_t *probe)	// I - Probe
+{
+  brf_discovery_t	*discovery = probe->discovery;
+					// Discovery run
+
+
+  papplDeviceList(probe->type, (pappl_device_cb_t)brf_probe_device_cb, probe, papplLogDevice, discovery->system);
+
+  pthread_mutex_lock(&discovery->mutex);
+  if (!discovery->abandoned)
+    papplLog(discovery->system, PAPPL_LOGLEVEL_DEBUG, "%s discovery finished.", probe->label);
+  discovery->num_running --;
+  pthread_cond_broadcast(&discovery->cond);
+  pthread_mutex_unlock(&discovery->mutex);
+
+  free(probe);
+  brf_discovery_release(discovery);
+
+  return (NULL);
+}
@@ -0,0 +1,759 @@
+//
+// Warm FreeDots workers for the Braille Printer Application
+//
+// Copyright © 2022 Chandresh Soni
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// FreeDots is a Java application, and starting the JVM takes much longer
+// than transcribing a short score.  FreeDots has no server mode, so we keep a
+// few "spare" FreeDots processes that are started ahead of time with the
+// name of a private FIFO as their input file.  A spare finishes starting up
+// and then waits in open() until a job writes its score to the FIFO.  Jobs
+// take the oldest spare, and a replacement is started right away for the
+// next job.  A timer reaps spares that died and starts new ones, backing off
+// when they keep failing.
+//
+// The Unicode braille that FreeDots writes is converted to BRF in process,
+// replacing the "lou_translate ... braille-patterns.cti" stage of the
+// musicxmltobrf filter.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+#include <dirent.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+
+//
+// Local types...
+//
+
+struct brf_freedots_s			// FreeDots process
+{
+  pid_t			pid;		// Process ID
+  int			width,		// Cells per line
+			outfd;		// Standard output of FreeDots
+  time_t		started;	// Start time
+  char			fifo[1024];	// Input FIFO
+};
+
+typedef struct brf_fdconv_s		// Unicode braille to BRF conversion state
+{
+  unsigned		ch;		// Current character
+  int			remaining;	// Remaining bytes of character
+} brf_fdconv_t;
+
+
+//
+// Local functions...
+//
+
+static bool	brf_freedots_check_cb(pappl_system_t *system, void *data);
+static size_t	brf_freedots_convert(brf_fdconv_t *conv, const char *in, size_t inlen, char *out);
+static void	brf_freedots_exit(void);
+static void	brf_freedots_fill(void);
+static bool	brf_freedots_find(void);
+static void	brf_freedots_kill(brf_freedots_t *fd);
+static brf_freedots_t *brf_freedots_spawn(int width);
+
+
+//
+// Local globals...
+//
+
+static pthread_mutex_t	brf_fd_mutex = PTHREAD_MUTEX_INITIALIZER;
+					// Mutex for the spares
+static pappl_system_t	*brf_fd_system = NULL;
+					// System for logging
+static char		brf_fd_directory[1024] = "";
+					// Directory for FIFOs
+static brf_freedots_t	*brf_fd_spares[BRF_FREEDOTS_MAX_SPARES];
+					// Spare processes, oldest first
+static int		brf_fd_num_spares = 0,
+					// Number of spare processes
+			brf_fd_max_spares = 0,
+					// Number of spares to keep
+			brf_fd_width = 0,
+					// Width of the last score
+			brf_fd_failures = 0,
+					// Consecutive failed starts
+			brf_fd_serial = 0;
+					// Serial number for FIFO names
+static time_t		brf_fd_retry = 0;
+					// Time to retry after failures
+static pid_t		brf_fd_server = 0;
+					// Process ID of the server
+static const char	brf_fd_brf[64] =// Dot patterns to BRF
+{
+  ' ', 'A', '1', 'B', '\'', 'K', '2', 'L',
+  '@', 'C', 'I', 'F', '/', 'M', 'S', 'P',
+  '\"', 'E', '3', 'H', '9', 'O', '6', 'R',
+  '^', 'D', 'J', 'G', '>', 'N', 'T', 'Q',
+  ',', '*', '5', '<', '-', 'U', '8', 'V',
+  '.', '%', '[', '$', '+', 'X', '!', '&',
+  ';', ':', '4', '\\', '0', 'Z', '7', '(',
+  '_', '?', 'W', ']', '#', 'Y', ')', '='
+};
+
+
+//
+// 'brfFreeDotsAcquire()' - Get a FreeDots process for a score.
+//
+// A spare with the same line width is used when there is one, otherwise a
+// new process is started.  Either way the spares are topped up for the next
+// score.  Returns `NULL` when FreeDots can't be run.
+//
+
+brf_freedots_t *			// O - FreeDots process or `NULL`
+brfFreeDotsAcquire(int width)		// I - Cells per line
+{
+  brf_freedots_t	*fd = NULL;	// FreeDots process
+  int			i;		// Looping var
+
+
+  pthread_mutex_lock(&brf_fd_mutex);
+
+  if (!brf_fd_directory[0])
+  {
+    pthread_mutex_unlock(&brf_fd_mutex);
+    return (NULL);
+  }
+
+  for (i = 0; i < brf_fd_num_spares; i ++)
+  {
+    if (brf_fd_spares[i]->width == width)
+    {
+      fd = brf_fd_spares[i];
+
+      brf_fd_num_spares --;
+      memmove(brf_fd_spares + i, brf_fd_spares + i + 1, (size_t)(brf_fd_num_spares - i) * sizeof(brf_freedots_t *));
+      break;
+    }
+  }
+
+  if (!fd)
+    fd = brf_freedots_spawn(width);
+
+  // The next score probably has the same width...
+  brf_fd_width = width;
+  brf_freedots_fill();
+
+  pthread_mutex_unlock(&brf_fd_mutex);
+
+  return (fd);
+}
+
+
+//
+// 'brfFreeDotsFilter()' - Filter function that transcribes a MusicXML score.
+//
+// The parameters point to a FreeDots process from brfFreeDotsAcquire().  The
+// score is written to its FIFO while the output is read and converted to BRF.
+//
+
+int					// O - Exit status
+brfFreeDotsFilter(
+    int              inputfd,		// I - File descriptor input stream
+    int              outputfd,		// I - File descriptor output stream
+    int              inputseekable,	// I - Is input stream seekable? (unused)
+    cf_filter_data_t *data,		// I - Job and printer data
+    void             *parameters)	// I - FreeDots process
+{
+  brf_freedots_t	*fd = (brf_freedots_t *)parameters;
+					// FreeDots process
+  brf_fdconv_t		conv;		// Conversion state
+  int			fifofd = -1;	// FIFO file descriptor
+  time_t		timeout;	// Time to give up waiting for FreeDots
+  struct pollfd		pfds[2];	// Poll file descriptors
+  char			inbuf[65536],	// Score buffer
+			outbuf[65536],	// FreeDots output buffer
+			brfbuf[65536];	// BRF buffer
+  const char		*inptr = inbuf;	// Pointer into score buffer
+  size_t		inlen = 0,	// Bytes left in score buffer
+			brflen,		// Bytes in BRF buffer
+			total = 0;	// Total bytes from FreeDots
+  ssize_t		bytes;		// Bytes read/written
+  bool			ineof = false,	// End of score?
+			ret = false;	// Return value
+  int			token = -1;	// CPU token
+
+
+  (void)inputseekable;
+
+  brfTraceBegin("freedots", data->job_id);
+
+  memset(&conv, 0, sizeof(conv));
+
+  if (!fd)
+    goto finish;
+
+  // Wait for FreeDots to open its input, a cold start takes a while...
+  for (timeout = time(NULL) + 120; (fifofd = open(fd->fifo, O_WRONLY | O_NONBLOCK | O_CLOEXEC)) < 0;)
+  {
+    if (errno != ENXIO && errno != EINTR)
+    {
+      if (data->logfunc)
+        data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "FreeDots: Unable to open '%s': %s", fd->fifo, strerror(errno));
+      goto finish;
+    }
+
+    // The output pipe hangs up if FreeDots dies while starting...
+    pfds[0].fd     = fd->outfd;
+    pfds[0].events = POLLIN;
+
+    if (time(NULL) > timeout || (data->iscanceledfunc && (data->iscanceledfunc)(data->iscanceleddata)) || (poll(pfds, 1, 0) > 0 && (pfds[0].revents & (POLLERR | POLLHUP))))
+    {
+      if (data->logfunc)
+        data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "FreeDots: Process %d did not start.", (int)fd->pid);
+      goto finish;
+    }
+
+    usleep(100000);
+  }
+
+  // Nobody else needs the FIFO now...
+  unlink(fd->fifo);
+
+  // The transcription starts as soon as the score comes in...
+  if (!brfCPUAcquire(data, &token))
+    goto finish;
+
+  if (data->logfunc)
+    data->logfunc(data->logdata, CF_LOGLEVEL_DEBUG, "FreeDots: Using process %d started %d seconds ago.", (int)fd->pid, (int)(time(NULL) - fd->started));
+
+  // Send the score and read the transcription at the same time...
+  pfds[1].fd     = fd->outfd;
+  pfds[1].events = POLLIN;
+
+  for (;;)
+  {
+    if (!inlen && !ineof)
+    {
+      if ((bytes = read(inputfd, inbuf, sizeof(inbuf))) < 0)
+      {
+        if (errno == EINTR || errno == EAGAIN)
+          continue;
+
+        if (data->logfunc)
+          data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "FreeDots: Unable to read score: %s", strerror(errno));
+        goto finish;
+      }
+      else if (bytes == 0)
+      {
+        // End of score, let FreeDots see EOF...
+        ineof = true;
+        close(fifofd);
+        fifofd = -1;
+      }
+      else
+      {
+        inptr = inbuf;
+        inlen = (size_t)bytes;
+      }
+    }
+
+    pfds[0].fd     = fifofd;
+    pfds[0].events = POLLOUT;
+
+    if (poll(pfds, 2, 1000) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      goto finish;
+    }
+
+    if (data->iscanceledfunc && (data->iscanceledfunc)(data->iscanceleddata))
+      goto finish;
+
+    if (fifofd >= 0 && (pfds[0].revents & (POLLOUT | POLLERR | POLLHUP)))
+    {
+      if ((bytes = write(fifofd, inptr, inlen)) < 0 && errno != EINTR && errno != EAGAIN)
+      {
+        if (data->logfunc)
+          data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "FreeDots: Unable to send score: %s", strerror(errno));
+        goto finish;
+      }
+      else if (bytes > 0)
+      {
+        inptr += bytes;
+        inlen -= (size_t)bytes;
+      }
+    }
+
+    if (pfds[1].revents & (POLLIN | POLLERR | POLLHUP))
+    {
+      if ((bytes = read(fd->outfd, outbuf, sizeof(outbuf))) < 0)
+      {
+        if (errno == EINTR || errno == EAGAIN)
+          continue;
+
+        goto finish;
+      }
+      else if (bytes == 0)
+        break;
+
+      // The token is returned while the next filter isn't reading...
+      if ((brflen = brf_freedots_convert(&conv, outbuf, (size_t)bytes, brfbuf)) > 0 && !brfCPUWrite(data, &token, outputfd, brfbuf, brflen))
+      {
+        if (data->logfunc)
+          data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "FreeDots: Unable to write output: %s", strerror(errno));
+        goto finish;
+      }
+
+      total += (size_t)bytes;
+    }
+  }
+
+  if (!ineof || !total)
+  {
+    if (data->logfunc)
+      data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "FreeDots: Unable to transcribe score.");
+    goto finish;
+  }
+
+  ret = true;
+
+  finish:
+
+  if (fifofd >= 0)
+    close(fifofd);
+
+  close(inputfd);
+  close(outputfd);
+
+  brfCPURelease(token);
+
+  brfTraceEnd("freedots", data->job_id);
+
+  return (ret ? 0 : 1);
+}
+
+
+//
+// 'brfFreeDotsInit()' - Start managing FreeDots processes.
+//
+// Nothing is started until the first score tells us the line width.
+// Returns `false` if FreeDots is not installed.
+//
+
+bool					// O - `true` if FreeDots is available
+brfFreeDotsInit(pappl_system_t *system,	// I - System
+                int            num_spares)
+					// I - Number of spare processes to keep
+{
+  DIR		*dir;			// Spool directory
+  struct dirent	*dent;			// Directory entry
+  size_t	len;			// Length of name
+  char		filename[1024];		// Stale FIFO
+
+
+  if (!brf_freedots_find())
+  {
+    papplLog(system, PAPPL_LOGLEVEL_INFO, "FreeDots not found, MusicXML jobs use musicxmltobrf.");
+    return (false);
+  }
+
+  pthread_mutex_lock(&brf_fd_mutex);
+
+  brf_fd_system     = system;
+  brf_fd_max_spares = num_spares < 0 ? 0 : num_spares > BRF_FREEDOTS_MAX_SPARES ? BRF_FREEDOTS_MAX_SPARES : num_spares;
+
+  papplSystemGetSpoolDirectory(system, brf_fd_directory, sizeof(brf_fd_directory));
+
+  // Remove FIFOs left behind by a previous server...
+  if ((dir = opendir(brf_fd_directory)) != NULL)
+  {
+    while ((dent = readdir(dir)) != NULL)
+    {
+      if (strncmp(dent->d_name, "freedots-", 9) || (len = strlen(dent->d_name)) < 5 || strcmp(dent->d_name + len - 5, ".fifo"))
+        continue;
+
+      snprintf(filename, sizeof(filename), "%s/%s", brf_fd_directory, dent->d_name);
+      unlink(filename);
+    }
+
+    closedir(dir);
+  }
+
+  pthread_mutex_unlock(&brf_fd_mutex);
+
+  brf_fd_server = getpid();
+  atexit(brf_freedots_exit);
+
+  if (brf_fd_max_spares > 0)
+    papplSystemAddTimerCallback(system, 0, 10, brf_freedots_check_cb, NULL);
+
+  papplLog(system, PAPPL_LOGLEVEL_INFO, "Keeping %d spare FreeDots processes for MusicXML jobs.", brf_fd_max_spares);
+
+  return (true);
+}
+
+
+//
+// 'brfFreeDotsRelease()' - Clean up after a score.
+//
+
+void
+brfFreeDotsRelease(brf_freedots_t *fd)	// I - FreeDots process
+{
+  int	status = -1;			// Exit status
+
+
+  if (!fd)
+    return;
+
+  close(fd->outfd);
+  unlink(fd->fifo);
+
+  // FreeDots is done once its output is closed, unless the job failed...
+  if (waitpid(fd->pid, &status, WNOHANG) == 0)
+  {
+    kill(fd->pid, SIGKILL);
+    while (waitpid(fd->pid, &status, 0) < 0 && errno == EINTR);
+  }
+
+  if (WIFEXITED(status) && !WEXITSTATUS(status))
+  {
+    pthread_mutex_lock(&brf_fd_mutex);
+    brf_fd_failures = 0;
+    pthread_mutex_unlock(&brf_fd_mutex);
+  }
+  else
+    papplLog(brf_fd_system, PAPPL_LOGLEVEL_DEBUG, "FreeDots process %d stopped with status %d.", (int)fd->pid, status);
+
+  free(fd);
+}
+
+
+//
+// 'brf_freedots_check_cb()' - Replace spare processes that died.
+//
+
+static bool				// O - `true` to keep the timer
+brf_freedots_check_cb(
+    pappl_system_t *system,		// I - System
+    void           *data)		// I - Callback data (not used)
+{
+  int		i,			// Looping var
+		status;			// Exit status
+  pid_t		pid;			// Process ID from waitpid()
+  brf_freedots_t *fd;			// Spare process
+
+
+  (void)data;
+
+  pthread_mutex_lock(&brf_fd_mutex);
+
+  for (i = 0; i < brf_fd_num_spares;)
+  {
+    fd = brf_fd_spares[i];
+
+    if ((pid = waitpid(fd->pid, &status, WNOHANG)) == 0 || (pid < 0 && errno != ECHILD))
+    {
+      i ++;
+      continue;
+    }
+    else if (pid < 0)
+      status = -1;			// Something else reaped it already
+
+    // A spare should be waiting for a score, so this is a failed start...
+    papplLog(system, PAPPL_LOGLEVEL_WARN, "Spare FreeDots process %d exited with status %d after %d seconds.", (int)fd->pid, status, (int)(time(NULL) - fd->started));
+
+    close(fd->outfd);
+    unlink(fd->fifo);
+    free(fd);
+
+    brf_fd_num_spares --;
+    memmove(brf_fd_spares + i, brf_fd_spares + i + 1, (size_t)(brf_fd_num_spares - i) * sizeof(brf_freedots_t *));
+
+    if (++ brf_fd_failures >= BRF_FREEDOTS_MAX_FAILURES)
+    {
+      // Back off 30 seconds, doubling up to 8 minutes...
+      brf_fd_retry = time(NULL) + (30 << (brf_fd_failures - BRF_FREEDOTS_MAX_FAILURES > 4 ? 4 : brf_fd_failures - BRF_FREEDOTS_MAX_FAILURES));
+
+      papplLog(system, PAPPL_LOGLEVEL_ERROR, "FreeDots failed to start %d times, retrying in %d seconds.", brf_fd_failures, (int)(brf_fd_retry - time(NULL)));
+    }
+  }
+
+  brf_freedots_fill();
+
+  pthread_mutex_unlock(&brf_fd_mutex);
+
+  return (true);
+}
+
+
+//
+// 'brf_freedots_convert()' - Convert Unicode braille to BRF.
+//
+// Dots 7 and 8 are dropped.  Other text is copied in upper case, and
+// characters that have no BRF equivalent are skipped.  The output is never
+// longer than the input.
+//
+
+static size_t				// O - Number of bytes in output
+brf_freedots_convert(
+    brf_fdconv_t *conv,			// I - Conversion state
+    const char   *in,			// I - UTF-8 input
+    size_t       inlen,			// I - Length of input
+    char         *out)			// I - Output buffer
+{
+  char		*outptr = out;		// Pointer into output
+  const char	*end = in + inlen;	// End of input
+  int		c;			// Current byte
+
+
+  for (; in < end; in ++)
+  {
+    c = *in & 255;
+
+    if (conv->remaining > 0 && (c & 0xc0) == 0x80)
+    {
+      conv->ch = (conv->ch << 6) | (unsigned)(c & 0x3f);
+
+      if (-- conv->remaining > 0)
+        continue;
+
+      if (conv->ch >= 0x2800 && conv->ch <= 0x28ff)
+        *outptr++ = brf_fd_brf[conv->ch & 0x3f];
+      else if (conv->ch == 0xa0)
+        *outptr++ = ' ';
+
+      continue;
+    }
+
+    // Start of a character, an incomplete sequence is dropped...
+    conv->remaining = 0;
+
+    if (c < 0x80)
+    {
+      if (c == '\n' || c == '\r' || c == '\f')
+        *outptr++ = (char)c;
+      else if (c == '\t')
+        *outptr++ = ' ';
+      else if (c >= ' ' && c < 0x7f)
+        *outptr++ = (char)toupper(c);
+    }
+    else if ((c & 0xe0) == 0xc0)
+    {
+      conv->ch        = (unsigned)(c & 0x1f);
+      conv->remaining = 1;
+    }
+    else if ((c & 0xf0) == 0xe0)
+    {
+      conv->ch        = (unsigned)(c & 0x0f);
+      conv->remaining = 2;
+    }
+    else if ((c & 0xf8) == 0xf0)
+    {
+      conv->ch        = (unsigned)(c & 0x07);
+      conv->remaining = 3;
+    }
+  }
+
+  return ((size_t)(outptr - out));
+}
+
+
+//
+// 'brf_freedots_exit()' - Stop the spare processes when the server exits.
+//
+
+static void
+brf_freedots_exit(void)
+{
+  // Filter processes forked from the server run the exit handlers too...
+  if (getpid() != brf_fd_server)
+    return;
+
+  pthread_mutex_lock(&brf_fd_mutex);
+
+  while (brf_fd_num_spares > 0)
+    brf_freedots_kill(brf_fd_spares[-- brf_fd_num_spares]);
+
+  brf_fd_max_spares = 0;
+
+  pthread_mutex_unlock(&brf_fd_mutex);
+}
+
+
+//
+// 'brf_freedots_fill()' - Start spare processes for the current line width.
+//
+// The mutex must be held.
+//
+
+static void
+brf_freedots_fill(void)
+{
+  int		i;			// Looping var
+  brf_freedots_t *fd;			// New spare process
+
+
+  if (brf_fd_width <= 0)
+    return;
+
+  // Spares for another width are not likely to be used...
+  for (i = 0; i < brf_fd_num_spares;)
+  {
+    if (brf_fd_spares[i]->width == brf_fd_width)
+    {
+      i ++;
+      continue;
+    }
+
+    brf_freedots_kill(brf_fd_spares[i]);
+
+    brf_fd_num_spares --;
+    memmove(brf_fd_spares + i, brf_fd_spares + i + 1, (size_t)(brf_fd_num_spares - i) * sizeof(brf_freedots_t *));
+  }
+
+  if (brf_fd_failures >= BRF_FREEDOTS_MAX_FAILURES && time(NULL) < brf_fd_retry)
+    return;
+
+  while (brf_fd_num_spares < brf_fd_max_spares)
+  {
+    if ((fd = brf_freedots_spawn(brf_fd_width)) == NULL)
+    {
+      brf_fd_failures = BRF_FREEDOTS_MAX_FAILURES;
+      brf_fd_retry    = time(NULL) + 30;
+      break;
+    }
+
+    brf_fd_spares[brf_fd_num_spares ++] = fd;
+  }
+}
+
+
+//
+// 'brf_freedots_find()' - Look for FreeDots in the PATH.
+//
+
+static bool				// O - `true` if found, `false` otherwise
+brf_freedots_find(void)
+{
+  const char	*path = getenv("PATH"),	// Search path
+		*ptr,			// Pointer into search path
+		*end;			// End of current directory
+  char		filename[1024];		// Candidate file
+
+
+  for (ptr = path ? path : "/usr/local/bin:/usr/bin:/bin"; *ptr; ptr = *end ? end + 1 : end)
+  {
+    if ((end = strchr(ptr, ':')) == NULL)
+      end = ptr + strlen(ptr);
+
+    if (end > ptr)
+    {
+      snprintf(filename, sizeof(filename), "%.*s/FreeDots", (int)(end - ptr), ptr);
+
+      if (!access(filename, X_OK))
+        return (true);
+    }
+  }
+
+  return (false);
+}
+
+
+//
+// 'brf_freedots_kill()' - Stop a spare process.
+//
+
+static void
+brf_freedots_kill(brf_freedots_t *fd)	// I - FreeDots process
+{
+  kill(fd->pid, SIGKILL);
+  while (waitpid(fd->pid, NULL, 0) < 0 && errno == EINTR);
+
+  close(fd->outfd);
+  unlink(fd->fifo);
+  free(fd);
+}
+
+
+//
+// 'brf_freedots_spawn()' - Start a FreeDots process.
+//
+// The process reads the score from a new FIFO and writes the transcription
+// to a pipe.  The mutex must be held.
+//
+
+static brf_freedots_t *			// O - FreeDots process or `NULL` on error
+brf_freedots_spawn(int width)		// I - Cells per line
+{
+  brf_freedots_t	*fd;		// FreeDots process
+  int			outpipe[2];	// Pipe from FreeDots
+  char			widthstr[16],	// Width argument
+			*argv[6];	// Command-line arguments
+  posix_spawn_file_actions_t actions;	// Child file actions
+  int			status;		// Spawn status
+  extern char		**environ;	// Environment
+
+
+  if ((fd = calloc(1, sizeof(brf_freedots_t))) == NULL)
+    return (NULL);
+
+  snprintf(fd->fifo, sizeof(fd->fifo), "%s/freedots-%d-%d.fifo", brf_fd_directory, (int)getpid(), ++ brf_fd_serial);
+  snprintf(widthstr, sizeof(widthstr), "%d", width);
+
+  if (mkfifo(fd->fifo, 0600))
+  {
+    papplLog(brf_fd_system, PAPPL_LOGLEVEL_ERROR, "Unable to create FIFO '%s': %s", fd->fifo, strerror(errno));
+    free(fd);
+    return (NULL);
+  }
+
+  if (pipe(outpipe))
+  {
+    papplLog(brf_fd_system, PAPPL_LOGLEVEL_ERROR, "Unable to create pipe for FreeDots: %s", strerror(errno));
+    unlink(fd->fifo);
+    free(fd);
+    return (NULL);
+  }
+
+  // Don't leak the pipe into other programs...
+  fcntl(outpipe[0], F_SETFD, FD_CLOEXEC);
+  fcntl(outpipe[1], F_SETFD, FD_CLOEXEC);
+
+  argv[0] = "FreeDots";
+  argv[1] = "-nw";
+  argv[2] = "-w";
+  argv[3] = widthstr;
+  argv[4] = fd->fifo;
+  argv[5] = NULL;
+
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+  posix_spawn_file_actions_adddup2(&actions, outpipe[1], 1);
+
+  status = posix_spawnp(&fd->pid, "FreeDots", &actions, NULL, argv, environ);
+
+  posix_spawn_file_actions_destroy(&actions);
+  close(outpipe[1]);
+
+  if (status)
+  {
+    papplLog(brf_fd_system, PAPPL_LOGLEVEL_ERROR, "Unable to run FreeDots: %s", strerror(status));
+    close(outpipe[0]);
+    unlink(fd->fifo);
+    free(fd);
+    return (NULL);
+  }
+
+  fd->width   = width;
+  fd->outfd   = outpipe[0];
+  fd->started = time(NULL);
+
+  papplLog(brf_fd_system, PAPPL_LOGLEVEL_DEBUG, "Started FreeDots process %d for %d cells per line.", (int)fd->pid, width);
+
+  return (fd);
+}
@@ -0,0 +1,365 @@
+//
+// BRF page layout for the Braille Printer Application
+//
+// Copyright © 2022 Chandresh Soni
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// This is the native version of addmargins() in filter/cups-braille.sh: it
+// adds the top margin at the start of each page and the left margin in front
+// of each non-empty line, ends lines with CR LF, and makes the document end
+// with exactly one form feed.  It works in a single streaming pass, either
+// as a filter function or fused into the stage that sends data to the device.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+
+
+//
+// Local functions...
+//
+
+static bool	brf_layout_flush(brf_layout_t *layout);
+static bool	brf_layout_newpage(brf_layout_t *layout);
+static bool	brf_layout_put(brf_layout_t *layout, const char *s, size_t bytes);
+static ssize_t	brf_layout_write_fd(int *fd, const void *buffer, size_t bytes);
+
+
+//
+// 'brfLayoutFilter()' - Filter function that lays out BRF pages.
+//
+// The parameters point to a `brf_layout_params_t` structure.  Without
+// parameters the "TopMargin" and "LeftMargin" job options are used.
+//
+
+int					// O - Exit status
+brfLayoutFilter(
+    int              inputfd,		// I - File descriptor input stream
+    int              outputfd,		// I - File descriptor output stream
+    int              inputseekable,	// I - Is input stream seekable? (unused)
+    cf_filter_data_t *data,		// I - Job and printer data
+    void             *parameters)	// I - Layout parameters or `NULL`
+{
+  brf_layout_params_t	*params = (brf_layout_params_t *)parameters;
+					// Layout parameters
+  brf_layout_t		layout;		// Layout state
+  char			buffer[65536];	// Read buffer
+  ssize_t		bytes;		// Bytes read
+  int			top_margin,	// Top margin in lines
+			left_margin;	// Left margin in cells
+  bool			ret;		// Return value
+
+
+  (void)inputseekable;
+
+  brfTraceBegin("layout", data->job_id);
+
+  if (params)
+  {
+    top_margin  = params->top_margin;
+    left_margin = params->left_margin;
+  }
+  else
+    brfLayoutGetMargins(data->num_options, data->options, &top_margin, &left_margin);
+
+  ret = brfLayoutInit(&layout, top_margin, left_margin, (brf_layout_cb_t)brf_layout_write_fd, &outputfd);
+
+  while (ret && (bytes = read(inputfd, buffer, sizeof(buffer))) > 0)
+  {
+    if (data->iscanceledfunc && (data->iscanceledfunc)(data->iscanceleddata))
+      ret = false;
+    else
+      ret = brfLayoutWrite(&layout, buffer, (size_t)bytes);
+  }
+
+  if (ret)
+    ret = brfLayoutFinish(&layout);
+  else if (data->logfunc)
+    data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "Layout: Unable to write output: %s", strerror(errno));
+
+  close(inputfd);
+  close(outputfd);
+
+  brfTraceEnd("layout", data->job_id);
+
+  return (ret ? 0 : 1);
+}
+
+
+//
+// 'brfLayoutFinish()' - End the document with a form feed and flush output.
+//
+// A form feed at the end of the input is replaced by the final one, so
+// documents never end with a blank page.
+//
+
+bool					// O - `true` on success, `false` on error
+brfLayoutFinish(brf_layout_t *layout)	// I - Layout state
+{
+  for (; layout->held_lines > 0; layout->held_lines --)
+  {
+    if (!brf_layout_put(layout, "\r\n", 2))
+      return (false);
+  }
+
+  layout->held_ff = false;
+
+  if (!brf_layout_put(layout, "\f", 1))
+    return (false);
+
+  return (brf_layout_flush(layout));
+}
+
+
+//
+// 'brfLayoutGetMargins()' - Get the text margins from job options.
+//
+// Both the PPD option names and the IPP keywords of the drivers are
+// recognized.  Missing margins are 0.
+//
+
+void
+brfLayoutGetMargins(
+    int           num_options,		// I - Number of options
+    cups_option_t *options,		// I - Options
+    int           *top_margin,		// O - Top margin in lines
+    int           *left_margin)		// O - Left margin in cells
+{
+  const char	*val;			// Option value
+
+
+  if ((val = cupsGetOption("TopMargin", num_options, options)) == NULL)
+    val = cupsGetOption("top-margin", num_options, options);
+  *top_margin = val ? atoi(val) : 0;
+
+  if ((val = cupsGetOption("LeftMargin", num_options, options)) == NULL)
+    val = cupsGetOption("left-margin", num_options, options);
+  *left_margin = val ? atoi(val) : 0;
+
+  if (*top_margin < 0 || *top_margin > BRF_LAYOUT_MAX_MARGIN)
+    *top_margin = 0;
+  if (*left_margin < 0 || *left_margin > BRF_LAYOUT_MAX_MARGIN)
+    *left_margin = 0;
+}
+
+
+//
+// 'brfLayoutInit()' - Start laying out a document.
+//
+// The top margin of the first page is sent right away.
+//
+
+bool					// O - `true` on success, `false` on error
+brfLayoutInit(brf_layout_t    *layout,	// I - Layout state
+              int             top_margin,
+					// I - Top margin in lines
+              int             left_margin,
+					// I - Left margin in cells
+              brf_layout_cb_t cb,	// I - Output callback
+              void            *cb_data)	// I - Output callback data
+{
+  memset(layout, 0, sizeof(brf_layout_t));
+
+  layout->top_margin    = top_margin < 0 ? 0 : top_margin > BRF_LAYOUT_MAX_MARGIN ? BRF_LAYOUT_MAX_MARGIN : top_margin;
+  layout->left_margin   = left_margin < 0 ? 0 : left_margin > BRF_LAYOUT_MAX_MARGIN ? BRF_LAYOUT_MAX_MARGIN : left_margin;
+  layout->cb            = cb;
+  layout->cb_data       = cb_data;
+  layout->at_line_start = true;
+
+  return (brf_layout_newpage(layout));
+}
+
+
+//
+// 'brfLayoutWrite()' - Lay out document data.
+//
+
+bool					// O - `true` on success, `false` on error
+brfLayoutWrite(brf_layout_t *layout,	// I - Layout state
+               const void   *buffer,	// I - Document data
+               size_t       bytes)	// I - Number of bytes
+{
+  const char	*ptr = (const char *)buffer,
+					// Pointer into data
+		*end = ptr + bytes,	// End of data
+		*start;			// Start of run of text
+  static const char spaces[BRF_LAYOUT_MAX_MARGIN] =
+  {					// Left margin
+    ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ',
+    ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ',
+    ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ',
+    ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' '
+  };
+
+
+  while (ptr < end)
+  {
+    switch (*ptr)
+    {
+      case '\f' :
+          // Hold the form feed until we know it isn't the last one...
+          if (layout->held_ff && !brf_layout_newpage(layout))
+            return (false);
+
+          layout->held_ff = true;
+          ptr ++;
+          break;
+
+      case '\r' :
+          // Line endings are normalized to CR LF below...
+          ptr ++;
+          break;
+
+      case '\n' :
+          if (layout->held_ff)
+            layout->held_lines ++;
+          else if (!brf_layout_put(layout, "\r\n", 2))
+            return (false);
+
+          layout->at_line_start = true;
+          ptr ++;
+          break;
+
+      default :
+          if (layout->held_ff && !brf_layout_newpage(layout))
+            return (false);
+
+          if (layout->at_line_start)
+          {
+            if (!brf_layout_put(layout, spaces, (size_t)layout->left_margin))
+              return (false);
+
+            layout->at_line_start = false;
+          }
+
+          // Copy the rest of the text up to the next control character...
+          for (start = ptr ++; ptr < end && *ptr != '\f' && *ptr != '\r' && *ptr != '\n'; ptr ++);
+
+          if (!brf_layout_put(layout, start, (size_t)(ptr - start)))
+            return (false);
+          break;
+    }
+  }
+
+  return (true);
+}
+
+
+//
+// 'brf_layout_flush()' - Send buffered output.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_layout_flush(brf_layout_t *layout)	// I - Layout state
+{
+  if (layout->used > 0 && (layout->cb)(layout->cb_data, layout->buffer, layout->used) < 0)
+    return (false);
+
+  layout->used = 0;
+
+  return (true);
+}
+
+
+//
+// 'brf_layout_newpage()' - Send a held form feed and the top margin.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_layout_newpage(brf_layout_t *layout)// I - Layout state
+{
+  int	i;				// Looping var
+
+
+  if (layout->held_ff)
+  {
+    if (!brf_layout_put(layout, "\f", 1))
+      return (false);
+
+    layout->held_ff = false;
+  }
+
+  for (i = 0; i < layout->top_margin; i ++)
+  {
+    if (!brf_layout_put(layout, "\r\n", 2))
+      return (false);
+  }
+
+  // Blank lines that followed the form feed...
+  for (; layout->held_lines > 0; layout->held_lines --)
+  {
+    if (!brf_layout_put(layout, "\r\n", 2))
+      return (false);
+  }
+
+  layout->at_line_start = true;
+
+  return (true);
+}
+
+
+//
+// 'brf_layout_put()' - Add output to the buffer.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_layout_put(brf_layout_t *layout,	// I - Layout state
+               const char   *s,		// I - Output
+               size_t       bytes)	// I - Number of bytes
+{
+  size_t	count;			// Bytes to copy
+
+
+  while (bytes > 0)
+  {
+    if (layout->used == sizeof(layout->buffer) && !brf_layout_flush(layout))
+      return (false);
+
+    if ((count = sizeof(layout->buffer) - layout->used) > bytes)
+      count = bytes;
+
+    memcpy(layout->buffer + layout->used, s, count);
+    layout->used += count;
+    s            += count;
+    bytes        -= count;
+  }
+
+  return (true);
+}
+
+
+//
+// 'brf_layout_write_fd()' - Write output to a file descriptor.
+//
+
+static ssize_t				// O - Bytes written or `-1` on error
+brf_layout_write_fd(int        *fd,	// I - File descriptor
+                    const void *buffer,	// I - Output
+                    size_t     bytes)	// I - Number of bytes
+{
+  const char	*ptr = (const char *)buffer;
+					// Pointer into output
+  ssize_t	written;		// Bytes written
+
+
+  while (bytes > 0)
+  {
+    if ((written = write(*fd, ptr, bytes)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      return (-1);
+    }
+
+    ptr   += written;
+    bytes -= (size_t)written;
+  }
+
+  return (ptr - (const char *)buffer);
+}
@@ -0,0 +1,1450 @@
+//
+// IPP load generator for the Braille Printer Application
+//
+// Copyright © 2022 Chandresh Soni
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Usage:
+//
+//   brf-load [OPTIONS] [-o NAME=VALUE ...]
+//
+// Starts "brf-printer-app server" on a loopback port with a scratch spool
+// directory and state file, adds printers whose output goes to a sink in
+// this program, to simulated embossers, to "/dev/null", or to files, and
+// submits a mix of text, PDF, BRF, and image jobs from several concurrent
+// clients over IPP.
+//
+// For each job it measures the submission latency (Print-Job request to
+// response), the time to the first byte at the device (submission to the
+// first "device-write" event in the server's "/brf-trace.json"), and the
+// completion latency (submission until the job leaves the active jobs, to
+// within the poll interval).  The report lists percentiles of each, the
+// job throughput, and the bytes the sink received.
+//
+// The trace and this program both use the monotonic clock, so the server
+// must run on the same host and with tracing enabled.
+//
+
+//
+// Include necessary headers...
+//
+
+#include <cups/cups.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+
+//
+// Constants...
+//
+
+#  define BRF_LOAD_MAX_PRINTERS	64	// Maximum number of printers
+#  define BRF_LOAD_NUM_TYPES	4	// Number of document types
+
+
+//
+// Local types...
+//
+
+typedef struct brf_load_type_s		// Document type
+{
+  const char		*name,		// Name in the job mix
+			*format;	// MIME media type
+  int			weight;		// Weight in the job mix
+  char			filename[1024];	// Document file
+} brf_load_type_t;
+
+typedef struct brf_load_job_s		// Submitted job
+{
+  int			printer,	// Printer index
+			type,		// Document type index
+			job_id;		// Job ID or 0 if not submitted
+  double		submit_start,	// Time Print-Job was sent
+			submit_end,	// Time Print-Job response arrived
+			first_byte,	// Time of first device write or 0
+			done;		// Time job left the active jobs or 0
+  ipp_jstate_t		state;		// Final job state
+} brf_load_job_t;
+
+typedef struct brf_load_sink_s		// Output sink of a printer
+{
+  int			fd;		// Listening socket
+  int			port;		// Port number
+  atomic_llong		bytes;		// Bytes received
+} brf_load_sink_t;
+
+
+//
+// Local functions...
+//
+
+static void	*brf_load_client(void *data);
+static int	brf_load_compare(const void *a, const void *b);
+static http_t	*brf_load_connect(void);
+static bool	brf_load_create_printers(const char *device, const char *driver);
+static bool	brf_load_make_brf(const char *filename, size_t size);
+static bool	brf_load_make_pdf(const char *filename, size_t size);
+static bool	brf_load_make_png(const char *filename, size_t size);
+static bool	brf_load_make_text(const char *filename, size_t size);
+static void	brf_load_monitor(double interval, double timeout);
+static double	brf_load_now(void);
+static void	brf_load_png_chunk(FILE *fp, const char *type, const unsigned char *data, size_t len);
+static void	brf_load_poll_jobs(http_t *http, int printer, double start);
+static void	brf_load_poll_trace(http_t *http);
+static void	brf_load_report(double start, double end);
+static void	brf_load_report_line(const char *name, double *values, int count);
+static void	*brf_load_sink(brf_load_sink_t *sink);
+static bool	brf_load_start_server(const char *app, int num_options, char **options);
+static void	brf_load_stop_server(void);
+static int	brf_load_usage(int status);
+
+
+//
+// Local globals...
+//
+
+static brf_load_type_t	brf_load_types[BRF_LOAD_NUM_TYPES] =
+{					// Document types
+  { "text",  "text/plain",                     4, "" },
+  { "brf",   "application/vnd.cups-paged-brf", 4, "" },
+  { "pdf",   "application/pdf",                1, "" },
+  { "image", "image/png",                      1, "" }
+};
+static char		brf_load_host[256] = "localhost";
+					// Server hostname
+static int		brf_load_port = 8765;
+					// Server port
+static char		brf_load_dir[1024] = "";
+					// Scratch directory
+static pid_t		brf_load_pid = 0;
+					// Server process
+static int		brf_load_num_printers = 2;
+					// Number of printers
+static char		brf_load_printers[BRF_LOAD_MAX_PRINTERS][1024];
+					// Printer URIs
+static char		brf_load_resources[BRF_LOAD_MAX_PRINTERS][256];
+					// Printer resource paths
+static brf_load_sink_t	brf_load_sinks[BRF_LOAD_MAX_PRINTERS];
+					// Output sinks
+static brf_load_job_t	*brf_load_jobs = NULL;
+					// Jobs
+static int		brf_load_num_jobs = 100;
+					// Number of jobs
+static atomic_int	brf_load_next_job = 0;
+					// Next job to submit
+static unsigned		brf_load_seed = 1;
+					// Seed for the job mix
+static pthread_mutex_t	brf_load_mutex = PTHREAD_MUTEX_INITIALIZER;
+					// Mutex for job times
+
+
+//
+// 'main()' - Main entry for the load generator.
+//
+
+int					// O - Exit status
+main(int  argc,				// I - Number of command-line arguments
+     char *argv[])			// I - Command-line arguments
+{
+  int		i,			// Looping var
+		t;			// Document type
+  const char	*opt,			// Current option
+		*app = "./brf-printer-app",
+					// Server executable
+		*device = "sink",	// Output device
+		*driver = "gen_brf",	// Driver name
+		*uri = NULL;		// Running server
+  int		num_clients = 4;	// Number of clients
+  size_t	size = 4096;		// Size of generated documents
+  double	interval = 0.05,	// Poll interval in seconds
+		timeout = 600.0;	// Timeout in seconds
+  int		num_options = 0;	// Number of server options
+  char		*options[256];		// Server options
+  char		*mix = NULL,		// Job mix
+		*ptr,			// Pointer into job mix
+		*name;			// Name in job mix
+  pthread_t	*tids;			// Client threads
+  int		err;			// Thread creation error
+  double	start,			// Start of load
+		end;			// End of load
+  char		scheme[32],		// URI scheme
+		userpass[256],		// URI username:password
+		resource[256];		// URI resource
+
+
+  for (i = 1; i < argc; i ++)
+  {
+    if (argv[i][0] != '-' || !argv[i][1] || argv[i][2])
+    {
+      fprintf(stderr, "brf-load: Unknown option '%s'.\n", argv[i]);
+      return (brf_load_usage(1));
+    }
+
+    opt = argv[i] + 1;
+
+    if (*opt == 'h')
+      return (brf_load_usage(0));
+
+    if ((i + 1) >= argc)
+    {
+      fprintf(stderr, "brf-load: Missing value after '-%c'.\n", *opt);
+      return (brf_load_usage(1));
+    }
+
+    i ++;
+
+    switch (*opt)
+    {
+      case 'a' : // -a SERVER-EXECUTABLE
+          app = argv[i];
+          break;
+      case 'c' : // -c CLIENTS
+          if ((num_clients = atoi(argv[i])) < 1)
+            return (brf_load_usage(1));
+          break;
+      case 'd' : // -d sink|sim[?PARAMS]|null|DIRECTORY
+          device = argv[i];
+          break;
+      case 'f' : // -f TYPE=FILENAME
+          if ((ptr = strchr(argv[i], '=')) == NULL)
+            return (brf_load_usage(1));
+
+          *ptr++ = '\0';
+
+          for (t = 0; t < BRF_LOAD_NUM_TYPES; t ++)
+          {
+            if (!strcmp(argv[i], brf_load_types[t].name))
+              break;
+          }
+
+          if (t >= BRF_LOAD_NUM_TYPES)
+          {
+            fprintf(stderr, "brf-load: Unknown document type '%s'.\n", argv[i]);
+            return (1);
+          }
+
+          snprintf(brf_load_types[t].filename, sizeof(brf_load_types[t].filename), "%s", ptr);
+          break;
+      case 'i' : // -i POLL-INTERVAL-MS
+          if ((interval = atoi(argv[i]) / 1000.0) <= 0.0)
+            return (brf_load_usage(1));
+          break;
+      case 'j' : // -j JOBS
+          if ((brf_load_num_jobs = atoi(argv[i])) < 1)
+            return (brf_load_usage(1));
+          break;
+      case 'm' : // -m text=W,brf=W,pdf=W,image=W
+          mix = argv[i];
+          break;
+      case 'M' : // -M DRIVER
+          driver = argv[i];
+          break;
+      case 'n' : // -n PRINTERS
+          if ((brf_load_num_printers = atoi(argv[i])) < 1 || brf_load_num_printers > BRF_LOAD_MAX_PRINTERS)
+            return (brf_load_usage(1));
+          break;
+      case 'o' : // -o NAME=VALUE
+          if (num_options >= (int)(sizeof(options) / sizeof(options[0]) - 2))
+            return (brf_load_usage(1));
+          options[num_options ++] = "-o";
+          options[num_options ++] = argv[i];
+          break;
+      case 'p' : // -p PORT
+          if ((brf_load_port = atoi(argv[i])) < 1)
+            return (brf_load_usage(1));
+          break;
+      case 'r' : // -r SEED
+          brf_load_seed = (unsigned)atoi(argv[i]);
+          break;
+      case 's' : // -s SIZE-KB
+          if ((size = (size_t)atoi(argv[i]) * 1024) < 1024)
+            return (brf_load_usage(1));
+          break;
+      case 't' : // -t TIMEOUT-SECONDS
+          if ((timeout = atof(argv[i])) <= 0.0)
+            return (brf_load_usage(1));
+          break;
+      case 'u' : // -u ipp://HOST:PORT
+          uri = argv[i];
+          break;
+      default :
+          fprintf(stderr, "brf-load: Unknown option '-%c'.\n", *opt);
+          return (brf_load_usage(1));
+    }
+  }
+
+  // Parse the job mix...
+  if (mix)
+  {
+    for (i = 0; i < BRF_LOAD_NUM_TYPES; i ++)
+      brf_load_types[i].weight = 0;
+
+    for (name = strtok(mix, ","); name; name = strtok(NULL, ","))
+    {
+      if ((ptr = strchr(name, '=')) == NULL)
+        return (brf_load_usage(1));
+
+      *ptr++ = '\0';
+
+      for (i = 0; i < BRF_LOAD_NUM_TYPES; i ++)
+      {
+        if (!strcmp(name, brf_load_types[i].name))
+        {
+          brf_load_types[i].weight = atoi(ptr);
+          break;
+        }
+      }
+
+      if (i >= BRF_LOAD_NUM_TYPES)
+      {
+        fprintf(stderr, "brf-load: Unknown document type '%s'.\n", name);
+        return (1);
+      }
+    }
+
+    for (i = 0; i < BRF_LOAD_NUM_TYPES && brf_load_types[i].weight <= 0; i ++);
+
+    if (i >= BRF_LOAD_NUM_TYPES)
+    {
+      fputs("brf-load: The job mix is empty.\n", stderr);
+      return (1);
+    }
+  }
+
+  // Create the scratch directory and the documents...
+  snprintf(brf_load_dir, sizeof(brf_load_dir), "%s/brf-load-XXXXXX", getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+
+  if (!mkdtemp(brf_load_dir))
+  {
+    fprintf(stderr, "brf-load: Unable to create scratch directory: %s\n", strerror(errno));
+    return (1);
+  }
+
+  for (i = 0; i < BRF_LOAD_NUM_TYPES; i ++)
+  {
+    brf_load_type_t	*type = brf_load_types + i;
+					// Document type
+    bool		ok;		// Document created?
+
+    if (type->filename[0] || type->weight <= 0)
+      continue;
+
+    snprintf(type->filename, sizeof(type->filename), "%s/load-%s", brf_load_dir, type->name);
+
+    switch (i)
+    {
+      case 0 :
+          ok = brf_load_make_text(type->filename, size);
+          break;
+      case 1 :
+          ok = brf_load_make_brf(type->filename, size);
+          break;
+      case 2 :
+          ok = brf_load_make_pdf(type->filename, size);
+          break;
+      default :
+          ok = brf_load_make_png(type->filename, size);
+          break;
+    }
+
+    if (!ok)
+    {
+      fprintf(stderr, "brf-load: Unable to create %s document: %s\n", type->name, strerror(errno));
+      return (1);
+    }
+  }
+
+  // Start the server or use a running one...
+  if (uri)
+  {
+    if (httpSeparateURI(HTTP_URI_CODING_ALL, uri, scheme, sizeof(scheme), userpass, sizeof(userpass), brf_load_host, sizeof(brf_load_host), &brf_load_port, resource, sizeof(resource)) < HTTP_URI_STATUS_OK)
+    {
+      fprintf(stderr, "brf-load: Bad server URI '%s'.\n", uri);
+      return (1);
+    }
+  }
+  else if (!brf_load_start_server(app, num_options, options))
+  {
+    brf_load_stop_server();
+    return (1);
+  }
+
+  if (!brf_load_create_printers(device, driver))
+  {
+    brf_load_stop_server();
+    return (1);
+  }
+
+  // Submit the jobs...
+  if ((brf_load_jobs = (brf_load_job_t *)calloc((size_t)brf_load_num_jobs, sizeof(brf_load_job_t))) == NULL || (tids = (pthread_t *)calloc((size_t)num_clients, sizeof(pthread_t))) == NULL)
+  {
+    perror("brf-load: Unable to allocate memory");
+    brf_load_stop_server();
+    return (1);
+  }
+
+  printf("Submitting %d jobs from %d clients to %d printers...\n", brf_load_num_jobs, num_clients, brf_load_num_printers);
+
+  start = brf_load_now();
+
+  for (i = 0; i < num_clients; i ++)
+  {
+    if ((err = pthread_create(tids + i, NULL, brf_load_client, (void *)(intptr_t)i)) != 0)
+    {
+      fprintf(stderr, "brf-load: Unable to create client thread: %s\n", strerror(err));
+      num_clients = i;
+      break;
+    }
+  }
+
+  brf_load_monitor(interval, timeout);
+
+  for (i = 0; i < num_clients; i ++)
+    pthread_join(tids[i], NULL);
+
+  end = brf_load_now();
+
+  brf_load_stop_server();
+
+  brf_load_report(start, end);
+
+  return (0);
+}
+
+
+//
+// 'brf_load_client()' - Submit jobs until all jobs are submitted.
+//
+
+static void *				// O - Thread exit status (unused)
+brf_load_client(void *data)		// I - Client number
+{
+  http_t	*http;			// Connection to server
+  ipp_t		*request,		// IPP request
+		*response;		// IPP response
+  int		i,			// Job index
+		t,			// Document type
+		total = 0,		// Total weight
+		pick;			// Weight pick
+  unsigned	seed = brf_load_seed + (unsigned)(intptr_t)data;
+					// Seed for the job mix
+  brf_load_job_t *job;			// Current job
+  char		title[64];		// Job title
+
+
+  if ((http = brf_load_connect()) == NULL)
+    return (NULL);
+
+  for (t = 0; t < BRF_LOAD_NUM_TYPES; t ++)
+    total += brf_load_types[t].weight > 0 ? brf_load_types[t].weight : 0;
+
+  while ((i = atomic_fetch_add(&brf_load_next_job, 1)) < brf_load_num_jobs)
+  {
+    job = brf_load_jobs + i;
+
+    for (t = 0, pick = rand_r(&seed) % total; t < BRF_LOAD_NUM_TYPES; t ++)
+    {
+      if (brf_load_types[t].weight <= 0)
+        continue;
+      else if (pick < brf_load_types[t].weight)
+        break;
+
+      pick -= brf_load_types[t].weight;
+    }
+
+    job->type    = t;
+    job->printer = i % brf_load_num_printers;
+
+    snprintf(title, sizeof(title), "load-%d-%s", i + 1, brf_load_types[t].name);
+
+    request = ippNewRequest(IPP_OP_PRINT_JOB);
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, brf_load_printers[job->printer]);
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser());
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "job-name", NULL, title);
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_MIMETYPE, "document-format", NULL, brf_load_types[t].format);
+
+    pthread_mutex_lock(&brf_load_mutex);
+    job->submit_start = brf_load_now();
+    pthread_mutex_unlock(&brf_load_mutex);
+
+    response = cupsDoFileRequest(http, request, brf_load_resources[job->printer], brf_load_types[t].filename);
+
+    pthread_mutex_lock(&brf_load_mutex);
+    job->submit_end = brf_load_now();
+
+    if (ippGetStatusCode(response) <= IPP_STATUS_OK_EVENTS_COMPLETE)
+    {
+      job->job_id = ippGetInteger(ippFindAttribute(response, "job-id", IPP_TAG_INTEGER), 0);
+    }
+    else
+    {
+      job->state = IPP_JSTATE_ABORTED;
+      job->done  = job->submit_end;
+      fprintf(stderr, "brf-load: %s: %s\n", title, cupsLastErrorString());
+    }
+    pthread_mutex_unlock(&brf_load_mutex);
+
+    ippDelete(response);
+  }
+
+  httpClose(http);
+
+  return (NULL);
+}
+
+
+//
+// 'brf_load_compare()' - Compare two latencies.
+//
+
+static int				// O - Result of comparison
+brf_load_compare(const void *a,		// I - First latency
+                 const void *b)		// I - Second latency
+{
+  double	da = *(const double *)a,// First latency
+		db = *(const double *)b;// Second latency
+
+
+  return (da < db ? -1 : da > db ? 1 : 0);
+}
+
+
+//
+// 'brf_load_connect()' - Connect to the server.
+//
+
+static http_t *				// O - Connection or `NULL` on error
+brf_load_connect(void)
+{
+  http_t	*http;			// Connection
+
+
+  if ((http = httpConnect2(brf_load_host, brf_load_port, NULL, AF_UNSPEC, HTTP_ENCRYPTION_IF_REQUESTED, 1, 30000, NULL)) == NULL)
+    fprintf(stderr, "brf-load: Unable to connect to %s:%d: %s\n", brf_load_host, brf_load_port, cupsLastErrorString());
+
+  return (http);
+}
+
+
+//
+// 'brf_load_create_printers()' - Add the printers and their output sinks.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_load_create_printers(
+    const char *device,			// I - "sink", "sim?...", "null", or directory
+    const char *driver)			// I - Driver name
+{
+  int			i;		// Looping var
+  http_t		*http;		// Connection to server
+  ipp_t			*request,	// IPP request
+			*response;	// IPP response
+  ipp_attribute_t	*attr;		// Printer URI
+  char			name[64],	// Printer name
+			scheme[32],	// URI scheme
+			userpass[256],	// URI username:password
+			host[256],	// URI hostname
+			system_uri[1024],
+					// System URI
+			device_uri[1100];
+					// Device URI
+  struct sockaddr_in	addr;		// Sink address
+  socklen_t		addrlen;	// Length of sink address
+  int			port;		// URI port
+  pthread_t		tid;		// Sink thread
+  int			err;		// Thread creation error
+
+
+  if ((http = brf_load_connect()) == NULL)
+    return (false);
+
+  httpAssembleURI(HTTP_URI_CODING_ALL, system_uri, sizeof(system_uri), "ipp", NULL, brf_load_host, brf_load_port, "/ipp/system");
+
+  for (i = 0; i < brf_load_num_printers; i ++)
+  {
+    // Output goes to a loopback socket, /dev/null, or files...
+    if (!strcmp(device, "sink"))
+    {
+      memset(&addr, 0, sizeof(addr));
+      addr.sin_family      = AF_INET;
+      addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      addrlen              = sizeof(addr);
+
+      if ((brf_load_sinks[i].fd = socket(AF_INET, SOCK_STREAM, 0)) < 0 || bind(brf_load_sinks[i].fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(brf_load_sinks[i].fd, 4) || getsockname(brf_load_sinks[i].fd, (struct sockaddr *)&addr, &addrlen))
+      {
+        fprintf(stderr, "brf-load: Unable to create output sink: %s\n", strerror(errno));
+        httpClose(http);
+        return (false);
+      }
+
+      brf_load_sinks[i].port = ntohs(addr.sin_port);
+
+      if ((err = pthread_create(&tid, NULL, (void *(*)(void *))brf_load_sink, brf_load_sinks + i)) != 0)
+      {
+        fprintf(stderr, "brf-load: Unable to create output sink: %s\n", strerror(err));
+        httpClose(http);
+        return (false);
+      }
+
+      pthread_detach(tid);
+
+      snprintf(device_uri, sizeof(device_uri), "socket://127.0.0.1:%d", brf_load_sinks[i].port);
+    }
+    else if (!strncmp(device, "sim", 3) && (!device[3] || device[3] == '?'))
+    {
+      // A simulated embosser per printer, with the same parameters...
+      snprintf(device_uri, sizeof(device_uri), "sim://load-%d%s", i + 1, device + 3);
+    }
+    else if (!strcmp(device, "null"))
+    {
+      snprintf(device_uri, sizeof(device_uri), "file:///dev/null");
+    }
+    else
+    {
+      snprintf(device_uri, sizeof(device_uri), "file://%s", device);
+    }
+
+    snprintf(name, sizeof(name), "load-%d-%d", (int)getpid(), i + 1);
+
+    request = ippNewRequest(IPP_OP_CREATE_PRINTER);
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "system-uri", NULL, system_uri);
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser());
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "printer-service-type", NULL, "print");
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "smi55357-driver", NULL, driver);
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "smi55357-device-uri", NULL, device_uri);
+    ippAddString(request, IPP_TAG_PRINTER, IPP_TAG_NAME, "printer-name", NULL, name);
+
+    response = cupsDoRequest(http, request, "/ipp/system");
+
+    if (ippGetStatusCode(response) > IPP_STATUS_OK_EVENTS_COMPLETE)
+    {
+      fprintf(stderr, "brf-load: Unable to add printer '%s': %s\n", name, cupsLastErrorString());
+      ippDelete(response);
+      httpClose(http);
+      return (false);
+    }
+
+    if ((attr = ippFindAttribute(response, "printer-uri-supported", IPP_TAG_URI)) != NULL)
+      snprintf(brf_load_printers[i], sizeof(brf_load_printers[i]), "%s", ippGetString(attr, 0, NULL));
+    else
+      httpAssembleURIf(HTTP_URI_CODING_ALL, brf_load_printers[i], sizeof(brf_load_printers[i]), "ipp", NULL, brf_load_host, brf_load_port, "/ipp/print/%s", name);
+
+    if (httpSeparateURI(HTTP_URI_CODING_ALL, brf_load_printers[i], scheme, sizeof(scheme), userpass, sizeof(userpass), host, sizeof(host), &port, brf_load_resources[i], sizeof(brf_load_resources[i])) < HTTP_URI_STATUS_OK)
+      snprintf(brf_load_resources[i], sizeof(brf_load_resources[i]), "/ipp/print/%s", name);
+
+    printf("Added printer %s with device %s.\n", brf_load_printers[i], device_uri);
+
+    ippDelete(response);
+  }
+
+  httpClose(http);
+
+  return (true);
+}
+
+
+//
+// 'brf_load_make_brf()' - Create a BRF document.
+//
+// 25 lines of 40 cells per page.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_load_make_brf(const char *filename,	// I - Filename
+                  size_t     size)	// I - Approximate size in bytes
+{
+  FILE		*fp;			// File
+  size_t	bytes = 0;		// Bytes written
+  int		line = 0,		// Line on page
+		col;			// Column
+  static const char cells[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789,;:!?-()";
+					// Cells to use
+
+
+  if ((fp = fopen(filename, "w")) == NULL)
+    return (false);
+
+  while (bytes < size)
+  {
+    for (col = 0; col < 40; col ++)
+      putc(col % 6 == 5 ? ' ' : cells[(bytes + (size_t)col) % (sizeof(cells) - 1)], fp);
+
+    putc('\n', fp);
+    bytes += 41;
+
+    if (++ line == 25)
+    {
+      putc('\f', fp);
+      bytes ++;
+      line = 0;
+    }
+  }
+
+  return (!fclose(fp));
+}
+
+
+//
+// 'brf_load_make_pdf()' - Create a PDF document with text.
+//
+// 40 lines of Helvetica per page.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_load_make_pdf(const char *filename,	// I - Filename
+                  size_t     size)	// I - Approximate size in bytes
+{
+  FILE		*fp;			// File
+  int		num_pages = (int)(size / 2400) + 1,
+					// Number of pages
+		page,			// Current page
+		line,			// Current line
+		obj;			// Current object
+  long		*offsets,		// Object offsets
+		xref,			// Offset of cross-reference table
+		length;			// Content stream length
+  char		content[8192],		// Content stream
+		*ptr;			// Pointer into content stream
+
+
+  if ((offsets = (long *)calloc((size_t)(3 + 2 * num_pages + 1), sizeof(long))) == NULL)
+    return (false);
+
+  if ((fp = fopen(filename, "w")) == NULL)
+  {
+    free(offsets);
+    return (false);
+  }
+
+  fputs("%PDF-1.4\n", fp);
+
+  offsets[1] = ftell(fp);
+  fputs("1 0 obj<</Type/Catalog/Pages 2 0 R>>endobj\n", fp);
+
+  offsets[2] = ftell(fp);
+  fputs("2 0 obj<</Type/Pages/Kids[", fp);
+  for (page = 0; page < num_pages; page ++)
+    fprintf(fp, "%d 0 R ", 4 + 2 * page);
+  fprintf(fp, "]/Count %d>>endobj\n", num_pages);
+
+  offsets[3] = ftell(fp);
+  fputs("3 0 obj<</Type/Font/Subtype/Type1/BaseFont/Helvetica>>endobj\n", fp);
+
+  for (page = 0, obj = 4; page < num_pages; page ++, obj += 2)
+  {
+    offsets[obj] = ftell(fp);
+    fprintf(fp, "%d 0 obj<</Type/Page/Parent 2 0 R/MediaBox[0 0 612 792]/Resources<</Font<</F1 3 0 R>>>>/Contents %d 0 R>>endobj\n", obj, obj + 1);
+
+    snprintf(content, sizeof(content), "BT /F1 12 Tf 14 TL 72 720 Td\n");
+    for (line = 0, ptr = content + strlen(content); line < 40; line ++, ptr += strlen(ptr))
+      snprintf(ptr, sizeof(content) - (size_t)(ptr - content), "(Page %d line %d: the quick brown fox jumps over the lazy dog.) '\n", page + 1, line + 1);
+    snprintf(ptr, sizeof(content) - (size_t)(ptr - content), "ET\n");
+    length = (long)strlen(content);
+
+    offsets[obj + 1] = ftell(fp);
+    fprintf(fp, "%d 0 obj<</Length %ld>>stream\n%sendstream\nendobj\n", obj + 1, length, content);
+  }
+
+  xref = ftell(fp);
+  fprintf(fp, "xref\n0 %d\n0000000000 65535 f \n", obj);
+  for (page = 1; page < obj; page ++)
+    fprintf(fp, "%010ld 00000 n \n", offsets[page]);
+  fprintf(fp, "trailer<</Size %d/Root 1 0 R>>\nstartxref\n%ld\n%%%%EOF\n", obj, xref);
+
+  free(offsets);
+
+  return (!fclose(fp));
+}
+
+
+//
+// 'brf_load_make_png()' - Create a grayscale PNG image.
+//
+// 400 pixels wide with a pattern of boxes.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_load_make_png(const char *filename,	// I - Filename
+                  size_t     size)	// I - Approximate uncompressed size in bytes
+{
+  FILE		*fp;			// File
+  unsigned	width = 400,		// Width in pixels
+		height = (unsigned)(size / 400) + 1,
+					// Height in pixels
+		x, y;			// Current pixel
+  unsigned char	*pixels,		// Filtered rows
+		*ptr,			// Pointer into rows
+		*zdata,			// Compressed rows
+		header[13];		// IHDR data
+  uLongf	zlen;			// Length of compressed rows
+  bool		ret = false;		// Return value
+
+
+  if ((pixels = (unsigned char *)malloc((size_t)(width + 1) * height)) == NULL)
+    return (false);
+
+  for (y = 0, ptr = pixels; y < height; y ++)
+  {
+    *ptr++ = 0;				// No filter
+
+    for (x = 0; x < width; x ++)
+      *ptr++ = ((x / 40) + (y / 40)) & 1 ? 0 : 255;
+  }
+
+  zlen = compressBound((uLong)((width + 1) * height));
+
+  if ((zdata = (unsigned char *)malloc(zlen)) != NULL && compress(zdata, &zlen, pixels, (uLong)((width + 1) * height)) == Z_OK && (fp = fopen(filename, "wb")) != NULL)
+  {
+    fwrite("\211PNG\r\n\032\n", 1, 8, fp);
+
+    header[0]  = (unsigned char)(width >> 24);
+    header[1]  = (unsigned char)(width >> 16);
+    header[2]  = (unsigned char)(width >> 8);
+    header[3]  = (unsigned char)width;
+    header[4]  = (unsigned char)(height >> 24);
+    header[5]  = (unsigned char)(height >> 16);
+    header[6]  = (unsigned char)(height >> 8);
+    header[7]  = (unsigned char)height;
+    header[8]  = 8;			// Bit depth
+    header[9]  = 0;			// Grayscale
+    header[10] = 0;			// Deflate
+    header[11] = 0;			// Adaptive filtering
+    header[12] = 0;			// No interlace
+
+    brf_load_png_chunk(fp, "IHDR", header, sizeof(header));
+    brf_load_png_chunk(fp, "IDAT", zdata, zlen);
+    brf_load_png_chunk(fp, "IEND", NULL, 0);
+
+    ret = !fclose(fp);
+  }
+
+  free(zdata);
+  free(pixels);
+
+  return (ret);
+}
+
+
+//
+// 'brf_load_make_text()' - Create a plain text document.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_load_make_text(const char *filename,// I - Filename
+                   size_t     size)	// I - Approximate size in bytes
+{
+  FILE		*fp;			// File
+  size_t	bytes = 0;		// Bytes written
+  int		para = 0;		// Paragraph number
+
+
+  if ((fp = fopen(filename, "w")) == NULL)
+    return (false);
+
+  while (bytes < size)
+  {
+    para ++;
+    bytes += (size_t)fprintf(fp, "Paragraph %d. Braille is a tactile writing system used by people who are visually impaired. It is read by touch, with six raised dots in each cell, and every cell stands for a letter, a number, or a contraction.\n\n", para);
+  }
+
+  return (!fclose(fp));
+}
+
+
+//
+// 'brf_load_monitor()' - Track jobs until all of them are done.
+//
+
+static void
+brf_load_monitor(double interval,	// I - Poll interval in seconds
+                 double timeout)	// I - Timeout in seconds
+{
+  http_t	*http;			// Connection to server
+  int		i,			// Looping var
+		pending;		// Jobs not done
+  double	start = brf_load_now(),	// Start of monitoring
+		poll_start,		// Start of current poll
+		last_trace = 0.0;	// Time of last trace fetch
+  struct timespec delay;		// Delay between polls
+
+
+  if ((http = brf_load_connect()) == NULL)
+    return;
+
+  delay.tv_sec  = (time_t)interval;
+  delay.tv_nsec = (long)((interval - (double)delay.tv_sec) * 1000000000.0);
+
+  for (;;)
+  {
+    poll_start = brf_load_now();
+
+    for (i = 0; i < brf_load_num_printers; i ++)
+      brf_load_poll_jobs(http, i, poll_start);
+
+    // The trace rings are small, read them about every half second...
+    if ((poll_start - last_trace) >= 0.5)
+    {
+      brf_load_poll_trace(http);
+      last_trace = poll_start;
+    }
+
+    pthread_mutex_lock(&brf_load_mutex);
+    for (i = 0, pending = 0; i < brf_load_num_jobs; i ++)
+    {
+      if (!brf_load_jobs[i].done)
+        pending ++;
+    }
+    pthread_mutex_unlock(&brf_load_mutex);
+
+    if (!pending && atomic_load(&brf_load_next_job) >= brf_load_num_jobs)
+      break;
+
+    if ((poll_start - start) > timeout)
+    {
+      fprintf(stderr, "brf-load: Timed out with %d jobs not done.\n", pending);
+      break;
+    }
+
+    nanosleep(&delay, NULL);
+  }
+
+  // Pick up the last device writes...
+  brf_load_poll_trace(http);
+
+  httpClose(http);
+}
+
+
+//
+// 'brf_load_now()' - Get the monotonic time in seconds.
+//
+
+static double				// O - Time in seconds
+brf_load_now(void)
+{
+  struct timespec	now;		// Current time
+
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return ((double)now.tv_sec + (double)now.tv_nsec / 1000000000.0);
+}
+
+
+//
+// 'brf_load_png_chunk()' - Write a PNG chunk.
+//
+
+static void
+brf_load_png_chunk(
+    FILE                *fp,		// I - File
+    const char          *type,		// I - Chunk type
+    const unsigned char *data,		// I - Chunk data
+    size_t              len)		// I - Length of chunk data
+{
+  unsigned char	buffer[4];		// Length or CRC
+  uLong		crc;			// CRC of type and data
+
+
+  buffer[0] = (unsigned char)(len >> 24);
+  buffer[1] = (unsigned char)(len >> 16);
+  buffer[2] = (unsigned char)(len >> 8);
+  buffer[3] = (unsigned char)len;
+  fwrite(buffer, 1, 4, fp);
+  fwrite(type, 1, 4, fp);
+
+  if (len > 0)
+    fwrite(data, 1, len, fp);
+
+  crc = crc32(0, (const Bytef *)type, 4);
+  if (len > 0)
+    crc = crc32(crc, data, (uInt)len);
+
+  buffer[0] = (unsigned char)(crc >> 24);
+  buffer[1] = (unsigned char)(crc >> 16);
+  buffer[2] = (unsigned char)(crc >> 8);
+  buffer[3] = (unsigned char)crc;
+  fwrite(buffer, 1, 4, fp);
+}
+
+
+//
+// 'brf_load_poll_jobs()' - Find the jobs of a printer that are done.
+//
+// Jobs that were submitted before the poll started and are no longer in the
+// printer's active jobs are done.
+//
+
+static void
+brf_load_poll_jobs(http_t *http,	// I - Connection to server
+                   int    printer,	// I - Printer index
+                   double start)	// I - Start of poll
+{
+  ipp_t			*request,	// IPP request
+			*response,	// IPP response
+			*jresponse;	// Get-Job-Attributes response
+  ipp_attribute_t	*attr;		// Current attribute
+  int			i,		// Looping var
+			num_active = 0,	// Number of active jobs
+			alloc_active = 0,
+					// Allocated active jobs
+			*active = NULL,	// Active job IDs
+			*temp;		// New active job IDs
+  bool			found;		// Job is active?
+  brf_load_job_t	*job;		// Current job
+  double		now;		// Time of response
+  static const char * const pattrs[] = { "job-id" };
+					// Requested attributes
+
+
+  request = ippNewRequest(IPP_OP_GET_JOBS);
+  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, brf_load_printers[printer]);
+  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser());
+  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "which-jobs", NULL, "not-completed");
+  ippAddStrings(request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "requested-attributes", 1, NULL, pattrs);
+
+  response = cupsDoRequest(http, request, brf_load_resources[printer]);
+  now      = brf_load_now();
+
+  if (ippGetStatusCode(response) > IPP_STATUS_OK_EVENTS_COMPLETE)
+  {
+    ippDelete(response);
+    return;
+  }
+
+  for (attr = ippFirstAttribute(response); attr; attr = ippNextAttribute(response))
+  {
+    if (ippGetName(attr) && !strcmp(ippGetName(attr), "job-id") && ippGetValueTag(attr) == IPP_TAG_INTEGER)
+    {
+      if (num_active >= alloc_active)
+      {
+        if ((temp = (int *)realloc(active, (size_t)(alloc_active + 64) * sizeof(int))) == NULL)
+          break;
+
+        active       = temp;
+        alloc_active += 64;
+      }
+
+      active[num_active ++] = ippGetInteger(attr, 0);
+    }
+  }
+
+  ippDelete(response);
+
+  for (job = brf_load_jobs; job < (brf_load_jobs + brf_load_num_jobs); job ++)
+  {
+    pthread_mutex_lock(&brf_load_mutex);
+    found = job->printer != printer || !job->job_id || job->done || job->submit_end <= 0.0 || job->submit_end > start;
+    pthread_mutex_unlock(&brf_load_mutex);
+
+    if (found)
+      continue;
+
+    for (i = 0; i < num_active && !found; i ++)
+      found = active[i] == job->job_id;
+
+    if (found)
+      continue;
+
+    // The job is done, find out how it ended...
+    request = ippNewRequest(IPP_OP_GET_JOB_ATTRIBUTES);
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, brf_load_printers[printer]);
+    ippAddInteger(request, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "job-id", job->job_id);
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser());
+
+    jresponse = cupsDoRequest(http, request, brf_load_resources[printer]);
+
+    pthread_mutex_lock(&brf_load_mutex);
+    job->done  = now;
+    job->state = (ipp_jstate_t)ippGetInteger(ippFindAttribute(jresponse, "job-state", IPP_TAG_ENUM), 0);
+    pthread_mutex_unlock(&brf_load_mutex);
+
+    ippDelete(jresponse);
+  }
+
+  free(active);
+}
+
+
+//
+// 'brf_load_poll_trace()' - Record the first device write of each job.
+//
+
+static void
+brf_load_poll_trace(http_t *http)	// I - Connection to server
+{
+  http_status_t	status;			// HTTP status
+  char		*json = NULL,		// Trace JSON
+		*temp,			// New trace buffer
+		*line,			// Current line
+		*next;			// Next line
+  size_t	used = 0,		// Bytes in buffer
+		size = 0;		// Size of buffer
+  ssize_t	bytes;			// Bytes read
+  int		job_id;			// Job ID
+  double	ts;			// Timestamp in seconds
+  brf_load_job_t *job;			// Current job
+  static const char prefix[] = "{\"name\":\"device-write\",\"ph\":\"B\",\"ts\":";
+					// Start of device write events
+
+
+  httpClearFields(http);
+
+  if (httpGet(http, "/brf-trace.json"))
+  {
+    httpReconnect2(http, 30000, NULL);
+    return;
+  }
+
+  while ((status = httpUpdate(http)) == HTTP_STATUS_CONTINUE);
+
+  if (status != HTTP_STATUS_OK)
+  {
+    httpFlush(http);
+    return;
+  }
+
+  for (;;)
+  {
+    if ((size - used) < 4096)
+    {
+      if ((temp = (char *)realloc(json, size + 65536)) == NULL)
+        break;
+
+      json = temp;
+      size += 65536;
+    }
+
+    if ((bytes = httpRead2(http, json + used, size - used - 1)) <= 0)
+      break;
+
+    used += (size_t)bytes;
+  }
+
+  if (!json)
+  {
+    httpFlush(http);
+    return;
+  }
+
+  json[used] = '\0';
+
+  // One event per line: {"name":"device-write","ph":"B","ts":...,"args":{"job-id":N}}
+  pthread_mutex_lock(&brf_load_mutex);
+
+  for (line = json; line; line = next)
+  {
+    if ((next = strchr(line, '\n')) != NULL)
+      *next++ = '\0';
+
+    if (strncmp(line, prefix, sizeof(prefix) - 1) || (temp = strstr(line, "\"job-id\":")) == NULL)
+      continue;
+
+    ts     = strtod(line + sizeof(prefix) - 1, NULL) / 1000000.0;
+    job_id = atoi(temp + 9);
+
+    for (job = brf_load_jobs; job < (brf_load_jobs + brf_load_num_jobs); job ++)
+    {
+      if (job->job_id == job_id)
+      {
+        if (!job->first_byte || ts < job->first_byte)
+          job->first_byte = ts;
+        break;
+      }
+    }
+  }
+
+  pthread_mutex_unlock(&brf_load_mutex);
+
+  free(json);
+}
+
+
+//
+// 'brf_load_report()' - Report the latencies and throughput.
+//
+
+static void
+brf_load_report(double start,		// I - Start of load
+                double end)		// I - End of load
+{
+  int		i,			// Looping var
+		t,			// Document type
+		count,			// Number of values
+		completed = 0,		// Completed jobs
+		failed = 0,		// Failed jobs
+		unfinished = 0;		// Jobs not done
+  double	*values;		// Latencies
+  long long	bytes = 0;		// Bytes at the sinks
+  brf_load_job_t *job;			// Current job
+  char		name[64];		// Name of line
+
+
+  if ((values = (double *)calloc((size_t)brf_load_num_jobs, sizeof(double))) == NULL)
+    return;
+
+  for (i = 0, job = brf_load_jobs; i < brf_load_num_jobs; i ++, job ++)
+  {
+    if (!job->done)
+      unfinished ++;
+    else if (job->state == IPP_JSTATE_COMPLETED)
+      completed ++;
+    else
+      failed ++;
+  }
+
+  for (i = 0; i < brf_load_num_printers; i ++)
+    bytes += atomic_load(&brf_load_sinks[i].bytes);
+
+  printf("\n%d jobs in %.3f seconds: %d completed, %d failed, %d not done.\n", brf_load_num_jobs, end - start, completed, failed, unfinished);
+  printf("Throughput: %.2f jobs/s", completed / (end - start));
+  if (bytes > 0)
+    printf(", %.1f KB/s at the devices", bytes / 1024.0 / (end - start));
+  puts(".\n");
+
+  printf("%-18s %6s %9s %9s %9s %9s\n", "Latency (ms)", "count", "p50", "p90", "p99", "max");
+
+  for (i = 0, count = 0; i < brf_load_num_jobs; i ++)
+  {
+    if (brf_load_jobs[i].submit_end > 0.0)
+      values[count ++] = brf_load_jobs[i].submit_end - brf_load_jobs[i].submit_start;
+  }
+  brf_load_report_line("submit", values, count);
+
+  for (i = 0, count = 0; i < brf_load_num_jobs; i ++)
+  {
+    if (brf_load_jobs[i].first_byte > 0.0)
+      values[count ++] = brf_load_jobs[i].first_byte - brf_load_jobs[i].submit_start;
+  }
+  brf_load_report_line("first-byte", values, count);
+
+  for (i = 0, count = 0; i < brf_load_num_jobs; i ++)
+  {
+    if (brf_load_jobs[i].done > 0.0 && brf_load_jobs[i].state == IPP_JSTATE_COMPLETED)
+      values[count ++] = brf_load_jobs[i].done - brf_load_jobs[i].submit_start;
+  }
+  brf_load_report_line("complete", values, count);
+
+  for (t = 0; t < BRF_LOAD_NUM_TYPES; t ++)
+  {
+    for (i = 0, count = 0; i < brf_load_num_jobs; i ++)
+    {
+      if (brf_load_jobs[i].type == t && brf_load_jobs[i].done > 0.0 && brf_load_jobs[i].state == IPP_JSTATE_COMPLETED)
+        values[count ++] = brf_load_jobs[i].done - brf_load_jobs[i].submit_start;
+    }
+
+    if (count > 0)
+    {
+      snprintf(name, sizeof(name), "  complete %s", brf_load_types[t].name);
+      brf_load_report_line(name, values, count);
+    }
+  }
+
+  free(values);
+}
+
+
+//
+// 'brf_load_report_line()' - Report the percentiles of some latencies.
+//
+
+static void
+brf_load_report_line(const char *name,	// I - Name of line
+                     double     *values,// I - Latencies in seconds
+                     int        count)	// I - Number of latencies
+{
+  if (count == 0)
+  {
+    printf("%-18s %6d %9s %9s %9s %9s\n", name, 0, "-", "-", "-", "-");
+    return;
+  }
+
+  qsort(values, (size_t)count, sizeof(double), brf_load_compare);
+
+  printf("%-18s %6d %9.1f %9.1f %9.1f %9.1f\n", name, count, 1000.0 * values[(count - 1) * 50 / 100], 1000.0 * values[(count - 1) * 90 / 100], 1000.0 * values[(count - 1) * 99 / 100], 1000.0 * values[count - 1]);
+}
+
+
+//
+// 'brf_load_sink()' - Receive and discard printer output.
+//
+
+static void *				// O - Thread exit status (unused)
+brf_load_sink(brf_load_sink_t *sink)	// I - Sink
+{
+  int		fd;			// Connection
+  char		buffer[65536];		// Output
+  ssize_t	bytes;			// Bytes received
+
+
+  while ((fd = accept(sink->fd, NULL, NULL)) >= 0 || errno == EINTR)
+  {
+    if (fd < 0)
+      continue;
+
+    while ((bytes = read(fd, buffer, sizeof(buffer))) > 0 || (bytes < 0 && errno == EINTR))
+    {
+      if (bytes > 0)
+        atomic_fetch_add(&sink->bytes, bytes);
+    }
+
+    close(fd);
+  }
+
+  return (NULL);
+}
+
+
+//
+// 'brf_load_start_server()' - Start the server on a loopback port.
+//
+// The server gets the scratch directory for its spool directory, log file,
+// and state file.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_load_start_server(
+    const char *app,			// I - Server executable
+    int        num_options,		// I - Number of extra arguments
+    char       **options)		// I - Extra arguments
+{
+  char		*args[300],		// Server arguments
+		port[64],		// Port option
+		spool[1100],		// Spool directory option
+		logfile[1100];		// Log file option
+  int		i,			// Looping var
+		num_args = 0;		// Number of arguments
+  http_t	*http;			// Test connection
+  double	start;			// Start time
+
+
+  snprintf(port, sizeof(port), "server-port=%d", brf_load_port);
+  snprintf(spool, sizeof(spool), "spool-directory=%s", brf_load_dir);
+  snprintf(logfile, sizeof(logfile), "log-file=%s/server.log", brf_load_dir);
+
+  args[num_args ++] = (char *)app;
+  args[num_args ++] = "server";
+  args[num_args ++] = "-o";
+  args[num_args ++] = port;
+  args[num_args ++] = "-o";
+  args[num_args ++] = "listen-hostname=localhost";
+  args[num_args ++] = "-o";
+  args[num_args ++] = spool;
+  args[num_args ++] = "-o";
+  args[num_args ++] = logfile;
+  args[num_args ++] = "-o";
+  args[num_args ++] = "log-level=info";
+
+  for (i = 0; i < num_options; i ++)
+    args[num_args ++] = options[i];
+
+  args[num_args] = NULL;
+
+  printf("Starting %s on port %d, logging to %s/server.log...\n", app, brf_load_port, brf_load_dir);
+
+  if ((brf_load_pid = fork()) == 0)
+  {
+    // Keep the state file in the scratch directory...
+    unsetenv("SNAP_DATA");
+    setenv("XDG_DATA_HOME", brf_load_dir, 1);
+
+    execv(app, args);
+    perror("brf-load: Unable to start server");
+    _exit(1);
+  }
+  else if (brf_load_pid < 0)
+  {
+    perror("brf-load: Unable to start server");
+    brf_load_pid = 0;
+    return (false);
+  }
+
+  // Wait for the listener...
+  for (start = brf_load_now(); (brf_load_now() - start) < 30.0; usleep(100000))
+  {
+    if (waitpid(brf_load_pid, NULL, WNOHANG) == brf_load_pid)
+    {
+      fputs("brf-load: The server exited while starting.\n", stderr);
+      brf_load_pid = 0;
+      return (false);
+    }
+
+    if ((http = httpConnect2(brf_load_host, brf_load_port, NULL, AF_UNSPEC, HTTP_ENCRYPTION_IF_REQUESTED, 1, 1000, NULL)) != NULL)
+    {
+      httpClose(http);
+      return (true);
+    }
+  }
+
+  fputs("brf-load: The server did not start listening.\n", stderr);
+
+  return (false);
+}
+
+
+//
+// 'brf_load_stop_server()' - Stop the server.
+//
+
+static void
+brf_load_stop_server(void)
+{
+  if (brf_load_pid > 0)
+  {
+    kill(brf_load_pid, SIGTERM);
+    waitpid(brf_load_pid, NULL, 0);
+    brf_load_pid = 0;
+  }
+}
+
+
+//
+// 'brf_load_usage()' - Show program usage.
+//
+
+static int				// O - Exit status
+brf_load_usage(int status)		// I - Exit status
+{
+  FILE	*fp = status ? stderr : stdout;	// Output file
+
+
+  fputs("Usage: brf-load [OPTIONS]\n", fp);
+  fputs("Options:\n", fp);
+  fputs("  -a SERVER          Server executable (default ./brf-printer-app).\n", fp);
+  fputs("  -c CLIENTS         Number of concurrent clients (default 4).\n", fp);
+  fputs("  -d sink|null|DIR   Printer output (default sink).\n", fp);
+  fputs("  -d sim[?PARAMS]    Simulated embossers, e.g. \"sim?cps=1000&feed=100\".\n", fp);
+  fputs("  -f TYPE=FILE       Use FILE for the \"text\", \"brf\", \"pdf\", or \"image\" jobs.\n", fp);
+  fputs("  -i MS              Job state poll interval (default 50).\n", fp);
+  fputs("  -j JOBS            Number of jobs (default 100).\n", fp);
+  fputs("  -M DRIVER          Driver name (default gen_brf).\n", fp);
+  fputs("  -m TYPE=W,...      Job mix weights (default text=4,brf=4,pdf=1,image=1).\n", fp);
+  fputs("  -n PRINTERS        Number of printers (default 2).\n", fp);
+  fputs("  -o NAME=VALUE      Server option.\n", fp);
+  fputs("  -p PORT            Server port (default 8765).\n", fp);
+  fputs("  -r SEED            Seed for the job mix (default 1).\n", fp);
+  fputs("  -s KB              Size of generated documents (default 4).\n", fp);
+  fputs("  -t SECONDS         Timeout (default 600).\n", fp);
+  fputs("  -u ipp://HOST:PORT Use a running server.\n", fp);
+
+  return (status);
+}
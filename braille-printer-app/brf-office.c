@@ -0,0 +1,676 @@
+//
+// OpenDocument and OOXML text extraction for the Braille Printer Application
+//
+// Copyright © 2022 Chandresh Soni
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Office documents are ZIP archives.  Instead of copying the document and
+// unpacking it with "unzip", the central directory is read straight from the
+// spool file and only the member with the document body is inflated.  The
+// XML is turned into paragraphs of text while it is being inflated.
+// Archives this reader doesn't support, like ZIP64 archives, are left to
+// the external converter, see brfOfficeCheck().
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+#include <stdint.h>
+#include <zlib.h>
+
+
+//
+// Local constants...
+//
+
+#define BRF_ZIP_EOCD_SIG	0x06054b50	// End of central directory record
+#define BRF_ZIP_CDIR_SIG	0x02014b50	// Central directory file header
+#define BRF_ZIP_LOCAL_SIG	0x04034b50	// Local file header
+#define BRF_ZIP64_LOCATOR_SIG	0x07064b50	// ZIP64 end of central directory locator
+#define BRF_ZIP_MAX_CDIR	16777216	// Maximum size of central directory
+#define BRF_ZIP_ENCRYPTED	0x0001		// General purpose flag of encrypted members
+
+
+//
+// Local types...
+//
+
+typedef enum brf_xml_state_e		// XML parser state
+{
+  BRF_XML_TEXT,				// Character data
+  BRF_XML_TAG,				// Inside a tag
+  BRF_XML_QUOTE,			// Inside a quoted attribute value
+  BRF_XML_ENTITY			// Inside an entity reference
+} brf_xml_state_t;
+
+typedef struct brf_xml_s		// XML to text state
+{
+  int			fd;		// Output file descriptor
+  brf_xml_state_t	state;		// Parser state
+  char			quote;		// Quote character of attribute value
+  char			name[64];	// Tag name
+  size_t		namelen;	// Length of tag name
+  bool			in_name,	// Still reading the tag name?
+			closing,	// Closing tag?
+			empty;		// Empty element tag?
+  char			entity[16];	// Entity name
+  size_t		entitylen;	// Length of entity name
+  int			skip;		// Depth of skipped elements
+  size_t		used;		// Bytes used in output buffer
+  char			buffer[8192];	// Output buffer
+} brf_xml_t;
+
+
+//
+// Local functions...
+//
+
+static uint16_t	brf_get16(const unsigned char *p);
+static uint32_t	brf_get32(const unsigned char *p);
+static bool	brf_xml_char(brf_xml_t *xml, int ch);
+static bool	brf_xml_end_tag(brf_xml_t *xml);
+static bool	brf_xml_flush(brf_xml_t *xml);
+static bool	brf_xml_put(brf_xml_t *xml, const char *s, size_t bytes);
+static bool	brf_xml_write(brf_xml_t *xml, const unsigned char *data, size_t bytes);
+static bool	brf_zip_find(int fd, const char *member, off_t *offset, uint16_t *method, uint32_t *comp_size);
+
+
+//
+// 'brfOfficeCheck()' - Check whether a document can be read natively.
+//
+// Documents that fail this check are converted by the external filter.
+//
+
+bool					// O - `true` if supported, `false` otherwise
+brfOfficeCheck(const char *filename,	// I - Document file
+               const char *member)	// I - Member with the document body
+{
+  int		fd;			// Document file
+  off_t		offset;			// Offset of member data
+  uint16_t	method = 0;		// Compression method
+  uint32_t	comp_size;		// Compressed size
+  bool		ret;			// Return value
+
+
+  if ((fd = open(filename, O_RDONLY)) < 0)
+    return (false);
+
+  ret = brf_zip_find(fd, member, &offset, &method, &comp_size) && (method == 0 || method == Z_DEFLATED);
+
+  close(fd);
+
+  return (ret);
+}
+
+
+//
+// 'brfOfficeToTextFilter()' - Filter function that extracts the text of an
+//                             OpenDocument or OOXML document.
+//
+// The parameters point to the name of the archive member with the document
+// body, "content.xml" or "word/document.xml".  The input must be a file.
+//
+
+int					// O - Exit status
+brfOfficeToTextFilter(
+    int              inputfd,		// I - File descriptor input stream
+    int              outputfd,		// I - File descriptor output stream
+    int              inputseekable,	// I - Is input stream seekable? (unused)
+    cf_filter_data_t *data,		// I - Job and printer data
+    void             *parameters)	// I - Member name
+{
+  const char	*member = (const char *)parameters;
+					// Archive member
+  off_t		offset;			// Offset of member data
+  uint16_t	method = 0;		// Compression method
+  uint32_t	comp_size;		// Compressed size
+  unsigned char	inbuf[65536],		// Compressed data
+		outbuf[65536];		// Inflated data
+  ssize_t	bytes;			// Bytes read
+  z_stream	stream;			// Inflate stream
+  int		zerr = Z_OK;		// Inflate status
+  bool		zinit = false;		// Inflate stream initialized?
+  brf_xml_t	*xml;			// XML to text state
+  bool		ret = false;		// Return value
+
+
+  (void)inputseekable;
+
+  if ((xml = calloc(1, sizeof(brf_xml_t))) == NULL)
+  {
+    close(inputfd);
+    close(outputfd);
+    return (1);
+  }
+
+  brfTraceBegin("officetotext", data->job_id);
+
+  xml->fd = outputfd;
+
+  memset(&stream, 0, sizeof(stream));
+
+  if (!member || !brf_zip_find(inputfd, member, &offset, &method, &comp_size))
+  {
+    if (data->logfunc)
+      data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "OfficeToText: No \"%s\" in document.", member ? member : "(null)");
+    goto finish;
+  }
+
+  if (method != 0 && method != Z_DEFLATED)
+  {
+    if (data->logfunc)
+      data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "OfficeToText: Unsupported compression method %u for \"%s\".", method, member);
+    goto finish;
+  }
+
+  if (data->logfunc)
+    data->logfunc(data->logdata, CF_LOGLEVEL_DEBUG, "OfficeToText: Reading \"%s\", %u bytes at offset %ld.", member, comp_size, (long)offset);
+
+  if (method == Z_DEFLATED)
+  {
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+      goto finish;
+
+    zinit = true;
+  }
+
+  while (comp_size > 0 && zerr != Z_STREAM_END)
+  {
+    if (data->iscanceledfunc && (data->iscanceledfunc)(data->iscanceleddata))
+    {
+      if (data->logfunc)
+        data->logfunc(data->logdata, CF_LOGLEVEL_DEBUG, "OfficeToText: Job canceled.");
+      goto finish;
+    }
+
+    if ((bytes = pread(inputfd, inbuf, comp_size < sizeof(inbuf) ? (size_t)comp_size : sizeof(inbuf), offset)) <= 0)
+    {
+      if (bytes < 0 && errno == EINTR)
+        continue;
+
+      if (data->logfunc)
+        data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "OfficeToText: Unable to read document: %s", bytes < 0 ? strerror(errno) : "Truncated file");
+      goto finish;
+    }
+
+    offset    += bytes;
+    comp_size -= (uint32_t)bytes;
+
+    if (method == 0)
+    {
+      if (!brf_xml_write(xml, inbuf, (size_t)bytes))
+        goto write_error;
+      continue;
+    }
+
+    stream.next_in  = inbuf;
+    stream.avail_in = (uInt)bytes;
+
+    do
+    {
+      stream.next_out  = outbuf;
+      stream.avail_out = sizeof(outbuf);
+
+      if ((zerr = inflate(&stream, Z_NO_FLUSH)) != Z_OK && zerr != Z_STREAM_END && zerr != Z_BUF_ERROR)
+      {
+        if (data->logfunc)
+          data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "OfficeToText: Unable to inflate \"%s\": %s", member, stream.msg ? stream.msg : "Unknown error");
+        goto finish;
+      }
+
+      if (!brf_xml_write(xml, outbuf, sizeof(outbuf) - stream.avail_out))
+        goto write_error;
+    }
+    while (stream.avail_out == 0 && zerr != Z_STREAM_END);
+  }
+
+  if (zinit && zerr != Z_STREAM_END)
+  {
+    if (data->logfunc)
+      data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "OfficeToText: Unable to inflate \"%s\": Truncated data", member);
+    goto finish;
+  }
+
+  if (!brf_xml_put(xml, "\n", 1) || !brf_xml_flush(xml))
+    goto write_error;
+
+  ret = true;
+  goto finish;
+
+  write_error:
+
+  if (data->logfunc)
+    data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "OfficeToText: Unable to write output: %s", strerror(errno));
+
+  finish:
+
+  if (zinit)
+    inflateEnd(&stream);
+
+  free(xml);
+
+  close(inputfd);
+  close(outputfd);
+
+  brfTraceEnd("officetotext", data->job_id);
+
+  return (ret ? 0 : 1);
+}
+
+
+//
+// 'brf_get16()' - Get a little-endian 16-bit integer.
+//
+
+static uint16_t				// O - Value
+brf_get16(const unsigned char *p)	// I - Pointer to data
+{
+  return ((uint16_t)(p[0] | (p[1] << 8)));
+}
+
+
+//
+// 'brf_get32()' - Get a little-endian 32-bit integer.
+//
+
+static uint32_t				// O - Value
+brf_get32(const unsigned char *p)	// I - Pointer to data
+{
+  return ((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+
+//
+// 'brf_xml_char()' - Add a character of character data.
+//
+// White space in the XML is only formatting, paragraph breaks come from the
+// paragraph elements.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_xml_char(brf_xml_t *xml,		// I - XML to text state
+             int       ch)		// I - Unicode character
+{
+  char	utf8[4];			// UTF-8 encoding
+
+
+  if (xml->skip > 0)
+    return (true);
+
+  if (ch < 0x80)
+  {
+    utf8[0] = (char)(isspace(ch) ? ' ' : ch);
+    return (brf_xml_put(xml, utf8, 1));
+  }
+  else if (ch < 0x800)
+  {
+    utf8[0] = (char)(0xc0 | (ch >> 6));
+    utf8[1] = (char)(0x80 | (ch & 0x3f));
+    return (brf_xml_put(xml, utf8, 2));
+  }
+  else if (ch < 0x10000)
+  {
+    utf8[0] = (char)(0xe0 | (ch >> 12));
+    utf8[1] = (char)(0x80 | ((ch >> 6) & 0x3f));
+    utf8[2] = (char)(0x80 | (ch & 0x3f));
+    return (brf_xml_put(xml, utf8, 3));
+  }
+  else
+  {
+    utf8[0] = (char)(0xf0 | (ch >> 18));
+    utf8[1] = (char)(0x80 | ((ch >> 12) & 0x3f));
+    utf8[2] = (char)(0x80 | ((ch >> 6) & 0x3f));
+    utf8[3] = (char)(0x80 | (ch & 0x3f));
+    return (brf_xml_put(xml, utf8, 4));
+  }
+}
+
+
+//
+// 'brf_xml_end_tag()' - Handle a complete tag.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_xml_end_tag(brf_xml_t *xml)		// I - XML to text state
+{
+  const char	*name = xml->name;	// Tag name
+  static const char * const skip[] =	// Elements without document text
+  {
+    "mc:Fallback",			// Copy of the mc:Choice content
+    "office:annotation",
+    "text:note-citation",
+    "w:delText",
+    "w:instrText"
+  };
+  int		i;			// Looping var
+
+
+  xml->name[xml->namelen] = '\0';
+
+  for (i = 0; i < (int)(sizeof(skip) / sizeof(skip[0])); i ++)
+  {
+    if (!strcmp(name, skip[i]))
+    {
+      if (xml->closing && xml->skip > 0)
+        xml->skip --;
+      else if (!xml->closing && !xml->empty)
+        xml->skip ++;
+
+      return (true);
+    }
+  }
+
+  if (xml->skip > 0)
+    return (true);
+
+  if ((xml->closing || xml->empty) && (!strcmp(name, "text:p") || !strcmp(name, "text:h") || !strcmp(name, "w:p")))
+    return (brf_xml_put(xml, "\n\n", 2));
+  else if (!xml->closing && (!strcmp(name, "text:line-break") || !strcmp(name, "w:br") || !strcmp(name, "w:cr")))
+    return (brf_xml_put(xml, "\n", 1));
+  else if (!xml->closing && (!strcmp(name, "text:tab") || !strcmp(name, "text:s") || !strcmp(name, "w:tab")))
+    return (brf_xml_put(xml, " ", 1));
+
+  return (true);
+}
+
+
+//
+// 'brf_xml_flush()' - Write buffered output.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_xml_flush(brf_xml_t *xml)		// I - XML to text state
+{
+  const char	*ptr = xml->buffer;	// Pointer into buffer
+  ssize_t	written;		// Bytes written
+
+
+  while (xml->used > 0)
+  {
+    if ((written = write(xml->fd, ptr, xml->used)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      return (false);
+    }
+
+    ptr       += written;
+    xml->used -= (size_t)written;
+  }
+
+  return (true);
+}
+
+
+//
+// 'brf_xml_put()' - Add text to the output buffer.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_xml_put(brf_xml_t  *xml,		// I - XML to text state
+            const char *s,		// I - Text
+            size_t     bytes)		// I - Number of bytes
+{
+  size_t	count;			// Bytes to copy
+
+
+  while (bytes > 0)
+  {
+    if (xml->used == sizeof(xml->buffer) && !brf_xml_flush(xml))
+      return (false);
+
+    if ((count = sizeof(xml->buffer) - xml->used) > bytes)
+      count = bytes;
+
+    memcpy(xml->buffer + xml->used, s, count);
+    xml->used += count;
+    s         += count;
+    bytes     -= count;
+  }
+
+  return (true);
+}
+
+
+//
+// 'brf_xml_write()' - Convert XML to text.
+//
+// This is not a validating parser: it only tracks tags, attribute quoting
+// and entity references, which is all office documents need.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_xml_write(brf_xml_t           *xml,	// I - XML to text state
+              const unsigned char *data,// I - XML data
+              size_t              bytes)// I - Number of bytes
+{
+  const unsigned char	*end = data + bytes;
+					// End of data
+  const unsigned char	*start;		// Start of run of text
+
+
+  while (data < end)
+  {
+    switch (xml->state)
+    {
+      case BRF_XML_TEXT :
+          for (start = data; data < end && *data != '<' && *data != '&' && !isspace(*data); data ++);
+
+          if (data > start && xml->skip == 0 && !brf_xml_put(xml, (const char *)start, (size_t)(data - start)))
+            return (false);
+
+          if (data >= end)
+            break;
+
+          if (*data == '<')
+          {
+            xml->state   = BRF_XML_TAG;
+            xml->namelen = 0;
+            xml->in_name = true;
+            xml->closing = false;
+            xml->empty   = false;
+          }
+          else if (*data == '&')
+          {
+            xml->state     = BRF_XML_ENTITY;
+            xml->entitylen = 0;
+          }
+          else if (!brf_xml_char(xml, *data))
+            return (false);
+
+          data ++;
+          break;
+
+      case BRF_XML_TAG :
+          if (*data == '>')
+          {
+            xml->state = BRF_XML_TEXT;
+
+            if (!brf_xml_end_tag(xml))
+              return (false);
+          }
+          else if (*data == '\"' || *data == '\'')
+          {
+            xml->state = BRF_XML_QUOTE;
+            xml->quote = (char)*data;
+          }
+          else if (*data == '/')
+          {
+            if (xml->namelen == 0)
+            {
+              xml->closing = true;
+            }
+            else
+            {
+              xml->empty   = true;
+              xml->in_name = false;
+            }
+          }
+          else if (isspace(*data))
+          {
+            if (xml->namelen > 0)
+              xml->in_name = false;
+          }
+          else if (xml->in_name && xml->namelen < sizeof(xml->name) - 1)
+          {
+            xml->name[xml->namelen ++] = (char)*data;
+          }
+
+          data ++;
+          break;
+
+      case BRF_XML_QUOTE :
+          if (*data == (unsigned char)xml->quote)
+            xml->state = BRF_XML_TAG;
+
+          data ++;
+          break;
+
+      case BRF_XML_ENTITY :
+          if (*data == ';')
+          {
+            int ch = 0;			// Character
+
+            xml->entity[xml->entitylen] = '\0';
+            xml->state                  = BRF_XML_TEXT;
+
+            if (xml->entity[0] == '#')
+              ch = xml->entity[1] == 'x' ? (int)strtol(xml->entity + 2, NULL, 16) : atoi(xml->entity + 1);
+            else if (!strcmp(xml->entity, "amp"))
+              ch = '&';
+            else if (!strcmp(xml->entity, "lt"))
+              ch = '<';
+            else if (!strcmp(xml->entity, "gt"))
+              ch = '>';
+            else if (!strcmp(xml->entity, "quot"))
+              ch = '\"';
+            else if (!strcmp(xml->entity, "apos"))
+              ch = '\'';
+
+            if (ch > 0 && ch < 0x110000 && !brf_xml_char(xml, ch))
+              return (false);
+          }
+          else if (xml->entitylen < sizeof(xml->entity) - 1)
+          {
+            xml->entity[xml->entitylen ++] = (char)*data;
+          }
+
+          data ++;
+          break;
+    }
+  }
+
+  return (true);
+}
+
+
+//
+// 'brf_zip_find()' - Find an archive member using the central directory.
+//
+// Only the end of central directory record, the central directory and the
+// local header of the member are read.  ZIP64 archives and encrypted members
+// are not supported.
+//
+
+static bool				// O - `true` if found, `false` otherwise
+brf_zip_find(int         fd,		// I - ZIP file
+             const char  *member,	// I - Member name
+             off_t       *offset,	// O - Offset of member data
+             uint16_t    *method,	// O - Compression method
+             uint32_t    *comp_size)	// O - Compressed size
+{
+  struct stat	fileinfo;		// File information
+  unsigned char	tail[65557],		// End of file
+		*ptr,			// Pointer into data
+		*cdir = NULL,		// Central directory
+		local[30];		// Local file header
+  size_t	taillen,		// Length of end of file
+		namelen = strlen(member);
+					// Length of member name
+  uint32_t	cdir_size,		// Size of central directory
+		cdir_offset,		// Offset of central directory
+		local_offset = 0;	// Offset of local header
+  bool		found = false;		// Member found?
+
+
+  if (fstat(fd, &fileinfo) || fileinfo.st_size < 22)
+    return (false);
+
+  // The end of central directory record is followed by a comment of up to
+  // 64k...
+  taillen = fileinfo.st_size < (off_t)sizeof(tail) ? (size_t)fileinfo.st_size : sizeof(tail);
+
+  if (pread(fd, tail, taillen, fileinfo.st_size - (off_t)taillen) != (ssize_t)taillen)
+    return (false);
+
+  for (ptr = tail + taillen - 22; ptr >= tail; ptr --)
+  {
+    if (brf_get32(ptr) == BRF_ZIP_EOCD_SIG)
+      break;
+  }
+
+  if (ptr < tail)
+    return (false);
+
+  // ZIP64 archives have a locator in front of the record and the sizes and
+  // offsets in it set to all ones...
+  if ((ptr - tail) >= 20 && brf_get32(ptr - 20) == BRF_ZIP64_LOCATOR_SIG)
+    return (false);
+
+  cdir_size   = brf_get32(ptr + 12);
+  cdir_offset = brf_get32(ptr + 16);
+
+  if (cdir_size == 0xffffffff || cdir_offset == 0xffffffff)
+    return (false);
+
+  if (cdir_size > BRF_ZIP_MAX_CDIR || (off_t)cdir_offset + (off_t)cdir_size > fileinfo.st_size)
+    return (false);
+
+  if ((cdir = malloc(cdir_size)) == NULL)
+    return (false);
+
+  if (pread(fd, cdir, cdir_size, (off_t)cdir_offset) != (ssize_t)cdir_size)
+  {
+    free(cdir);
+    return (false);
+  }
+
+  for (ptr = cdir; ptr + 46 <= cdir + cdir_size && brf_get32(ptr) == BRF_ZIP_CDIR_SIG;)
+  {
+    uint16_t	n = brf_get16(ptr + 28),// Name length
+		e = brf_get16(ptr + 30),// Extra field length
+		c = brf_get16(ptr + 32);// Comment length
+
+    if (ptr + 46 + n > cdir + cdir_size)
+      break;
+
+    if (n == namelen && !memcmp(ptr + 46, member, namelen))
+    {
+      *method      = brf_get16(ptr + 10);
+      *comp_size   = brf_get32(ptr + 20);
+      local_offset = brf_get32(ptr + 42);
+      found        = *comp_size != 0xffffffff && brf_get32(ptr + 24) != 0xffffffff && local_offset != 0xffffffff && !(brf_get16(ptr + 8) & BRF_ZIP_ENCRYPTED);
+      break;
+    }
+
+    ptr += 46 + n + e + c;
+  }
+
+  free(cdir);
+
+  if (!found)
+    return (false);
+
+  // The data follows the local header, which has its own extra field...
+  if (pread(fd, local, sizeof(local), (off_t)local_offset) != (ssize_t)sizeof(local) || brf_get32(local) != BRF_ZIP_LOCAL_SIG || (brf_get16(local + 6) & BRF_ZIP_ENCRYPTED))
+    return (false);
+
+  *offset = (off_t)local_offset + 30 + brf_get16(local + 26) + brf_get16(local + 28);
+
+  return (*offset + (off_t)*comp_size <= fileinfo.st_size);
+}
@@ -0,0 +1,543 @@
+//
+// BRF page offset index for the Braille Printer Application
+//
+// Copyright © 2022 Chandresh Soni
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Pages in a BRF document are separated by form feeds, so finding page N
+// means scanning everything before it.  The page index records the start
+// offset of every page while a document is written (or the first time it is
+// read), and is kept next to the document as a ".pgx" sidecar file:
+//
+//   "BRFPGX\0\2"      Magic and format version
+//   uint64            Length of the document in bytes
+//   uint64            Inode number of the document
+//   uint64            Modification time of the document
+//   uint32            Number of page offsets
+//   uint64 * count    Page start offsets
+//
+// All numbers are big-endian.  The sidecar is only used when the recorded
+// length, inode, and modification time match the document, so a document
+// that was replaced by another one of the same size is scanned again.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+#include <dirent.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+
+//
+// Local types...
+//
+
+struct brf_pgindex_s			// Page offset index
+{
+  size_t	num_offsets,		// Number of page start offsets
+		alloc_offsets;		// Allocated page start offsets
+  off_t		*offsets;		// Page start offsets
+  off_t		length;			// Number of bytes scanned
+};
+
+
+//
+// Local globals...
+//
+
+static const unsigned char brf_pgx_magic[8] = { 'B', 'R', 'F', 'P', 'G', 'X', 0, 2 };
+					// Sidecar file magic
+
+
+//
+// Local functions...
+//
+
+static bool	brf_pgindex_add(brf_pgindex_t *idx, off_t offset);
+static void	brf_pgx_get(const unsigned char *buffer, int bytes, uint64_t *value);
+static void	brf_pgx_put(unsigned char *buffer, int bytes, uint64_t value);
+
+
+//
+// 'brfPageIndexCleanup()' - Remove sidecar files of deleted documents.
+//
+
+void
+brfPageIndexCleanup(const char *directory)// I - Directory to clean
+{
+  DIR		*dir;			// Directory
+  struct dirent	*dent;			// Directory entry
+  char		filename[1024],		// Sidecar filename
+		docname[1024],		// Document filename
+		*ext;			// Extension in filename
+  struct stat	info;			// Document information
+
+
+  if ((dir = opendir(directory)) == NULL)
+    return;
+
+  while ((dent = readdir(dir)) != NULL)
+  {
+    if ((ext = strrchr(dent->d_name, '.')) == NULL || strcmp(ext, BRF_PGX_EXT))
+      continue;
+
+    snprintf(filename, sizeof(filename), "%s/%s", directory, dent->d_name);
+    snprintf(docname, sizeof(docname), "%s/%.*s", directory, (int)(ext - dent->d_name), dent->d_name);
+
+    if (stat(docname, &info) && errno == ENOENT)
+      unlink(filename);
+  }
+
+  closedir(dir);
+}
+
+
+//
+// 'brfPageIndexCreate()' - Create an empty page index.
+//
+
+brf_pgindex_t *				// O - Page index or `NULL` on error
+brfPageIndexCreate(void)
+{
+  brf_pgindex_t	*idx;			// Page index
+
+
+  if ((idx = (brf_pgindex_t *)calloc(1, sizeof(brf_pgindex_t))) == NULL)
+    return (NULL);
+
+  // The first page starts at the beginning of the document...
+  if (!brf_pgindex_add(idx, 0))
+  {
+    free(idx);
+    return (NULL);
+  }
+
+  return (idx);
+}
+
+
+//
+// 'brfPageIndexDelete()' - Free a page index.
+//
+
+void
+brfPageIndexDelete(brf_pgindex_t *idx)	// I - Page index
+{
+  if (idx)
+  {
+    free(idx->offsets);
+    free(idx);
+  }
+}
+
+
+//
+// 'brfPageIndexGetCount()' - Get the number of pages in a page index.
+//
+
+int					// O - Number of pages
+brfPageIndexGetCount(brf_pgindex_t *idx)// I - Page index
+{
+  size_t	count;			// Number of pages
+
+
+  if (!idx)
+    return (0);
+
+  // A form feed at the very end doesn't start another page...
+  for (count = idx->num_offsets; count > 0 && idx->offsets[count - 1] >= idx->length; count --);
+
+  return ((int)count);
+}
+
+
+//
+// 'brfPageIndexGetPagesBefore()' - Get the number of complete pages before an
+//                                  offset.
+//
+// A page is complete when its form feed is before the offset.
+//
+
+int					// O - Number of complete pages
+brfPageIndexGetPagesBefore(
+    brf_pgindex_t *idx,			// I - Page index
+    off_t         offset)		// I - Offset in document
+{
+  size_t	left,			// Left side of search
+		right,			// Right side of search
+		middle;			// Middle of search
+
+
+  if (!idx)
+    return (0);
+
+  // offsets[i] is the end of page i, find the last one at or before offset...
+  left  = 1;
+  right = idx->num_offsets;
+
+  while (left < right)
+  {
+    middle = (left + right) / 2;
+
+    if (idx->offsets[middle] <= offset)
+      left = middle + 1;
+    else
+      right = middle;
+  }
+
+  return ((int)left - 1);
+}
+
+
+//
+// 'brfPageIndexGetRange()' - Get the byte range of a range of pages.
+//
+// The range includes the form feed that ends the last page, if any.
+//
+
+bool					// O - `true` on success, `false` if out of range
+brfPageIndexGetRange(
+    brf_pgindex_t *idx,			// I - Page index
+    int           first,		// I - First page (1-based)
+    int           last,			// I - Last page (1-based)
+    off_t         *start,		// O - Start offset
+    off_t         *end)			// O - End offset (exclusive)
+{
+  int	count = brfPageIndexGetCount(idx);
+					// Number of pages
+
+
+  if (first < 1)
+    first = 1;
+  if (last > count)
+    last = count;
+
+  if (first > last)
+    return (false);
+
+  *start = idx->offsets[first - 1];
+  *end   = (size_t)last < idx->num_offsets ? idx->offsets[last] : idx->length;
+
+  return (true);
+}
+
+
+//
+// 'brfPageIndexGetJobRange()' - Get the byte range of a job's "page-ranges".
+//
+// When all pages are wanted no index is needed and the range is the whole
+// file, with "end" set to -1.
+//
+
+bool					// O - `true` on success, `false` on error
+brfPageIndexGetJobRange(
+    pappl_job_t        *job,		// I - Job
+    pappl_pr_options_t *options,	// I - Job options
+    off_t              *start,		// O - Start offset
+    off_t              *end)		// O - End offset (exclusive) or -1 for end of file
+{
+  brf_pgindex_t	*idx;			// Page index
+  int		first,			// First page
+		last,			// Last page
+		count;			// Number of pages
+  bool		ret;			// Return value
+
+
+  *start = 0;
+  *end   = -1;
+
+  first = options->first_page > 1 ? options->first_page : 1;
+  last  = options->last_page > 0 ? options->last_page : INT_MAX;
+
+  if (first == 1 && last == INT_MAX)
+    return (true);
+
+  if ((idx = brfPageIndexLoad(papplJobGetFilename(job), true)) == NULL)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to index pages of print file '%s': %s", papplJobGetFilename(job), strerror(errno));
+    return (false);
+  }
+
+  count = brfPageIndexGetCount(idx);
+  if (last > count)
+    last = count;
+
+  if ((ret = brfPageIndexGetRange(idx, first, last, start, end)) == true)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Printing pages %d to %d of %d, bytes %ld to %ld.", first, last, count, (long)*start, (long)*end);
+    papplJobSetImpressions(job, last - first + 1);
+  }
+  else
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "No pages to print in page-ranges, the document has %d pages.", count);
+
+  brfPageIndexDelete(idx);
+
+  return (ret);
+}
+
+
+//
+// 'brfPageIndexLoad()' - Load the page index of a document.
+//
+// The sidecar file is used when it is current.  Otherwise the document is
+// scanned and, when "save" is `true`, a new sidecar file is written for the
+// next time.
+//
+
+brf_pgindex_t *				// O - Page index or `NULL` on error
+brfPageIndexLoad(const char *filename,	// I - Document filename
+                 bool       save)	// I - Save a new sidecar file?
+{
+  brf_pgindex_t	*idx = NULL;		// Page index
+  char		pgxname[1024];		// Sidecar filename
+  int		fd;			// File descriptor
+  struct stat	info;			// Document information
+  unsigned char	header[36],		// Sidecar header
+		buffer[65536];		// Read buffer
+  uint64_t	length,			// Document length
+		inode,			// Document inode
+		mtime,			// Document modification time
+		count,			// Number of offsets
+		offset;			// Current offset
+  ssize_t	bytes;			// Bytes read
+  size_t	i;			// Looping var
+
+
+  if (stat(filename, &info))
+    return (NULL);
+
+  snprintf(pgxname, sizeof(pgxname), "%s" BRF_PGX_EXT, filename);
+
+  // Try the sidecar file first...
+  if ((fd = open(pgxname, O_RDONLY)) >= 0)
+  {
+    if (read(fd, header, sizeof(header)) == (ssize_t)sizeof(header) && !memcmp(header, brf_pgx_magic, sizeof(brf_pgx_magic)))
+    {
+      brf_pgx_get(header + 8, 8, &length);
+      brf_pgx_get(header + 16, 8, &inode);
+      brf_pgx_get(header + 24, 8, &mtime);
+      brf_pgx_get(header + 32, 4, &count);
+
+      if ((off_t)length == info.st_size && inode == (uint64_t)info.st_ino && mtime == (uint64_t)info.st_mtime && count > 0 && (idx = (brf_pgindex_t *)calloc(1, sizeof(brf_pgindex_t))) != NULL)
+      {
+        idx->length = (off_t)length;
+
+        if ((idx->offsets = (off_t *)calloc((size_t)count, sizeof(off_t))) != NULL)
+        {
+          idx->alloc_offsets = (size_t)count;
+
+          while (idx->num_offsets < (size_t)count && (bytes = read(fd, buffer, sizeof(buffer) - sizeof(buffer) % 8)) >= 8)
+          {
+            for (i = 0; i + 8 <= (size_t)bytes && idx->num_offsets < (size_t)count; i += 8)
+            {
+              brf_pgx_get(buffer + i, 8, &offset);
+              idx->offsets[idx->num_offsets ++] = (off_t)offset;
+            }
+          }
+        }
+
+        if (idx->num_offsets != (size_t)count)
+        {
+          brfPageIndexDelete(idx);
+          idx = NULL;
+        }
+      }
+    }
+
+    close(fd);
+
+    if (idx)
+      return (idx);
+  }
+
+  // Otherwise scan the document...
+  if ((fd = open(filename, O_RDONLY)) < 0)
+    return (NULL);
+
+  if ((idx = brfPageIndexCreate()) != NULL)
+  {
+    while ((bytes = read(fd, buffer, sizeof(buffer))) > 0)
+    {
+      if (!brfPageIndexScan(idx, buffer, (size_t)bytes))
+        break;
+    }
+
+    if (bytes != 0)
+    {
+      brfPageIndexDelete(idx);
+      idx = NULL;
+    }
+  }
+
+  close(fd);
+
+  if (idx && save)
+    brfPageIndexSave(idx, filename);
+
+  return (idx);
+}
+
+
+//
+// 'brfPageIndexSave()' - Save the sidecar file of a document.
+//
+
+bool					// O - `true` on success, `false` on error
+brfPageIndexSave(brf_pgindex_t *idx,	// I - Page index
+                 const char    *filename)
+					// I - Document filename
+{
+  char		pgxname[1024],		// Sidecar filename
+		tempname[1024];		// Temporary filename
+  int		fd;			// File descriptor
+  struct stat	info;			// Document information
+  unsigned char	buffer[8192];		// Write buffer
+  size_t	i,			// Looping var
+		used;			// Bytes used in buffer
+  bool		ret = true;		// Return value
+
+
+  // The document must be complete, the sidecar records its current state...
+  if (!idx || !filename || stat(filename, &info))
+    return (false);
+
+  snprintf(pgxname, sizeof(pgxname), "%s" BRF_PGX_EXT, filename);
+  snprintf(tempname, sizeof(tempname), "%s.tmp", pgxname);
+
+  if ((fd = open(tempname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0)
+    return (false);
+
+  memcpy(buffer, brf_pgx_magic, sizeof(brf_pgx_magic));
+  brf_pgx_put(buffer + 8, 8, (uint64_t)idx->length);
+  brf_pgx_put(buffer + 16, 8, (uint64_t)info.st_ino);
+  brf_pgx_put(buffer + 24, 8, (uint64_t)info.st_mtime);
+  brf_pgx_put(buffer + 32, 4, (uint64_t)idx->num_offsets);
+  used = 36;
+
+  for (i = 0; ret && i <= idx->num_offsets; i ++)
+  {
+    if (i == idx->num_offsets || used > (sizeof(buffer) - 8))
+    {
+      if (write(fd, buffer, used) != (ssize_t)used)
+        ret = false;
+
+      used = 0;
+    }
+
+    if (i < idx->num_offsets)
+    {
+      brf_pgx_put(buffer + used, 8, (uint64_t)idx->offsets[i]);
+      used += 8;
+    }
+  }
+
+  if (close(fd))
+    ret = false;
+
+  // Replace the old sidecar atomically...
+  if (!ret || rename(tempname, pgxname))
+  {
+    unlink(tempname);
+    return (false);
+  }
+
+  return (true);
+}
+
+
+//
+// 'brfPageIndexScan()' - Add document data to a page index.
+//
+// Call this with the data as it is written to record the page offsets
+// without another pass over the document.
+//
+
+bool					// O - `true` on success, `false` on error
+brfPageIndexScan(brf_pgindex_t *idx,	// I - Page index
+                 const void    *buffer,	// I - Document data
+                 size_t        bytes)	// I - Number of bytes
+{
+  const char	*start = (const char *)buffer,
+					// Start of data
+		*ptr = start,		// Pointer into data
+		*end = start + bytes;	// End of data
+
+
+  if (!idx)
+    return (false);
+
+  while (ptr < end && (ptr = memchr(ptr, '\f', (size_t)(end - ptr))) != NULL)
+  {
+    ptr ++;
+
+    if (!brf_pgindex_add(idx, idx->length + (ptr - start)))
+      return (false);
+  }
+
+  idx->length += (off_t)bytes;
+
+  return (true);
+}
+
+
+//
+// 'brf_pgindex_add()' - Add a page start offset.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_pgindex_add(brf_pgindex_t *idx,	// I - Page index
+                off_t         offset)	// I - Page start offset
+{
+  off_t		*temp;			// New offsets
+  size_t	alloc;			// New allocation
+
+
+  if (idx->num_offsets >= idx->alloc_offsets)
+  {
+    alloc = idx->alloc_offsets ? 2 * idx->alloc_offsets : 64;
+
+    if ((temp = (off_t *)realloc(idx->offsets, alloc * sizeof(off_t))) == NULL)
+      return (false);
+
+    idx->offsets       = temp;
+    idx->alloc_offsets = alloc;
+  }
+
+  idx->offsets[idx->num_offsets ++] = offset;
+
+  return (true);
+}
+
+
+//
+// 'brf_pgx_get()' - Get a big-endian number.
+//
+
+static void
+brf_pgx_get(const unsigned char *buffer,// I - Buffer
+            int                 bytes,	// I - Number of bytes
+            uint64_t            *value)	// O - Value
+{
+  for (*value = 0; bytes > 0; bytes --, buffer ++)
+    *value = (*value << 8) | *buffer;
+}
+
+
+//
+// 'brf_pgx_put()' - Put a big-endian number.
+//
+
+static void
+brf_pgx_put(unsigned char *buffer,	// I - Buffer
+            int           bytes,	// I - Number of bytes
+            uint64_t      value)	// I - Value
+{
+  for (buffer += bytes - 1; bytes > 0; bytes --, buffer --, value >>= 8)
+    *buffer = (unsigned char)value;
+}
@@ -0,0 +1,406 @@
+//
+// PDF text extraction for the Braille Printer Application
+//
+// Copyright © 2022 Chandresh Soni
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// This replaces "pdftotext -raw" in front of the translation: a few worker
+// threads extract the text of the pages with poppler, each with its own
+// document object since poppler documents can't be shared between threads.
+// Pages are written in page order as soon as they and all pages before them
+// are done, so translation of the first pages starts while later pages are
+// still being extracted.  Like pdftotext, every page ends with a form feed.
+//
+// The text differs from "pdftotext -raw": poppler-glib only offers the text
+// of a page in reading order, so columns and tables come out the way
+// "pdftotext" without options reads them, not in content stream order.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+#include <poppler.h>
+#include <sys/mman.h>
+
+
+//
+// Local types...
+//
+
+typedef struct brf_pdftext_s		// PDF text extraction state
+{
+  cf_filter_data_t	*data;		// Job and printer data
+  GBytes		*bytes;		// PDF file data
+  pthread_mutex_t	mutex;		// Mutex for pages
+  pthread_cond_t	cond;		// Condition for page changes
+  int			num_pages,	// Number of pages
+			next_page,	// Next page for a worker
+			written,	// Number of pages written
+			window;		// Maximum pages ahead of output
+  char			**pages;	// Page text, `NULL` while extracting
+  bool			*done;		// Page extracted?
+  bool			canceled;	// Stop extracting?
+} brf_pdftext_t;
+
+
+//
+// Local functions...
+//
+
+static void	*brf_pdftext_worker(brf_pdftext_t *pt);
+static bool	brf_pdftext_write(int fd, const char *s, size_t bytes);
+
+
+//
+// 'brfPDFToTextFilter()' - Filter function that extracts the text of a PDF.
+//
+
+int					// O - Exit status
+brfPDFToTextFilter(
+    int              inputfd,		// I - File descriptor input stream
+    int              outputfd,		// I - File descriptor output stream
+    int              inputseekable,	// I - Is input stream seekable? (unused)
+    cf_filter_data_t *data,		// I - Job and printer data
+    void             *parameters)	// I - Parameters (unused)
+{
+  brf_pdftext_t		pt;		// Extraction state
+  PopplerDocument	*doc = NULL;	// PDF document
+  GError		*error = NULL;	// Error from poppler
+  pthread_t		workers[BRF_PDFTEXT_MAX_WORKERS];
+					// Worker threads
+  int			i,		// Looping var
+			num_workers = 0,// Number of worker threads
+			err;		// Thread creation error
+  struct stat		fileinfo;	// Input file information
+  void			*map = NULL;	// Mapped input file
+  char			*buffer = NULL;	// Input data when not a file
+  size_t		length = 0,	// Length of input data
+			size = 0,	// Allocated size of input data
+			textlen;	// Length of page text
+  ssize_t		bytes;		// Bytes read
+  char			*text;		// Page text
+  bool			ret = false;	// Return value
+
+
+  (void)inputseekable;
+
+  brfTraceBegin("pdftotext", data->job_id);
+  (void)parameters;
+
+  memset(&pt, 0, sizeof(pt));
+  pt.data = data;
+  pthread_mutex_init(&pt.mutex, NULL);
+  pthread_cond_init(&pt.cond, NULL);
+
+  // Map the spool file, or read the PDF when it comes from a pipe...
+  if (!fstat(inputfd, &fileinfo) && S_ISREG(fileinfo.st_mode) && fileinfo.st_size > 0 && (map = mmap(NULL, (size_t)fileinfo.st_size, PROT_READ, MAP_PRIVATE, inputfd, 0)) != MAP_FAILED)
+  {
+    length = (size_t)fileinfo.st_size;
+    pt.bytes = g_bytes_new_static(map, length);
+  }
+  else
+  {
+    map = NULL;
+
+    for (;;)
+    {
+      if (length == size)
+      {
+        char *temp;			// New buffer
+
+        if ((temp = realloc(buffer, size + 1048576)) == NULL)
+        {
+	  if (data->logfunc)
+	    data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "PDFToText: Unable to allocate memory for document.");
+	  goto finish;
+        }
+
+        buffer = temp;
+        size   += 1048576;
+      }
+
+      if ((bytes = read(inputfd, buffer + length, size - length)) == 0)
+        break;
+      else if (bytes < 0)
+      {
+        if (errno == EINTR || errno == EAGAIN)
+	  continue;
+
+	if (data->logfunc)
+	  data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "PDFToText: Unable to read document: %s", strerror(errno));
+	goto finish;
+      }
+
+      length += (size_t)bytes;
+    }
+
+    pt.bytes = g_bytes_new_static(buffer, length);
+  }
+
+  if ((doc = poppler_document_new_from_bytes(pt.bytes, NULL, &error)) == NULL)
+  {
+    if (data->logfunc)
+      data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "PDFToText: Unable to open document: %s", error ? error->message : "Unknown error");
+    if (error)
+      g_error_free(error);
+    goto finish;
+  }
+
+  pt.num_pages = poppler_document_get_n_pages(doc);
+  g_object_unref(doc);
+
+  if (pt.num_pages <= 0)
+  {
+    ret = true;
+    goto finish;
+  }
+
+  if ((pt.pages = calloc((size_t)pt.num_pages, sizeof(char *))) == NULL || (pt.done = calloc((size_t)pt.num_pages, sizeof(bool))) == NULL)
+  {
+    if (data->logfunc)
+      data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "PDFToText: Unable to allocate memory for %d pages.", pt.num_pages);
+    goto finish;
+  }
+
+  num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (num_workers > BRF_PDFTEXT_MAX_WORKERS)
+    num_workers = BRF_PDFTEXT_MAX_WORKERS;
+  if (num_workers > pt.num_pages)
+    num_workers = pt.num_pages;
+  if (num_workers < 1)
+    num_workers = 1;
+
+  // Don't let the workers get too far ahead of the output...
+  pt.window = 4 * num_workers;
+
+  if (data->logfunc)
+    data->logfunc(data->logdata, CF_LOGLEVEL_DEBUG, "PDFToText: %d pages, %d workers.", pt.num_pages, num_workers);
+
+  for (i = 0; i < num_workers; i ++)
+  {
+    if ((err = pthread_create(workers + i, NULL, (void *(*)(void *))brf_pdftext_worker, &pt)) != 0)
+    {
+      if (data->logfunc)
+	data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "PDFToText: Unable to create worker thread: %s", strerror(err));
+      break;
+    }
+  }
+
+  if ((num_workers = i) == 0)
+    goto finish;
+
+  // Write the pages in order...
+  while (pt.written < pt.num_pages)
+  {
+    if (data->iscanceledfunc && (data->iscanceledfunc)(data->iscanceleddata))
+    {
+      if (data->logfunc)
+        data->logfunc(data->logdata, CF_LOGLEVEL_DEBUG, "PDFToText: Job canceled after %d pages.", pt.written);
+      goto finish;
+    }
+
+    pthread_mutex_lock(&pt.mutex);
+    while (!pt.done[pt.written] && !pt.canceled)
+      pthread_cond_wait(&pt.cond, &pt.mutex);
+    if (pt.canceled)
+    {
+      pthread_mutex_unlock(&pt.mutex);
+      goto finish;
+    }
+    text = pt.pages[pt.written];
+    pt.pages[pt.written] = NULL;
+    pthread_mutex_unlock(&pt.mutex);
+
+    textlen = text ? strlen(text) : 0;
+
+    if ((textlen > 0 && !brf_pdftext_write(outputfd, text, textlen)) || (textlen > 0 && text[textlen - 1] != '\n' && !brf_pdftext_write(outputfd, "\n", 1)) || !brf_pdftext_write(outputfd, "\f", 1))
+    {
+      if (data->logfunc)
+        data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "PDFToText: Unable to write output: %s", strerror(errno));
+      g_free(text);
+      goto finish;
+    }
+
+    g_free(text);
+
+    pthread_mutex_lock(&pt.mutex);
+    pt.written ++;
+    pthread_cond_broadcast(&pt.cond);
+    pthread_mutex_unlock(&pt.mutex);
+  }
+
+  ret = true;
+
+  finish:
+
+  // Stop the workers and clean up...
+  pthread_mutex_lock(&pt.mutex);
+  pt.canceled = true;
+  pthread_cond_broadcast(&pt.cond);
+  pthread_mutex_unlock(&pt.mutex);
+
+  for (i = 0; i < num_workers; i ++)
+    pthread_join(workers[i], NULL);
+
+  if (pt.pages)
+  {
+    for (i = 0; i < pt.num_pages; i ++)
+      g_free(pt.pages[i]);
+
+    free(pt.pages);
+  }
+
+  free(pt.done);
+
+  if (pt.bytes)
+    g_bytes_unref(pt.bytes);
+  if (map)
+    munmap(map, length);
+  free(buffer);
+
+  pthread_cond_destroy(&pt.cond);
+  pthread_mutex_destroy(&pt.mutex);
+
+  close(inputfd);
+  close(outputfd);
+
+  brfTraceEnd("pdftotext", data->job_id);
+
+  return (ret ? 0 : 1);
+}
+
+
+//
+// 'brf_pdftext_worker()' - Extract the text of pages.
+//
+
+static void *				// O - Thread exit status (unused)
+brf_pdftext_worker(brf_pdftext_t *pt)	// I - Extraction state
+{
+  PopplerDocument	*doc;		// This worker's copy of the document
+  PopplerPage		*page;		// Current page
+  int			pagenum;	// Current page number
+  char			*text;		// Page text
+  int			token;		// CPU token
+  GError		*error = NULL;	// Error from poppler
+
+
+  if ((doc = poppler_document_new_from_bytes(pt->bytes, NULL, &error)) == NULL)
+  {
+    // Fail the document rather than skipping the pages of this worker...
+    if (pt->data->logfunc)
+      pt->data->logfunc(pt->data->logdata, CF_LOGLEVEL_ERROR, "PDFToText: Unable to open document: %s", error ? error->message : "Unknown error");
+    if (error)
+      g_error_free(error);
+
+    pthread_mutex_lock(&pt->mutex);
+    pt->canceled = true;
+    pthread_cond_broadcast(&pt->cond);
+    pthread_mutex_unlock(&pt->mutex);
+
+    return (NULL);
+  }
+
+  pthread_mutex_lock(&pt->mutex);
+
+  for (;;)
+  {
+    while (!pt->canceled && pt->next_page < pt->num_pages && pt->next_page >= pt->written + pt->window)
+      pthread_cond_wait(&pt->cond, &pt->mutex);
+
+    if (pt->canceled || pt->next_page >= pt->num_pages)
+      break;
+
+    if (pt->data->iscanceledfunc && (pt->data->iscanceledfunc)(pt->data->iscanceleddata))
+    {
+      // Stop the other workers and the writer...
+      pt->canceled = true;
+      pthread_cond_broadcast(&pt->cond);
+      break;
+    }
+
+    pagenum = pt->next_page ++;
+
+    pthread_mutex_unlock(&pt->mutex);
+
+    text = NULL;
+
+    if (!brfCPUAcquire(pt->data, &token))
+    {
+      pthread_mutex_lock(&pt->mutex);
+      pt->canceled = true;
+      pthread_cond_broadcast(&pt->cond);
+      break;
+    }
+
+    brfTraceBegin("pdftotext-page", pt->data->job_id);
+
+    if ((page = poppler_document_get_page(doc, pagenum)) != NULL)
+    {
+      text = poppler_page_get_text(page);
+      g_object_unref(page);
+    }
+
+    brfTraceEnd("pdftotext-page", pt->data->job_id);
+
+    brfCPURelease(token);
+
+    pthread_mutex_lock(&pt->mutex);
+
+    if (!page)
+    {
+      if (pt->data->logfunc)
+        pt->data->logfunc(pt->data->logdata, CF_LOGLEVEL_ERROR, "PDFToText: Unable to load page %d.", pagenum + 1);
+
+      pt->canceled = true;
+      pthread_cond_broadcast(&pt->cond);
+      break;
+    }
+    else if (!text && pt->data->logfunc)
+      pt->data->logfunc(pt->data->logdata, CF_LOGLEVEL_WARN, "PDFToText: No text on page %d.", pagenum + 1);
+
+    pt->pages[pagenum] = text;
+    pt->done[pagenum]  = true;
+    pthread_cond_broadcast(&pt->cond);
+  }
+
+  pthread_mutex_unlock(&pt->mutex);
+
+  g_object_unref(doc);
+
+  return (NULL);
+}
+
+
+//
+// 'brf_pdftext_write()' - Write text to the output.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_pdftext_write(int        fd,	// I - Output file descriptor
+                  const char *s,	// I - Text
+                  size_t     bytes)	// I - Number of bytes
+{
+  ssize_t	written;		// Bytes written
+
+
+  while (bytes > 0)
+  {
+    if ((written = write(fd, s, bytes)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      return (false);
+    }
+
+    s     += written;
+    bytes -= (size_t)written;
+  }
+
+  return (true);
+}
@@ -2,11 +2,16 @@
 
 //
 // Include necessary headers...
+#include "brf-printer-app.h"
 #include <strings.h>
-#include <cupsfilters/log.h>
-#include <cupsfilters/filter.h>
 #include <limits.h>
-#include <pappl/pappl.h>
+#include <stddef.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 
 
 
@@ -15,34 +20,152 @@
 #  define brf_TESTPAGE_MIMETYPE	"application/vnd.cups-paged-brf"
 
 
-extern bool	brf_gen(pappl_system_t *system, const char *driver_name, const char *device_uri, const char *device_id, pappl_pr_driver_data_t *data, ipp_t **attrs, void *cbdata);
 extern char* strdup(const char*);
+//
+// Local types...
+//
+
+typedef struct brf_chain_run_s		// Filter chain on its own threads
+{
+  pappl_job_t		*job;		// Job
+  int			inputfd,	// Input file descriptor
+			outputfd,	// Output socket
+			keepfd;		// Our copy of the output socket
+  cf_filter_data_t	*data;		// Job and printer data
+  cups_array_t		*chain;		// Filters
+  pthread_mutex_t	mutex;		// Mutex for "stop"
+  bool			stop;		// Stop the filters?
+  int			status;		// Exit status of the chain
+} brf_chain_run_t;
+
+typedef struct brf_filter_run_s		// Filter of a chain on its own thread
+{
+  cf_filter_filter_in_chain_t *filter;	// Filter
+  int			inputfd,	// Input file descriptor
+			outputfd,	// Output pipe or socket
+			inputseekable;	// Is input stream seekable?
+  cf_filter_data_t	*data;		// Job and printer data
+  int			status;		// Exit status of the filter
+} brf_filter_run_t;
+
+typedef struct brf_job_chain_s		// Filters for a job
+{
+  pappl_job_t		*job;		// Job
+  pappl_pr_options_t	*job_options;	// Job options
+  brf_job_data_t	*job_data;	// Job and printer data
+  cups_array_t		*chain;		// Filters
+  brf_translate_params_t translate_params;
+					// Parameters for brfTranslateFilter()
+  cf_filter_filter_in_chain_t translate,// Translation filter for this job
+			music,		// FreeDots filter for this job
+			external;	// External filter for this job
+  cf_filter_external_t	external_params;// Parameters for cfFilterExternal()
+  char			**envp;		// Environment for filter processes
+  brf_freedots_t	*freedots;	// FreeDots process for MusicXML
+  int			top_margin,	// Top margin in lines
+			left_margin;	// Left margin in cells
+  brf_chain_run_t	run;		// Filter chain thread data
+  pthread_t		tid;		// Filter chain thread
+  int			chainfd;	// Output of the filters
+} brf_job_chain_t;
+
+typedef struct brf_print_output_s	// Output state of brf_print_filter_function()
+{
+  pappl_job_t		*job;		// Job
+  pappl_device_t	*device;	// Output device
+  brf_lane_t		lane;		// Scheduling lane of job
+  bool			duplex;		// Printing on both sides?
+  brf_writer_t		*writer;	// Asynchronous device writer
+  brf_pgindex_t		*pgindex;	// Page index of the output
+  brf_ckpt_t		*ckpt;		// Checkpoint for resuming the job
+  brf_retain_t		*retain;	// Output kept for reprints
+  off_t			queued,		// Bytes queued for the device
+			base;		// Bytes sent by earlier writers
+  int			debug_fd;	// File descriptor for debug copy
+  brf_sanitize_t	sanitize;	// BRF clean-up state
+  unsigned char		*clean;		// Cleaned up BRF
+  size_t		cleansize;	// Size of clean buffer
+} brf_print_output_t;
+
+
 //
 // Local functions...
 //
 static bool BRFTestFilterCB(pappl_job_t *job,  pappl_device_t *device,void *cbdata) ; 
 static int brf_print_filter_function(int inputfd,int outputfd, int inputseekable,cf_filter_data_t *data, void *parameters); 
+static ssize_t brf_print_output(brf_print_output_t *output, const void *buffer, size_t bytes);
+static bool	brf_print_ahead_cb(pappl_job_t *job, pappl_device_t *device);
+static ssize_t	brf_print_send(brf_print_output_t *output, const void *buffer, size_t bytes);
+static int	brf_chain_is_stopped(brf_chain_run_t *run);
+static void	*brf_chain_run(brf_chain_run_t *run);
+static char	**brf_external_envp(cf_filter_data_t *data, char **envp);
+static int	brf_external_filter(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, void *parameters);
+static void	brf_external_log(cf_filter_data_t *data, char *line);
+static char	*brf_external_options(cf_filter_data_t *data, cf_filter_external_t *params);
+static void	*brf_filter_run(brf_filter_run_t *run);
+static int	brf_job_is_canceled(pappl_job_t *job);
+static ssize_t	brf_job_read(pappl_job_t *job, int fd, void *buffer, size_t bytes);
+static char	**brf_job_envp(pappl_job_t *job, char * const *extra);
+static bool	brf_job_chain_create(pappl_job_t *job, int num_workers, brf_job_chain_t *jc);
+static void	brf_job_chain_delete(brf_job_chain_t *jc);
+static void	brf_job_data_delete(brf_job_data_t *job_data);
+static bool	brf_job_chain_finish(brf_job_chain_t *jc, bool stop);
+static int	brf_job_chain_start(brf_job_chain_t *jc);
+static bool	brf_render_ahead_cb(pappl_job_t *job, brf_layout_cb_t cb, void *cb_data);
 static const char *autoadd_cb(const char *device_info, const char *device_uri, const char *device_id, void *cbdata);
 static bool	driver_cb(pappl_system_t *system, const char *driver_name, const char *device_uri, const char *device_id, pappl_pr_driver_data_t *data, ipp_t **attrs, void *cbdata);
-static int	match_id(int num_did, cups_option_t *did, const char *match_id);
 static const char *mime_cb(const unsigned char *header, size_t headersize, void *data);
 static bool	printer_cb(const char *device_info, const char *device_uri, const char *device_id, pappl_system_t *system);
 static brf_job_data_t *_brfCreateJobData(pappl_job_t *job,pappl_pr_options_t *job_options);
 static pappl_system_t *system_cb(int num_options, cups_option_t *options, void *data);
+static int	compare_drivers(pappl_pr_driver_t *a, pappl_pr_driver_t *b);
+static bool	create_drivers(void);
+static void	*autoadd_run(pappl_system_t *system);
+static void	event_cb(pappl_system_t *system, pappl_printer_t *printer, pappl_job_t *job, pappl_event_t event, void *data);
+static bool	cleanup_cb(pappl_system_t *system, void *data);
+static bool	idle_cb(pappl_system_t *system, void *data);
+static void	idle_count_cb(pappl_printer_t *printer, int *num_active);
+static void	notify_systemd(const char *state);
 
 
 //
 // Local globals...
 //
 
-static pappl_pr_driver_t	brf_drivers[] =
-{					// Driver list
+static pappl_pr_driver_t	brf_gen_drivers[] =
+{					// Generic driver list
 { "gen_brf",  "Generic",
   NULL, NULL },
 
 };
+static int			brf_num_drivers = 0;
+					// Number of drivers
+static pappl_pr_driver_t	*brf_drivers = NULL;
+					// Driver list, sorted by name
 static char			brf_statefile[1024];
 					// State file
+static brf_printer_app_global_data_t brf_global_data;
+					// Global data
+static int			brf_discovery_timeout = 10;
+					// Discovery timeout in seconds
+static int			brf_idle_exit = 0;
+					// Idle time before exiting (0 = never)
+static int			brf_freedots_spares = 2;
+					// Spare FreeDots processes to keep
+static int			brf_ahead_jobs = BRF_AHEAD_JOBS;
+					// Jobs to render ahead per printer
+static int			brf_ahead_disk = BRF_AHEAD_MAX_DISK;
+					// Render-ahead disk budget in MB
+static int			brf_trace_events = BRF_TRACE_EVENTS;
+					// Trace events kept per thread
+static int			brf_cpu_tokens = -1;
+					// CPU tokens (-1 = one per processor)
+static int			brf_retain_size = BRF_RETAIN_MAX_SIZE;
+					// Retention store budget in MB
+static time_t			brf_idle_time = 0;
+					// Time of last activity
+static pthread_mutex_t		brf_idle_mutex = PTHREAD_MUTEX_INITIALIZER;
+					// Mutex for last activity time
 
 
 //
@@ -53,10 +176,13 @@ int					// O - Exit status
 main(int  argc,				// I - Number of command-line arguments
      char *argv[])			// I - Command-line arguments
 {
+  if (!create_drivers())
+    return (1);
+
   return (papplMainloop(argc, argv,
                         "1.0",
                         NULL,
-                        (int)(sizeof(brf_drivers) / sizeof(brf_drivers[0])),
+                        brf_num_drivers,
                         brf_drivers, autoadd_cb, driver_cb,
                         /*subcmd_name*/NULL, /*subcmd_cb*/NULL,
                         system_cb,
@@ -75,117 +201,74 @@ autoadd_cb(const char *device_info,	// I - Device information/name (not used)
            const char *device_id,	// I - IEEE-1284 device ID
            void       *cbdata)		// I - Callback data (System)
 {
-  int		i,			// Looping var
-		score,			// Current driver match score
-	    	best_score = 0,		// Best score
-		num_did;		// Number of device ID key/value pairs
-  cups_option_t	*did;			// Device ID key/value pairs
-  const char	*make,			// Manufacturer name
-		*best_name = NULL;	// Best driver
- 
+  int		score;			// Best driver match score
+  const char	*best_name;		// Best driver
 
 
   (void)device_info;
 
-  // First parse the device ID and get any potential driver name to match...
-  num_did = papplDeviceParseID(device_id, &did);
+  // Score the device ID against the precompiled driver match strings...
+  best_name = brfDeviceIDMatch(device_id, &score);
 
-  if ((make = cupsGetOption("MANUFACTURER", num_did, did)) == NULL)
-    if ((make = cupsGetOption("MANU", num_did, did)) == NULL)
-      make = cupsGetOption("MFG", num_did, did);
+  if (best_name)
+    papplLog((pappl_system_t *)cbdata, PAPPL_LOGLEVEL_DEBUG, "Device '%s' matches driver '%s' with score %d.", device_uri, best_name, score);
 
-  
-  // // Then loop through the driver list to find the best match...
-  // for (i = 0; i < (int)(sizeof(brf_drivers) / sizeof(brf_drivers[0])); i ++)
-  {
- 
+  return (best_name);
+}
 
-    if (brf_drivers[i].device_id)
-    {
-      // See if we have a matching device ID...
-      score = match_id(num_did, did, brf_drivers[i].device_id);
-      if (score > best_score)
-      {
-        best_score = score;
-        best_name  = brf_drivers[i].name;
-      }
-    }
-   }
 
-  // Clean up and return...
-  cupsFreeOptions(num_did, did);
+//
+// 'compare_drivers()' - Compare two drivers by name.
+//
 
-  return (best_name);
+static int				// O - Result of comparison
+compare_drivers(pappl_pr_driver_t *a,	// I - First driver
+                pappl_pr_driver_t *b)	// I - Second driver
+{
+  return (strcmp(a->name, b->name));
 }
 
 
-
 //
-// 'match_id()' - Compare two IEEE-1284 device IDs and return a score.
+// 'create_drivers()' - Create the driver list.
 //
-// The score is 2 for each exact match and 1 for a partial match in a comma-
-// delimited field.  Any non-match results in a score of 0.
+// The Index models come from the tables generated from the .drv files, with
+// the model as the driver extension.  The list is sorted so that driver_cb()
+// can look drivers up with a binary search.
 //
 
-static int				// O - Score
-match_id(int           num_did,		// I - Number of device ID key/value pairs
-         cups_option_t *did,		// I - Device ID key/value pairs
-         const char    *match_id)	// I - Driver's device ID match string
+static bool				// O - `true` on success, `false` on error
+create_drivers(void)
 {
-  int		i,			// Looping var
-		score = 0,		// Score
-		num_mid;		// Number of match ID key/value pairs
-  cups_option_t	*mid,			// Match ID key/value pairs
-		*current;		// Current key/value pair
-  const char	*value,			// Device ID value
-		*valptr;		// Pointer into value
-
+  int	i;				// Looping var
+  int	num_gen = (int)(sizeof(brf_gen_drivers) / sizeof(brf_gen_drivers[0]));
+					// Number of generic drivers
 
-  // Parse the matching device ID into key/value pairs...
-  if ((num_mid = papplDeviceParseID(match_id, &mid)) == 0)
-    return (0);
 
-  // Loop through the match pairs to find matches (or not)
-  for (i = num_mid, current = mid; i > 0; i --, current ++)
+  if ((brf_drivers = (pappl_pr_driver_t *)calloc((size_t)(num_gen + brf_index_num_models), sizeof(pappl_pr_driver_t))) == NULL)
   {
-    if ((value = cupsGetOption(current->name, num_did, did)) == NULL)
-    {
-      // No match
-      score = 0;
-      break;
-    }
+    perror("brf-printer-app");
+    return (false);
+  }
 
-    if (!strcasecmp(current->value, value))
-    {
-      // Full match!
-      score += 2;
-    }
-    else if ((valptr = strstr(value, current->value)) != NULL)
-    {
-      // Possible substring match, check
-      size_t mlen = strlen(current->value);
-					// Length of match value
-      if ((valptr == value || valptr[-1] == ',') && (!valptr[mlen] || valptr[mlen] == ','))
-      {
-        // Partial match!
-        score ++;
-      }
-      else
-      {
-        // No match
-        score = 0;
-        break;
-      }
-    }
-    else
-    {
-      // No match
-      score = 0;
-      break;
-    }
+  memcpy(brf_drivers, brf_gen_drivers, sizeof(brf_gen_drivers));
+
+  for (i = 0; i < brf_index_num_models; i ++)
+  {
+    brf_drivers[num_gen + i].name        = brf_index_models[i].name;
+    brf_drivers[num_gen + i].description = brf_index_models[i].description;
+    brf_drivers[num_gen + i].device_id   = brf_index_models[i].device_id;
+    brf_drivers[num_gen + i].extension   = (void *)(brf_index_models + i);
   }
+
+  brf_num_drivers = num_gen + brf_index_num_models;
+
+  qsort(brf_drivers, (size_t)brf_num_drivers, sizeof(pappl_pr_driver_t), (int (*)(const void *, const void *))compare_drivers);
+
+  return (true);
 }
 
+
 //
 // 'driver_cb()' - Main driver callback.
 //
@@ -200,27 +283,30 @@ driver_cb(
     ipp_t                  **attrs,	// O - Pointer to driver attributes
     void                   *cbdata)	// I - Callback data (not used)
 {
-  int	i;				// Looping var
+  pappl_pr_driver_t	key,		// Search key
+			*driver;	// Matching driver
 
 
   // Copy make/model info...
-  for (i = 0; i < (int)(sizeof(brf_drivers) / sizeof(brf_drivers[0])); i ++)
+  key.name = driver_name;
+
+  if ((driver = (pappl_pr_driver_t *)bsearch(&key, brf_drivers, (size_t)brf_num_drivers, sizeof(pappl_pr_driver_t), (int (*)(const void *, const void *))compare_drivers)) == NULL)
   {
-    if (!strcmp(driver_name, brf_drivers[i].name))
-    {
-      papplCopyString(data->make_and_model, brf_drivers[i].description, sizeof(data->make_and_model));
-      break;
-    }
+    papplLog(system, PAPPL_LOGLEVEL_ERROR, "Unknown driver '%s'.", driver_name);
+    return (false);
   }
 
+  papplCopyString(data->make_and_model, driver->description, sizeof(data->make_and_model));
+
   // Pages per minute 
   data->ppm = 5;
 
  
   // Color values...
-  data->color_supported   = PAPPL_COLOR_MODE_AUTO | PAPPL_COLOR_MODE_MONOCHROME;
-  data->color_default   = PAPPL_COLOR_MODE_MONOCHROME;
-  data->raster_types  = PAPPL_PWG_RASTER_TYPE_BLACK_8; // to be done just guess
+  // Embossers only know dot or no dot, so raster is bi-level by default...
+  data->color_supported   = PAPPL_COLOR_MODE_AUTO | PAPPL_COLOR_MODE_BI_LEVEL | PAPPL_COLOR_MODE_MONOCHROME;
+  data->color_default   = PAPPL_COLOR_MODE_BI_LEVEL;
+  data->raster_types  = PAPPL_PWG_RASTER_TYPE_BLACK_1 | PAPPL_PWG_RASTER_TYPE_BLACK_8 | PAPPL_PWG_RASTER_TYPE_SGRAY_8;
 
   // "print-quality-default" value...
   data->quality_default = IPP_QUALITY_NORMAL;
@@ -238,9 +324,11 @@ driver_cb(
  // data->testpage_cb = brfTestPageCB;
 
   // Use the corresponding sub-driver callback to set things up...
-  if (!strncmp(driver_name, "gen_", 4))
+  if (driver->extension)
+    return (brf_index(system, driver_name, device_uri, device_id, data, attrs, driver->extension));
+  else if (!strncmp(driver_name, "gen_", 4))
     return (brf_gen(system, driver_name, device_uri, device_id, data, attrs, cbdata));
- 
+
   else
     return (false);
 }
@@ -276,6 +364,8 @@ printer_cb(const char     *device_info,	// I - Device information
 
   if (driver_name)
   {
+    static pthread_mutex_t create_mutex = PTHREAD_MUTEX_INITIALIZER;
+					// Serialize creation across probes
     char	name[128],		// Printer name
 		*nameptr;		// Pointer in name
     papplCopyString(name, device_info, sizeof(name));
@@ -283,6 +373,8 @@ printer_cb(const char     *device_info,	// I - Device information
     if ((nameptr = strstr(name, " (")) != NULL)
       *nameptr = '\0';
 
+    pthread_mutex_lock(&create_mutex);
+
     if (!papplPrinterCreate(system, 0, name, driver_name, device_id, device_uri))
     {
       // Printer already exists with this name, so try adding a number to the
@@ -311,6 +403,8 @@ printer_cb(const char     *device_info,	// I - Device information
           break;
       }
     }
+
+    pthread_mutex_unlock(&create_mutex);
   }
 
   return (false);
@@ -334,6 +428,8 @@ system_cb(
 			*system_name;	// System name, if any
   pappl_loglevel_t	loglevel;	// Log level
   int			port = 0;	// Port number, if any
+  pthread_t		tid;		// Auto-add thread
+  int			err;		// Thread creation error
   pappl_soptions_t	soptions = PAPPL_SOPTIONS_MULTI_QUEUE | PAPPL_SOPTIONS_WEB_INTERFACE | PAPPL_SOPTIONS_WEB_LOG | PAPPL_SOPTIONS_WEB_SECURITY;
 					// System options
   static pappl_version_t versions[1] =	// Software versions
@@ -378,6 +474,90 @@ system_cb(
       port = atoi(val);
   }
 
+  if ((val = cupsGetOption("discovery-timeout", num_options, options)) != NULL)
+  {
+    if (!isdigit(*val & 255) || (brf_discovery_timeout = atoi(val)) < 1)
+    {
+      fprintf(stderr, "brf: Bad discovery-timeout value '%s'.\n", val);
+      return (NULL);
+    }
+  }
+
+  if ((val = cupsGetOption("idle-exit", num_options, options)) != NULL)
+  {
+    if (!isdigit(*val & 255))
+    {
+      fprintf(stderr, "brf: Bad idle-exit value '%s'.\n", val);
+      return (NULL);
+    }
+    else
+      brf_idle_exit = atoi(val);
+  }
+
+  if ((val = cupsGetOption("freedots-spares", num_options, options)) != NULL)
+  {
+    if (!isdigit(*val & 255) || (brf_freedots_spares = atoi(val)) > BRF_FREEDOTS_MAX_SPARES)
+    {
+      fprintf(stderr, "brf: Bad freedots-spares value '%s'.\n", val);
+      return (NULL);
+    }
+  }
+
+  if ((val = cupsGetOption("render-ahead", num_options, options)) != NULL)
+  {
+    if (!isdigit(*val & 255))
+    {
+      fprintf(stderr, "brf: Bad render-ahead value '%s'.\n", val);
+      return (NULL);
+    }
+    else
+      brf_ahead_jobs = atoi(val);
+  }
+
+  if ((val = cupsGetOption("render-ahead-disk", num_options, options)) != NULL)
+  {
+    if (!isdigit(*val & 255))
+    {
+      fprintf(stderr, "brf: Bad render-ahead-disk value '%s'.\n", val);
+      return (NULL);
+    }
+    else
+      brf_ahead_disk = atoi(val);
+  }
+
+  if ((val = cupsGetOption("cpu-tokens", num_options, options)) != NULL)
+  {
+    if (!isdigit(*val & 255))
+    {
+      fprintf(stderr, "brf: Bad cpu-tokens value '%s'.\n", val);
+      return (NULL);
+    }
+    else
+      brf_cpu_tokens = atoi(val);
+  }
+
+  if ((val = cupsGetOption("retain-size", num_options, options)) != NULL)
+  {
+    if (!isdigit(*val & 255))
+    {
+      fprintf(stderr, "brf: Bad retain-size value '%s'.\n", val);
+      return (NULL);
+    }
+    else
+      brf_retain_size = atoi(val);
+  }
+
+  if ((val = cupsGetOption("trace-events", num_options, options)) != NULL)
+  {
+    if (!isdigit(*val & 255))
+    {
+      fprintf(stderr, "brf: Bad trace-events value '%s'.\n", val);
+      return (NULL);
+    }
+    else
+      brf_trace_events = atoi(val);
+  }
+
   // State file...
   if ((val = getenv("SNAP_DATA")) != NULL)
   {
@@ -411,130 +591,287 @@ system_cb(
   if ((system = papplSystemCreate(soptions, system_name ? system_name : "Braille printer app", port, "_print,_universal", cupsGetOption("spool-directory", num_options, options), logfile ? logfile : "-", loglevel, cupsGetOption("auth-service", num_options, options), /* tls_only */false)) == NULL)
     return (NULL);
 
-  papplSystemAddListeners(system, NULL);
+  brf_global_data.system = system;
+
+  // Trace the job stages, before any threads or filters start...
+  brfTraceInit(system, brf_trace_events);
+
+  // Share the processors between the conversions of all printers...
+  brfCPUInit(system, brf_cpu_tokens);
+
+#ifndef _WIN32
+  // Filters run on server threads and write to pipes, a filter that exits
+  // early must give the writer EPIPE and not stop the server...
+  signal(SIGPIPE, SIG_IGN);
+#endif // !_WIN32
+
+  papplSystemGetSpoolDirectory(system, brf_global_data.spool_dir, sizeof(brf_global_data.spool_dir));
+
+  papplSystemAddListeners(system, cupsGetOption("listen-hostname", num_options, options));
   papplSystemSetHostName(system, hostname);
 
+  // Simulated embossers for testing without hardware...
+  brfSimInit(system);
+
   papplSystemSetMIMECallback(system, mime_cb, NULL);
   papplSystemAddMIMEFilter(system, "application/pdf", brf_TESTPAGE_MIMETYPE, BRFTestFilterCB, NULL);
+  papplSystemAddMIMEFilter(system, "text/plain", brf_TESTPAGE_MIMETYPE, BRFTestFilterCB, NULL);
+  papplSystemAddMIMEFilter(system, "application/vnd.oasis.opendocument.text", brf_TESTPAGE_MIMETYPE, BRFTestFilterCB, NULL);
+  papplSystemAddMIMEFilter(system, "application/vnd.openxmlformats-officedocument.wordprocessingml.document", brf_TESTPAGE_MIMETYPE, BRFTestFilterCB, NULL);
+  papplSystemAddMIMEFilter(system, "application/vnd.recordare.musicxml+xml", brf_TESTPAGE_MIMETYPE, BRFTestFilterCB, NULL);
+
+  // Keep the output of completed jobs for reprints from the web interface...
+  brfRetainInit(system, (off_t)brf_retain_size * 1048576);
 
-  papplSystemSetPrinterDrivers(system, (int)(sizeof(brf_drivers) / sizeof(brf_drivers[0])), brf_drivers, autoadd_cb, /*create_cb*/NULL, driver_cb, system);
+  // ... and let failed jobs be resumed...
+  brfCheckpointInit(system);
+
+  papplSystemSetPrinterDrivers(system, brf_num_drivers, brf_drivers, autoadd_cb, /*create_cb*/NULL, driver_cb, system);
+  brfDeviceIDIndexCreate(brf_num_drivers, brf_drivers);
 
   
   papplSystemSetFooterHTML(system, "Copyright &copy; 2022 by Chandresh Soni. All rights reserved.");
-  papplSystemSetSaveCallback(system, (pappl_save_cb_t)papplSystemSaveState, (void *)brf_statefile);
+  papplSystemSetSaveCallback(system, brfSaveStateCB, NULL);
   papplSystemSetVersions(system, (int)(sizeof(versions) / sizeof(versions[0])), versions);
 
   fprintf(stderr, "brf: statefile='%s'\n", brf_statefile);
 
+  // Save the state in the background, after bursts of changes have settled...
+  brfSaveInit(system, brf_statefile);
+
   if (!papplSystemLoadState(system, brf_statefile))
   {
     // No old state, use defaults and auto-add printers...
     papplSystemSetDNSSDName(system, system_name ? system_name : "brf");
 
-    papplLog(system, PAPPL_LOGLEVEL_INFO, "Auto-adding printers...");
-    papplDeviceList(PAPPL_DEVTYPE_USB, (pappl_device_cb_t)printer_cb, system, papplLogDevice, system);
+    // Probe for printers in the background so that the first client doesn't
+    // wait for discovery...
+    if ((err = pthread_create(&tid, NULL, (void *(*)(void *))autoadd_run, system)) != 0)
+      papplLog(system, PAPPL_LOGLEVEL_ERROR, "Unable to create auto-add thread: %s", strerror(err));
+    else
+      pthread_detach(tid);
+  }
+
+  // Let urgent jobs go ahead of large ones at page boundaries...
+  brfSchedulerInit(brf_print_ahead_cb);
+
+  // Send consecutive small jobs as one document...
+  brfSessionInit(system);
+
+  // Remove page index files left behind by deleted jobs...
+  papplSystemAddTimerCallback(system, 0, 600, cleanup_cb, NULL);
+
+  // Keep FreeDots warm for MusicXML jobs...
+  brfFreeDotsInit(system, brf_freedots_spares);
+
+  // Convert queued jobs while the embosser is busy...
+  brfRenderAheadInit(system, brf_ahead_jobs, (off_t)brf_ahead_disk * 1048576, brf_render_ahead_cb);
+
+  papplSystemSetEventCallback(system, event_cb, NULL);
+
+  if (brf_idle_exit > 0)
+  {
+    // Exit after the idle time so socket activation can start us again...
+    brf_idle_time = time(NULL);
+
+    papplSystemAddTimerCallback(system, 0, brf_idle_exit < 120 ? brf_idle_exit / 4 + 1 : 30, idle_cb, NULL);
   }
 
+  // The listeners are open, tell systemd we are ready for connections...
+  notify_systemd("READY=1");
+
   return (system);
 }
 
 
 //
-// 'BRFTestFilterCB()' - Print a test page.
+// 'autoadd_run()' - Auto-add printers.
 //
 
-// Items to configure the properties of this Printer Application
-// These items do not change while the Printer Application is running
-typedef struct brf_printer_app_config_s
+static void *				// O - Thread exit status (unused)
+autoadd_run(pappl_system_t *system)	// I - System
 {
-  // Identification of the Printer Application
-  const char        *system_name;        // Name of the system
-  const char        *system_package_name;// Name of Printer Application
-                                         // package/executable
-  const char        *version;            // Program version number string
-  unsigned short    numeric_version[4];  // Numeric program version
-  const char        *web_if_footer;      // HTML Footer for web interface
-  
-  pappl_pr_autoadd_cb_t autoadd_cb;
+  papplLog(system, PAPPL_LOGLEVEL_INFO, "Auto-adding printers...");
+  brfDiscoverDevices(system, PAPPL_DEVTYPE_USB | PAPPL_DEVTYPE_DNS_SD | PAPPL_DEVTYPE_SNMP, brf_discovery_timeout, (pappl_device_cb_t)printer_cb, system);
 
-  
-  pappl_pr_identify_cb_t identify_cb;
+  return (NULL);
+}
 
 
-  pappl_pr_testpage_cb_t testpage_cb;
+//
+// 'cleanup_cb()' - Clean up the spool directory.
+//
 
+static bool				// O - `true` to keep the timer
+cleanup_cb(pappl_system_t *system,	// I - System
+           void           *data)	// I - Callback data (not used)
+{
+  (void)system;
+  (void)data;
 
-  cups_array_t      *spooling_conversions;
+  brfPageIndexCleanup(brf_global_data.spool_dir);
+  brfCheckpointCleanup(brf_global_data.spool_dir);
 
-  
-  cups_array_t      *stream_formats;
-  const char        *backends_ignore;
+  return (true);
+}
+
+
+//
+// 'event_cb()' - Record activity for the idle exit and render-ahead.
+//
 
-  const char        *backends_only;
+static void
+event_cb(pappl_system_t  *system,	// I - System
+         pappl_printer_t *printer,	// I - Printer, if any
+         pappl_job_t     *job,		// I - Job, if any
+         pappl_event_t   event,		// I - Event
+         void            *data)		// I - Callback data (not used)
+{
+  (void)system;
+  (void)printer;
+  (void)job;
+  (void)data;
+
+  // New jobs may be rendered ahead while the printer is busy...
+  if (event & PAPPL_EVENT_JOB_CREATED)
+    brfRenderAheadKick();
+
+  pthread_mutex_lock(&brf_idle_mutex);
+  brf_idle_time = time(NULL);
+  pthread_mutex_unlock(&brf_idle_mutex);
+}
 
-  void              *testpage_data;
 
-} pr_printer_app_config_t;
+//
+// 'idle_cb()' - Shut down the server after the idle time.
+//
+// The server only exits when no printer has an active job, so a job that is
+// spooled and then left to print is never interrupted.
+//
 
-typedef struct brf_printer_app_global_data_s
+static bool				// O - `true` to keep the timer, `false` to remove it
+idle_cb(pappl_system_t *system,		// I - System
+        void           *data)		// I - Callback data (not used)
 {
-  pr_printer_app_config_t *config;
-  pappl_system_t          *system;
-  int                     num_drivers;     // Number of drivers (from the PPDs)
-  pappl_pr_driver_t       *drivers;        // Driver index (for menu and
-                                           // auto-add)
-   char              spool_dir[1024];     // Spool directory, customizable via
-                                         // SPOOL_DIR environment variable                                         
+  int		num_active = 0;		// Number of active jobs
+  time_t	curtime = time(NULL),	// Current time
+		idle_time;		// Time of last activity
 
-} brf_printer_app_global_data_t;
 
+  (void)data;
 
+  papplSystemIteratePrinters(system, (pappl_printer_cb_t)idle_count_cb, &num_active);
 
-// Data for brf_print_filter_function()
-typedef struct brf_print_filter_function_data_s
-// look-up table
-{
-  pappl_device_t *device;                    // Device
-  const char *device_uri;                          // Printer device URI
-  pappl_job_t *job;                          // Job
-  brf_printer_app_global_data_t *global_data; // Global data
-} brf_print_filter_function_data_t;
+  pthread_mutex_lock(&brf_idle_mutex);
+  if (num_active > 0)
+    brf_idle_time = curtime;
+  idle_time = brf_idle_time;
+  pthread_mutex_unlock(&brf_idle_mutex);
+
+  if ((curtime - idle_time) < brf_idle_exit)
+    return (true);
+
+  papplLog(system, PAPPL_LOGLEVEL_INFO, "Shutting down after %d seconds of inactivity.", brf_idle_exit);
+  notify_systemd("STOPPING=1");
+  brfSaveShutdown(system);
+  papplSystemShutdown(system);
+
+  return (false);
+}
 
-typedef struct brf_cups_device_data_s
+
+//
+// 'idle_count_cb()' - Count the active jobs of a printer.
+//
+
+static void
+idle_count_cb(
+    pappl_printer_t *printer,		// I - Printer
+    int             *num_active)	// IO - Number of active jobs
 {
-  const char *device_uri;    // Device URI
-  int inputfd,         // FD for job data input
-      backfd,          // FD for back channel
-      sidefd;          // FD for side channel
-  int backend_pid;     // PID of CUPS backend
-  double back_timeout, // Timeout back channel (sec)
-      side_timeout;    // Timeout side channel (sec)
-
-  cf_filter_filter_in_chain_t *chain_filter; // Filters in chain
-        // Common data for filter functions
-  cf_filter_external_t backend_params; // Parameters for launching
-                                             // backend via cfFilterExternal()
-  bool internal_filter_data;                 // Is filter_data
-                                             // internal?
-} brf_cups_device_data_t;
-
-typedef struct brf_spooling_conversion_s
+  *num_active += papplPrinterGetNumberOfActiveJobs(printer);
+}
+
+
+//
+// 'notify_systemd()' - Send a state notification to systemd, if running as a
+//                      notify service.
+//
+
+static void
+notify_systemd(const char *state)	// I - State string
 {
-  char *srctype;                   // Input data type
-  char *dsttype;                   // Output data type
-  int num_filters;                       // Number of filters
-  cf_filter_filter_in_chain_t filters[]; // List of filters with
-                                         // parameters
-} brf_spooling_conversion_t;
+  const char		*path;		// Notification socket path
+  int			fd;		// Socket
+  struct sockaddr_un	addr;		// Socket address
+  size_t		pathlen;	// Length of path
+
+
+  if ((path = getenv("NOTIFY_SOCKET")) == NULL || (*path != '/' && *path != '@') || (pathlen = strlen(path)) >= sizeof(addr.sun_path))
+    return;
+
+  if ((fd = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0)
+    return;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, path, pathlen);
+
+  // Leading '@' means an abstract socket name...
+  if (*path == '@')
+    addr.sun_path[0] = '\0';
+
+  if (sendto(fd, state, strlen(state), 0, (struct sockaddr *)&addr, (socklen_t)(offsetof(struct sockaddr_un, sun_path) + pathlen)) < 0)
+    fprintf(stderr, "brf: Unable to notify systemd: %s\n", strerror(errno));
 
+  close(fd);
+}
+
+
+//
+// 'BRFTestFilterCB()' - Print a test page.
+//
+
+static char *filter_envp[] =
+    {
+      "CUPS_BRAILLE_LAYOUT=native",	// Margins are added by brfLayoutWrite()
+      NULL
+    };
+// The environment of external filters is set per job, see brf_job_envp()...
 static cf_filter_external_t filter_data_ext =
     {
       "/usr/lib/cups/filter/texttobrf",
       0,
       0,
       NULL,
-      NULL
+      filter_envp
+    };
+static cf_filter_external_t filter_data_musicxml_ext =
+    {
+      "/usr/lib/cups/filter/musicxmltobrf",
+      0,
+      0,
+      NULL,
+      filter_envp
     };
+static brf_spooling_conversion_t brf_convert_pdf_to_brf_native =
+    {
+        "application/pdf",
+        "application/vnd.cups-paged-brf",
+        2,
+        {
+          {
+            brfPDFToTextFilter,
+            NULL,
+            "brfpdftotext"
+          },
+          {
+            brfTranslateFilter,
+            NULL,			// Set per job, see BRFTestFilterCB()
+            "brftranslate"
+          }
+        }
+     };
 static brf_spooling_conversion_t brf_convert_pdf_to_brf =
     {
         "application/pdf",
@@ -548,277 +885,1653 @@ static brf_spooling_conversion_t brf_convert_pdf_to_brf =
           }
         }
      };
-
-bool // O - `true` on success, `false` on failure
-BRFTestFilterCB(
-    pappl_job_t *job,       // I - Job
-    pappl_device_t *device, // I - Output device
-    void *cbdata)           // I - Callback data (not used)
-{
-  pappl_pr_options_t *job_options = papplJobCreatePrintOptions(job, INT_MAX, 0);
-  brf_spooling_conversion_t *conversion;     // Spooling conversion to use
-                                             // for pre-filtering
-  cf_filter_filter_in_chain_t *chain_filter, // Filter in chain
-      *print;
-  brf_cups_device_data_t *device_data = NULL;
-  brf_print_filter_function_data_t *print_params;
-  brf_printer_app_global_data_t *global_data;
-  brf_job_data_t *job_data;
-  cups_array_t *spooling_conversions;
-  cups_array_t *chain;
-  const char *informat;
-  const char *filename;     // Input filename
-  int fd;                   // Input file descriptor
-
-  int nullfd;               // File descriptor for /dev/null
-
-  bool ret = false;    // Return value
-  int num_options = 0; 
-  cups_option_t *options = NULL;
-  cf_filter_external_t *ext_filter_params;
-
-  pappl_pr_driver_data_t driver_data;
-  pappl_printer_t *printer = papplJobGetPrinter(job);
-  const char *device_uri = papplPrinterGetDeviceURI(printer);
-  spooling_conversions = cupsArrayNew(NULL, NULL);
-  cupsArrayAdd(spooling_conversions, &brf_convert_pdf_to_brf);
-
-    job_options = papplJobCreatePrintOptions(job, INT_MAX, 1);
-
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-	      "Printing job in spooling mode");
-
-  job_data = _brfCreateJobData(job, job_options);
-
-  
-
-
-  //
-  // Open the input file...
-  //
-
-  filename = papplJobGetFilename(job);
-  if ((fd = open(filename, O_RDONLY)) < 0)
-  {
-    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to open input file '%s' for printing: %s",
-                filename, strerror(errno));
-    return (false);
-  }
-
-  //
-  // Get input file format
-  //
-
+static brf_spooling_conversion_t brf_convert_odt_to_brf =
+    {
+        "application/vnd.oasis.opendocument.text",
+        "application/vnd.cups-paged-brf",
+        2,
+        {
+          {
+            brfOfficeToTextFilter,
+            "content.xml",
+            "brfofficetotext"
+          },
+          {
+            brfTranslateFilter,
+            NULL,			// Set per job, see BRFTestFilterCB()
+            "brftranslate"
+          }
+        }
+     };
+static brf_spooling_conversion_t brf_convert_odt_to_brf_ext =
+    {
+        "application/vnd.oasis.opendocument.text",
+        "application/vnd.cups-paged-brf",
+        1,
+        {
+          {
+            cfFilterExternal,
+            (void *)(&filter_data_ext),
+            "texttobrf"
+          }
+        }
+     };
+static brf_spooling_conversion_t brf_convert_docx_to_brf =
+    {
+        "application/vnd.openxmlformats-officedocument.wordprocessingml.document",
+        "application/vnd.cups-paged-brf",
+        2,
+        {
+          {
+            brfOfficeToTextFilter,
+            "word/document.xml",
+            "brfofficetotext"
+          },
+          {
+            brfTranslateFilter,
+            NULL,			// Set per job, see BRFTestFilterCB()
+            "brftranslate"
+          }
+        }
+     };
+static brf_spooling_conversion_t brf_convert_docx_to_brf_ext =
+    {
+        "application/vnd.openxmlformats-officedocument.wordprocessingml.document",
+        "application/vnd.cups-paged-brf",
+        1,
+        {
+          {
+            cfFilterExternal,
+            (void *)(&filter_data_ext),
+            "texttobrf"
+          }
+        }
+     };
+static brf_spooling_conversion_t brf_convert_text_to_brf =
+    {
+        "text/plain",
+        "application/vnd.cups-paged-brf",
+        1,
+        {
+          {
+            brfTranslateFilter,
+            NULL,			// Set per job, see BRFTestFilterCB()
+            "brftranslate"
+          }
+        }
+     };
+static brf_spooling_conversion_t brf_convert_text_to_brf_ext =
+    {
+        "text/plain",
+        "application/vnd.cups-paged-brf",
+        1,
+        {
+          {
+            cfFilterExternal,
+            (void *)(&filter_data_ext),
+            "texttobrf"
+          }
+        }
+     };
+static brf_spooling_conversion_t brf_convert_musicxml_to_brf =
+    {
+        "application/vnd.recordare.musicxml+xml",
+        "application/vnd.cups-paged-brf",
+        1,
+        {
+          {
+            brfFreeDotsFilter,
+            NULL,			// Set per job, see BRFTestFilterCB()
+            "brffreedots"
+          }
+        }
+     };
+static brf_spooling_conversion_t brf_convert_musicxml_to_brf_ext =
+    {
+        "application/vnd.recordare.musicxml+xml",
+        "application/vnd.cups-paged-brf",
+        1,
+        {
+          {
+            cfFilterExternal,
+            (void *)(&filter_data_musicxml_ext),
+            "musicxmltobrf"
+          }
+        }
+     };
+
+bool // O - `true` on success, `false` on failure
+BRFTestFilterCB(
+    pappl_job_t *job,       // I - Job
+    pappl_device_t *device, // I - Output device
+    void *cbdata)           // I - Callback data (not used)
+{
+  pappl_pr_options_t *job_options;
+  brf_cups_device_data_t *device_data = NULL;
+  brf_print_filter_function_data_t *print_params;
+  brf_printer_app_global_data_t *global_data = &brf_global_data;
+  brf_job_data_t *job_data;
+  brf_job_chain_t jc;       // Filters for the job
+  int fd;                   // Input file descriptor
+  int nullfd;               // File descriptor for /dev/null
+  bool ret = false;    // Return value
+
+  pappl_printer_t *printer = papplJobGetPrinter(job);
+  const char *device_uri = papplPrinterGetDeviceURI(printer);
+  // Nothing left to do when the job was printed ahead of a larger one...
+  if (brfSchedulerWasPrinted(job))
+    return (true);
+
+  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+	      "Printing job in spooling mode");
+
+  // Render the next jobs while this one is embossed...
+  brfRenderAheadKick();
+
+  brfTraceBegin("job-setup", papplJobGetID(job));
+
+  // The output of the filters goes to PAPPL's built-in backend
+  print_params =
+      (brf_print_filter_function_data_t *)
+          calloc(1, sizeof(brf_print_filter_function_data_t));
+  print_params->device = device;
+  print_params->device_uri = device_uri;
+  print_params->job = job;
+  print_params->global_data = global_data;
+  print_params->lane = brfSchedulerGetLane(job);
+
+  if ((fd = brfRenderAheadOpen(job)) >= 0)
+  {
+    // Already converted and laid out while the printer was busy...
+    job_options = papplJobCreatePrintOptions(job, INT_MAX, 1);
+    job_data    = _brfCreateJobData(job, job_options);
+    print_params->layout = false;
+  }
+  else
+  {
+    //
+    // Set up filter function chain
+    //
+
+    if (!brf_job_chain_create(job, 0, &jc))
+    {
+      brfTraceEnd("job-setup", papplJobGetID(job));
+      free(print_params);
+      return (false);
+    }
+
+    job_data = jc.job_data;
+
+    // texttobrf leaves the margins to us, see filter_envp...
+    print_params->layout      = true;
+    print_params->top_margin  = jc.top_margin;
+    print_params->left_margin = jc.left_margin;
+  }
+
+  //
+  // Connect the job's filter_data to the backend
+  //
+
+  if (strncmp(device_uri, "cups:", 5) == 0)
+  {
+    // Get the device data
+    device_data = (brf_cups_device_data_t *)papplDeviceGetData(device);
+
+    // Connect the filter_data
+    device_data->filter_data = job_data->filter_data;
+  }
+
+  //
+  // Fire up the filter functions
+  //
+
+  papplJobSetImpressions(job, 1);
+
+  // The filters run on their own thread while this one sends their output
+  // to the device, so the job can pause at a page boundary for more urgent
+  // jobs...
+  if (fd < 0 && (fd = brf_job_chain_start(&jc)) < 0)
+  {
+    brfTraceEnd("job-setup", papplJobGetID(job));
+    brf_job_chain_delete(&jc);
+    free(print_params);
+    return (false);
+  }
+
+  brfTraceEnd("job-setup", papplJobGetID(job));
+
+  // The backend has no output, data is going to the device
+  nullfd = open("/dev/null", O_RDWR);
+
+  if (print_params->layout)
+  {
+    ret = brf_print_filter_function(dup(fd), nullfd, 0, job_data->filter_data, print_params) == 0;
+
+    if (!brf_job_chain_finish(&jc, !ret))
+      ret = false;
+
+    brf_job_chain_delete(&jc);
+  }
+  else
+  {
+    ret = brf_print_filter_function(fd, nullfd, 0, job_data->filter_data, print_params) == 0;
+
+    brf_job_data_delete(job_data);
+    papplJobDeletePrintOptions(job_options);
+  }
+
+  free(print_params);
+
+  return (ret);
+}
+
+
+//
+// 'brf_job_chain_create()' - Choose the filters for a job.
+//
+// `num_workers` limits the number of translation workers, 0 means automatic.
+//
+
+static bool				// O - `true` on success, `false` on failure
+brf_job_chain_create(
+    pappl_job_t     *job,		// I - Job
+    int             num_workers,	// I - Number of translation workers
+    brf_job_chain_t *jc)		// O - Filters for the job
+{
+  brf_spooling_conversion_t *conversion;     // Spooling conversion to use
+                                             // for pre-filtering
+  cups_array_t *spooling_conversions;
+  const char *informat;
+  int i;                                     // Looping var
+
+
+  memset(jc, 0, sizeof(brf_job_chain_t));
+  jc->job     = job;
+  jc->chainfd = -1;
+
+  spooling_conversions = cupsArrayNew(NULL, NULL);
+  cupsArrayAdd(spooling_conversions, &brf_convert_pdf_to_brf_native);
+  cupsArrayAdd(spooling_conversions, &brf_convert_pdf_to_brf);
+  cupsArrayAdd(spooling_conversions, &brf_convert_odt_to_brf);
+  cupsArrayAdd(spooling_conversions, &brf_convert_odt_to_brf_ext);
+  cupsArrayAdd(spooling_conversions, &brf_convert_docx_to_brf);
+  cupsArrayAdd(spooling_conversions, &brf_convert_docx_to_brf_ext);
+  cupsArrayAdd(spooling_conversions, &brf_convert_text_to_brf);
+  cupsArrayAdd(spooling_conversions, &brf_convert_text_to_brf_ext);
+  cupsArrayAdd(spooling_conversions, &brf_convert_musicxml_to_brf);
+  cupsArrayAdd(spooling_conversions, &brf_convert_musicxml_to_brf_ext);
+
+  jc->job_options = papplJobCreatePrintOptions(job, INT_MAX, 1);
+  jc->job_data    = _brfCreateJobData(job, jc->job_options);
+
+  //
+  // Get input file format
+  //
+
   informat = papplJobGetFormat(job);
   papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
               "Input file format: %s", informat);
- 
 
+  //
+  // Find filters to use for this job
+  //
+
+  for (conversion =
+           (brf_spooling_conversion_t *)
+               cupsArrayFirst(spooling_conversions);
+       conversion;
+       conversion =
+           (brf_spooling_conversion_t *)
+               cupsArrayNext(spooling_conversions))
+   
+  {
+    if (strcmp(conversion->srctype, informat) == 0)
+    {
+      // Text is translated natively unless the job needs texttobrf or
+      // texttobrf would lay it out with file2brl...
+      if (conversion->filters[conversion->num_filters - 1].function == brfTranslateFilter && (!brfTranslateGetParams(jc->job_options, jc->job_data->filter_data->num_options, jc->job_data->filter_data->options, &jc->translate_params) || !brfTranslateCanSplit(&jc->translate_params)))
+        continue;
+
+      // Office documents are read natively unless the archive is one we
+      // can't read...
+      if (conversion->filters[0].function == brfOfficeToTextFilter && !brfOfficeCheck(papplJobGetFilename(job), (const char *)conversion->filters[0].parameters))
+      {
+        papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Unable to read \"%s\" natively, using the external converter.", (const char *)conversion->filters[0].parameters);
+        continue;
+      }
+
+      // Scores go to a warm FreeDots process unless FreeDots is missing...
+      if (conversion->filters[0].function == brfFreeDotsFilter && (!brfTranslateGetParams(jc->job_options, jc->job_data->filter_data->num_options, jc->job_data->filter_data->options, &jc->translate_params) || (jc->freedots = brfFreeDotsAcquire(jc->translate_params.width)) == NULL))
+        continue;
+
+      break;
+    }
+  }
+
+  cupsArrayDelete(spooling_conversions);
+
+  if (conversion == NULL )
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR,
+                "No pre-filter found for input format %s",
+                informat);
+    brf_job_chain_delete(jc);
+    return (false);
+  }
+
+  // Filter processes get the printer of this job in their environment, jobs
+  // on other printers run at the same time...
+  if ((jc->envp = brf_job_envp(job, filter_envp)) == NULL)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to create filter environment: %s", strerror(errno));
+    brf_job_chain_delete(jc);
+    return (false);
+  }
+
+  // Set input and output formats for the filter chain
+  jc->job_data->filter_data->content_type = conversion->srctype;
+  jc->job_data->filter_data->final_content_type = conversion->dsttype;
+
+  jc->chain = cupsArrayNew(NULL, NULL);
+
+  for (i = 0; i < conversion->num_filters; i ++)
+  {
+    if (conversion->filters[i].function == brfTranslateFilter)
+    {
+      jc->translate_params.num_workers = num_workers;
+      jc->translate_params.envp        = jc->envp;
+
+      jc->translate            = conversion->filters[i];
+      jc->translate.parameters = &jc->translate_params;
+      cupsArrayAdd(jc->chain, &jc->translate);
+    }
+    else if (conversion->filters[i].function == brfFreeDotsFilter)
+    {
+      jc->music            = conversion->filters[i];
+      jc->music.parameters = jc->freedots;
+      cupsArrayAdd(jc->chain, &jc->music);
+    }
+    else if (conversion->filters[i].function == cfFilterExternal)
+    {
+      jc->external_params      = *(cf_filter_external_t *)conversion->filters[i].parameters;
+      jc->external_params.envp = jc->envp;
+
+      jc->external            = conversion->filters[i];
+      jc->external.function   = brf_external_filter;
+      jc->external.parameters = &jc->external_params;
+      cupsArrayAdd(jc->chain, &jc->external);
+    }
+    else
+      cupsArrayAdd(jc->chain, &(conversion->filters[i]));
+  }
+
+  brfLayoutGetMargins(jc->job_data->filter_data->num_options, jc->job_data->filter_data->options, &jc->top_margin, &jc->left_margin);
+
+  return (true);
+}
+
+
+//
+// 'brf_job_chain_delete()' - Free the filters for a job.
+//
+
+static void
+brf_job_chain_delete(brf_job_chain_t *jc)// I - Filters for the job
+{
+  brfFreeDotsRelease(jc->freedots);
+  jc->freedots = NULL;
+
+  cupsArrayDelete(jc->chain);
+  jc->chain = NULL;
+
+  free(jc->envp);
+  jc->envp = NULL;
+
+  brf_job_data_delete(jc->job_data);
+  jc->job_data = NULL;
+
+  if (jc->job_options)
+  {
+    papplJobDeletePrintOptions(jc->job_options);
+    jc->job_options = NULL;
+  }
+}
+
+
+//
+// 'brf_job_data_delete()' - Free the data from _brfCreateJobData().
+//
+
+static void
+brf_job_data_delete(
+    brf_job_data_t *job_data)		// I - Job data
+{
+  cf_filter_data_t	*filter_data;	// Filter data
+
+
+  if (!job_data)
+    return;
+
+  if ((filter_data = job_data->filter_data) != NULL)
+  {
+    free(filter_data->printer);
+    free(filter_data->job_user);
+    free(filter_data->job_title);
+    cupsFreeOptions(filter_data->num_options, filter_data->options);
+    free(filter_data);
+  }
+
+  free(job_data);
+}
+
+
+//
+// 'brf_job_envp()' - Build the environment for the filter processes of a job.
+//
+// The server's environment is copied with "PRINTER" and "PRINTER_LOCATION"
+// of the job's printer and the `extra` variables, so that jobs on different
+// printers never share the process environment.  The result is a single
+// allocation that is freed with free().
+//
+
+static char **				// O - Environment or `NULL` on error
+brf_job_envp(pappl_job_t *job,		// I - Job
+             char * const *extra)	// I - Extra variables or `NULL`
+{
+  extern char		**environ;	// Server environment
+  pappl_printer_t	*printer = papplJobGetPrinter(job);
+					// Printer
+  const char		*name = papplPrinterGetName(printer);
+					// Printer name
+  const char		*vars[34];	// Variables of the job
+  int			num_vars = 0;	// Number of variables of the job
+  char			location[1024],	// Printer location
+			printervar[1024],// PRINTER variable
+			locationvar[1100];// PRINTER_LOCATION variable
+  char			**envp,		// Environment
+			**ep,		// Current environment pointer
+			**sp,		// Current server variable
+			*ptr;		// Pointer into strings
+  size_t		count,		// Number of variables
+			size,		// Size of strings
+			len;		// Length of variable
+  int			i,		// Looping var
+			j;		// Looping var
+
+
+  for (i = 0; extra && extra[i] && num_vars < 32; i ++)
+    vars[num_vars ++] = extra[i];
+
+  if (name && *name)
+  {
+    snprintf(printervar, sizeof(printervar), "PRINTER=%s", name);
+    vars[num_vars ++] = printervar;
+  }
+
+  if (papplPrinterGetLocation(printer, location, sizeof(location)) && location[0])
+  {
+    snprintf(locationvar, sizeof(locationvar), "PRINTER_LOCATION=%s", location);
+    vars[num_vars ++] = locationvar;
+  }
+
+  // Count the server variables that are kept...
+  for (i = 0, count = 0, size = 0; i < num_vars; i ++, count ++)
+    size += strlen(vars[i]) + 1;
+
+  for (sp = environ; *sp; sp ++)
+  {
+    if (strncmp(*sp, "PRINTER=", 8) && strncmp(*sp, "PRINTER_LOCATION=", 17))
+    {
+      for (j = 0, len = strcspn(*sp, "="); j < num_vars; j ++)
+        if (!strncmp(*sp, vars[j], len + 1))
+          break;
+
+      if (j >= num_vars)
+      {
+        count ++;
+        size += strlen(*sp) + 1;
+      }
+    }
+  }
+
+  // Copy everything into one allocation...
+  if ((envp = malloc((count + 1) * sizeof(char *) + size)) == NULL)
+    return (NULL);
+
+  ptr = (char *)(envp + count + 1);
+  ep  = envp;
+
+  for (sp = environ; *sp && (size_t)(ep - envp) < count - (size_t)num_vars; sp ++)
+  {
+    if (!strncmp(*sp, "PRINTER=", 8) || !strncmp(*sp, "PRINTER_LOCATION=", 17))
+      continue;
+
+    for (j = 0, len = strcspn(*sp, "="); j < num_vars; j ++)
+      if (!strncmp(*sp, vars[j], len + 1))
+        break;
+
+    if (j < num_vars)
+      continue;
+
+    len = strlen(*sp) + 1;
+    memcpy(ptr, *sp, len);
+    *ep++ = ptr;
+    ptr   += len;
+  }
+
+  for (i = 0; i < num_vars; i ++)
+  {
+    len = strlen(vars[i]) + 1;
+    memcpy(ptr, vars[i], len);
+    *ep++ = ptr;
+    ptr   += len;
+  }
+
+  *ep = NULL;
+
+  return (envp);
+}
+
+
+//
+// 'brf_job_chain_finish()' - Wait for the filters of a job to finish.
+//
+// When the job is canceled or `stop` is `true` because the output isn't
+// wanted anymore, the output ends right away and the filters stop at their
+// next chunk, external filters are terminated by the threads that wait for
+// them.  Any output that wasn't read is discarded, so the filters never
+// block writing to the socket.
+//
+
+static bool				// O - `true` if the filters succeeded
+brf_job_chain_finish(
+    brf_job_chain_t *jc,		// I - Filters for the job
+    bool            stop)		// I - Stop the filters?
+{
+  char	buffer[8192];			// Buffer for discarding output
+
+
+  if (stop || papplJobIsCanceled(jc->job))
+  {
+    papplLogJob(jc->job, PAPPL_LOGLEVEL_DEBUG, "Stopping filters of %s job.", stop ? "failed" : "canceled");
+
+    pthread_mutex_lock(&jc->run.mutex);
+    jc->run.stop = true;
+    pthread_mutex_unlock(&jc->run.mutex);
+
+    shutdown(jc->run.keepfd, SHUT_WR);
+  }
+
+  while (read(jc->chainfd, buffer, sizeof(buffer)) > 0);
+
+  pthread_join(jc->tid, NULL);
+
+  close(jc->chainfd);
+  close(jc->run.keepfd);
+
+  jc->chainfd = -1;
+
+  // The chain is gone, filters of the job see the job state again...
+  jc->run.data->iscanceledfunc = (cf_filter_iscanceledfunc_t)brf_job_is_canceled;
+  jc->run.data->iscanceleddata = jc->job;
+
+  pthread_mutex_destroy(&jc->run.mutex);
+
+  return (jc->run.status == 0);
+}
+
+
+//
+// 'brf_job_chain_start()' - Start the filters for a job.
+//
+// The filters run on their own threads, connected by pipes, and the last
+// one writes to a socket, so that brf_job_chain_finish() can end the output
+// with shutdown() while a filter is still writing.  Use
+// brf_job_chain_finish() when done reading.
+//
+// Nothing runs in a forked copy of the server: external filters are started
+// with posix_spawn(), see brf_external_filter().
+//
+
+static int				// O - Output of the filters or `-1` on error
+brf_job_chain_start(
+    brf_job_chain_t *jc)		// I - Filters for the job
+{
+  const char	*filename;		// Input filename
+  int		fd,			// Input file descriptor
+		sv[2],			// Socket pair
+		err;			// Thread creation error
+
+
+  //
+  // Open the input file...
+  //
+
+  filename = papplJobGetFilename(jc->job);
+  if ((fd = open(filename, O_RDONLY | O_CLOEXEC)) < 0)
+  {
+    papplLogJob(jc->job, PAPPL_LOGLEVEL_ERROR, "Unable to open input file '%s' for printing: %s",
+                filename, strerror(errno));
+    return (-1);
+  }
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+  {
+    papplLogJob(jc->job, PAPPL_LOGLEVEL_ERROR, "Unable to create socket pair: %s", strerror(errno));
+    close(fd);
+    return (-1);
+  }
+
+  fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+  fcntl(sv[1], F_SETFD, FD_CLOEXEC);
+
+  jc->run.job      = jc->job;
+  jc->run.inputfd  = fd;
+  jc->run.outputfd = sv[1];
+  jc->run.keepfd   = fcntl(sv[1], F_DUPFD_CLOEXEC, 0);
+  jc->run.data     = jc->job_data->filter_data;
+  jc->run.chain    = jc->chain;
+  jc->run.stop     = false;
+  jc->run.status   = 1;
+
+  pthread_mutex_init(&jc->run.mutex, NULL);
+
+  // The filters stop when the job is canceled or the output isn't wanted
+  // anymore...
+  jc->run.data->iscanceledfunc = (cf_filter_iscanceledfunc_t)brf_chain_is_stopped;
+  jc->run.data->iscanceleddata = &jc->run;
+
+  if ((err = pthread_create(&jc->tid, NULL, (void *(*)(void *))brf_chain_run, &jc->run)) != 0)
+  {
+    papplLogJob(jc->job, PAPPL_LOGLEVEL_ERROR, "Unable to create filter thread: %s", strerror(err));
+
+    jc->run.data->iscanceledfunc = (cf_filter_iscanceledfunc_t)brf_job_is_canceled;
+    jc->run.data->iscanceleddata = jc->job;
+
+    pthread_mutex_destroy(&jc->run.mutex);
+
+    close(fd);
+    close(sv[0]);
+    close(sv[1]);
+    close(jc->run.keepfd);
+    return (-1);
+  }
+
+  return (jc->chainfd = sv[0]);
+}
+
+
+//
+// 'brf_job_is_canceled()' - Tell the filters whether the job was canceled.
+//
+
+static int				// O - 1 if canceled, 0 otherwise
+brf_job_is_canceled(pappl_job_t *job)	// I - Job
+{
+  return (papplJobIsCanceled(job) ? 1 : 0);
+}
+
+
+//
+// 'brf_job_read()' - Read filter output, stopping when the job is canceled.
+//
+
+static ssize_t				// O - Bytes read, 0 at end, or `-1` on error or cancel
+brf_job_read(pappl_job_t *job,		// I - Job
+             int         fd,		// I - File descriptor
+             void        *buffer,	// I - Buffer
+             size_t      bytes)		// I - Size of buffer
+{
+  struct pollfd	pfd;			// Descriptor to poll
+  int		ready;			// Result of poll()
+  ssize_t	rbytes;			// Bytes read
+
+
+  pfd.fd     = fd;
+  pfd.events = POLLIN;
+
+  for (;;)
+  {
+    if (papplJobIsCanceled(job))
+    {
+      errno = ECANCELED;
+      return (-1);
+    }
+
+    if ((ready = poll(&pfd, 1, 1000)) < 0 && errno != EINTR && errno != EAGAIN)
+      return (-1);
+    else if (ready <= 0)
+      continue;
+
+    if ((rbytes = read(fd, buffer, bytes)) < 0 && (errno == EINTR || errno == EAGAIN))
+      continue;
+
+    return (rbytes);
+  }
+}
+
+
+//
+// 'brf_render_ahead_cb()' - Convert and lay out a job ahead of time.
+//
+
+static bool				// O - `true` on success, `false` on failure
+brf_render_ahead_cb(
+    pappl_job_t     *job,		// I - Job
+    brf_layout_cb_t cb,			// I - Output callback
+    void            *cb_data)		// I - Output callback data
+{
+  brf_job_chain_t	jc;		// Filters for the job
+  brf_layout_t		layout;		// Page layout state
+  int			fd;		// Output of the filters
+  ssize_t		bytes = 0;	// Bytes read
+  char			buffer[65536];	// Read buffer
+  bool			ok;		// Output OK?
+
+
+  // Use a single translation worker to stay in the CPU budget...
+  if (!brf_job_chain_create(job, 1, &jc))
+    return (false);
+
+  if ((fd = brf_job_chain_start(&jc)) < 0)
+  {
+    brf_job_chain_delete(&jc);
+    return (false);
+  }
+
+  brfTraceBegin("render-ahead", papplJobGetID(job));
+
+  ok = brfLayoutInit(&layout, jc.top_margin, jc.left_margin, cb, cb_data);
+
+  while (ok && (bytes = brf_job_read(job, fd, buffer, sizeof(buffer))) > 0)
+    ok = brfLayoutWrite(&layout, buffer, (size_t)bytes);
+
+  if (bytes < 0)
+    ok = false;
+
+  if (ok)
+    ok = brfLayoutFinish(&layout);
+
+  if (!brf_job_chain_finish(&jc, !ok))
+    ok = false;
+
+  brf_job_chain_delete(&jc);
+
+  brfTraceEnd("render-ahead", papplJobGetID(job));
+
+  return (ok);
+}
+
+//
+// 'brf_print_filter_function()' - Send the output of the filter chain to the
+//                                 device.
+//
+// When the parameters ask for it, the pages are laid out on the way, so the
+// translated text doesn't need another pass through addmargins.
+//
+
+int                                               // O - Error status
+brf_print_filter_function(int inputfd,            // I - File descriptor input
+                                                  //     stream
+                          int outputfd,           // I - File descriptor output
+                                                  //     stream (unused)
+                          int inputseekable,      // I - Is input stream
+                                                  //     seekable? (unused)
+                          cf_filter_data_t *data, // I - Job and printer data
+                          void *parameters)       // I - PAPPL output device
+{
+  ssize_t bytes;                    // Bytes read/written
+  char buffer[65536];               // Read/write buffer
+  cf_logfunc_t log = data->logfunc; // Log function
+  void *ld = data->logdata;         // log function data
+  brf_print_filter_function_data_t *params =
+      (brf_print_filter_function_data_t *)parameters;
+  pappl_device_t *device = params->device; // PAPPL output device
+  pappl_job_t *job = params->job;
+  pappl_printer_t *printer;
+  brf_printer_app_global_data_t *global_data = params->global_data;
+  brf_print_output_t output;         // Output state
+  ipp_attribute_t *attr;             // sides attribute
+  pappl_pr_driver_data_t driver_data; // Printer driver data
+  brf_layout_t layout;               // Page layout state
+  off_t sent;                        // Bytes sent to the device
+  bool ok;                           // Output OK?
+  char filename[2048]; // Name for debug copy of the
+                       // job
+
+  (void)inputseekable;
+
+  memset(&output, 0, sizeof(output));
+  output.job      = job;
+  output.device   = device;
+  output.lane     = params->lane;
+  output.debug_fd = -1;
+
+  // Clean up the BRF like the printfile callbacks of the drivers do, Index
+  // embossers only take uppercase ASCII BRF and generic ones get CR LF line
+  // endings...
+  papplPrinterGetDriverData(papplJobGetPrinter(job), &driver_data);
+  brfSanitizeInit(&output.sanitize, driver_data.extension ? BRF_SANITIZE_ASCII | BRF_SANITIZE_CONTROL | BRF_SANITIZE_FOLD : BRF_SANITIZE_CRLF);
+
+  // Duplex jobs can only pause at the end of a sheet...
+  if ((attr = papplJobGetAttribute(job, "sides")) != NULL)
+    output.duplex = strcmp(ippGetString(attr, 0, NULL), "one-sided") != 0;
+  else
+    output.duplex = driver_data.sides_default != PAPPL_SIDES_ONE_SIDED;
+
+  if (papplSystemGetLogLevel(global_data->system) == PAPPL_LOGLEVEL_DEBUG)
+  {
+    // We are in debug mode
+    // Debug copy file name (in spool directory)
+    printer = papplJobGetPrinter(job);
+    snprintf(filename, sizeof(filename), "%s/debug-jobdata-%s-%d.prn",
+             global_data->spool_dir, papplPrinterGetName(printer),
+             papplJobGetID(job));
+    if (log)
+      log(ld, CF_LOGLEVEL_DEBUG,
+          "Backend: Creating debug copy of what goes to the printer: %s", filename);
+    // Open the file
+    output.debug_fd = open(filename, O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR);
+  }
+
+  // Device output happens on a separate thread so that the filters can keep
+  // producing data while the embosser is busy...
+  if ((output.writer = brfWriterCreate(device, job, 0, 0)) == NULL)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR,
+          "Backend: Unable to start device writer.");
+    if (output.debug_fd >= 0)
+      close(output.debug_fd);
+    close(inputfd);
+    close(outputfd);
+    return (1);
+  }
+
+  brfTraceBegin("device-output", papplJobGetID(job));
+
+  // The filters set the embosser up on their own, end a document that was
+  // left open for this job...
+  brfSessionClose(job, output.writer);
+
+  // Index the pages as they go by, for the page count and the debug copy...
+  output.pgindex = brfPageIndexCreate();
+
+  // Keep the output so a failed job can be resumed where it stopped...
+  output.ckpt = brfCheckpointCreate(job, global_data->spool_dir);
+
+  // ... and keep complete output for reprints...
+  if (!papplJobGetAttribute(job, "page-ranges"))
+    output.retain = brfRetainCreate(job);
+
+  if (params->layout)
+    ok = brfLayoutInit(&layout, params->top_margin, params->left_margin, (brf_layout_cb_t)brf_print_output, &output);
+  else
+    ok = true;
+
+  while (ok && (bytes = brf_job_read(job, inputfd, buffer, sizeof(buffer))) > 0)
+  {
+    if (params->layout)
+      ok = brfLayoutWrite(&layout, buffer, (size_t)bytes);
+    else
+      ok = brf_print_output(&output, buffer, (size_t)bytes) >= 0;
+  }
+
+  if (ok && params->layout)
+    ok = brfLayoutFinish(&layout);
+
+  // Wait for the device to take the rest of the data...
+  sent = output.base + brfWriterGetSent(output.writer);
+
+  if (!brfWriterFinish(output.writer))
+    ok = false;
+  else
+    sent = output.queued;
+
+  brfCheckpointFinish(output.ckpt, output.pgindex, sent, ok);
+  brfRetainFinish(output.retain, ok);
+
+  brfSanitizeFinish(&output.sanitize, job);
+  free(output.clean);
+
+  brfTraceEnd("device-output", papplJobGetID(job));
+
+  if (!ok)
+  {
+    if (papplJobIsCanceled(job))
+      papplLogJob(job, PAPPL_LOGLEVEL_INFO, "Backend: Job canceled, output to device stopped.");
+    else if (log)
+      log(ld, CF_LOGLEVEL_ERROR,
+          "Backend: Output to device: Unable to send job data to printer.");
+    brfPageIndexDelete(output.pgindex);
+    if (output.debug_fd >= 0)
+      close(output.debug_fd);
+    close(inputfd);
+    close(outputfd);
+    return (1);
+  }
+
+  papplJobSetImpressionsCompleted(job, brfPageIndexGetCount(output.pgindex));
+
+  if (output.debug_fd >= 0)
+  {
+    close(output.debug_fd);
+    brfPageIndexSave(output.pgindex, filename);
+  }
+
+  brfPageIndexDelete(output.pgindex);
+
+  close(inputfd);
+  close(outputfd);
+  return (0);
+}
+
+
+//
+// 'brf_chain_is_stopped()' - Tell the filters whether to stop.
+//
+
+static int				// O - 1 to stop, 0 otherwise
+brf_chain_is_stopped(
+    brf_chain_run_t *run)		// I - Filter chain data
+{
+  bool	stop;				// Stop the filters?
+
+
+  pthread_mutex_lock(&run->mutex);
+  stop = run->stop;
+  pthread_mutex_unlock(&run->mutex);
+
+  return (stop || papplJobIsCanceled(run->job) ? 1 : 0);
+}
+
+
+//
+// 'brf_chain_run()' - Run a filter chain and end its output.
+//
+// Unlike cfFilterChain(), which forks a copy of the server for each filter
+// of a longer chain, every filter gets a thread and a pipe to the next one.
+// The last filter runs on this thread.
+//
+
+static void *				// O - Thread exit status (unused)
+brf_chain_run(brf_chain_run_t *run)	// I - Filter chain thread data
+{
+  brf_filter_run_t	filters[BRF_CHAIN_MAX_FILTERS];
+					// Filters
+  pthread_t		tids[BRF_CHAIN_MAX_FILTERS];
+					// Filter threads
+  bool			started[BRF_CHAIN_MAX_FILTERS];
+					// Filter thread started?
+  cf_filter_filter_in_chain_t *filter;	// Current filter
+  int			i,		// Looping var
+			num_filters,	// Number of filters
+			inputfd,	// Input of current filter
+			fds[2],		// Pipe to next filter
+			err;		// Thread creation error
+
+
+  brfTraceBegin("filter-chain", run->data->job_id);
+
+  if ((num_filters = cupsArrayCount(run->chain)) > BRF_CHAIN_MAX_FILTERS)
+    num_filters = BRF_CHAIN_MAX_FILTERS;
+
+  memset(started, 0, sizeof(started));
+
+  if (num_filters < 1)
+  {
+    close(run->inputfd);
+    close(run->outputfd);
+    num_filters = 0;
+  }
+
+  run->status = num_filters ? 0 : 1;
+  inputfd     = run->inputfd;
+
+  for (i = 0, filter = (cf_filter_filter_in_chain_t *)cupsArrayFirst(run->chain); i < num_filters && filter; i ++, filter = (cf_filter_filter_in_chain_t *)cupsArrayNext(run->chain))
+  {
+    filters[i].filter        = filter;
+    filters[i].inputfd       = inputfd;
+    filters[i].inputseekable = i == 0;
+    filters[i].data          = run->data;
+    filters[i].status        = 1;
+
+    if (i == (num_filters - 1))
+    {
+      // The last filter writes to the socket on this thread...
+      filters[i].outputfd = run->outputfd;
+      brf_filter_run(filters + i);
+      break;
+    }
+
+    if (pipe(fds))
+    {
+      papplLogJob(run->job, PAPPL_LOGLEVEL_ERROR, "Unable to create filter pipe: %s", strerror(errno));
+      close(inputfd);
+      close(run->outputfd);
+      run->status = 1;
+      break;
+    }
+
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+    filters[i].outputfd = fds[1];
+    inputfd             = fds[0];
+
+    if ((err = pthread_create(tids + i, NULL, (void *(*)(void *))brf_filter_run, filters + i)) != 0)
+    {
+      // The next filter sees the end of its input...
+      papplLogJob(run->job, PAPPL_LOGLEVEL_ERROR, "Unable to create filter thread: %s", strerror(err));
+      close(filters[i].inputfd);
+      close(filters[i].outputfd);
+    }
+    else
+      started[i] = true;
+  }
+
+  for (; i >= 0; i --)
+  {
+    if (i < (num_filters - 1) && started[i])
+      pthread_join(tids[i], NULL);
+
+    if (i < num_filters && filters[i].status && !run->status)
+      run->status = filters[i].status;
+  }
+
+  brfTraceEnd("filter-chain", run->data->job_id);
+
+  shutdown(run->keepfd, SHUT_WR);
+
+  return (NULL);
+}
+
+
+//
+// 'brf_external_envp()' - Add the content types to a filter environment.
+//
+// The result is a single allocation that is freed with free().
+//
+
+static char **				// O - Environment or `NULL` on error
+brf_external_envp(
+    cf_filter_data_t *data,		// I - Job and printer data
+    char             **envp)		// I - Environment of the job
+{
+  extern char	**environ;		// Server environment
+  char		**newenv,		// New environment
+		**ep,			// Current new variable
+		*ptr;			// Pointer into strings
+  size_t	count,			// Number of variables
+		size;			// Size of content type strings
+  int		len;			// Length of variable
+
+
+  if (!envp)
+    envp = environ;
+
+  for (count = 0; envp[count]; count ++);
+
+  size = 34 + strlen(data->content_type ? data->content_type : "") + strlen(data->final_content_type ? data->final_content_type : "");
+
+  if ((newenv = malloc((count + 3) * sizeof(char *) + size)) == NULL)
+    return (NULL);
+
+  ptr = (char *)(newenv + count + 3);
+
+  for (ep = newenv; *envp; envp ++)
+  {
+    if (strncmp(*envp, "CONTENT_TYPE=", 13) && strncmp(*envp, "FINAL_CONTENT_TYPE=", 19))
+      *ep++ = *envp;
+  }
+
+  *ep++ = ptr;
+  len   = snprintf(ptr, size, "CONTENT_TYPE=%s", data->content_type ? data->content_type : "") + 1;
+  ptr   += len;
+  *ep++ = ptr;
+  snprintf(ptr, size - (size_t)len, "FINAL_CONTENT_TYPE=%s", data->final_content_type ? data->final_content_type : "");
+  *ep   = NULL;
 
-  //    return (false);
+  return (newenv);
+}
 
-  // Find filters to use for this job
-  //
 
-  for (conversion =
-           (brf_spooling_conversion_t *)
-               cupsArrayFirst(spooling_conversions);
-       conversion;
-       conversion =
-           (brf_spooling_conversion_t *)
-               cupsArrayNext(spooling_conversions))
-   
+//
+// 'brf_external_filter()' - Run an external filter with a CPU token.
+//
+// The filter is started with posix_spawn() like a CUPS filter, in a process
+// group of its own, with only its standard input, output, and error open.
+// Its output is copied to the next filter, so that the token can be
+// returned while the next filter doesn't read, and the messages on its
+// standard error go to the job log.  When the chain is stopped, the process
+// group gets SIGTERM, and SIGKILL when it doesn't exit in time.  This thread
+// is the only one waiting for the filter, so the signals never reach a
+// reused process ID.
+//
+
+static int				// O - Exit status
+brf_external_filter(
+    int              inputfd,		// I - File descriptor input stream
+    int              outputfd,		// I - File descriptor output stream
+    int              inputseekable,	// I - Is input stream seekable? (unused)
+    cf_filter_data_t *data,		// I - Job and printer data
+    void             *parameters)	// I - cfFilterExternal() parameters
+{
+  cf_filter_external_t	*params = (cf_filter_external_t *)parameters;
+					// Filter parameters
+  posix_spawnattr_t	attr;		// Child attributes
+  posix_spawn_file_actions_t actions;	// Child file actions
+  sigset_t		mask;		// Signal mask of the child
+  pid_t			pid;		// Filter process ID
+  char			*argv[7],	// Filter arguments
+			job_id[16],	// Job ID argument
+			copies[16],	// Copies argument
+			*options,	// Options argument
+			**envp;		// Filter environment
+  int			outpipe[2],	// Standard output of the filter
+			errpipe[2],	// Standard error of the filter
+			token,		// CPU token
+			status,		// Exit status
+			fd,		// Looping var
+			maxfd,		// Maximum file descriptor
+			flags,		// File descriptor flags
+			err;		// Spawn error
+  struct pollfd		pfds[2];	// Pipes to poll
+  char			buffer[32768],	// Copy buffer
+			line[2048];	// Message from the filter
+  size_t		linelen = 0;	// Length of message
+  ssize_t		bytes;		// Bytes read
+  time_t		stopped = 0;	// Time the filter was stopped
+  bool			killed = false,	// Sent SIGKILL?
+			ok = true;	// Output copied?
+
+
+  (void)inputseekable;
+
+  if (!brfCPUAcquire(data, &token))
   {
-    if (strcmp(conversion->srctype, informat) == 0)
+    close(inputfd);
+    close(outputfd);
+    return (1);
+  }
 
-      break;
-    
+  // CUPS filter arguments and environment...
+  snprintf(job_id, sizeof(job_id), "%d", data->job_id);
+  snprintf(copies, sizeof(copies), "%d", data->copies > 0 ? data->copies : 1);
+
+  options = brf_external_options(data, params);
+  envp    = brf_external_envp(data, params->envp);
+
+  argv[0] = data->printer ? data->printer : (char *)params->filter;
+  argv[1] = job_id;
+  argv[2] = data->job_user ? data->job_user : "";
+  argv[3] = data->job_title ? data->job_title : "";
+  argv[4] = copies;
+  argv[5] = options ? options : "";
+  argv[6] = NULL;
+
+  if (!envp || pipe(outpipe))
+  {
+    if (data->logfunc)
+      data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "Unable to start \"%s\": %s", params->filter, strerror(errno));
+
+    free(options);
+    free(envp);
+    close(inputfd);
+    close(outputfd);
+    brfCPURelease(token);
+    return (1);
   }
-  if (conversion == NULL )
+
+  if (pipe(errpipe))
   {
-    papplLogJob(job, PAPPL_LOGLEVEL_ERROR,
-                "No pre-filter found for input format %s",
-                informat);
-    return (false);
+    if (data->logfunc)
+      data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "Unable to start \"%s\": %s", params->filter, strerror(errno));
+
+    free(options);
+    free(envp);
+    close(outpipe[0]);
+    close(outpipe[1]);
+    close(inputfd);
+    close(outputfd);
+    brfCPURelease(token);
+    return (1);
   }
-  // Set input and output formats for the filter chain
-  job_data->filter_data->content_type = conversion->srctype;
-  job_data->filter_data->final_content_type = conversion->dsttype;
 
-  //
-  // Connect the job's filter_data to the backend
-  //
+  fcntl(outpipe[0], F_SETFD, FD_CLOEXEC);
+  fcntl(outpipe[1], F_SETFD, FD_CLOEXEC);
+  fcntl(errpipe[0], F_SETFD, FD_CLOEXEC);
+  fcntl(errpipe[1], F_SETFD, FD_CLOEXEC);
 
-  if (strncmp(device_uri, "cups:", 5) == 0)
+  // Own process group, default signal handling, and nothing of the server
+  // open but the pipes...
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+  posix_spawnattr_setpgroup(&attr, 0);
+
+  sigemptyset(&mask);
+  posix_spawnattr_setsigmask(&attr, &mask);
+
+  sigaddset(&mask, SIGTERM);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGHUP);
+  sigaddset(&mask, SIGPIPE);
+  posix_spawnattr_setsigdefault(&attr, &mask);
+
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, inputfd, 0);
+  posix_spawn_file_actions_adddup2(&actions, outpipe[1], 1);
+  posix_spawn_file_actions_adddup2(&actions, errpipe[1], 2);
+
+  for (fd = 3, maxfd = (int)sysconf(_SC_OPEN_MAX); fd < maxfd && fd < 65536; fd ++)
   {
-    // Get the device data
-    device_data = (brf_cups_device_data_t *)papplDeviceGetData(device);
+    if ((flags = fcntl(fd, F_GETFD)) >= 0 && !(flags & FD_CLOEXEC))
+      posix_spawn_file_actions_addclose(&actions, fd);
+  }
 
-    // Connect the filter_data
-    device_data->filter_data = job_data->filter_data;
+  err = posix_spawn(&pid, params->filter, &actions, &attr, argv, envp);
+
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+
+  free(options);
+  free(envp);
+
+  close(inputfd);
+  close(outpipe[1]);
+  close(errpipe[1]);
+
+  if (err)
+  {
+    if (data->logfunc)
+      data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "Unable to start \"%s\": %s", params->filter, strerror(err));
+
+    close(outpipe[0]);
+    close(errpipe[0]);
+    close(outputfd);
+    brfCPURelease(token);
+    return (1);
   }
 
-  //
-  // Set up filter function chain
-  //
+  if (data->logfunc)
+    data->logfunc(data->logdata, CF_LOGLEVEL_DEBUG, "Started \"%s\" (PID %d).", params->filter, (int)pid);
 
-  chain = cupsArrayNew(NULL, NULL);
+  // Copy the output and log the messages until both pipes are closed...
+  pfds[0].fd     = outpipe[0];
+  pfds[0].events = POLLIN;
+  pfds[1].fd     = errpipe[0];
+  pfds[1].events = POLLIN;
 
-  for (int i = 0; i < conversion->num_filters; i++){
-    cupsArrayAdd(chain, &(conversion->filters[i]));
-   
+  while (pfds[0].fd >= 0 || pfds[1].fd >= 0)
+  {
+    if (!stopped && (!ok || (data->iscanceledfunc && (data->iscanceledfunc)(data->iscanceleddata))))
+    {
+      if (data->logfunc)
+        data->logfunc(data->logdata, CF_LOGLEVEL_DEBUG, "Stopping \"%s\" (PID %d).", params->filter, (int)pid);
+
+      kill(-pid, SIGTERM);
+      stopped = time(NULL);
+    }
+    else if (stopped && !killed && (time(NULL) - stopped) >= BRF_CANCEL_TIMEOUT)
+    {
+      kill(-pid, SIGKILL);
+      killed = true;
     }
-    
-    chain_filter = NULL;
-  print =
-      (cf_filter_filter_in_chain_t *)calloc(1, sizeof(cf_filter_filter_in_chain_t));
-  // Put filter function to send data to PAPPL's built-in backend at the end
-  // of the chain
-  print_params =
-      (brf_print_filter_function_data_t *)
-          calloc(1, sizeof(brf_print_filter_function_data_t));
-  print_params->device = device;
-  print_params->device_uri = device_uri;
-  print_params->job = job;
-  print_params->global_data = global_data;
-  print->function = brf_print_filter_function;
-  print->parameters = print_params;
-  print->name = "Backend";
-  cupsArrayAdd(chain, print);
 
-  // //
-  // // Update status
-  // //
+    if (poll(pfds, 2, 1000) <= 0)
+      continue;
 
-  // pr_update_status(papplJobGetPrinter(job), device);
+    if (pfds[0].revents)
+    {
+      if ((bytes = read(pfds[0].fd, buffer, sizeof(buffer))) > 0)
+      {
+        // Output that isn't wanted anymore is discarded...
+        if (ok && !brfCPUWrite(data, &token, outputfd, buffer, (size_t)bytes))
+          ok = false;
+      }
+      else if (bytes == 0 || (errno != EINTR && errno != EAGAIN))
+      {
+        close(pfds[0].fd);
+        pfds[0].fd = -1;
+      }
+    }
 
-  //
-  // Fire up the filter functions
-  //
+    if (pfds[1].revents)
+    {
+      if ((bytes = read(pfds[1].fd, line + linelen, sizeof(line) - linelen - 1)) > 0)
+      {
+        char	*start,			// Start of message
+		*end;			// End of message
 
-  papplJobSetImpressions(job, 1);
+        linelen += (size_t)bytes;
+        line[linelen] = '\0';
 
-  // The filter chain has no output, data is going to the device
-  nullfd = open("/dev/null", O_RDWR);
+        for (start = line; (end = strchr(start, '\n')) != NULL; start = end + 1)
+        {
+          *end = '\0';
+          brf_external_log(data, start);
+        }
 
-  if (cfFilterChain(fd, nullfd, 1, job_data->filter_data, chain) == 0)
-    ret = true;
+        if (start == line && linelen == (sizeof(line) - 1))
+        {
+          // Log a message that doesn't fit in pieces...
+          brf_external_log(data, line);
+          linelen = 0;
+        }
+        else if (start > line)
+        {
+          linelen -= (size_t)(start - line);
+          memmove(line, start, linelen);
+        }
+      }
+      else if (bytes == 0 || (errno != EINTR && errno != EAGAIN))
+      {
+        close(pfds[1].fd);
+        pfds[1].fd = -1;
+      }
+    }
+  }
 
-  // //
-  // // Update status
-  // //
+  if (linelen > 0)
+  {
+    line[linelen] = '\0';
+    brf_external_log(data, line);
+  }
 
- 
+  while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
 
-  return (ret);
+  close(outputfd);
+  brfCPURelease(token);
+
+  if (WIFEXITED(status) && !WEXITSTATUS(status))
+    return (ok && !stopped ? 0 : 1);
+
+  if (data->logfunc && !stopped)
+  {
+    if (WIFEXITED(status))
+      data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "\"%s\" (PID %d) stopped with status %d.", params->filter, (int)pid, WEXITSTATUS(status));
+    else
+      data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "\"%s\" (PID %d) crashed on signal %d.", params->filter, (int)pid, WTERMSIG(status));
+  }
+
+  return (1);
 }
 
-int                                               // O - Error status
-brf_print_filter_function(int inputfd,            // I - File descriptor input
-                                                  //     stream
-                          int outputfd,           // I - File descriptor output
-                                                  //     stream (unused)
-                          int inputseekable,      // I - Is input stream
-                                                  //     seekable? (unused)
-                          cf_filter_data_t *data, // I - Job and printer data
-                          void *parameters)       // I - PAPPL output device
-{
-  ssize_t bytes;                    // Bytes read/written
-  char buffer[65536];               // Read/write buffer
-  cf_logfunc_t log = data->logfunc; // Log function
-  void *ld = data->logdata;         // log function data
-  brf_print_filter_function_data_t *params =
-      (brf_print_filter_function_data_t *)parameters;
-  pappl_device_t *device = params->device; // PAPPL output device
-  pappl_job_t *job = params->job;
-  pappl_printer_t *printer;
-  brf_printer_app_global_data_t *global_data = params->global_data;
-  char filename[2048]; // Name for debug copy of the
-                       // job
-  int debug_fd = -1;   // File descriptor for debug copy
 
-  (void)inputseekable;
+//
+// 'brf_external_log()' - Log a message from an external filter.
+//
+// The level comes from the CUPS message prefix, "PAGE:" and similar control
+// messages are logged for debugging.
+//
+
+static void
+brf_external_log(cf_filter_data_t *data,// I - Job and printer data
+                 char             *line)// I - Message
+{
+  cf_loglevel_t	level = CF_LOGLEVEL_DEBUG;
+					// Log level
 
 
+  if (!data->logfunc || !*line)
+    return;
 
-  if (papplSystemGetLogLevel(global_data->system) == PAPPL_LOGLEVEL_DEBUG)
+  if (!strncmp(line, "ERROR:", 6))
   {
-    // We are in debug mode
-    // Debug copy file name (in spool directory)
-    printer = papplJobGetPrinter(job);
-    snprintf(filename, sizeof(filename), "%s/debug-jobdata-%s-%d.prn",
-             global_data->spool_dir, papplPrinterGetName(printer),
-             papplJobGetID(job));
-    if (log)
-      log(ld, CF_LOGLEVEL_DEBUG,
-          "Backend: Creating debug copy of what goes to the printer: %s", filename);
-    // Open the file
-    debug_fd = open(filename, O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR);
+    level = CF_LOGLEVEL_ERROR;
+    line  += 6;
+  }
+  else if (!strncmp(line, "WARNING:", 8))
+  {
+    level = CF_LOGLEVEL_WARN;
+    line  += 8;
   }
+  else if (!strncmp(line, "INFO:", 5))
+  {
+    level = CF_LOGLEVEL_INFO;
+    line  += 5;
+  }
+  else if (!strncmp(line, "DEBUG:", 6))
+    line += 6;
+
+  while (*line == ' ')
+    line ++;
+
+  data->logfunc(data->logdata, level, "%s", line);
+}
+
+
+//
+// 'brf_external_options()' - Encode the options argument of a filter.
+//
+// Options of the filter parameters are added to the job options, spaces,
+// quotes, and backslashes in values are quoted for cupsParseOptions().
+//
+
+static char *				// O - Options string or `NULL` on error
+brf_external_options(
+    cf_filter_data_t     *data,		// I - Job and printer data
+    cf_filter_external_t *params)	// I - Filter parameters
+{
+  int		num_options = 0,	// Number of options
+		i;			// Looping var
+  cups_option_t	*options = NULL,	// Options
+		*option;		// Current option
+  size_t	size = 1;		// Size of string
+  char		*s,			// Options string
+		*ptr;			// Pointer into string
+  const char	*value;			// Pointer into value
+
+
+  for (i = 0; i < data->num_options; i ++)
+    num_options = cupsAddOption(data->options[i].name, data->options[i].value, num_options, &options);
+
+  for (i = 0; i < params->num_options; i ++)
+    num_options = cupsAddOption(params->options[i].name, params->options[i].value, num_options, &options);
+
+  for (i = num_options, option = options; i > 0; i --, option ++)
+    size += strlen(option->name) + 2 * strlen(option->value) + 2;
 
-  while ((bytes = read(inputfd, buffer, sizeof(buffer))) > 0)
+  if ((s = malloc(size)) != NULL)
   {
-    if (debug_fd >= 0)
-      if (write(debug_fd, buffer, (size_t)bytes) != bytes)
+    for (i = num_options, option = options, ptr = s; i > 0; i --, option ++)
+    {
+      if (ptr > s)
+        *ptr++ = ' ';
+
+      ptr += strlen(strcpy(ptr, option->name));
+      *ptr++ = '=';
+
+      for (value = option->value; *value; value ++)
       {
-        if (log)
-          log(ld, CF_LOGLEVEL_ERROR,
-              "Backend: Debug copy: Unable to write %d bytes, stopping debug copy, continuing job output.",
-              (int)bytes);
-        close(debug_fd);
-        debug_fd = -1;
+        if (strchr(" \t\"'\\", *value))
+          *ptr++ = '\\';
+
+        *ptr++ = *value;
       }
-    return (false);
+    }
+
+    *ptr = '\0';
+  }
+
+  cupsFreeOptions(num_options, options);
+
+  return (s);
+}
+
+
+//
+// 'brf_filter_run()' - Run a filter of a chain.
+//
+
+static void *				// O - Thread exit status (unused)
+brf_filter_run(brf_filter_run_t *run)	// I - Filter thread data
+{
+  run->status = (run->filter->function)(run->inputfd, run->outputfd, run->inputseekable, run->data, run->filter->parameters);
+
+  return (NULL);
+}
+
+
+//
+// 'brf_print_ahead_cb()' - Print a job ahead of a larger one.
+//
+// Raw BRF goes to the driver, everything else through the filters.
+//
+
+static bool				// O - `true` on success, `false` on failure
+brf_print_ahead_cb(pappl_job_t    *job,	// I - Job to print
+                   pappl_device_t *device)
+					// I - Output device
+{
+  pappl_printer_t	*printer = papplJobGetPrinter(job);
+					// Printer
+  pappl_pr_driver_data_t driver_data;	// Driver data
+  pappl_pr_options_t	*options;	// Job options
+  brf_cups_device_data_t *device_data = NULL;
+					// CUPS backend data, if any
+  cf_filter_data_t	*filter_data = NULL;
+					// Filter data of the larger job
+  bool			ret;		// Return value
+
+
+  papplPrinterGetDriverData(printer, &driver_data);
+
+  if (!strncmp(papplPrinterGetDeviceURI(printer), "cups:", 5))
+  {
+    device_data = (brf_cups_device_data_t *)papplDeviceGetData(device);
+    filter_data = device_data->filter_data;
+  }
+
+  if (driver_data.format && !strcmp(papplJobGetFormat(job), driver_data.format))
+  {
+    options = papplJobCreatePrintOptions(job, INT_MAX, 0);
+    ret     = (driver_data.printfile_cb)(job, options, device);
+    papplJobDeletePrintOptions(options);
+  }
+  else
+    ret = BRFTestFilterCB(job, device, NULL);
+
+  if (device_data)
+    device_data->filter_data = filter_data;
+
+  return (ret);
+}
+
+
+//
+// 'brf_print_output()' - Clean up data and send it to the device, recording
+//                        progress and pausing for more urgent jobs at page
+//                        boundaries.
+//
+
+static ssize_t				// O - Bytes written or `-1` on error
+brf_print_output(
+    brf_print_output_t *output,		// I - Output state
+    const void         *buffer,		// I - Data
+    size_t             bytes)		// I - Number of bytes
+{
+  const unsigned char	*ptr,		// Pointer into clean data
+			*ff;		// Form feed
+  unsigned char		*clean;		// New clean buffer
+  size_t		len,		// Length up to form feed
+			size,		// Size needed for clean data
+			total = bytes;	// Bytes of input data
 
-    if (papplDeviceWrite(device, buffer, (size_t)bytes) < 0)
+
+  // Clean up the data first...
+  if ((size = 2 * bytes + 4) > output->cleansize)
+  {
+    if ((clean = realloc(output->clean, size)) == NULL)
     {
-      if (log)
-        log(ld, CF_LOGLEVEL_ERROR,
-            "Backend: Output to device: Unable to send %d bytes to printer.",
-            (int)bytes);
-      if (debug_fd >= 0)
-        close(debug_fd);
-      close(inputfd);
-      close(outputfd);
-      return (1);
+      papplLogJob(output->job, PAPPL_LOGLEVEL_ERROR, "Backend: Unable to allocate %d bytes: %s", (int)size, strerror(errno));
+      return (-1);
     }
+
+    output->clean     = clean;
+    output->cleansize = size;
   }
-  papplDeviceFlush(device);
 
-  if (debug_fd >= 0)
-    close(debug_fd);
+  ptr   = output->clean;
+  bytes = brfSanitize(&output->sanitize, buffer, bytes, output->clean);
 
-  close(inputfd);
-  close(outputfd);
-  return (0);
+  while ((ff = memchr(ptr, '\f', bytes)) != NULL)
+  {
+    len = (size_t)(ff - ptr) + 1;
+
+    if (brf_print_send(output, ptr, len) < 0)
+      return (-1);
+
+    ptr   += len;
+    bytes -= len;
+
+    brfCheckpointUpdate(output->ckpt, output->pgindex, output->base + brfWriterGetSent(output->writer));
+
+    // Other jobs can only go first at the end of a sheet with duplex...
+    if (output->lane != BRF_LANE_URGENT && (!output->duplex || !(brfPageIndexGetPagesBefore(output->pgindex, output->queued) & 1)) && brfSchedulerShouldYield(output->job, output->lane))
+    {
+      // Finish the page on the device, print the other jobs, and go on...
+      if (!brfWriterFinish(output->writer))
+      {
+        output->writer = NULL;
+        return (-1);
+      }
+
+      output->base = output->queued;
+      brfCheckpointUpdate(output->ckpt, output->pgindex, output->base);
+
+      brfSchedulerYield(output->job, output->lane, output->device);
+
+      // End a document the jobs printed ahead left open, this job's output
+      // sets the embosser up on its own...
+      if ((output->writer = brfWriterCreate(output->device, output->job, 0, 0)) == NULL || !brfSessionClose(output->job, output->writer))
+        return (-1);
+    }
+  }
+
+  if (bytes > 0 && brf_print_send(output, ptr, bytes) < 0)
+    return (-1);
+
+  return ((ssize_t)total);
 }
+
+
 //
-// 'brfCreateJobData()' - Load the printer's PPD file and set the PPD options
-//                          according to the job options
+// 'brf_print_send()' - Send data to the device, the page index, the kept
+//                      output, and the debug copy.
 //
-typedef struct brf_job_data_s		// Job data
+
+static ssize_t				// O - Bytes written or `-1` on error
+brf_print_send(
+    brf_print_output_t *output,		// I - Output state
+    const void         *buffer,		// I - Data
+    size_t             bytes)		// I - Number of bytes
 {
-  char                  *device_uri;    // Printer device URI
-                                          // PPD file to be used by CUPS filters
-  cf_filter_data_t         *filter_data;   // Common print job data for filter
-                                        // functions
-  char                  *stream_filter; // CUPS Filter to use when printing
-                                        // in streaming mode (Raster input)
-  cups_array_t          *chain;         // Filter function chain
-  cf_filter_filter_in_chain_t *ppd_filter, // Filter from PPD file
-                        *print;         // Filter function call for printing
-  int                   device_fd;      // File descriptor to pipe output
-                                        // to the device
-  int                   device_pid;     // Process ID for device output
-                                        // sub-process
-  FILE                  *device_file;   // File pointer for output to
-                                        // device
-  int                   line_count;     // Raster lines actually received for
-                                        // this page
-  void                  *data;          // Job-type-specific data
-  brf_printer_app_global_data_t *global_data; // Global data
-} brf_job_data_t;
+  brfPageIndexScan(output->pgindex, buffer, bytes);
+  brfCheckpointWrite(output->ckpt, buffer, bytes);
+  brfRetainWrite(output->retain, buffer, bytes);
+
+  if (output->debug_fd >= 0 && write(output->debug_fd, buffer, bytes) != (ssize_t)bytes)
+  {
+    papplLogJob(output->job, PAPPL_LOGLEVEL_ERROR, "Backend: Debug copy: Unable to write %d bytes, stopping debug copy, continuing job output.", (int)bytes);
+    close(output->debug_fd);
+    output->debug_fd = -1;
+  }
+
+  if (brfWriterWrite(output->writer, buffer, bytes) < 0)
+  {
+    papplLogJob(output->job, PAPPL_LOGLEVEL_ERROR, "Backend: Output to device: Unable to send %d bytes to printer.", (int)bytes);
+    return (-1);
+  }
+
+  output->queued += (off_t)bytes;
 
+  return ((ssize_t)bytes);
+}
+//
+// 'brfCreateJobData()' - Load the printer's PPD file and set the PPD options
+//                          according to the job options
+//
 brf_job_data_t *
 _brfCreateJobData(pappl_job_t *job,
 		   pappl_pr_options_t *job_options)
@@ -827,6 +2540,7 @@ _brfCreateJobData(pappl_job_t *job,
   
   brf_job_data_t         *job_data;      // PPD data for job
   pappl_pr_driver_data_t driver_data;   // Printer driver data
+  const brf_drv_model_t  *model;        // Driver model, if any
   int		        num_options = 0;// Number of PPD print options
   cups_option_t	        *options = NULL;// PPD print options
   cups_option_t         *opt;
@@ -894,6 +2608,19 @@ _brfCreateJobData(pappl_job_t *job,
     num_options = cupsAddOption("page-ranges", buf, num_options, &(options));
   }
 
+  // Driver options from the .drv files go to the filters under their PPD
+  // option names...
+  if ((model = (const brf_drv_model_t *)driver_data.extension) != NULL)
+  {
+    for (i = 0; i < model->num_options; i ++)
+    {
+      if ((val = cupsGetOption(model->options[i]->keyword, job_options->num_vendor, job_options->vendor)) == NULL)
+        val = model->options[i]->choices[model->options[i]->default_choice];
+
+      num_options = cupsAddOption(model->options[i]->name, val, num_options, &(options));
+    }
+  }
+
   // // Finishings
   // papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Adding options for finishings");
   // if (job_options->finishings & PAPPL_FINISHINGS_PUNCH)
@@ -1017,21 +2744,18 @@ _brfCreateJobData(pappl_job_t *job,
 				num_options, &(options));
   }
 
+  // Job priority for the order of CPU-intensive stages, see brfCPUAcquire()
+  snprintf(buf, sizeof(buf) - 1, "%d", papplJobGetPriority(job));
+  num_options = cupsAddOption("job-priority", buf,
+			      num_options, &(options));
+
   // Log the option settings which will get used
   papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "options to be used:");
   for (i = num_options, opt = options; i > 0; i --, opt ++)
     papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "  %s=%s", opt->name, opt->value);
 
-  // Set environment variables for filters
-  if ((val = papplPrinterGetName(printer)) != NULL && val[0])
-    setenv("PRINTER", val, 1);
-  else
-    unsetenv("PRINTER");
-  if ((val = papplPrinterGetLocation(printer, buf, sizeof(buf))) != NULL &&
-      buf[0])
-    setenv("PRINTER_LOCATION", val, 1);
-  else
-    unsetenv("PRINTER_LOCATION");
+  // The printer of the job goes into the filter environment, see
+  // brf_job_envp()...
 
   // Clean up
   ippDelete(driver_attrs);
@@ -1057,9 +2781,9 @@ _brfCreateJobData(pappl_job_t *job,
   filter_data->logfunc = (cf_logfunc_t)papplLogJob; // Job log function catching page counts
                                     // ("PAGE: XX YY" messages)
   filter_data->logdata = job;
-  // filter_data->iscanceledfunc = _prJobIsCanceled; // Function to indicate
-  //                                                 // whether the job got
-  //                                                 // canceled
+  filter_data->iscanceledfunc = (cf_filter_iscanceledfunc_t)brf_job_is_canceled;
+					// Function to indicate whether the job
+					// got canceled
   filter_data->iscanceleddata = job;
 
  
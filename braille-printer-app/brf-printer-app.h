@@ -0,0 +1,391 @@
+//
+// Private header for the Braille Printer Application
+//
+// Copyright © 2022 Chandresh Soni
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#ifndef _BRF_PRINTER_APP_H_
+#  define _BRF_PRINTER_APP_H_
+
+//
+// Include necessary headers...
+//
+
+#  include <pappl/pappl.h>
+#  include <cupsfilters/log.h>
+#  include <cupsfilters/filter.h>
+#  include <pthread.h>
+
+
+//
+// Constants...
+//
+
+#  define BRF_AHEAD_JOBS	2	// Default jobs to render ahead per printer
+#  define BRF_AHEAD_MAX_DISK	256	// Default render-ahead disk budget in MB
+#  define BRF_AHEAD_NICE	10	// Nice value of the render-ahead thread
+#  define BRF_WRITER_BUFFERS	4	// Number of device output buffers
+#  define BRF_WRITER_BUFSIZE	65536	// Size of each device output buffer
+#  define BRF_PGX_EXT		".pgx"	// Extension of page index sidecar files
+#  define BRF_LAYOUT_MAX_MARGIN	40	// Maximum top/left margin
+#  define BRF_CANCEL_TIMEOUT	5	// Seconds for filters to exit after cancel
+#  define BRF_CHAIN_MAX_FILTERS	8	// Maximum filters in a job filter chain
+#  define BRF_CKPT_MAX_AGE	86400	// Seconds to keep output of failed jobs
+#  define BRF_CKPT_MAX_SIZE	64	// Maximum MB of output kept to resume a job
+#  define BRF_CPU_MAX_TOKENS	256	// Maximum CPU tokens
+#  define BRF_CPU_WAITERS	256	// Maximum stages waiting for a CPU token
+#  define BRF_FREEDOTS_MAX_FAILURES 3	// Failed FreeDots starts before backing off
+#  define BRF_FREEDOTS_MAX_SPARES 8	// Maximum spare FreeDots processes
+#  define BRF_PDFTEXT_MAX_WORKERS 4	// Maximum PDF text extraction workers
+#  define BRF_RETAIN_MAX_SIZE	1024	// Default retention store budget in MB
+#  define BRF_SANITIZE_ASCII	0x01	// Replace non-ASCII characters
+#  define BRF_SANITIZE_CONTROL	0x02	// Replace control characters with spaces
+#  define BRF_SANITIZE_CRLF	0x04	// End lines with CR LF
+#  define BRF_SANITIZE_FOLD	0x08	// Fold lowercase BRF characters to uppercase
+#  define BRF_SANITIZE_STRIP	0x10	// Remove CR and SUB characters
+#  define BRF_SAVE_DELAY	2	// Seconds without changes before saving state
+#  define BRF_SAVE_MAX_DELAY	10	// Maximum seconds before saving changed state
+#  define BRF_SCHED_MAX_AHEAD	64	// Maximum jobs remembered as printed ahead
+#  define BRF_SCHED_SHORT_SIZE	32768	// Maximum document size of short jobs
+#  define BRF_SESSION_TIMEOUT	5	// Seconds before an idle embosser session ends
+#  define BRF_SIM_BUFFER	4096	// Default input buffer of simulated embossers
+#  define BRF_SIM_CHUNKS	64	// Chunks in the input buffer of simulated embossers
+#  define BRF_SIM_CPS		200	// Default characters per second of simulated embossers
+#  define BRF_SIM_FEED		500	// Default page feed milliseconds of simulated embossers
+#  define BRF_TRACE_EVENTS	4096	// Default trace events kept per thread
+#  define BRF_TRACE_RINGS	64	// Maximum number of traced threads
+#  define BRF_TRANSLATE_CHUNK	65536	// Target size of translation chunks
+#  define BRF_TRANSLATE_MAX_WIDTH 256	// Maximum cells per line
+#  define BRF_TRANSLATE_MAX_WORKERS 8	// Maximum translation workers
+
+
+//
+// Types...
+//
+
+typedef struct brf_writer_s brf_writer_t;
+					// Asynchronous device writer
+typedef struct brf_pgindex_s brf_pgindex_t;
+					// BRF page offset index
+typedef struct brf_freedots_s brf_freedots_t;
+					// FreeDots process
+typedef struct brf_ckpt_s brf_ckpt_t;	// Output checkpoint
+typedef struct brf_retain_s brf_retain_t;
+					// Job output kept for reprints
+
+typedef ssize_t (*brf_layout_cb_t)(void *cb_data, const void *buffer, size_t bytes);
+					// Layout output callback
+typedef bool (*brf_render_cb_t)(pappl_job_t *job, brf_layout_cb_t cb, void *cb_data);
+					// Render a job into a layout callback
+
+typedef struct brf_layout_s		// BRF page layout state
+{
+  int			top_margin,	// Top margin in lines
+			left_margin;	// Left margin in cells
+  brf_layout_cb_t	cb;		// Output callback
+  void			*cb_data;	// Output callback data
+  bool			at_line_start,	// At the start of a line?
+			held_ff;	// Form feed held back?
+  int			held_lines;	// Line ends held back after form feed
+  size_t		used;		// Bytes used in output buffer
+  char			buffer[8192];	// Output buffer
+} brf_layout_t;
+
+typedef struct brf_sanitize_s		// BRF clean-up state
+{
+  unsigned		flags;		// BRF_SANITIZE_ flags
+  bool			cr;		// Last character was CR?
+  unsigned char		utf8[4];	// Pending UTF-8 sequence
+  int			utf8_len,	// Length of UTF-8 sequence
+			utf8_used;	// Bytes of UTF-8 sequence seen
+  unsigned		non_ascii,	// Non-ASCII characters replaced
+			control;	// Control characters replaced
+} brf_sanitize_t;
+
+typedef enum brf_lane_e			// Scheduling lane, most urgent first
+{
+  BRF_LANE_URGENT,			// "job-priority" above 50
+  BRF_LANE_SHORT,			// Small document, default priority
+  BRF_LANE_BULK				// Everything else
+} brf_lane_t;
+
+typedef bool (*brf_sched_print_cb_t)(pappl_job_t *job, pappl_device_t *device);
+					// Print a job ahead of another
+
+typedef struct brf_layout_params_s	// Parameters for brfLayoutFilter()
+{
+  int			top_margin,	// Top margin in lines
+			left_margin;	// Left margin in cells
+} brf_layout_params_t;
+
+typedef struct brf_translate_params_s	// Parameters for brfTranslateFilter()
+{
+  char			tables[1024];	// liblouis table list or "" for none
+  int			width;		// Cells per line
+  int			num_workers;	// Number of workers or 0 for automatic
+  char			**envp;		// Environment for fmt and lou_translate or `NULL`
+} brf_translate_params_t;
+
+typedef struct brf_drv_option_s		// Driver option from the .drv files
+{
+  const char		*name;		// PPD option name
+  const char		*keyword;	// IPP attribute name
+  const char		*text;		// Human-readable name
+  int			num_choices;	// Number of choices
+  const char * const	*choices;	// Choice names
+  const char * const	*texts;		// Human-readable choice names
+  int			default_choice;	// Index of default choice
+} brf_drv_option_t;
+
+typedef struct brf_drv_media_s		// Media size from the .drv files
+{
+  const char		*pwg_name;	// PWG media size name
+  const char		*ppd_name;	// PPD media size name
+  int			width,		// Width in hundredths of millimeters
+			length;		// Length in hundredths of millimeters
+} brf_drv_media_t;
+
+typedef struct brf_drv_model_s		// Model from the .drv files
+{
+  const char		*name;		// Driver name
+  const char		*description;	// Make and model
+  const char		*device_id;	// IEEE-1284 device ID match string
+  const char		*ppd_name;	// PCFileName of the replaced PPD
+  int			version;	// Index protocol version (3 or 4)
+  bool			duplex;		// Double-sided printing supported?
+  const char		*paper_length;	// IndexPaperLength ("In", "Mm") or `NULL`
+  int			left,		// Hardware margins in hundredths of mm
+			bottom,
+			right,
+			top;
+  int			min_width,	// Minimum/maximum size in hundredths of mm
+			min_length,
+			max_width,
+			max_length;
+  int			num_media;	// Number of media sizes
+  const brf_drv_media_t	*media;		// Media sizes
+  int			default_media;	// Index of default media size
+  int			num_options;	// Number of options
+  const brf_drv_option_t * const *options;
+					// Options
+} brf_drv_model_t;
+
+// Items to configure the properties of this Printer Application
+// These items do not change while the Printer Application is running
+typedef struct brf_printer_app_config_s
+{
+  // Identification of the Printer Application
+  const char        *system_name;        // Name of the system
+  const char        *system_package_name;// Name of Printer Application
+                                         // package/executable
+  const char        *version;            // Program version number string
+  unsigned short    numeric_version[4];  // Numeric program version
+  const char        *web_if_footer;      // HTML Footer for web interface
+
+  pappl_pr_autoadd_cb_t autoadd_cb;
+
+
+  pappl_pr_identify_cb_t identify_cb;
+
+
+  pappl_pr_testpage_cb_t testpage_cb;
+
+
+  cups_array_t      *spooling_conversions;
+
+
+  cups_array_t      *stream_formats;
+  const char        *backends_ignore;
+
+  const char        *backends_only;
+
+  void              *testpage_data;
+
+} pr_printer_app_config_t;
+
+typedef struct brf_printer_app_global_data_s
+{
+  pr_printer_app_config_t *config;
+  pappl_system_t          *system;
+  int                     num_drivers;     // Number of drivers (from the PPDs)
+  pappl_pr_driver_t       *drivers;        // Driver index (for menu and
+                                           // auto-add)
+   char              spool_dir[1024];     // Spool directory, customizable via
+                                         // SPOOL_DIR environment variable
+
+} brf_printer_app_global_data_t;
+
+// Data for brf_print_filter_function()
+typedef struct brf_print_filter_function_data_s
+// look-up table
+{
+  pappl_device_t *device;                    // Device
+  const char *device_uri;                          // Printer device URI
+  pappl_job_t *job;                          // Job
+  brf_printer_app_global_data_t *global_data; // Global data
+  bool layout;                               // Lay out pages before sending?
+  int top_margin,                            // Top margin in lines
+      left_margin;                           // Left margin in cells
+  brf_lane_t lane;                           // Scheduling lane of job
+} brf_print_filter_function_data_t;
+
+typedef struct brf_cups_device_data_s
+{
+  const char *device_uri;    // Device URI
+  int inputfd,         // FD for job data input
+      backfd,          // FD for back channel
+      sidefd;          // FD for side channel
+  int backend_pid;     // PID of CUPS backend
+  double back_timeout, // Timeout back channel (sec)
+      side_timeout;    // Timeout side channel (sec)
+
+  cf_filter_filter_in_chain_t *chain_filter; // Filters in chain
+  cf_filter_data_t *filter_data;             // Common data for filter functions
+  cf_filter_external_t backend_params; // Parameters for launching
+                                             // backend via cfFilterExternal()
+  bool internal_filter_data;                 // Is filter_data
+                                             // internal?
+} brf_cups_device_data_t;
+
+typedef struct brf_spooling_conversion_s
+{
+  char *srctype;                   // Input data type
+  char *dsttype;                   // Output data type
+  int num_filters;                       // Number of filters
+  cf_filter_filter_in_chain_t filters[]; // List of filters with
+                                         // parameters
+} brf_spooling_conversion_t;
+
+typedef struct brf_job_data_s		// Job data
+{
+  char                  *device_uri;    // Printer device URI
+                                          // PPD file to be used by CUPS filters
+  cf_filter_data_t         *filter_data;   // Common print job data for filter
+                                        // functions
+  char                  *stream_filter; // CUPS Filter to use when printing
+                                        // in streaming mode (Raster input)
+  cups_array_t          *chain;         // Filter function chain
+  cf_filter_filter_in_chain_t *ppd_filter, // Filter from PPD file
+                        *print;         // Filter function call for printing
+  int                   device_fd;      // File descriptor to pipe output
+                                        // to the device
+  int                   device_pid;     // Process ID for device output
+                                        // sub-process
+  FILE                  *device_file;   // File pointer for output to
+                                        // device
+  int                   line_count;     // Raster lines actually received for
+                                        // this page
+  void                  *data;          // Job-type-specific data
+  brf_printer_app_global_data_t *global_data; // Global data
+} brf_job_data_t;
+
+
+//
+// Globals...
+//
+
+extern const brf_drv_model_t	brf_index_models[];
+					// Index models (generated)
+extern const int		brf_index_num_models;
+					// Number of Index models
+
+
+//
+// Functions...
+//
+
+extern bool		brf_gen(pappl_system_t *system, const char *driver_name, const char *device_uri, const char *device_id, pappl_pr_driver_data_t *data, ipp_t **attrs, void *cbdata);
+
+extern bool		brf_index(pappl_system_t *system, const char *driver_name, const char *device_uri, const char *device_id, pappl_pr_driver_data_t *data, ipp_t **attrs, void *cbdata);
+
+extern void		brfCheckpointCleanup(const char *directory);
+extern brf_ckpt_t	*brfCheckpointCreate(pappl_job_t *job, const char *directory);
+extern void		brfCheckpointFinish(brf_ckpt_t *ckpt, brf_pgindex_t *idx, off_t sent, bool ok);
+extern void		brfCheckpointInit(pappl_system_t *system);
+extern void		brfCheckpointUpdate(brf_ckpt_t *ckpt, brf_pgindex_t *idx, off_t sent);
+extern void		brfCheckpointWrite(brf_ckpt_t *ckpt, const void *buffer, size_t bytes);
+
+extern bool		brfCPUAcquire(cf_filter_data_t *data, int *token);
+extern bool		brfCPUInit(pappl_system_t *system, int num_tokens);
+extern void		brfCPURelease(int token);
+extern bool		brfCPUWrite(cf_filter_data_t *data, int *token, int fd, const void *buffer, size_t bytes);
+
+extern bool		brfDeviceIDIndexCreate(int num_drivers, pappl_pr_driver_t *drivers);
+extern const char	*brfDeviceIDMatch(const char *device_id, int *score);
+extern void		brfDiscoverDevices(pappl_system_t *system, pappl_devtype_t types, int timeout, pappl_device_cb_t cb, void *cb_data);
+
+extern brf_freedots_t	*brfFreeDotsAcquire(int width);
+extern int		brfFreeDotsFilter(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, void *parameters);
+extern bool		brfFreeDotsInit(pappl_system_t *system, int num_spares);
+extern void		brfFreeDotsRelease(brf_freedots_t *fd);
+
+extern int		brfLayoutFilter(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, void *parameters);
+extern bool		brfLayoutFinish(brf_layout_t *layout);
+extern void		brfLayoutGetMargins(int num_options, cups_option_t *options, int *top_margin, int *left_margin);
+extern bool		brfLayoutInit(brf_layout_t *layout, int top_margin, int left_margin, brf_layout_cb_t cb, void *cb_data);
+extern bool		brfLayoutWrite(brf_layout_t *layout, const void *buffer, size_t bytes);
+
+extern bool		brfOfficeCheck(const char *filename, const char *member);
+extern int		brfOfficeToTextFilter(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, void *parameters);
+
+extern int		brfPDFToTextFilter(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, void *parameters);
+
+extern void		brfPageIndexCleanup(const char *directory);
+extern brf_pgindex_t	*brfPageIndexCreate(void);
+extern void		brfPageIndexDelete(brf_pgindex_t *idx);
+extern int		brfPageIndexGetCount(brf_pgindex_t *idx);
+extern bool		brfPageIndexGetJobRange(pappl_job_t *job, pappl_pr_options_t *options, off_t *start, off_t *end);
+extern int		brfPageIndexGetPagesBefore(brf_pgindex_t *idx, off_t offset);
+extern bool		brfPageIndexGetRange(brf_pgindex_t *idx, int first, int last, off_t *start, off_t *end);
+extern brf_pgindex_t	*brfPageIndexLoad(const char *filename, bool save);
+extern bool		brfPageIndexSave(brf_pgindex_t *idx, const char *filename);
+extern bool		brfPageIndexScan(brf_pgindex_t *idx, const void *buffer, size_t bytes);
+
+extern bool		brfRenderAheadInit(pappl_system_t *system, int num_jobs, off_t max_disk, brf_render_cb_t cb);
+extern void		brfRenderAheadKick(void);
+extern int		brfRenderAheadOpen(pappl_job_t *job);
+
+extern brf_retain_t	*brfRetainCreate(pappl_job_t *job);
+extern void		brfRetainFinish(brf_retain_t *ret, bool ok);
+extern bool		brfRetainInit(pappl_system_t *system, off_t max_size);
+extern void		brfRetainWrite(brf_retain_t *ret, const void *buffer, size_t bytes);
+
+extern bool		brfSaveInit(pappl_system_t *system, const char *filename);
+extern bool		brfSaveShutdown(pappl_system_t *system);
+extern bool		brfSaveStateCB(pappl_system_t *system, void *data);
+
+extern size_t		brfSanitize(brf_sanitize_t *s, const void *buffer, size_t bytes, unsigned char *out);
+extern void		brfSanitizeFinish(brf_sanitize_t *s, pappl_job_t *job);
+extern void		brfSanitizeInit(brf_sanitize_t *s, unsigned flags);
+
+extern brf_lane_t	brfSchedulerGetLane(pappl_job_t *job);
+extern void		brfSchedulerInit(brf_sched_print_cb_t cb);
+extern bool		brfSchedulerShouldYield(pappl_job_t *job, brf_lane_t lane);
+extern bool		brfSchedulerWasPrinted(pappl_job_t *job);
+extern int		brfSchedulerYield(pappl_job_t *job, brf_lane_t lane, pappl_device_t *device);
+
+extern bool		brfSessionBegin(pappl_job_t *job, brf_writer_t *writer, const char *init, const char *end);
+extern bool		brfSessionClose(pappl_job_t *job, brf_writer_t *writer);
+extern bool		brfSessionEnd(pappl_job_t *job, brf_writer_t *writer, const char *separator);
+extern void		brfSessionInit(pappl_system_t *system);
+
+extern void		brfSimInit(pappl_system_t *system);
+
+extern void		brfTraceBegin(const char *name, int job_id);
+extern void		brfTraceEnd(const char *name, int job_id);
+extern bool		brfTraceInit(pappl_system_t *system, int num_events);
+
+extern bool		brfTranslateCanSplit(const brf_translate_params_t *params);
+extern int		brfTranslateFilter(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, void *parameters);
+extern bool		brfTranslateGetParams(pappl_pr_options_t *job_options, int num_options, cups_option_t *options, brf_translate_params_t *params);
+
+extern brf_writer_t	*brfWriterCreate(pappl_device_t *device, pappl_job_t *job, int num_buffers, size_t bufsize);
+extern bool		brfWriterFinish(brf_writer_t *writer);
+extern off_t		brfWriterGetSent(brf_writer_t *writer);
+extern ssize_t		brfWriterWrite(brf_writer_t *writer, const void *buffer, size_t bytes);
+
+
+#endif // !_BRF_PRINTER_APP_H_
@@ -0,0 +1,518 @@
+//
+// Render-ahead of queued jobs for the Braille Printer Application
+//
+// Copyright © 2022 Chandresh Soni
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// PAPPL only starts converting a job once the previous job has been
+// embossed, so the embosser sits idle while the next document is translated.
+// While a printer is busy, a background thread converts the next few pending
+// jobs into laid-out BRF files in the spool directory, and the print callback
+// sends such a file straight to the device when the job's turn comes.
+//
+// Rendering ahead stays within a budget: one job at a time for the whole
+// system, at a lower CPU priority and with a single translation worker, and
+// a limit on the disk space used by the rendered files.  A job that is
+// started while it is still being rendered ahead is converted normally and
+// the early copy is thrown away.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+#include <dirent.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#  include <sys/syscall.h>
+#endif // __linux__
+
+
+//
+// Local types...
+//
+
+typedef enum brf_ahead_state_e		// Render-ahead state
+{
+  BRF_AHEAD_RENDERING,			// Being rendered
+  BRF_AHEAD_DONE,			// Ready to print
+  BRF_AHEAD_FAILED			// Failed or over budget
+} brf_ahead_state_t;
+
+typedef struct brf_ahead_s		// Job rendered ahead
+{
+  int			printer_id,	// Printer ID
+			job_id;		// Job ID
+  brf_ahead_state_t	state;		// Render-ahead state
+  bool			canceled;	// Job started before rendering finished?
+  off_t			size,		// Size of rendered file
+			limit;		// Maximum size of rendered file
+  int			fd;		// Rendered file while rendering
+  char			filename[1024];	// Rendered file
+} brf_ahead_t;
+
+typedef struct brf_ahead_find_s		// Search for a job to render
+{
+  pappl_job_t		*job;		// Job to render, if any
+  int			printer_id;	// Printer of job
+  const char		*format;	// Format the driver prints directly
+  int			num_pending;	// Pending jobs seen on the printer
+} brf_ahead_find_t;
+
+
+//
+// Local functions...
+//
+
+static void	brf_ahead_expire(void);
+static void	brf_ahead_find_job_cb(pappl_job_t *job, brf_ahead_find_t *find);
+static void	brf_ahead_find_printer_cb(pappl_printer_t *printer, brf_ahead_find_t *find);
+static brf_ahead_t *brf_ahead_get(int job_id);
+static void	brf_ahead_remove(brf_ahead_t *ahead);
+static void	brf_ahead_render(pappl_job_t *job, int printer_id);
+static void	*brf_ahead_run(void *data);
+static ssize_t	brf_ahead_write(brf_ahead_t *ahead, const void *buffer, size_t bytes);
+
+
+//
+// Local globals...
+//
+
+static pthread_mutex_t	brf_ahead_mutex = PTHREAD_MUTEX_INITIALIZER;
+					// Mutex for rendered jobs
+static pthread_cond_t	brf_ahead_cond = PTHREAD_COND_INITIALIZER;
+					// Condition for wakeups
+static pappl_system_t	*brf_ahead_system = NULL;
+					// System
+static brf_render_cb_t	brf_ahead_cb = NULL;
+					// Render callback
+static char		brf_ahead_directory[1024] = "";
+					// Directory for rendered files
+static int		brf_ahead_num_jobs = 0;
+					// Jobs to render ahead per printer
+static off_t		brf_ahead_max_disk = 0,
+					// Disk budget in bytes
+			brf_ahead_used = 0;
+					// Disk space used by rendered files
+static bool		brf_ahead_kicked = false;
+					// Look for work right away?
+static cups_array_t	*brf_ahead_jobs = NULL;
+					// Jobs rendered ahead
+
+
+//
+// 'brfRenderAheadInit()' - Start rendering queued jobs ahead.
+//
+// `num_jobs` is the number of pending jobs per printer to render while the
+// printer is busy, 0 disables rendering ahead.
+//
+
+bool					// O - `true` on success, `false` on error
+brfRenderAheadInit(
+    pappl_system_t  *system,		// I - System
+    int             num_jobs,		// I - Jobs to render ahead per printer
+    off_t           max_disk,		// I - Disk budget in bytes
+    brf_render_cb_t cb)			// I - Render callback
+{
+  DIR		*dir;			// Spool directory
+  struct dirent	*dent;			// Directory entry
+  char		filename[1024];		// Stale rendered file
+  pthread_t	tid;			// Render thread
+  int		err;			// Thread creation error
+
+
+  brf_ahead_system   = system;
+  brf_ahead_cb       = cb;
+  brf_ahead_num_jobs = num_jobs;
+  brf_ahead_max_disk = max_disk;
+  brf_ahead_jobs     = cupsArrayNew(NULL, NULL);
+
+  papplSystemGetSpoolDirectory(system, brf_ahead_directory, sizeof(brf_ahead_directory));
+
+  // Remove files rendered by a previous server...
+  if ((dir = opendir(brf_ahead_directory)) != NULL)
+  {
+    while ((dent = readdir(dir)) != NULL)
+    {
+      if (strncmp(dent->d_name, "ahead-", 6))
+        continue;
+
+      snprintf(filename, sizeof(filename), "%s/%s", brf_ahead_directory, dent->d_name);
+      unlink(filename);
+    }
+
+    closedir(dir);
+  }
+
+  if (num_jobs <= 0 || max_disk <= 0)
+    return (true);
+
+  if ((err = pthread_create(&tid, NULL, brf_ahead_run, NULL)) != 0)
+  {
+    papplLog(system, PAPPL_LOGLEVEL_ERROR, "Unable to create render-ahead thread: %s", strerror(err));
+    return (false);
+  }
+
+  pthread_detach(tid);
+
+  papplLog(system, PAPPL_LOGLEVEL_INFO, "Rendering up to %d jobs per printer ahead, using up to %ldMB.", num_jobs, (long)(max_disk / 1048576));
+
+  return (true);
+}
+
+
+//
+// 'brfRenderAheadKick()' - Look for jobs to render now.
+//
+// Call this when a job starts printing or is queued.
+//
+
+void
+brfRenderAheadKick(void)
+{
+  pthread_mutex_lock(&brf_ahead_mutex);
+  brf_ahead_kicked = true;
+  pthread_cond_broadcast(&brf_ahead_cond);
+  pthread_mutex_unlock(&brf_ahead_mutex);
+}
+
+
+//
+// 'brfRenderAheadOpen()' - Open the rendered output of a job.
+//
+// The file is removed right away and belongs to the caller.  Returns `-1`
+// when the job hasn't been rendered ahead.
+//
+
+int					// O - File descriptor or `-1`
+brfRenderAheadOpen(pappl_job_t *job)	// I - Job
+{
+  brf_ahead_t	*ahead;			// Job rendered ahead
+  int		fd = -1;		// File descriptor
+  off_t		size = 0;		// Size of rendered file
+
+
+  pthread_mutex_lock(&brf_ahead_mutex);
+
+  if ((ahead = brf_ahead_get(papplJobGetID(job))) != NULL)
+  {
+    if (ahead->state == BRF_AHEAD_RENDERING)
+    {
+      // Don't wait for the slower background rendering...
+      ahead->canceled = true;
+    }
+    else
+    {
+      if (ahead->state == BRF_AHEAD_DONE && (fd = open(ahead->filename, O_RDONLY | O_CLOEXEC)) >= 0)
+        size = ahead->size;
+
+      brf_ahead_remove(ahead);
+    }
+  }
+
+  pthread_mutex_unlock(&brf_ahead_mutex);
+
+  if (fd >= 0)
+    papplLogJob(job, PAPPL_LOGLEVEL_INFO, "Printing %ld bytes rendered ahead.", (long)size);
+
+  return (fd);
+}
+
+
+//
+// 'brf_ahead_expire()' - Remove rendered files of jobs that won't print.
+//
+// PAPPL is not called with the mutex held, since its callbacks take it.
+//
+
+static void
+brf_ahead_expire(void)
+{
+  brf_ahead_t		*ahead;		// Job rendered ahead
+  int			i,		// Looping var
+			count = 0,	// Number of jobs to check
+			printer_ids[64],// Printer IDs
+			job_ids[64];	// Job IDs
+  pappl_printer_t	*printer;	// Printer
+  pappl_job_t		*job;		// Job
+
+
+  pthread_mutex_lock(&brf_ahead_mutex);
+
+  for (ahead = (brf_ahead_t *)cupsArrayFirst(brf_ahead_jobs); ahead && count < (int)(sizeof(job_ids) / sizeof(job_ids[0])); ahead = (brf_ahead_t *)cupsArrayNext(brf_ahead_jobs))
+  {
+    if (ahead->state != BRF_AHEAD_RENDERING)
+    {
+      printer_ids[count] = ahead->printer_id;
+      job_ids[count ++]  = ahead->job_id;
+    }
+  }
+
+  pthread_mutex_unlock(&brf_ahead_mutex);
+
+  for (i = 0; i < count; i ++)
+  {
+    if ((printer = papplSystemFindPrinter(brf_ahead_system, NULL, printer_ids[i], NULL)) != NULL && (job = papplPrinterFindJob(printer, job_ids[i])) != NULL && papplJobGetState(job) <= IPP_JSTATE_PROCESSING)
+      continue;
+
+    // Canceled or gone...
+    pthread_mutex_lock(&brf_ahead_mutex);
+    if ((ahead = brf_ahead_get(job_ids[i])) != NULL && ahead->state != BRF_AHEAD_RENDERING)
+      brf_ahead_remove(ahead);
+    pthread_mutex_unlock(&brf_ahead_mutex);
+  }
+}
+
+
+//
+// 'brf_ahead_find_job_cb()' - Look for a pending job to render.
+//
+
+static void
+brf_ahead_find_job_cb(
+    pappl_job_t      *job,		// I - Active job
+    brf_ahead_find_t *find)		// I - Search state
+{
+  brf_ahead_t	*ahead;			// Job rendered ahead
+
+
+  if (find->job || papplJobGetState(job) != IPP_JSTATE_PENDING || find->num_pending >= brf_ahead_num_jobs)
+    return;
+
+  find->num_pending ++;
+
+  // Raw BRF goes straight to the driver...
+  if (find->format && !strcmp(papplJobGetFormat(job), find->format))
+    return;
+
+  pthread_mutex_lock(&brf_ahead_mutex);
+  ahead = brf_ahead_get(papplJobGetID(job));
+  pthread_mutex_unlock(&brf_ahead_mutex);
+
+  if (!ahead)
+    find->job = job;
+}
+
+
+//
+// 'brf_ahead_find_printer_cb()' - Look for a busy printer with jobs to render.
+//
+
+static void
+brf_ahead_find_printer_cb(
+    pappl_printer_t  *printer,		// I - Printer
+    brf_ahead_find_t *find)		// I - Search state
+{
+  pappl_pr_driver_data_t driver_data;	// Driver data
+
+
+  if (find->job || papplPrinterGetState(printer) != IPP_PSTATE_PROCESSING)
+    return;
+
+  papplPrinterGetDriverData(printer, &driver_data);
+
+  find->printer_id  = papplPrinterGetID(printer);
+  find->format      = driver_data.format;
+  find->num_pending = 0;
+
+  papplPrinterIterateActiveJobs(printer, (pappl_job_cb_t)brf_ahead_find_job_cb, find, 1, 0);
+}
+
+
+//
+// 'brf_ahead_get()' - Find a job rendered ahead.
+//
+// The mutex must be held.
+//
+
+static brf_ahead_t *			// O - Job rendered ahead or `NULL`
+brf_ahead_get(int job_id)		// I - Job ID
+{
+  brf_ahead_t	*ahead;			// Job rendered ahead
+
+
+  for (ahead = (brf_ahead_t *)cupsArrayFirst(brf_ahead_jobs); ahead; ahead = (brf_ahead_t *)cupsArrayNext(brf_ahead_jobs))
+  {
+    if (ahead->job_id == job_id)
+      break;
+  }
+
+  return (ahead);
+}
+
+
+//
+// 'brf_ahead_remove()' - Forget a job rendered ahead and remove its file.
+//
+// The mutex must be held.
+//
+
+static void
+brf_ahead_remove(brf_ahead_t *ahead)	// I - Job rendered ahead
+{
+  cupsArrayRemove(brf_ahead_jobs, ahead);
+
+  if (ahead->state == BRF_AHEAD_DONE)
+    brf_ahead_used -= ahead->size;
+
+  unlink(ahead->filename);
+  free(ahead);
+}
+
+
+//
+// 'brf_ahead_render()' - Render a job into the spool directory.
+//
+
+static void
+brf_ahead_render(pappl_job_t *job,	// I - Job
+                 int         printer_id)// I - Printer ID
+{
+  brf_ahead_t	*ahead;			// Job rendered ahead
+  bool		ok;			// Rendered successfully?
+
+
+  if ((ahead = calloc(1, sizeof(brf_ahead_t))) == NULL)
+    return;
+
+  ahead->printer_id = printer_id;
+  ahead->job_id     = papplJobGetID(job);
+  ahead->state      = BRF_AHEAD_RENDERING;
+
+  snprintf(ahead->filename, sizeof(ahead->filename), "%s/ahead-%d-%d.brf", brf_ahead_directory, printer_id, ahead->job_id);
+
+  if ((ahead->fd = open(ahead->filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to create '%s': %s", ahead->filename, strerror(errno));
+    free(ahead);
+    return;
+  }
+
+  pthread_mutex_lock(&brf_ahead_mutex);
+  ahead->limit = brf_ahead_max_disk - brf_ahead_used;
+  cupsArrayAdd(brf_ahead_jobs, ahead);
+  pthread_mutex_unlock(&brf_ahead_mutex);
+
+  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Rendering ahead while the printer is busy.");
+
+  ok = (brf_ahead_cb)(job, (brf_layout_cb_t)brf_ahead_write, ahead);
+
+  close(ahead->fd);
+  ahead->fd = -1;
+
+  pthread_mutex_lock(&brf_ahead_mutex);
+
+  if (ahead->canceled)
+  {
+    brf_ahead_remove(ahead);
+  }
+  else if (ok)
+  {
+    ahead->state   = BRF_AHEAD_DONE;
+    brf_ahead_used += ahead->size;
+  }
+  else
+  {
+    // Keep the entry so the job isn't tried again...
+    ahead->state = BRF_AHEAD_FAILED;
+    unlink(ahead->filename);
+  }
+
+  pthread_mutex_unlock(&brf_ahead_mutex);
+}
+
+
+//
+// 'brf_ahead_run()' - Render jobs ahead until the server exits.
+//
+
+static void *				// O - Thread exit status (unused)
+brf_ahead_run(void *data)		// I - Thread data (unused)
+{
+  brf_ahead_find_t	find;		// Search state
+  struct timespec	timeout;	// Time to look for work again
+
+
+  (void)data;
+
+#ifdef __linux__
+  // Threads have their own nice value on Linux, and the filters inherit it...
+  setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), BRF_AHEAD_NICE);
+#endif // __linux__
+
+  for (;;)
+  {
+    pthread_mutex_lock(&brf_ahead_mutex);
+
+    if (!brf_ahead_kicked)
+    {
+      clock_gettime(CLOCK_REALTIME, &timeout);
+      timeout.tv_sec += 30;
+
+      pthread_cond_timedwait(&brf_ahead_cond, &brf_ahead_mutex, &timeout);
+    }
+
+    brf_ahead_kicked = false;
+
+    pthread_mutex_unlock(&brf_ahead_mutex);
+
+    brf_ahead_expire();
+
+    memset(&find, 0, sizeof(find));
+    papplSystemIteratePrinters(brf_ahead_system, (pappl_printer_cb_t)brf_ahead_find_printer_cb, &find);
+
+    if (find.job)
+    {
+      brf_ahead_render(find.job, find.printer_id);
+
+      // Look for the next job right away...
+      brfRenderAheadKick();
+    }
+  }
+
+  return (NULL);
+}
+
+
+//
+// 'brf_ahead_write()' - Write rendered output within the disk budget.
+//
+
+static ssize_t				// O - Bytes written or `-1` to stop
+brf_ahead_write(brf_ahead_t *ahead,	// I - Job rendered ahead
+                const void  *buffer,	// I - Output
+                size_t      bytes)	// I - Number of bytes
+{
+  const char	*ptr = (const char *)buffer;
+					// Pointer into output
+  ssize_t	written;		// Bytes written
+  bool		canceled;		// Job started already?
+
+
+  pthread_mutex_lock(&brf_ahead_mutex);
+  canceled = ahead->canceled;
+  pthread_mutex_unlock(&brf_ahead_mutex);
+
+  if (canceled || ahead->size + (off_t)bytes > ahead->limit)
+    return (-1);
+
+  while (bytes > 0)
+  {
+    if ((written = write(ahead->fd, ptr, bytes)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      return (-1);
+    }
+
+    ptr         += written;
+    bytes       -= (size_t)written;
+    ahead->size += written;
+  }
+
+  return (ptr - (const char *)buffer);
+}
@@ -0,0 +1,834 @@
+//
+// Retention store for the Braille Printer Application
+//
+// Copyright © 2022 Chandresh Soni
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// The device-ready output of completed jobs is kept for reprints in the
+// "retain" directory of the spool directory, one file per job:
+//
+//   PRINTER-JOB.brz
+//
+// BRF compresses very well, so the output is deflated while it is sent, with
+// every page in a frame of its own.  A table of the frames at the end of the
+// file lets any range of pages be inflated straight to the device without
+// touching the others:
+//
+//   header   "BRFZ", version, printer ID, job ID
+//   frames   raw deflate data, one frame per page
+//   table    offset, compressed and uncompressed size of each frame
+//   trailer  number of frames, "BRFZ"
+//
+// Numbers are stored in host byte order, the files never leave the spool
+// directory.  The "/brf-reprint" page of the web interface lists the kept
+// jobs; reprinting a job there inflates the requested pages to a new BRF job,
+// which goes through the driver like any other BRF document.  Clients can't
+// send kept files themselves.  When the store grows beyond its size budget,
+// the files that were least recently written or reprinted are removed first.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+#include <dirent.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <zlib.h>
+
+
+//
+// Local types...
+//
+
+typedef struct brf_rheader_s		// File header
+{
+  char			magic[4];	// "BRFZ"
+  uint32_t		version;	// Format version (1)
+  int32_t		printer_id,	// Printer ID
+			job_id;		// Job ID
+} brf_rheader_t;
+
+typedef struct brf_rframe_s		// Frame table entry
+{
+  uint64_t		offset;		// Offset of frame in file
+  uint32_t		csize,		// Compressed size
+			usize;		// Uncompressed size
+} brf_rframe_t;
+
+typedef struct brf_rtrailer_s		// File trailer
+{
+  uint32_t		num_frames;	// Number of frames
+  char			magic[4];	// "BRFZ"
+} brf_rtrailer_t;
+
+struct brf_retain_s			// Output being kept
+{
+  pappl_job_t		*job;		// Job
+  int			fd;		// Output file or -1 after an error
+  z_stream		stream;		// Compressor
+  brf_rframe_t		*frames;	// Frames
+  uint32_t		num_frames,	// Number of frames
+			alloc_frames;	// Allocated frames
+  uint64_t		offset;		// Current offset in file
+  char			tempname[1100],	// Temporary filename
+			filename[1024];	// Final filename
+  unsigned char		buffer[65536];	// Compressed data
+};
+
+typedef struct brf_rfile_s		// Kept file for eviction
+{
+  char			*name;		// Filename
+  off_t			size;		// Size in bytes
+  time_t		mtime;		// Time last written or reprinted
+} brf_rfile_t;
+
+
+//
+// Local functions...
+//
+
+static void	brf_retain_abort(brf_retain_t *ret, const char *message);
+static int	brf_retain_compare(brf_rfile_t *a, brf_rfile_t *b);
+static bool	brf_retain_deflate(brf_retain_t *ret, const void *buffer, size_t bytes, int flush);
+static void	brf_retain_expire(void);
+static bool	brf_retain_frame(brf_retain_t *ret);
+static int	brf_retain_open(int printer_id, int job_id, brf_rtrailer_t *trailer, brf_rframe_t **frames);
+static bool	brf_retain_reprint(pappl_system_t *system, pappl_client_t *client, int printer_id, int job_id, const char *pages, char *message, size_t msgsize);
+static bool	brf_retain_reprint_cb(pappl_client_t *client, pappl_system_t *system);
+
+
+//
+// Local globals...
+//
+
+static char		brf_retain_dir[1024] = "";
+					// Directory for kept files
+static off_t		brf_retain_max = 0;
+					// Size budget in bytes
+static pthread_mutex_t	brf_retain_mutex = PTHREAD_MUTEX_INITIALIZER;
+					// Mutex for eviction
+
+
+//
+// 'brfRetainCreate()' - Start keeping the output of a job.
+//
+
+brf_retain_t *				// O - Kept output or `NULL` if disabled or on error
+brfRetainCreate(pappl_job_t *job)	// I - Job
+{
+  brf_retain_t	*ret;			// Kept output
+  brf_rheader_t	header;			// File header
+  int		printer_id = papplPrinterGetID(papplJobGetPrinter(job));
+					// Printer ID
+
+
+  if (!brf_retain_dir[0])
+    return (NULL);
+
+  if ((ret = (brf_retain_t *)calloc(1, sizeof(brf_retain_t))) == NULL)
+    return (NULL);
+
+  ret->job = job;
+
+  snprintf(ret->filename, sizeof(ret->filename), "%s/%d-%d.brz", brf_retain_dir, printer_id, papplJobGetID(job));
+  snprintf(ret->tempname, sizeof(ret->tempname), "%s.tmp", ret->filename);
+
+  if (deflateInit2(&ret->stream, Z_BEST_SPEED, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+  {
+    free(ret);
+    return (NULL);
+  }
+
+  memcpy(header.magic, "BRFZ", 4);
+  header.version    = 1;
+  header.printer_id = printer_id;
+  header.job_id     = papplJobGetID(job);
+
+  if ((ret->fd = open(ret->tempname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0 || write(ret->fd, &header, sizeof(header)) != (ssize_t)sizeof(header))
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_WARN, "Unable to keep output for reprints: %s", strerror(errno));
+
+    if (ret->fd >= 0)
+    {
+      close(ret->fd);
+      unlink(ret->tempname);
+    }
+
+    deflateEnd(&ret->stream);
+    free(ret);
+    return (NULL);
+  }
+
+  ret->offset = sizeof(header);
+
+  return (ret);
+}
+
+
+//
+// 'brfRetainFinish()' - Finish keeping the output of a job.
+//
+// The output is only kept when the job was sent completely.
+//
+
+void
+brfRetainFinish(brf_retain_t *ret,	// I - Kept output
+                bool         ok)	// I - Job sent completely?
+{
+  brf_rtrailer_t	trailer;	// File trailer
+  size_t	tsize;			// Size of frame table
+  uint32_t	i;			// Looping var
+  long		usize = 0;		// Uncompressed size
+
+
+  if (!ret)
+    return;
+
+  if (ret->fd >= 0 && (!ok || papplJobIsCanceled(ret->job)))
+  {
+    close(ret->fd);
+    unlink(ret->tempname);
+  }
+  else if (ret->fd >= 0)
+  {
+    // End the last page, then write the frame table...
+    if (ret->stream.total_in > 0)
+      brf_retain_frame(ret);
+
+    trailer.num_frames = ret->num_frames;
+    memcpy(trailer.magic, "BRFZ", 4);
+    tsize = ret->num_frames * sizeof(brf_rframe_t);
+
+    if (ret->fd < 0 || ret->num_frames == 0)
+    {
+      if (ret->fd >= 0)
+      {
+        close(ret->fd);
+        unlink(ret->tempname);
+      }
+    }
+    else if (write(ret->fd, ret->frames, tsize) != (ssize_t)tsize || write(ret->fd, &trailer, sizeof(trailer)) != (ssize_t)sizeof(trailer))
+    {
+      brf_retain_abort(ret, strerror(errno));
+    }
+    else if (close(ret->fd) || rename(ret->tempname, ret->filename))
+    {
+      papplLogJob(ret->job, PAPPL_LOGLEVEL_WARN, "Unable to keep output for reprints: %s", strerror(errno));
+      unlink(ret->tempname);
+    }
+    else
+    {
+      for (i = 0; i < ret->num_frames; i ++)
+        usize += (long)ret->frames[i].usize;
+
+      papplLogJob(ret->job, PAPPL_LOGLEVEL_INFO, "Kept %u pages in '%s' for reprints, %ld bytes compressed to %ld.", (unsigned)ret->num_frames, ret->filename, usize, (long)(ret->offset + tsize + sizeof(trailer)));
+
+      brf_retain_expire();
+    }
+  }
+
+  deflateEnd(&ret->stream);
+  free(ret->frames);
+  free(ret);
+}
+
+
+//
+// 'brfRetainInit()' - Set up the retention store.
+//
+// `max_size` is the size budget in bytes, 0 disables the store.
+//
+
+bool					// O - `true` on success, `false` on error
+brfRetainInit(pappl_system_t *system,	// I - System
+              off_t          max_size)	// I - Size budget in bytes
+{
+  char	spooldir[1024];			// Spool directory
+
+
+  if (max_size <= 0)
+    return (true);
+
+  papplSystemGetSpoolDirectory(system, spooldir, sizeof(spooldir));
+  snprintf(brf_retain_dir, sizeof(brf_retain_dir), "%s/retain", spooldir);
+
+  if (mkdir(brf_retain_dir, 0700) && errno != EEXIST)
+  {
+    papplLog(system, PAPPL_LOGLEVEL_ERROR, "Unable to create retention directory '%s': %s", brf_retain_dir, strerror(errno));
+    brf_retain_dir[0] = '\0';
+    return (false);
+  }
+
+  brf_retain_max = max_size;
+
+  papplSystemAddResourceCallback(system, "/brf-reprint", "text/html", (pappl_resource_cb_t)brf_retain_reprint_cb, system);
+
+  brf_retain_expire();
+
+  return (true);
+}
+
+
+//
+// 'brfRetainWrite()' - Keep output of a job.
+//
+// Pages end after each form feed.  A write error only stops keeping the
+// output, the job goes on.
+//
+
+void
+brfRetainWrite(brf_retain_t *ret,	// I - Kept output
+               const void   *buffer,	// I - Output
+               size_t       bytes)	// I - Number of bytes
+{
+  const char	*ptr = (const char *)buffer,
+					// Pointer into output
+		*ff;			// Form feed
+  size_t	len;			// Length up to form feed
+
+
+  if (!ret || ret->fd < 0)
+    return;
+
+  while (bytes > 0)
+  {
+    if ((ff = memchr(ptr, '\f', bytes)) != NULL)
+      len = (size_t)(ff - ptr) + 1;
+    else
+      len = bytes;
+
+    if (!brf_retain_deflate(ret, ptr, len, Z_NO_FLUSH) || (ff && !brf_retain_frame(ret)))
+      return;
+
+    ptr   += len;
+    bytes -= len;
+  }
+}
+
+
+//
+// 'brf_retain_abort()' - Stop keeping the output of a job.
+//
+
+static void
+brf_retain_abort(brf_retain_t *ret,	// I - Kept output
+                 const char   *message)	// I - Error message
+{
+  papplLogJob(ret->job, PAPPL_LOGLEVEL_WARN, "Unable to keep output for reprints: %s", message);
+
+  close(ret->fd);
+  unlink(ret->tempname);
+
+  ret->fd = -1;
+}
+
+
+//
+// 'brf_retain_compare()' - Compare kept files by age.
+//
+
+static int				// O - Result of comparison
+brf_retain_compare(brf_rfile_t *a,	// I - First file
+                   brf_rfile_t *b)	// I - Second file
+{
+  if (a->mtime < b->mtime)
+    return (-1);
+  else if (a->mtime > b->mtime)
+    return (1);
+  else
+    return (strcmp(a->name, b->name));
+}
+
+
+//
+// 'brf_retain_deflate()' - Compress output and write it to the kept file.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_retain_deflate(brf_retain_t *ret,	// I - Kept output
+                   const void   *buffer,// I - Output
+                   size_t       bytes,	// I - Number of bytes
+                   int          flush)	// I - Z_NO_FLUSH or Z_FINISH
+{
+  size_t	count;			// Compressed bytes
+
+
+  ret->stream.next_in  = (Bytef *)buffer;
+  ret->stream.avail_in = (uInt)bytes;
+
+  do
+  {
+    ret->stream.next_out  = ret->buffer;
+    ret->stream.avail_out = sizeof(ret->buffer);
+
+    if (deflate(&ret->stream, flush) == Z_STREAM_ERROR)
+    {
+      brf_retain_abort(ret, "Compression failed.");
+      return (false);
+    }
+
+    if ((count = sizeof(ret->buffer) - ret->stream.avail_out) > 0)
+    {
+      if (write(ret->fd, ret->buffer, count) != (ssize_t)count)
+      {
+        brf_retain_abort(ret, strerror(errno));
+        return (false);
+      }
+
+      ret->offset += count;
+    }
+  }
+  while (ret->stream.avail_out == 0 || (flush == Z_NO_FLUSH && ret->stream.avail_in > 0));
+
+  return (true);
+}
+
+
+//
+// 'brf_retain_expire()' - Remove the least recently used kept files until
+//                         the store fits its size budget.
+//
+
+static void
+brf_retain_expire(void)
+{
+  DIR		*dir;			// Directory
+  struct dirent	*dent;			// Directory entry
+  struct stat	info;			// File information
+  brf_rfile_t	*files = NULL,		// Kept files
+		*temp;			// New file array
+  size_t	i,			// Looping var
+		num_files = 0,		// Number of files
+		alloc_files = 0;	// Allocated files
+  off_t		total = 0;		// Total size
+  size_t	len;			// Length of name
+  char		filename[1300];		// Filename
+
+
+  pthread_mutex_lock(&brf_retain_mutex);
+
+  if ((dir = opendir(brf_retain_dir)) == NULL)
+  {
+    pthread_mutex_unlock(&brf_retain_mutex);
+    return;
+  }
+
+  while ((dent = readdir(dir)) != NULL)
+  {
+    if ((len = strlen(dent->d_name)) < 5 || strcmp(dent->d_name + len - 4, ".brz"))
+      continue;
+
+    snprintf(filename, sizeof(filename), "%s/%s", brf_retain_dir, dent->d_name);
+
+    if (stat(filename, &info))
+      continue;
+
+    if (num_files >= alloc_files)
+    {
+      if ((temp = realloc(files, (alloc_files + 64) * sizeof(brf_rfile_t))) == NULL)
+        break;
+
+      files       = temp;
+      alloc_files += 64;
+    }
+
+    if ((files[num_files].name = strdup(dent->d_name)) == NULL)
+      break;
+
+    files[num_files].size  = info.st_size;
+    files[num_files].mtime = info.st_mtime;
+    total += info.st_size;
+    num_files ++;
+  }
+
+  closedir(dir);
+
+  if (total > brf_retain_max)
+  {
+    qsort(files, num_files, sizeof(brf_rfile_t), (int (*)(const void *, const void *))brf_retain_compare);
+
+    for (i = 0; i < num_files && total > brf_retain_max; i ++)
+    {
+      snprintf(filename, sizeof(filename), "%s/%s", brf_retain_dir, files[i].name);
+
+      if (!unlink(filename))
+        total -= files[i].size;
+    }
+  }
+
+  for (i = 0; i < num_files; i ++)
+    free(files[i].name);
+
+  free(files);
+
+  pthread_mutex_unlock(&brf_retain_mutex);
+}
+
+
+//
+// 'brf_retain_frame()' - End the frame of a page.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_retain_frame(brf_retain_t *ret)	// I - Kept output
+{
+  brf_rframe_t	*temp;			// New frame table
+  uint64_t	start = ret->num_frames ? ret->frames[ret->num_frames - 1].offset + ret->frames[ret->num_frames - 1].csize : sizeof(brf_rheader_t);
+					// Start of frame
+
+
+  if (!brf_retain_deflate(ret, NULL, 0, Z_FINISH))
+    return (false);
+
+  if (ret->num_frames >= ret->alloc_frames)
+  {
+    if ((temp = realloc(ret->frames, (ret->alloc_frames + 256) * sizeof(brf_rframe_t))) == NULL)
+    {
+      brf_retain_abort(ret, strerror(errno));
+      return (false);
+    }
+
+    ret->frames       = temp;
+    ret->alloc_frames += 256;
+  }
+
+  temp = ret->frames + ret->num_frames ++;
+
+  temp->offset = start;
+  temp->csize  = (uint32_t)(ret->offset - start);
+  temp->usize  = (uint32_t)ret->stream.total_in;
+
+  deflateReset(&ret->stream);
+
+  return (true);
+}
+
+
+//
+// 'brf_retain_open()' - Open the kept file of a job and read its frame table.
+//
+
+static int				// O - File descriptor or -1 on error
+brf_retain_open(
+    int            printer_id,		// I - Printer ID
+    int            job_id,		// I - Job ID
+    brf_rtrailer_t *trailer,		// O - File trailer
+    brf_rframe_t   **frames)		// O - Frame table or `NULL` if not needed
+{
+  int		fd;			// Kept file
+  brf_rheader_t	header;			// File header
+  off_t		end;			// End of frames
+  size_t	tsize;			// Size of frame table
+  char		filename[1100];		// Kept filename
+
+
+  if (frames)
+    *frames = NULL;
+
+  snprintf(filename, sizeof(filename), "%s/%d-%d.brz", brf_retain_dir, printer_id, job_id);
+
+  if ((fd = open(filename, O_RDONLY | O_CLOEXEC)) < 0)
+    return (-1);
+
+  if (read(fd, &header, sizeof(header)) != (ssize_t)sizeof(header) || memcmp(header.magic, "BRFZ", 4) || header.version != 1 || header.printer_id != printer_id || header.job_id != job_id || (end = lseek(fd, -(off_t)sizeof(brf_rtrailer_t), SEEK_END)) < (off_t)sizeof(header) || read(fd, trailer, sizeof(brf_rtrailer_t)) != (ssize_t)sizeof(brf_rtrailer_t) || memcmp(trailer->magic, "BRFZ", 4) || trailer->num_frames == 0 || (off_t)((tsize = trailer->num_frames * sizeof(brf_rframe_t))) > end - (off_t)sizeof(header))
+  {
+    close(fd);
+    return (-1);
+  }
+
+  if (frames && ((*frames = (brf_rframe_t *)malloc(tsize)) == NULL || pread(fd, *frames, tsize, end - (off_t)tsize) != (ssize_t)tsize))
+  {
+    free(*frames);
+    *frames = NULL;
+    close(fd);
+    return (-1);
+  }
+
+  return (fd);
+}
+
+
+//
+// 'brf_retain_reprint()' - Queue pages of a kept job as a new job.
+//
+// Only the frames of the requested pages are read and inflated.  The new job
+// is a BRF document in the driver's format, so it is cleaned up by the driver
+// like any other.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_retain_reprint(
+    pappl_system_t *system,		// I - System
+    pappl_client_t *client,		// I - Client
+    int            printer_id,		// I - Printer ID
+    int            job_id,		// I - Job ID
+    const char     *pages,		// I - Page range or `NULL` for all
+    char           *message,		// O - Result message
+    size_t         msgsize)		// I - Size of message buffer
+{
+  pappl_printer_t	*printer;	// Printer
+  pappl_pr_driver_data_t driver_data;	// Driver data
+  pappl_job_t		*job;		// New job
+  int			fd,		// Kept file
+			tempfd = -1;	// Pages to reprint
+  brf_rtrailer_t	trailer;	// File trailer
+  brf_rframe_t		*frames = NULL;	// Frame table
+  int			first = 1,	// First page
+			last = INT_MAX,	// Last page
+			page;		// Current page
+  z_stream		stream;		// Decompressor
+  unsigned char		inbuf[65536],	// Compressed data
+			outbuf[65536];	// Uncompressed data
+  uint32_t		left;		// Compressed bytes left in frame
+  ssize_t		bytes;		// Bytes read
+  size_t		count;		// Bytes inflated
+  int			zerr;		// Decompression status
+  char			tempfile[1100],	// Pages to reprint
+			title[256],	// Job name
+			source[1100];	// Kept filename
+  bool			ret = false;	// Return value
+
+
+  memset(&stream, 0, sizeof(stream));
+  tempfile[0] = '\0';
+
+  if ((printer = papplSystemFindPrinter(system, NULL, printer_id, NULL)) == NULL)
+  {
+    snprintf(message, msgsize, "The printer of job %d no longer exists.", job_id);
+    return (false);
+  }
+
+  if (pages && *pages)
+  {
+    switch (sscanf(pages, "%d-%d", &first, &last))
+    {
+      case 1 :
+          last = first;
+          break;
+      case 2 :
+          break;
+      default :
+          first = 0;
+          break;
+    }
+
+    if (first < 1 || last < first)
+    {
+      snprintf(message, msgsize, "Bad page range '%s'.", pages);
+      return (false);
+    }
+  }
+
+  if ((fd = brf_retain_open(printer_id, job_id, &trailer, &frames)) < 0)
+  {
+    snprintf(message, msgsize, "The output of job %d is no longer kept.", job_id);
+    return (false);
+  }
+
+  if (last > (int)trailer.num_frames)
+    last = (int)trailer.num_frames;
+
+  if (first > last)
+  {
+    snprintf(message, msgsize, "Job %d only has %u pages.", job_id, (unsigned)trailer.num_frames);
+    goto finish;
+  }
+
+  snprintf(tempfile, sizeof(tempfile), "%s/reprint-%d-%d-XXXXXX", brf_retain_dir, printer_id, job_id);
+
+  if ((tempfd = mkstemp(tempfile)) < 0)
+  {
+    snprintf(message, msgsize, "Unable to create '%s': %s", tempfile, strerror(errno));
+    goto finish;
+  }
+
+  if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+  {
+    snprintf(message, msgsize, "Unable to decompress the output of job %d.", job_id);
+    goto finish;
+  }
+
+  for (page = first; page <= last; page ++)
+  {
+    if (lseek(fd, (off_t)frames[page - 1].offset, SEEK_SET) < 0)
+      break;
+
+    inflateReset(&stream);
+
+    for (left = frames[page - 1].csize, zerr = Z_OK; left > 0 && zerr != Z_STREAM_END;)
+    {
+      if ((bytes = read(fd, inbuf, left > sizeof(inbuf) ? sizeof(inbuf) : left)) <= 0)
+      {
+        if (bytes < 0 && errno == EINTR)
+          continue;
+
+        break;
+      }
+
+      left -= (uint32_t)bytes;
+
+      stream.next_in  = inbuf;
+      stream.avail_in = (uInt)bytes;
+
+      do
+      {
+        stream.next_out  = outbuf;
+        stream.avail_out = sizeof(outbuf);
+
+        if ((zerr = inflate(&stream, Z_NO_FLUSH)) != Z_OK && zerr != Z_STREAM_END && zerr != Z_BUF_ERROR)
+          break;
+
+        if ((count = sizeof(outbuf) - stream.avail_out) > 0 && write(tempfd, outbuf, count) != (ssize_t)count)
+        {
+          zerr = Z_ERRNO;
+          break;
+        }
+      }
+      while (stream.avail_out == 0);
+
+      if (zerr != Z_OK && zerr != Z_STREAM_END && zerr != Z_BUF_ERROR)
+        break;
+    }
+
+    if (zerr != Z_STREAM_END)
+      break;
+  }
+
+  if (page <= last)
+  {
+    snprintf(message, msgsize, "Page %d of the output of job %d is damaged.", page, job_id);
+    goto finish;
+  }
+
+  if (close(tempfd))
+  {
+    tempfd = -1;
+    snprintf(message, msgsize, "Unable to write '%s': %s", tempfile, strerror(errno));
+    goto finish;
+  }
+
+  tempfd = -1;
+
+  papplPrinterGetDriverData(printer, &driver_data);
+
+  if (first == last)
+    snprintf(title, sizeof(title), "Reprint of page %d of job %d", first, job_id);
+  else
+    snprintf(title, sizeof(title), "Reprint of pages %d to %d of job %d", first, last, job_id);
+
+  if ((job = papplJobCreateWithFile(printer, papplClientGetUsername(client), driver_data.format, title, 0, NULL, tempfile)) == NULL)
+  {
+    snprintf(message, msgsize, "Unable to queue the reprint of job %d.", job_id);
+    goto finish;
+  }
+
+  papplLogJob(job, PAPPL_LOGLEVEL_INFO, "Reprinting pages %d to %d of job %d.", first, last, job_id);
+  snprintf(message, msgsize, "Job %d reprints pages %d to %d of job %d.", papplJobGetID(job), first, last, job_id);
+
+  // The new job owns the pages now, and the kept file was just used...
+  tempfile[0] = '\0';
+
+  snprintf(source, sizeof(source), "%s/%d-%d.brz", brf_retain_dir, printer_id, job_id);
+  utimes(source, NULL);
+
+  ret = true;
+
+  finish:
+
+  if (tempfd >= 0)
+    close(tempfd);
+
+  if (tempfile[0])
+    unlink(tempfile);
+
+  inflateEnd(&stream);
+  free(frames);
+  close(fd);
+
+  return (ret);
+}
+
+
+//
+// 'brf_retain_reprint_cb()' - Show kept jobs and reprint them.
+//
+
+static bool				// O - `true` if handled
+brf_retain_reprint_cb(
+    pappl_client_t *client,		// I - Client
+    pappl_system_t *system)		// I - System
+{
+  int			num_form = 0;	// Number of form variables
+  cups_option_t		*form = NULL;	// Form variables
+  const char		*value;		// Form value
+  int			printer_id,	// Printer ID
+			job_id,		// Job ID
+			fd,		// Kept file
+			count = 0;	// Number of kept jobs
+  char			message[1024] = "";
+					// Result message
+  brf_rtrailer_t	trailer;	// File trailer
+  DIR			*dir;		// Retention directory
+  struct dirent		*dent;		// Directory entry
+  pappl_printer_t	*printer;	// Printer
+
+
+  if (!papplClientHTMLAuthorize(client))
+    return (true);
+
+  if (papplClientGetMethod(client) == HTTP_STATE_POST)
+  {
+    num_form = papplClientGetForm(client, &form);
+
+    if (!papplClientIsValidForm(client, num_form, form))
+      papplCopyString(message, "Invalid form submission.", sizeof(message));
+    else if ((value = cupsGetOption("job", num_form, form)) == NULL || sscanf(value, "%d-%d", &printer_id, &job_id) != 2)
+      papplCopyString(message, "Missing job.", sizeof(message));
+    else
+      brf_retain_reprint(system, client, printer_id, job_id, cupsGetOption("pages", num_form, form), message, sizeof(message));
+
+    cupsFreeOptions(num_form, form);
+  }
+
+  papplClientHTMLHeader(client, "Reprint Jobs", 0);
+  papplClientHTMLPuts(client, "<div class=\"content\"><div class=\"row\"><div class=\"col-12\"><h1 class=\"title\">Reprint Jobs</h1>\n");
+
+  if (message[0])
+    papplClientHTMLPrintf(client, "<div class=\"banner\">%s</div>\n", message);
+
+  papplClientHTMLStartForm(client, "/brf-reprint", false);
+  papplClientHTMLPuts(client, "<p><label>Pages: <input type=\"text\" name=\"pages\" placeholder=\"all, or 3-5\" pattern=\"[0-9]+(-[0-9]+)?\"></label></p>\n<table class=\"list\"><tbody>\n");
+
+  if (brf_retain_dir[0] && (dir = opendir(brf_retain_dir)) != NULL)
+  {
+    while ((dent = readdir(dir)) != NULL)
+    {
+      if (sscanf(dent->d_name, "%d-%d.brz", &printer_id, &job_id) != 2 || strlen(dent->d_name) < 5 || strcmp(dent->d_name + strlen(dent->d_name) - 4, ".brz"))
+        continue;
+
+      if ((printer = papplSystemFindPrinter(system, NULL, printer_id, NULL)) == NULL || (fd = brf_retain_open(printer_id, job_id, &trailer, NULL)) < 0)
+        continue;
+
+      close(fd);
+
+      papplClientHTMLPrintf(client, "<tr><td>%s</td><td>Job %d</td><td>%u pages</td><td><button type=\"submit\" name=\"job\" value=\"%d-%d\">Reprint</button></td></tr>\n", papplPrinterGetName(printer), job_id, (unsigned)trailer.num_frames, printer_id, job_id);
+      count ++;
+    }
+
+    closedir(dir);
+  }
+
+  if (!count)
+    papplClientHTMLPuts(client, "<tr><td>No output is kept for reprints.</td></tr>\n");
+
+  papplClientHTMLPuts(client, "</tbody></table></form></div></div></div>\n");
+  papplClientHTMLFooter(client);
+
+  return (true);
+}
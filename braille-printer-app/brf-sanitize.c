@@ -0,0 +1,323 @@
+//
+// BRF clean-up for the Braille Printer Application
+//
+// Copyright © 2022 Chandresh Soni
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// BRF files from the wild contain non-breaking spaces, Unicode braille
+// patterns, lowercase BRF characters and stray control or non-ASCII
+// characters.  The CUPS drivers clean them up with sed and tr in each
+// driver script; here all drivers share one pass over the data:
+//
+// - UTF-8 and ISO-8859-1 non-breaking spaces become spaces,
+// - with BRF_SANITIZE_ASCII, Unicode braille patterns (U+2800 to U+28FF)
+//   become BRF characters, with dots 7 and 8 dropped, and other non-ASCII
+//   characters become spaces, otherwise they are passed through unchanged
+//   for 8-bit braille tables like brftoembosser does,
+// - with BRF_SANITIZE_FOLD, lowercase BRF characters "`a-z{|}~" become
+//   "@A-Z[\]_" like textbrftoindexv3 does,
+// - with BRF_SANITIZE_CONTROL, control characters other than LF, CR, FF, and
+//   SUB become spaces,
+// - with BRF_SANITIZE_CRLF, lines end with CR LF,
+// - with BRF_SANITIZE_STRIP, CR and SUB are removed.
+//
+// Runs of printable ASCII, which is nearly all of a BRF file, are checked,
+// folded and copied 16 bytes at a time with SSE2 where available.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif // __SSE2__
+
+
+//
+// Local functions...
+//
+
+static unsigned char	*brf_sanitize_char(brf_sanitize_t *s, unsigned char ch, unsigned char *out);
+
+
+//
+// Local globals...
+//
+
+static const char brf_sanitize_dots[64] =
+{					// North American BRF for dots 1-6
+  ' ', 'A', '1', 'B', '\'', 'K', '2', 'L',
+  '@', 'C', 'I', 'F', '/',  'M', 'S', 'P',
+  '\"', 'E', '3', 'H', '9', 'O', '6', 'R',
+  '^', 'D', 'J', 'G', '>',  'N', 'T', 'Q',
+  ',', '*', '5', '<', '-',  'U', '8', 'V',
+  '.', '%', '[', '$', '+',  'X', '!', '&',
+  ';', ':', '4', '\\', '0', 'Z', '7', '(',
+  '_', '?', 'W', ']', '#',  'Y', ')', '='
+};
+
+
+//
+// 'brfSanitize()' - Clean up BRF data.
+//
+// "out" must have room for twice the input plus 4 bytes.  Incomplete UTF-8
+// sequences at the end of the input are completed by the next call.
+//
+
+size_t					// O - Bytes of clean data
+brfSanitize(brf_sanitize_t *s,		// I - Sanitizer state
+            const void     *buffer,	// I - Data
+            size_t         bytes,	// I - Number of bytes
+            unsigned char  *out)	// I - Output buffer
+{
+  const unsigned char	*in = (const unsigned char *)buffer,
+					// Pointer into data
+			*end = in + bytes;
+					// End of data
+  unsigned char		*outptr = out;	// Pointer into output
+#ifdef __SSE2__
+  __m128i		v,		// Current 16 bytes
+			lower,		// Lowercase bytes
+			low = _mm_set1_epi8(0x1f),
+					// Last control character
+			high = _mm_set1_epi8(0x7f),
+					// DEL, end of printable ASCII
+			fold = _mm_set1_epi8(0x5f),
+					// Last uppercase character
+			tilde = _mm_set1_epi8(0x7e),
+					// Tilde, folds to underscore
+			delta = _mm_set1_epi8(0x20);
+					// Uppercase - lowercase
+  unsigned		mask;		// Bytes that need the scalar code
+#endif // __SSE2__
+
+
+  while (in < end)
+  {
+#ifdef __SSE2__
+    if (!s->utf8_used && (end - in) >= 16)
+    {
+      // Bytes above 0x7f are negative as signed chars, so the two compares
+      // find all printable ASCII...
+      v    = _mm_loadu_si128((const __m128i *)in);
+      mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpgt_epi8(v, low), _mm_cmplt_epi8(v, high))) ^ 0xffff;
+
+      if (s->flags & BRF_SANITIZE_FOLD)
+      {
+        // Subtract 0x20 from lowercase and 0x1f from tilde, the compare
+        // results are -1...
+        lower = _mm_cmpgt_epi8(v, fold);
+        v     = _mm_sub_epi8(_mm_sub_epi8(v, _mm_and_si128(lower, delta)), _mm_cmpeq_epi8(v, tilde));
+      }
+
+      if (!mask)
+      {
+        _mm_storeu_si128((__m128i *)outptr, v);
+        in     += 16;
+        outptr += 16;
+        s->cr  = false;
+        continue;
+      }
+      else if ((mask & 1) == 0)
+      {
+        // Copy the printable bytes before the first special one...
+        unsigned n = (unsigned)__builtin_ctz(mask);
+					// Number of printable bytes
+
+        _mm_storeu_si128((__m128i *)outptr, v);
+        in     += n;
+        outptr += n;
+        s->cr  = false;
+      }
+    }
+#endif // __SSE2__
+
+    outptr = brf_sanitize_char(s, *in++, outptr);
+  }
+
+  return ((size_t)(outptr - out));
+}
+
+
+//
+// 'brfSanitizeFinish()' - Report the characters that were replaced.
+//
+
+void
+brfSanitizeFinish(brf_sanitize_t *s,	// I - Sanitizer state
+                  pappl_job_t    *job)	// I - Job
+{
+  // An incomplete UTF-8 sequence at the end is dropped...
+  if (s->utf8_used)
+  {
+    if (s->flags & BRF_SANITIZE_ASCII)
+      s->non_ascii ++;
+
+    s->utf8_used = 0;
+  }
+
+  if (s->non_ascii)
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Replaced %u unsupported non-ASCII characters in BRF file with spaces.", s->non_ascii);
+
+  if (s->control)
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Replaced %u unsupported control characters in BRF file with spaces.", s->control);
+}
+
+
+//
+// 'brfSanitizeInit()' - Start cleaning up BRF data.
+//
+
+void
+brfSanitizeInit(brf_sanitize_t *s,	// I - Sanitizer state
+                unsigned       flags)	// I - BRF_SANITIZE_ flags
+{
+  memset(s, 0, sizeof(brf_sanitize_t));
+
+  s->flags = flags;
+}
+
+
+//
+// 'brf_sanitize_char()' - Clean up one byte.
+//
+
+static unsigned char *			// O - New end of output
+brf_sanitize_char(brf_sanitize_t *s,	// I - Sanitizer state
+                  unsigned char  ch,	// I - Byte
+                  unsigned char  *out)	// I - End of output
+{
+  unsigned	code;			// Unicode character
+  bool		cr;			// Last character was CR?
+
+
+  if (s->utf8_used)
+  {
+    if ((ch & 0xc0) == 0x80)
+    {
+      // Continuation byte...
+      s->utf8[s->utf8_used ++] = ch;
+
+      if (s->utf8_used < s->utf8_len)
+        return (out);
+
+      if (s->utf8_len == 2)
+        code = ((s->utf8[0] & 0x1fU) << 6) | (s->utf8[1] & 0x3fU);
+      else if (s->utf8_len == 3)
+        code = ((s->utf8[0] & 0x0fU) << 12) | ((s->utf8[1] & 0x3fU) << 6) | (s->utf8[2] & 0x3fU);
+      else
+        code = 0x10000;
+
+      s->utf8_used = 0;
+      s->cr        = false;
+
+      if (code == 0xa0)
+      {
+        *out++ = ' ';
+      }
+      else if (!(s->flags & BRF_SANITIZE_ASCII))
+      {
+        memcpy(out, s->utf8, (size_t)s->utf8_len);
+        out += s->utf8_len;
+      }
+      else if (code >= 0x2800 && code <= 0x28ff)
+      {
+        *out++ = (unsigned char)brf_sanitize_dots[code & 0x3f];
+      }
+      else
+      {
+        *out++ = ' ';
+        s->non_ascii ++;
+      }
+
+      return (out);
+    }
+
+    // Incomplete sequence, pass or replace it and look at this byte on its
+    // own...
+    if (s->flags & BRF_SANITIZE_ASCII)
+    {
+      *out++ = ' ';
+      s->non_ascii ++;
+    }
+    else
+    {
+      memcpy(out, s->utf8, (size_t)s->utf8_used);
+      out += s->utf8_used;
+    }
+
+    s->utf8_used = 0;
+    s->cr        = false;
+  }
+
+  if (ch >= 0xc2 && ch <= 0xf4)
+  {
+    // Start of a UTF-8 sequence...
+    s->utf8[0]   = ch;
+    s->utf8_used = 1;
+    s->utf8_len  = ch < 0xe0 ? 2 : ch < 0xf0 ? 3 : 4;
+    return (out);
+  }
+
+  // Only a LF right after a CR keeps the CR's state...
+  cr    = s->cr;
+  s->cr = false;
+
+  if (ch == 0xa0)
+  {
+    // ISO-8859-1 non-breaking space...
+    *out++ = ' ';
+  }
+  else if (ch >= 0x80)
+  {
+    if (s->flags & BRF_SANITIZE_ASCII)
+    {
+      *out++ = ' ';
+      s->non_ascii ++;
+    }
+    else
+      *out++ = ch;
+  }
+  else if (ch == '\r' || ch == '\032')
+  {
+    if (!(s->flags & BRF_SANITIZE_STRIP))
+      *out++ = ch;
+
+    s->cr = ch == '\r';
+  }
+  else if (ch == '\n')
+  {
+    if ((s->flags & BRF_SANITIZE_CRLF) && !cr)
+      *out++ = '\r';
+
+    *out++ = ch;
+  }
+  else if (ch == '\f' || (ch >= ' ' && ch < 0x60))
+  {
+    *out++ = ch;
+  }
+  else if (ch >= 0x60 && ch < 0x7f)
+  {
+    if (!(s->flags & BRF_SANITIZE_FOLD))
+      *out++ = ch;
+    else if (ch == '~')
+      *out++ = '_';
+    else
+      *out++ = ch - 0x20;
+  }
+  else if (s->flags & BRF_SANITIZE_CONTROL)
+  {
+    *out++ = ' ';
+    s->control ++;
+  }
+  else
+  {
+    *out++ = ch;
+  }
+
+  return (out);
+}
@@ -0,0 +1,340 @@
+//
+// State saving for the Braille Printer Application
+//
+// Copyright © 2022 Chandresh Soni
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// PAPPL calls the save callback after every configuration change, and
+// papplSystemSaveState() rewrites the whole state file in place.  A burst of
+// changes from a management script thus writes the file many times while
+// the server waits for the disk.  The save callback only records the change
+// instead, and a background thread saves the state once no change has come
+// in for a moment, or at the latest after a few seconds of changes.
+//
+// The state is saved to a temporary file that replaces the state file when
+// its contents differ, so the state file is never partly written and is
+// left alone when nothing changed.  Once the server shuts down, the thread
+// is stopped, a pending save is written before the system goes away, and
+// later changes are saved right away.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+
+
+//
+// Local functions...
+//
+
+static void	*brf_save_run(pappl_system_t *system);
+static bool	brf_save_timer_cb(pappl_system_t *system, void *data);
+static bool	brf_save_write(pappl_system_t *system);
+
+
+//
+// Local globals...
+//
+
+static char		brf_save_filename[1024] = "";
+					// State file
+static pthread_mutex_t	brf_save_mutex = PTHREAD_MUTEX_INITIALIZER;
+					// Mutex for pending changes
+static pthread_cond_t	brf_save_cond;	// Condition for pending changes
+static pthread_mutex_t	brf_save_write_mutex = PTHREAD_MUTEX_INITIALIZER;
+					// Mutex for writing the state file
+static pthread_t	brf_save_thread;// Background thread
+static bool		brf_save_started = false;
+					// Background thread running?
+static bool		brf_save_stop = false;
+					// Stop the background thread?
+static struct timespec	brf_save_first,	// Time of first unsaved change
+			brf_save_last;	// Time of last unsaved change
+static bool		brf_save_pending = false;
+					// Unsaved changes?
+
+
+//
+// 'brfSaveInit()' - Start saving the state in the background.
+//
+
+bool					// O - `true` on success, `false` on error
+brfSaveInit(pappl_system_t *system,	// I - System
+            const char     *filename)	// I - State file
+{
+  pthread_condattr_t	cattr;		// Condition attributes
+  int			err;		// Thread creation error
+
+
+  papplCopyString(brf_save_filename, filename, sizeof(brf_save_filename));
+
+  pthread_condattr_init(&cattr);
+  pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+  pthread_cond_init(&brf_save_cond, &cattr);
+  pthread_condattr_destroy(&cattr);
+
+  if ((err = pthread_create(&brf_save_thread, NULL, (void *(*)(void *))brf_save_run, system)) != 0)
+  {
+    papplLog(system, PAPPL_LOGLEVEL_ERROR, "Unable to create state saving thread: %s", strerror(err));
+    return (false);
+  }
+
+  brf_save_started = true;
+
+  // Watch for a shutdown, which the save callback may never hear about...
+  papplSystemAddTimerCallback(system, 0, 1, brf_save_timer_cb, NULL);
+
+  return (true);
+}
+
+
+//
+// 'brfSaveShutdown()' - Stop the background thread and save pending changes.
+//
+// Must be called before the system is deleted.  Changes after this are saved
+// right away by the save callback.
+//
+
+bool					// O - `true` on success, `false` on error
+brfSaveShutdown(pappl_system_t *system)	// I - System
+{
+  bool	pending;			// Unsaved changes?
+
+
+  pthread_mutex_lock(&brf_save_mutex);
+
+  if (!brf_save_started)
+  {
+    pthread_mutex_unlock(&brf_save_mutex);
+    return (true);
+  }
+
+  brf_save_started = false;
+  brf_save_stop    = true;
+
+  pthread_cond_signal(&brf_save_cond);
+  pthread_mutex_unlock(&brf_save_mutex);
+
+  // Wait for a save in progress...
+  pthread_join(brf_save_thread, NULL);
+
+  pthread_mutex_lock(&brf_save_mutex);
+  pending          = brf_save_pending;
+  brf_save_pending = false;
+  pthread_mutex_unlock(&brf_save_mutex);
+
+  return (!pending || brf_save_write(system));
+}
+
+
+//
+// 'brfSaveStateCB()' - Schedule saving the state after a change.
+//
+
+bool					// O - `true` on success, `false` on error
+brfSaveStateCB(pappl_system_t *system,	// I - System
+               void           *data)	// I - Callback data (not used)
+{
+  (void)data;
+
+  if (papplSystemIsShutdown(system))
+    brfSaveShutdown(system);
+
+  pthread_mutex_lock(&brf_save_mutex);
+
+  if (!brf_save_started)
+  {
+    // Save right away, nothing will save the state later...
+    pthread_mutex_unlock(&brf_save_mutex);
+
+    return (brf_save_write(system));
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &brf_save_last);
+
+  if (!brf_save_pending)
+  {
+    brf_save_first   = brf_save_last;
+    brf_save_pending = true;
+  }
+
+  pthread_cond_signal(&brf_save_cond);
+  pthread_mutex_unlock(&brf_save_mutex);
+
+  return (true);
+}
+
+
+//
+// 'brf_save_run()' - Save the state after changes have settled.
+//
+
+static void *				// O - Thread exit status (unused)
+brf_save_run(pappl_system_t *system)	// I - System
+{
+  struct timespec	deadline;	// Time to save
+
+
+  pthread_mutex_lock(&brf_save_mutex);
+
+  while (!brf_save_stop)
+  {
+    while (!brf_save_pending && !brf_save_stop)
+      pthread_cond_wait(&brf_save_cond, &brf_save_mutex);
+
+    // Wait until there was no change for BRF_SAVE_DELAY seconds, but not
+    // longer than BRF_SAVE_MAX_DELAY seconds after the first change...
+    for (;;)
+    {
+      if (brf_save_last.tv_sec < (brf_save_first.tv_sec + BRF_SAVE_MAX_DELAY - BRF_SAVE_DELAY))
+      {
+        deadline = brf_save_last;
+        deadline.tv_sec += BRF_SAVE_DELAY;
+      }
+      else
+      {
+        deadline = brf_save_first;
+        deadline.tv_sec += BRF_SAVE_MAX_DELAY;
+      }
+
+      if (!brf_save_pending || brf_save_stop || pthread_cond_timedwait(&brf_save_cond, &brf_save_mutex, &deadline) == ETIMEDOUT)
+        break;
+    }
+
+    // brfSaveShutdown() saves pending changes when stopping...
+    if (!brf_save_pending || brf_save_stop)
+      continue;
+
+    brf_save_pending = false;
+
+    pthread_mutex_unlock(&brf_save_mutex);
+
+    brf_save_write(system);
+
+    pthread_mutex_lock(&brf_save_mutex);
+  }
+
+  pthread_mutex_unlock(&brf_save_mutex);
+
+  return (NULL);
+}
+
+
+//
+// 'brf_save_timer_cb()' - Save pending changes once the server shuts down.
+//
+
+static bool				// O - `true` to keep the timer, `false` to remove it
+brf_save_timer_cb(
+    pappl_system_t *system,		// I - System
+    void           *data)		// I - Callback data (not used)
+{
+  (void)data;
+
+  if (!papplSystemIsShutdown(system))
+    return (true);
+
+  brfSaveShutdown(system);
+
+  return (false);
+}
+
+
+//
+// 'brf_save_write()' - Write the state file when the state changed.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_save_write(pappl_system_t *system)	// I - System
+{
+  char		tempfile[1100];		// Temporary state file
+  int		oldfd,			// Current state file
+		newfd;			// New state file
+  char		oldbuf[8192],		// Current state
+		newbuf[8192];		// New state
+  ssize_t	oldbytes,		// Bytes of current state
+		newbytes;		// Bytes of new state
+  bool		changed = false;	// State changed?
+  bool		ret = true;		// Return value
+
+
+  pthread_mutex_lock(&brf_save_write_mutex);
+
+  brfTraceBegin("state-save", 0);
+
+  snprintf(tempfile, sizeof(tempfile), "%s.N", brf_save_filename);
+
+  if (!papplSystemSaveState(system, tempfile))
+  {
+    papplLog(system, PAPPL_LOGLEVEL_ERROR, "Unable to save state to '%s'.", tempfile);
+    unlink(tempfile);
+    ret = false;
+    goto finish;
+  }
+
+  // Compare the new state with the current state file...
+  if ((oldfd = open(brf_save_filename, O_RDONLY)) < 0)
+  {
+    changed = true;
+  }
+  else
+  {
+    if ((newfd = open(tempfile, O_RDONLY)) < 0)
+    {
+      changed = true;
+    }
+    else
+    {
+      do
+      {
+        oldbytes = read(oldfd, oldbuf, sizeof(oldbuf));
+        newbytes = read(newfd, newbuf, sizeof(newbuf));
+
+        if (oldbytes != newbytes || (newbytes > 0 && memcmp(oldbuf, newbuf, (size_t)newbytes)))
+          changed = true;
+      }
+      while (!changed && newbytes > 0);
+
+      close(newfd);
+    }
+
+    close(oldfd);
+  }
+
+  if (!changed)
+  {
+    papplLog(system, PAPPL_LOGLEVEL_DEBUG, "State unchanged, not saving '%s'.", brf_save_filename);
+    unlink(tempfile);
+    goto finish;
+  }
+
+  // Make sure the new state is on disk before it replaces the old one...
+  if ((newfd = open(tempfile, O_RDONLY)) >= 0)
+  {
+    fsync(newfd);
+    close(newfd);
+  }
+
+  if (rename(tempfile, brf_save_filename))
+  {
+    papplLog(system, PAPPL_LOGLEVEL_ERROR, "Unable to save state to '%s': %s", brf_save_filename, strerror(errno));
+    unlink(tempfile);
+    ret = false;
+  }
+  else
+  {
+    papplLog(system, PAPPL_LOGLEVEL_DEBUG, "Saved state to '%s'.", brf_save_filename);
+  }
+
+  finish:
+
+  brfTraceEnd("state-save", 0);
+
+  pthread_mutex_unlock(&brf_save_write_mutex);
+
+  return (ret);
+}
@@ -0,0 +1,407 @@
+//
+// Priority lanes for the Braille Printer Application
+//
+// Copyright © 2022 Chandresh Soni
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// PAPPL prints the jobs of a printer one at a time, so a book keeps a short
+// handout waiting until the last page is embossed.  Jobs are sorted into
+// lanes by "job-priority" and size, and a job that is being embossed checks
+// at every page boundary for pending jobs in a more urgent lane.  Those jobs
+// are printed right there on the same device, and the large job then goes on
+// with its next page.  Duplex jobs only pause at sheet boundaries, and the
+// drivers end the document around the jobs printed ahead.
+//
+// PAPPL only completes a job in its turn, so a job that was printed ahead
+// stays pending, with its impressions and a message saying so, until the
+// large job is done.  PAPPL then starts it and brfSchedulerWasPrinted()
+// tells the print callbacks to just complete it.  Jobs that are canceled or
+// deleted while they wait are forgotten the next time a job looks for jobs
+// to print ahead.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+#include <sys/stat.h>
+
+
+//
+// Local types...
+//
+
+typedef struct brf_sched_find_s		// Search for jobs to print ahead
+{
+  pappl_job_t		*current;	// Job being printed
+  brf_lane_t		lane;		// Lane of job being printed
+  pappl_job_t		*job;		// Best pending job
+  brf_lane_t		job_lane;	// Lane of best pending job
+} brf_sched_find_t;
+
+
+//
+// Local functions...
+//
+
+static void	brf_sched_find_cb(pappl_job_t *job, brf_sched_find_t *find);
+static bool	brf_sched_is_full(pappl_system_t *system);
+static bool	brf_sched_tried(int job_id);
+
+
+//
+// Local globals...
+//
+
+static pthread_mutex_t	brf_sched_mutex = PTHREAD_MUTEX_INITIALIZER;
+					// Mutex for jobs printed ahead
+static brf_sched_print_cb_t brf_sched_print_cb = NULL;
+					// Callback that prints a job
+static int		brf_sched_num_jobs = 0;
+					// Number of jobs printed ahead
+static struct
+{
+  int			id,		// Job ID
+			printer_id;	// Printer ID
+  bool			printing,	// Being printed ahead?
+			printed;	// Printed successfully?
+  int			impressions;	// Impressions printed
+}			brf_sched_jobs[BRF_SCHED_MAX_AHEAD];
+					// Jobs printed ahead
+
+
+//
+// 'brfSchedulerGetLane()' - Get the lane of a job.
+//
+// A "job-priority" above the default of 50 is urgent and one below 50 is
+// bulk.  Jobs with the default priority are short when the document is
+// small.
+//
+
+brf_lane_t				// O - Lane
+brfSchedulerGetLane(pappl_job_t *job)	// I - Job
+{
+  int		priority = papplJobGetPriority(job);
+					// Job priority
+  struct stat	fileinfo;		// Document information
+
+
+  if (priority > 50)
+    return (BRF_LANE_URGENT);
+  else if (priority < 50)
+    return (BRF_LANE_BULK);
+  else if (!stat(papplJobGetFilename(job), &fileinfo) && fileinfo.st_size <= BRF_SCHED_SHORT_SIZE)
+    return (BRF_LANE_SHORT);
+  else
+    return (BRF_LANE_BULK);
+}
+
+
+//
+// 'brfSchedulerInit()' - Set the callback that prints jobs ahead.
+//
+
+void
+brfSchedulerInit(brf_sched_print_cb_t cb)// I - Print callback
+{
+  brf_sched_print_cb = cb;
+}
+
+
+//
+// 'brfSchedulerShouldYield()' - Check for pending jobs in a more urgent lane.
+//
+
+bool					// O - `true` if jobs should be printed ahead
+brfSchedulerShouldYield(
+    pappl_job_t *job,			// I - Job being printed
+    brf_lane_t  lane)			// I - Lane of job being printed
+{
+  brf_sched_find_t	find;		// Search state
+
+
+  if (lane == BRF_LANE_URGENT || !brf_sched_print_cb || brf_sched_is_full(papplPrinterGetSystem(papplJobGetPrinter(job))))
+    return (false);
+
+  memset(&find, 0, sizeof(find));
+  find.current = job;
+  find.lane    = lane;
+
+  papplPrinterIterateActiveJobs(papplJobGetPrinter(job), (pappl_job_cb_t)brf_sched_find_cb, &find, 1, 0);
+
+  return (find.job != NULL);
+}
+
+
+//
+// 'brfSchedulerWasPrinted()' - Check whether a job was printed ahead.
+//
+// The impressions printed ahead are reported as completed.  Jobs that failed
+// while printed ahead are printed again normally, and a job that is being
+// printed ahead right now is printed by the caller.
+//
+
+bool					// O - `true` if printed ahead
+brfSchedulerWasPrinted(pappl_job_t *job)// I - Job
+{
+  int	i,				// Looping var
+	id = papplJobGetID(job),	// Job ID
+	impressions = 0;		// Impressions printed
+  bool	printed = false;		// Printed ahead?
+
+
+  pthread_mutex_lock(&brf_sched_mutex);
+
+  for (i = 0; i < brf_sched_num_jobs; i ++)
+  {
+    if (brf_sched_jobs[i].id == id && !brf_sched_jobs[i].printing)
+    {
+      printed     = brf_sched_jobs[i].printed;
+      impressions = brf_sched_jobs[i].impressions;
+
+      brf_sched_num_jobs --;
+      memmove(brf_sched_jobs + i, brf_sched_jobs + i + 1, (size_t)(brf_sched_num_jobs - i) * sizeof(brf_sched_jobs[0]));
+      break;
+    }
+  }
+
+  pthread_mutex_unlock(&brf_sched_mutex);
+
+  if (printed)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_INFO, "Job was printed ahead of a larger job.");
+    papplJobSetImpressions(job, impressions);
+    papplJobSetImpressionsCompleted(job, impressions);
+  }
+
+  return (printed);
+}
+
+
+//
+// 'brfSchedulerYield()' - Print pending jobs from more urgent lanes.
+//
+// Call this at a page boundary after all output has been sent to the device,
+// or for duplex jobs at a sheet boundary.  Jobs are taken most urgent lane
+// first, and in queue order within a lane, until there are none left or
+// BRF_SCHED_MAX_AHEAD jobs are waiting for their turn.
+//
+
+int					// O - Number of jobs printed
+brfSchedulerYield(pappl_job_t    *job,	// I - Job being printed
+                  brf_lane_t     lane,	// I - Lane of job being printed
+                  pappl_device_t *device)
+					// I - Output device
+{
+  brf_sched_find_t	find;		// Search state
+  pappl_printer_t	*printer = papplJobGetPrinter(job);
+					// Printer
+  int			i,		// Looping var
+			id,		// Job ID
+			impressions,	// Impressions printed
+			count = 0;	// Number of jobs printed
+  bool			printed;	// Printed successfully?
+
+
+  if (lane == BRF_LANE_URGENT || !brf_sched_print_cb)
+    return (0);
+
+  for (;;)
+  {
+    if (brf_sched_is_full(papplPrinterGetSystem(printer)))
+    {
+      // Forgetting a job would print it twice, wait for the jobs printed
+      // ahead to get their turn...
+      papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Not printing more jobs ahead, %d are waiting for their turn.", BRF_SCHED_MAX_AHEAD);
+      break;
+    }
+
+    memset(&find, 0, sizeof(find));
+    find.current = job;
+    find.lane    = lane;
+
+    papplPrinterIterateActiveJobs(printer, (pappl_job_cb_t)brf_sched_find_cb, &find, 1, 0);
+
+    if (!find.job || papplJobIsCanceled(job))
+      break;
+
+    id = papplJobGetID(find.job);
+
+    // The entry stays "printing" while the job's own print callback runs,
+    // so brfSchedulerWasPrinted() doesn't take it and the job isn't picked
+    // again...
+    pthread_mutex_lock(&brf_sched_mutex);
+    if (brf_sched_num_jobs >= BRF_SCHED_MAX_AHEAD)
+    {
+      // Another printer took the last entry...
+      pthread_mutex_unlock(&brf_sched_mutex);
+      break;
+    }
+
+    brf_sched_jobs[brf_sched_num_jobs].id          = id;
+    brf_sched_jobs[brf_sched_num_jobs].printer_id  = papplPrinterGetID(printer);
+    brf_sched_jobs[brf_sched_num_jobs].printing    = true;
+    brf_sched_jobs[brf_sched_num_jobs].printed     = false;
+    brf_sched_jobs[brf_sched_num_jobs].impressions = 0;
+    brf_sched_num_jobs ++;
+    pthread_mutex_unlock(&brf_sched_mutex);
+
+    papplLogJob(job, PAPPL_LOGLEVEL_INFO, "Pausing at a page boundary to print job %d.", id);
+    papplLogJob(find.job, PAPPL_LOGLEVEL_INFO, "Printing ahead of job %d.", papplJobGetID(job));
+
+    brfTraceBegin("print-ahead", id);
+    printed     = (brf_sched_print_cb)(find.job, device);
+    impressions = papplJobGetImpressionsCompleted(find.job);
+    brfTraceEnd("print-ahead", id);
+
+    pthread_mutex_lock(&brf_sched_mutex);
+    for (i = 0; i < brf_sched_num_jobs; i ++)
+    {
+      if (brf_sched_jobs[i].id == id)
+      {
+        brf_sched_jobs[i].printing    = false;
+        brf_sched_jobs[i].printed     = printed;
+        brf_sched_jobs[i].impressions = impressions;
+        break;
+      }
+    }
+    pthread_mutex_unlock(&brf_sched_mutex);
+
+    if (printed)
+      papplJobSetMessage(find.job, "Printed ahead of job %d, completes when it is done.", papplJobGetID(job));
+    else
+      papplLogJob(find.job, PAPPL_LOGLEVEL_WARN, "Unable to print ahead, the job will be printed in its turn.");
+
+    count ++;
+  }
+
+  if (count > 0)
+    papplLogJob(job, PAPPL_LOGLEVEL_INFO, "Resuming after %d job(s) printed ahead.", count);
+
+  return (count);
+}
+
+
+//
+// 'brf_sched_find_cb()' - Find the most urgent pending job.
+//
+
+static void
+brf_sched_find_cb(
+    pappl_job_t      *job,		// I - Active job
+    brf_sched_find_t *find)		// I - Search state
+{
+  brf_lane_t	lane;			// Lane of job
+
+
+  if (job == find->current || papplJobGetState(job) != IPP_JSTATE_PENDING || brf_sched_tried(papplJobGetID(job)))
+    return;
+
+  if ((lane = brfSchedulerGetLane(job)) >= find->lane)
+    return;
+
+  if (!find->job || lane < find->job_lane)
+  {
+    find->job      = job;
+    find->job_lane = lane;
+  }
+}
+
+
+//
+// 'brf_sched_is_full()' - Check whether no more jobs can be printed ahead.
+//
+// Jobs printed ahead that are no longer active, because they were canceled
+// or deleted while waiting for their turn, are forgotten first.  The jobs
+// are looked up without holding the mutex, which brf_sched_find_cb() takes
+// with the printer locked.
+//
+
+static bool				// O - `true` if full
+brf_sched_is_full(
+    pappl_system_t *system)		// I - System
+{
+  int			i, j,		// Looping vars
+			num_jobs = 0,	// Number of waiting jobs
+			ids[BRF_SCHED_MAX_AHEAD],
+					// Job IDs
+			printer_ids[BRF_SCHED_MAX_AHEAD];
+					// Printer IDs
+  pappl_printer_t	*printer;	// Printer
+  pappl_job_t		*job;		// Job
+  bool			full;		// Full?
+
+
+  pthread_mutex_lock(&brf_sched_mutex);
+
+  for (i = 0; i < brf_sched_num_jobs; i ++)
+  {
+    if (!brf_sched_jobs[i].printing)
+    {
+      ids[num_jobs]         = brf_sched_jobs[i].id;
+      printer_ids[num_jobs] = brf_sched_jobs[i].printer_id;
+      num_jobs ++;
+    }
+  }
+
+  pthread_mutex_unlock(&brf_sched_mutex);
+
+  for (i = 0; i < num_jobs; i ++)
+  {
+    if ((printer = papplSystemFindPrinter(system, NULL, printer_ids[i], NULL)) != NULL && (job = papplPrinterFindJob(printer, ids[i])) != NULL && papplJobGetState(job) < IPP_JSTATE_CANCELED)
+      continue;
+
+    pthread_mutex_lock(&brf_sched_mutex);
+
+    for (j = 0; j < brf_sched_num_jobs; j ++)
+    {
+      if (brf_sched_jobs[j].id == ids[i] && !brf_sched_jobs[j].printing)
+      {
+        brf_sched_num_jobs --;
+        memmove(brf_sched_jobs + j, brf_sched_jobs + j + 1, (size_t)(brf_sched_num_jobs - j) * sizeof(brf_sched_jobs[0]));
+        break;
+      }
+    }
+
+    pthread_mutex_unlock(&brf_sched_mutex);
+
+    papplLog(system, PAPPL_LOGLEVEL_DEBUG, "Forgetting job %d, it ended while waiting for its turn.", ids[i]);
+  }
+
+  pthread_mutex_lock(&brf_sched_mutex);
+  full = brf_sched_num_jobs >= BRF_SCHED_MAX_AHEAD;
+  pthread_mutex_unlock(&brf_sched_mutex);
+
+  return (full);
+}
+
+
+//
+// 'brf_sched_tried()' - Check whether a job has been printed ahead already.
+//
+
+static bool				// O - `true` if already tried
+brf_sched_tried(int job_id)		// I - Job ID
+{
+  int	i;				// Looping var
+  bool	tried = false;			// Already tried?
+
+
+  pthread_mutex_lock(&brf_sched_mutex);
+
+  for (i = 0; i < brf_sched_num_jobs; i ++)
+  {
+    if (brf_sched_jobs[i].id == job_id)
+    {
+      tried = true;
+      break;
+    }
+  }
+
+  pthread_mutex_unlock(&brf_sched_mutex);
+
+  return (tried);
+}
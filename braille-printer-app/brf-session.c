@@ -0,0 +1,424 @@
+//
+// Embosser sessions for the Braille Printer Application
+//
+// Copyright © 2022 Chandresh Soni
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Every job sets the embosser up and ends its document, which takes longer
+// than embossing a one-page label.  Consecutive small jobs of the same
+// format are therefore sent as one document: a job that is followed by a
+// small job only finishes its last page, and the next job skips the setup
+// sequence when it is the same as the last one sent.  A session that is
+// left open without a job to continue it is ended by a timer as soon as the
+// printer is idle.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+#include <sys/stat.h>
+
+
+//
+// Local types...
+//
+
+typedef struct brf_session_s		// Embosser session
+{
+  int			printer_id;	// Printer ID
+  bool			open;		// Document not ended yet?
+  time_t		idle;		// Time the last job ended
+  char			init[256],	// Last setup sequence sent
+			end[16];	// Sequence that ends the document
+} brf_session_t;
+
+typedef struct brf_session_find_s	// Search for the next job
+{
+  pappl_job_t		*current;	// Job being printed
+  pappl_job_t		*job;		// Next pending job
+} brf_session_find_t;
+
+
+//
+// Local functions...
+//
+
+static void		brf_session_find_cb(pappl_job_t *job, brf_session_find_t *find);
+static brf_session_t	*brf_session_get(pappl_printer_t *printer);
+static brf_session_t	*brf_session_get_id(int printer_id);
+static bool		brf_session_is_small(pappl_job_t *job);
+static bool		brf_session_timer_cb(pappl_system_t *system, void *data);
+
+
+//
+// Local globals...
+//
+
+static pthread_mutex_t	brf_session_mutex = PTHREAD_MUTEX_INITIALIZER;
+					// Mutex for sessions
+static brf_session_t	*brf_sessions = NULL;
+					// Sessions
+static int		brf_num_sessions = 0;
+					// Number of sessions
+
+
+//
+// 'brfSessionBegin()' - Begin the output of a job.
+//
+// The setup sequence is only sent when it differs from the one the open
+// document was started with, otherwise the job continues that document.
+//
+// The session functions only hold the session mutex to update the state and
+// write to the device after releasing it, so jobs on other printers don't
+// wait for a slow embosser.  Only the job that has the device open and the
+// timer that ends idle sessions change the session of a printer.
+//
+
+bool					// O - `true` on success, `false` on error
+brfSessionBegin(pappl_job_t  *job,	// I - Job
+                brf_writer_t *writer,	// I - Device writer
+                const char   *init,	// I - Setup sequence
+                const char   *end)	// I - Sequence that ends the document
+{
+  brf_session_t	*session;		// Session
+  char		prev_end[16] = "";	// End of the previous document
+  bool		send_init = true;	// Send the setup sequence?
+  bool		ret = true;		// Return value
+
+
+  pthread_mutex_lock(&brf_session_mutex);
+
+  if ((session = brf_session_get(papplJobGetPrinter(job))) != NULL)
+  {
+    if (session->open && !strcmp(session->init, init))
+    {
+      papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Continuing the embosser session of the previous job.");
+      send_init = false;
+    }
+    else
+    {
+      if (session->open)
+        papplCopyString(prev_end, session->end, sizeof(prev_end));
+
+      papplCopyString(session->init, init, sizeof(session->init));
+      papplCopyString(session->end, end, sizeof(session->end));
+    }
+
+    // The session is open until the end of the job...
+    session->open = true;
+  }
+
+  pthread_mutex_unlock(&brf_session_mutex);
+
+  if (prev_end[0] && brfWriterWrite(writer, prev_end, strlen(prev_end)) < 0)
+    ret = false;
+  else if (send_init && init[0] && brfWriterWrite(writer, init, strlen(init)) < 0)
+    ret = false;
+
+  if (!ret)
+  {
+    // ... and unknown after an error
+    pthread_mutex_lock(&brf_session_mutex);
+
+    if ((session = brf_session_get(papplJobGetPrinter(job))) != NULL)
+    {
+      session->open    = false;
+      session->init[0] = '\0';
+    }
+
+    pthread_mutex_unlock(&brf_session_mutex);
+  }
+
+  return (ret);
+}
+
+
+//
+// 'brfSessionClose()' - End the open document of a job's printer.
+//
+// Used before output that sets the embosser up on its own.
+//
+
+bool					// O - `true` on success, `false` on error
+brfSessionClose(pappl_job_t  *job,	// I - Job
+                brf_writer_t *writer)	// I - Device writer
+{
+  brf_session_t	*session;		// Session
+  char		end[16] = "";		// Sequence that ends the document
+
+
+  pthread_mutex_lock(&brf_session_mutex);
+
+  if ((session = brf_session_get(papplJobGetPrinter(job))) != NULL && session->open)
+  {
+    papplCopyString(end, session->end, sizeof(end));
+
+    session->open    = false;
+    session->init[0] = '\0';
+  }
+
+  pthread_mutex_unlock(&brf_session_mutex);
+
+  return (!end[0] || brfWriterWrite(writer, end, strlen(end)) >= 0);
+}
+
+
+//
+// 'brfSessionEnd()' - End the output of a job.
+//
+// When the job and the next pending job are small documents of the same
+// format, `separator` is sent instead of the end sequence and the document
+// stays open for the next job.  A `NULL` separator always ends the document.
+//
+
+bool					// O - `true` on success, `false` on error
+brfSessionEnd(pappl_job_t  *job,	// I - Job
+              brf_writer_t *writer,	// I - Device writer
+              const char   *separator)	// I - Page break for the next job or `NULL`
+{
+  brf_session_t		*session;	// Session
+  brf_session_find_t	find;		// Search for the next job
+  char			end[16] = "";	// Sequence that ends the document
+  bool			ret = true;	// Return value
+
+
+  // Look for a small job of the same format to continue the document...
+  memset(&find, 0, sizeof(find));
+  find.current = job;
+
+  if (separator && !papplJobIsCanceled(job) && brf_session_is_small(job))
+  {
+    papplPrinterIterateActiveJobs(papplJobGetPrinter(job), (pappl_job_cb_t)brf_session_find_cb, &find, 1, 0);
+
+    if (find.job && (strcmp(papplJobGetFormat(find.job), papplJobGetFormat(job)) || !brf_session_is_small(find.job)))
+      find.job = NULL;
+  }
+
+  pthread_mutex_lock(&brf_session_mutex);
+
+  if ((session = brf_session_get(papplJobGetPrinter(job))) == NULL || !session->open)
+  {
+    pthread_mutex_unlock(&brf_session_mutex);
+    return (true);
+  }
+
+  if (find.job)
+  {
+    session->idle = time(NULL);
+  }
+  else
+  {
+    papplCopyString(end, session->end, sizeof(end));
+
+    session->open    = false;
+    session->init[0] = '\0';
+  }
+
+  pthread_mutex_unlock(&brf_session_mutex);
+
+  if (find.job)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Keeping the embosser session open for job %d.", papplJobGetID(find.job));
+
+    if (separator[0] && brfWriterWrite(writer, separator, strlen(separator)) < 0)
+    {
+      ret = false;
+
+      pthread_mutex_lock(&brf_session_mutex);
+
+      if ((session = brf_session_get(papplJobGetPrinter(job))) != NULL)
+      {
+        session->open    = false;
+        session->init[0] = '\0';
+      }
+
+      pthread_mutex_unlock(&brf_session_mutex);
+    }
+  }
+  else if (end[0] && brfWriterWrite(writer, end, strlen(end)) < 0)
+  {
+    ret = false;
+  }
+
+  return (ret);
+}
+
+
+//
+// 'brfSessionInit()' - Start the timer that ends idle sessions.
+//
+
+void
+brfSessionInit(pappl_system_t *system)	// I - System
+{
+  papplSystemAddTimerCallback(system, 0, BRF_SESSION_TIMEOUT, brf_session_timer_cb, NULL);
+}
+
+
+//
+// 'brf_session_find_cb()' - Find the next pending job.
+//
+// Active jobs are in the order they are printed.
+//
+
+static void
+brf_session_find_cb(
+    pappl_job_t        *job,		// I - Active job
+    brf_session_find_t *find)		// I - Search state
+{
+  if (!find->job && job != find->current && papplJobGetState(job) == IPP_JSTATE_PENDING)
+    find->job = job;
+}
+
+
+//
+// 'brf_session_get()' - Get the session of a printer, creating it as needed.
+//
+// Must be called with the session mutex held.
+//
+
+static brf_session_t *			// O - Session or `NULL` on error
+brf_session_get(pappl_printer_t *printer)// I - Printer
+{
+  int		i,			// Looping var
+		printer_id = papplPrinterGetID(printer);
+					// Printer ID
+  brf_session_t	*temp;			// New session array
+
+
+  for (i = 0; i < brf_num_sessions; i ++)
+  {
+    if (brf_sessions[i].printer_id == printer_id)
+      return (brf_sessions + i);
+  }
+
+  if ((temp = (brf_session_t *)realloc(brf_sessions, (size_t)(brf_num_sessions + 1) * sizeof(brf_session_t))) == NULL)
+    return (NULL);
+
+  brf_sessions = temp;
+  temp += brf_num_sessions ++;
+
+  memset(temp, 0, sizeof(brf_session_t));
+  temp->printer_id = printer_id;
+
+  return (temp);
+}
+
+
+//
+// 'brf_session_get_id()' - Find the session of a printer ID.
+//
+// Must be called with the session mutex held.
+//
+
+static brf_session_t *			// O - Session or `NULL` if none
+brf_session_get_id(int printer_id)	// I - Printer ID
+{
+  int		i;			// Looping var
+
+
+  for (i = 0; i < brf_num_sessions; i ++)
+  {
+    if (brf_sessions[i].printer_id == printer_id)
+      return (brf_sessions + i);
+  }
+
+  return (NULL);
+}
+
+
+//
+// 'brf_session_is_small()' - Check whether a job is a small document.
+//
+
+static bool				// O - `true` if small
+brf_session_is_small(pappl_job_t *job)	// I - Job
+{
+  struct stat	fileinfo;		// Document information
+
+
+  return (!stat(papplJobGetFilename(job), &fileinfo) && fileinfo.st_size <= BRF_SCHED_SHORT_SIZE);
+}
+
+
+//
+// 'brf_session_timer_cb()' - End sessions that no job continued.
+//
+// The session mutex is only held to look at and take over a session, the
+// device output happens without it so that jobs don't wait for a slow
+// embosser.
+//
+
+static bool				// O - `true` to keep the timer
+brf_session_timer_cb(
+    pappl_system_t *system,		// I - System
+    void           *data)		// I - Callback data (not used)
+{
+  int			i,		// Looping var
+			num_idle = 0,	// Number of idle sessions
+			idle[16];	// Printer IDs of idle sessions
+  time_t		now = time(NULL);
+					// Current time
+  brf_session_t		*session;	// Session
+  pappl_printer_t	*printer;	// Printer
+  pappl_device_t	*device;	// Printer device
+  char			end[16];	// Sequence that ends the document
+
+
+  (void)data;
+
+  // Find the sessions to end...
+  pthread_mutex_lock(&brf_session_mutex);
+
+  for (i = 0; i < brf_num_sessions && num_idle < (int)(sizeof(idle) / sizeof(idle[0])); i ++)
+  {
+    if (brf_sessions[i].open && (now - brf_sessions[i].idle) >= BRF_SESSION_TIMEOUT)
+      idle[num_idle ++] = brf_sessions[i].printer_id;
+  }
+
+  pthread_mutex_unlock(&brf_session_mutex);
+
+  for (i = 0; i < num_idle; i ++)
+  {
+    // The device can only be opened while no job is using it...
+    if ((printer = papplSystemFindPrinter(system, NULL, idle[i], NULL)) == NULL)
+      device = NULL;
+    else if ((device = papplPrinterOpenDevice(printer)) == NULL)
+      continue;
+
+    // Take the session over, a job may have continued or ended it since...
+    pthread_mutex_lock(&brf_session_mutex);
+
+    end[0] = '\0';
+
+    if ((session = brf_session_get_id(idle[i])) != NULL && session->open && (now - session->idle) >= BRF_SESSION_TIMEOUT)
+    {
+      if (device)
+        papplCopyString(end, session->end, sizeof(end));
+
+      session->open    = false;
+      session->init[0] = '\0';
+    }
+
+    pthread_mutex_unlock(&brf_session_mutex);
+
+    if (!device)
+      continue;
+
+    if (end[0])
+    {
+      papplLogPrinter(printer, PAPPL_LOGLEVEL_DEBUG, "Ending the idle embosser session.");
+
+      papplDeviceWrite(device, end, strlen(end));
+      papplDeviceFlush(device);
+    }
+
+    papplPrinterCloseDevice(printer);
+  }
+
+  return (true);
+}
@@ -0,0 +1,496 @@
+//
+// Simulated embosser device for the Braille Printer Application
+//
+// Copyright © 2022 Chandresh Soni
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// The "sim" device scheme stands in for an embosser when testing the output
+// path without hardware:
+//
+//   sim://NAME?cps=CHARS&feed=MS&buffer=BYTES&jam=PAGE&paper=PAGES
+//
+// The embosser embosses "cps" characters per second, takes "feed"
+// milliseconds to feed each page, and has an input buffer of "buffer" bytes.
+// Writes are accepted as long as there is room in the buffer and block until
+// enough of it has been embossed otherwise, like a USB printer that holds
+// back its bulk endpoint.  Pages are counted from the generic FF and SUB
+// framing, skipping Index escape sequences (setup "ESC D ... ;" and the
+// graphic mode switches "ESC BEL" and "ESC ACK").
+//
+// With "jam" the embosser jams while feeding that page, counted from the
+// start of the server, and with "paper" it runs out of paper after that many
+// pages.  Either way the write fails and the status reports the problem
+// until the device is opened again, as if someone had cleared the jam or
+// loaded paper.  Embossers with the same NAME share their state, so a job
+// that resumes after a jam continues on the same simulated embosser.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+
+
+//
+// Local types...
+//
+
+typedef struct brf_sim_s		// Simulated embosser
+{
+  char			name[256];	// Name from the device URI
+  int			cps,		// Characters per second
+			feed,		// Page feed time in milliseconds
+			jam,		// Page that jams or 0
+			paper;		// Pages of paper or 0 for endless
+  size_t		buffer;		// Size of input buffer
+  double		chunks[BRF_SIM_CHUNKS];
+					// Times the chunks in the buffer are embossed
+  int			first_chunk,	// First chunk in the buffer
+			num_chunks;	// Number of chunks in the buffer
+  double		busy;		// Time all buffered data is embossed
+  int			pages,		// Pages embossed since the server started
+			paper_left;	// Pages of paper left
+  bool			loaded,		// Paper loaded yet?
+			content;	// Current page has content?
+  pappl_preason_t	reasons;	// Jam or paper out
+} brf_sim_t;
+
+typedef enum brf_sim_state_e		// Parser state
+{
+  BRF_SIM_STATE_TEXT,			// Text or graphics
+  BRF_SIM_STATE_ESCAPE,			// After ESC
+  BRF_SIM_STATE_SETUP			// In "ESC D ... ;"
+} brf_sim_state_t;
+
+typedef struct brf_sim_device_s		// Open simulated embosser
+{
+  brf_sim_t		*sim;		// Embosser
+  brf_sim_state_t	state;		// Parser state
+  double		start;		// Time the device was opened
+  size_t		bytes;		// Bytes written
+  int			pages,		// Pages embossed
+			documents;	// Documents ended with SUB
+} brf_sim_device_t;
+
+
+//
+// Local functions...
+//
+
+static void		brf_sim_close(pappl_device_t *device);
+static brf_sim_t	*brf_sim_get(const char *device_uri);
+static double		brf_sim_now(void);
+static bool		brf_sim_open(pappl_device_t *device, const char *device_uri, const char *name);
+static void		brf_sim_sleep(double seconds);
+static pappl_preason_t	brf_sim_status(pappl_device_t *device);
+static ssize_t		brf_sim_write(pappl_device_t *device, const void *buffer, size_t bytes);
+
+
+//
+// Local globals...
+//
+
+static pappl_system_t	*brf_sim_system = NULL;
+					// System (for logging)
+static pthread_mutex_t	brf_sim_mutex = PTHREAD_MUTEX_INITIALIZER;
+					// Mutex for simulated embossers
+static brf_sim_t	**brf_sims = NULL;
+					// Simulated embossers
+static int		brf_num_sims = 0;
+					// Number of simulated embossers
+
+
+//
+// 'brfSimInit()' - Add the "sim" device scheme.
+//
+
+void
+brfSimInit(pappl_system_t *system)	// I - System
+{
+  brf_sim_system = system;
+
+  papplDeviceAddScheme("sim", PAPPL_DEVTYPE_CUSTOM_LOCAL, NULL, brf_sim_open, brf_sim_close, NULL, brf_sim_write, brf_sim_status, NULL);
+}
+
+
+//
+// 'brf_sim_close()' - Close a simulated embosser.
+//
+// The embosser keeps embossing the data in its buffer after the close, the
+// next job waits for it like for a real embosser.
+//
+
+static void
+brf_sim_close(pappl_device_t *device)	// I - Device
+{
+  brf_sim_device_t	*dev = (brf_sim_device_t *)papplDeviceGetData(device);
+					// Open embosser
+
+
+  if (!dev)
+    return;
+
+  papplLog(brf_sim_system, PAPPL_LOGLEVEL_INFO, "sim://%s: %d pages and %d documents, %lu bytes in %.3f seconds.", dev->sim->name, dev->pages, dev->documents, (unsigned long)dev->bytes, brf_sim_now() - dev->start);
+
+  free(dev);
+  papplDeviceSetData(device, NULL);
+}
+
+
+//
+// 'brf_sim_get()' - Get the simulated embosser for a device URI.
+//
+// Must be called with the mutex held.  The parameters are set from the URI
+// every time, so a changed device URI applies to the next job.
+//
+
+static brf_sim_t *			// O - Embosser or `NULL` on error
+brf_sim_get(const char *device_uri)	// I - Device URI
+{
+  char		scheme[32],		// URI scheme
+		userpass[256],		// URI username:password
+		host[256],		// URI hostname
+		resource[1024],		// URI resource and query
+		*query,			// Query string
+		*name,			// Parameter name
+		*value,			// Parameter value
+		*saveptr;		// Pointer for strtok_r()
+  int		port,			// URI port
+		i;			// Looping var
+  brf_sim_t	*sim = NULL,		// Embosser
+		**temp;			// New embosser array
+
+
+  if (httpSeparateURI(HTTP_URI_CODING_ALL, device_uri, scheme, sizeof(scheme), userpass, sizeof(userpass), host, sizeof(host), &port, resource, sizeof(resource)) < HTTP_URI_STATUS_OK)
+    return (NULL);
+
+  for (i = 0; i < brf_num_sims; i ++)
+  {
+    if (!strcmp(brf_sims[i]->name, host))
+    {
+      sim = brf_sims[i];
+      break;
+    }
+  }
+
+  if (!sim)
+  {
+    if ((temp = (brf_sim_t **)realloc(brf_sims, (size_t)(brf_num_sims + 1) * sizeof(brf_sim_t *))) == NULL)
+      return (NULL);
+
+    brf_sims = temp;
+
+    if ((sim = (brf_sim_t *)calloc(1, sizeof(brf_sim_t))) == NULL)
+      return (NULL);
+
+    brf_sims[brf_num_sims ++] = sim;
+
+    papplCopyString(sim->name, host, sizeof(sim->name));
+  }
+
+  sim->cps    = BRF_SIM_CPS;
+  sim->feed   = BRF_SIM_FEED;
+  sim->buffer = BRF_SIM_BUFFER;
+  sim->jam    = 0;
+  sim->paper  = 0;
+
+  if ((query = strchr(resource, '?')) != NULL)
+  {
+    for (name = strtok_r(query + 1, "&", &saveptr); name; name = strtok_r(NULL, "&", &saveptr))
+    {
+      if ((value = strchr(name, '=')) == NULL)
+        continue;
+
+      *value++ = '\0';
+
+      if (!strcmp(name, "cps") && atoi(value) > 0)
+        sim->cps = atoi(value);
+      else if (!strcmp(name, "feed") && atoi(value) >= 0)
+        sim->feed = atoi(value);
+      else if (!strcmp(name, "buffer") && atoi(value) > 0)
+        sim->buffer = (size_t)atoi(value);
+      else if (!strcmp(name, "jam"))
+        sim->jam = atoi(value);
+      else if (!strcmp(name, "paper"))
+        sim->paper = atoi(value);
+    }
+  }
+
+  return (sim);
+}
+
+
+//
+// 'brf_sim_now()' - Get the monotonic time in seconds.
+//
+
+static double				// O - Time in seconds
+brf_sim_now(void)
+{
+  struct timespec	now;		// Current time
+
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return ((double)now.tv_sec + (double)now.tv_nsec / 1000000000.0);
+}
+
+
+//
+// 'brf_sim_open()' - Open a simulated embosser.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_sim_open(pappl_device_t *device,	// I - Device
+             const char     *device_uri,// I - Device URI
+             const char     *name)	// I - Job name
+{
+  brf_sim_t		*sim;		// Embosser
+  brf_sim_device_t	*dev;		// Open embosser
+
+
+  (void)name;
+
+  pthread_mutex_lock(&brf_sim_mutex);
+
+  if ((sim = brf_sim_get(device_uri)) == NULL)
+  {
+    pthread_mutex_unlock(&brf_sim_mutex);
+    papplDeviceError(device, "Bad simulated embosser '%s'.", device_uri);
+    return (false);
+  }
+
+  // Opening the device clears a jam and loads paper...
+  if (sim->reasons & PAPPL_PREASON_MEDIA_JAM)
+    sim->jam = 0;
+
+  if ((sim->reasons & PAPPL_PREASON_MEDIA_EMPTY) || !sim->loaded)
+  {
+    sim->paper_left = sim->paper;
+    sim->loaded     = true;
+  }
+
+  sim->reasons = PAPPL_PREASON_NONE;
+
+  pthread_mutex_unlock(&brf_sim_mutex);
+
+  if ((dev = (brf_sim_device_t *)calloc(1, sizeof(brf_sim_device_t))) == NULL)
+  {
+    papplDeviceError(device, "Unable to allocate memory for simulated embosser.");
+    return (false);
+  }
+
+  dev->sim   = sim;
+  dev->start = brf_sim_now();
+
+  papplDeviceSetData(device, dev);
+
+  return (true);
+}
+
+
+//
+// 'brf_sim_sleep()' - Sleep for some time.
+//
+
+static void
+brf_sim_sleep(double seconds)		// I - Seconds
+{
+  struct timespec	delay;		// Delay
+
+
+  if (seconds <= 0.0)
+    return;
+
+  delay.tv_sec  = (time_t)seconds;
+  delay.tv_nsec = (long)((seconds - (double)delay.tv_sec) * 1000000000.0);
+
+  while (nanosleep(&delay, &delay) && errno == EINTR);
+}
+
+
+//
+// 'brf_sim_status()' - Get the status of a simulated embosser.
+//
+
+static pappl_preason_t			// O - Jam or paper out
+brf_sim_status(pappl_device_t *device)	// I - Device
+{
+  brf_sim_device_t	*dev = (brf_sim_device_t *)papplDeviceGetData(device);
+					// Open embosser
+  pappl_preason_t	reasons;	// Status
+
+
+  if (!dev)
+    return (PAPPL_PREASON_NONE);
+
+  pthread_mutex_lock(&brf_sim_mutex);
+  reasons = dev->sim->reasons;
+  pthread_mutex_unlock(&brf_sim_mutex);
+
+  return (reasons);
+}
+
+
+//
+// 'brf_sim_write()' - Send data to a simulated embosser.
+//
+// The data is split into chunks of 1/BRF_SIM_CHUNKS of the input buffer, and
+// a chunk is only accepted when the buffer has room for it, so writes block
+// about as long as the embosser takes to make room for them.
+//
+
+static ssize_t				// O - Bytes written or `-1` on error
+brf_sim_write(pappl_device_t *device,	// I - Device
+              const void     *buffer,	// I - Data
+              size_t         bytes)	// I - Number of bytes
+{
+  brf_sim_device_t	*dev = (brf_sim_device_t *)papplDeviceGetData(device);
+					// Open embosser
+  brf_sim_t		*sim;		// Embosser
+  const unsigned char	*ptr = (const unsigned char *)buffer,
+					// Pointer into data
+			*end = ptr + bytes,
+					// End of data
+			*chunkend;	// End of chunk
+  size_t		chunksize;	// Bytes per chunk
+  int			max_chunks;	// Chunks that fit in the buffer
+  double		cost,		// Seconds to emboss chunk
+			now,		// Current time
+			wait;		// Seconds to wait for room
+  const char		*error = NULL;	// Jam or paper out message
+
+
+  if (!dev)
+    return (-1);
+
+  sim = dev->sim;
+
+  pthread_mutex_lock(&brf_sim_mutex);
+
+  if (sim->buffer < BRF_SIM_CHUNKS)
+  {
+    chunksize  = 1;
+    max_chunks = (int)sim->buffer;
+  }
+  else
+  {
+    chunksize  = sim->buffer / BRF_SIM_CHUNKS;
+    max_chunks = BRF_SIM_CHUNKS;
+  }
+
+  while (ptr < end && !error)
+  {
+    if ((chunkend = ptr + chunksize) > end)
+      chunkend = end;
+
+    // Count pages and the time to emboss them...
+    for (cost = 0.0; ptr < chunkend; ptr ++)
+    {
+      switch (dev->state)
+      {
+        case BRF_SIM_STATE_TEXT :
+            if (*ptr == 0x1b)
+            {
+              dev->state = BRF_SIM_STATE_ESCAPE;
+              continue;
+            }
+            else if (*ptr != '\f' && *ptr != 0x1a)
+            {
+              if (*ptr != '\r' && *ptr != '\n')
+              {
+                cost += 1.0 / sim->cps;
+                sim->content = true;
+              }
+              continue;
+            }
+            else if (*ptr == 0x1a)
+            {
+              // End of document, eject a page that isn't empty...
+              dev->documents ++;
+
+              if (!sim->content)
+                continue;
+            }
+
+            // Feed the page...
+            if (sim->jam > 0 && (sim->pages + 1) == sim->jam)
+            {
+              sim->reasons |= PAPPL_PREASON_MEDIA_JAM;
+              error = "Paper jam";
+              break;
+            }
+            else if (sim->paper > 0 && sim->paper_left <= 0)
+            {
+              sim->reasons |= PAPPL_PREASON_MEDIA_EMPTY;
+              error = "Out of paper";
+              break;
+            }
+
+            cost += sim->feed / 1000.0;
+            sim->pages ++;
+            sim->content = false;
+            if (sim->paper > 0)
+              sim->paper_left --;
+            dev->pages ++;
+            break;
+
+        case BRF_SIM_STATE_ESCAPE :
+            dev->state = *ptr == 'D' ? BRF_SIM_STATE_SETUP : BRF_SIM_STATE_TEXT;
+            break;
+
+        case BRF_SIM_STATE_SETUP :
+            if (*ptr == ';')
+              dev->state = BRF_SIM_STATE_TEXT;
+            break;
+      }
+
+      if (error)
+        break;
+    }
+
+    // Wait for room in the input buffer...
+    for (;;)
+    {
+      now = brf_sim_now();
+
+      while (sim->num_chunks > 0 && sim->chunks[sim->first_chunk] <= now)
+      {
+        sim->first_chunk = (sim->first_chunk + 1) % BRF_SIM_CHUNKS;
+        sim->num_chunks --;
+      }
+
+      if (sim->num_chunks < max_chunks)
+        break;
+
+      wait = sim->chunks[sim->first_chunk] - now;
+
+      pthread_mutex_unlock(&brf_sim_mutex);
+      brf_sim_sleep(wait);
+      pthread_mutex_lock(&brf_sim_mutex);
+    }
+
+    if (sim->busy < now)
+      sim->busy = now;
+
+    sim->busy += cost;
+
+    sim->chunks[(sim->first_chunk + sim->num_chunks) % BRF_SIM_CHUNKS] = sim->busy;
+    sim->num_chunks ++;
+  }
+
+  pthread_mutex_unlock(&brf_sim_mutex);
+
+  if (error)
+  {
+    papplDeviceError(device, "%s at page %d of sim://%s.", error, sim->pages + 1, sim->name);
+    return (-1);
+  }
+
+  dev->bytes += bytes;
+
+  return ((ssize_t)bytes);
+}
@@ -0,0 +1,357 @@
+//
+// Job tracing for the Braille Printer Application
+//
+// Copyright © 2022 Chandresh Soni
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Debug logging formats every message and copies all device data, which is
+// too slow to leave on.  Instead, each thread records begin and end events
+// of the job stages in a ring buffer of its own: a timestamp, a static name,
+// and the job ID, with no locking and no formatting.  The rings live in
+// shared memory so filter processes forked from the server record into them
+// too.  The "/brf-trace.json" page of the web interface exports the recent
+// events of all rings in the Chrome trace event format, which can be loaded
+// into Perfetto or "chrome://tracing".
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#  include <sys/syscall.h>
+#endif // __linux__
+
+
+//
+// Local types...
+//
+
+typedef struct brf_trace_event_s	// Trace event
+{
+  uint64_t		time;		// Monotonic time in nanoseconds
+  const char		*name;		// Stage name (static string)
+  int			job_id,		// Job ID or 0
+			pid,		// Process ID
+			tid;		// Thread ID
+  char			phase;		// 'B' for begin, 'E' for end
+} brf_trace_event_t;
+
+typedef struct brf_trace_ring_s		// Per-thread trace ring
+{
+  atomic_int		owner;		// Thread ID of owner or 0 if free
+  int			pid;		// Process ID of owner
+  atomic_uint_fast64_t	head;		// Number of events recorded
+  brf_trace_event_t	events[];	// Events
+} brf_trace_ring_t;
+
+
+//
+// Local functions...
+//
+
+static void	brf_trace_add(char phase, const char *name, int job_id);
+static void	brf_trace_atfork(void);
+static bool	brf_trace_cb(pappl_client_t *client, void *data);
+static brf_trace_ring_t *brf_trace_get(void);
+static brf_trace_ring_t *brf_trace_ring(int i);
+static void	brf_trace_release(brf_trace_ring_t *ring);
+
+
+//
+// Local globals...
+//
+
+static char		*brf_trace_rings = NULL;
+					// Shared memory for the rings
+static size_t		brf_trace_num_events = 0,
+					// Events per ring
+			brf_trace_ringsize = 0;
+					// Size of each ring in bytes
+static pthread_key_t	brf_trace_key;	// Key for releasing rings
+static __thread brf_trace_ring_t *brf_trace_current = NULL;
+					// Ring of this thread
+static __thread int	brf_trace_tid = 0;
+					// Thread ID of this thread
+
+
+//
+// 'brfTraceBegin()' - Record the start of a job stage.
+//
+// `name` must be a string constant.
+//
+
+void
+brfTraceBegin(const char *name,		// I - Stage name
+              int        job_id)	// I - Job ID or 0
+{
+  brf_trace_add('B', name, job_id);
+}
+
+
+//
+// 'brfTraceEnd()' - Record the end of a job stage.
+//
+
+void
+brfTraceEnd(const char *name,		// I - Stage name
+            int        job_id)		// I - Job ID or 0
+{
+  brf_trace_add('E', name, job_id);
+}
+
+
+//
+// 'brfTraceInit()' - Set up the trace rings and the export page.
+//
+// `num_events` is the number of events kept per thread, 0 disables tracing.
+//
+
+bool					// O - `true` on success, `false` on error
+brfTraceInit(pappl_system_t *system,	// I - System
+             int            num_events)	// I - Events per thread
+{
+  void	*rings;				// Shared memory
+
+
+  if (num_events <= 0)
+    return (true);
+
+  brf_trace_num_events = (size_t)num_events;
+  brf_trace_ringsize   = sizeof(brf_trace_ring_t) + brf_trace_num_events * sizeof(brf_trace_event_t);
+
+  if ((rings = mmap(NULL, BRF_TRACE_RINGS * brf_trace_ringsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+  {
+    papplLog(system, PAPPL_LOGLEVEL_ERROR, "Unable to allocate trace buffers: %s", strerror(errno));
+    return (false);
+  }
+
+  pthread_key_create(&brf_trace_key, (void (*)(void *))brf_trace_release);
+  pthread_atfork(NULL, NULL, brf_trace_atfork);
+
+  brf_trace_rings = (char *)rings;
+
+  papplSystemAddResourceCallback(system, "/brf-trace.json", "application/json", brf_trace_cb, NULL);
+
+  papplLog(system, PAPPL_LOGLEVEL_INFO, "Tracing the last %d events of each thread, see /brf-trace.json.", num_events);
+
+  return (true);
+}
+
+
+//
+// 'brf_trace_add()' - Record an event in the ring of this thread.
+//
+
+static void
+brf_trace_add(char       phase,		// I - Event phase
+              const char *name,		// I - Stage name
+              int        job_id)	// I - Job ID or 0
+{
+  brf_trace_ring_t	*ring;		// Ring of this thread
+  brf_trace_event_t	*event;		// Event
+  uint_fast64_t		head;		// Index of event
+  struct timespec	now;		// Current time
+
+
+  if (!brf_trace_rings || (ring = brf_trace_get()) == NULL)
+    return;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  // Only this thread writes the ring, readers check the head afterwards...
+  head  = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  event = ring->events + head % brf_trace_num_events;
+
+  event->time   = (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+  event->name   = name;
+  event->job_id = job_id;
+  event->pid    = ring->pid;
+  event->tid    = brf_trace_tid;
+  event->phase  = phase;
+
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+
+//
+// 'brf_trace_atfork()' - Forget the ring of the parent in a child process.
+//
+
+static void
+brf_trace_atfork(void)
+{
+  brf_trace_current = NULL;
+  brf_trace_tid     = 0;
+
+  pthread_setspecific(brf_trace_key, NULL);
+}
+
+
+//
+// 'brf_trace_cb()' - Export the trace events as Chrome trace JSON.
+//
+
+static bool				// O - `true` if handled
+brf_trace_cb(pappl_client_t *client,	// I - Client
+             void           *data)	// I - Callback data (unused)
+{
+  brf_trace_ring_t	*ring;		// Current ring
+  brf_trace_event_t	*events,	// Copy of ring events
+			*event;		// Current event
+  uint_fast64_t		i,		// Looping var
+			first,		// First valid event
+			last;		// End of valid events
+  int			r,		// Current ring number
+			count = 0;	// Number of events
+  char			*json,		// JSON output
+			*temp;		// New JSON buffer
+  size_t		used,		// Bytes used in output
+			size = 65536;	// Allocated size of output
+
+
+  (void)data;
+
+  if (!papplClientHTMLAuthorize(client))
+    return (true);
+
+  if ((events = malloc(brf_trace_num_events * sizeof(brf_trace_event_t))) == NULL || (json = malloc(size)) == NULL)
+  {
+    free(events);
+    return (false);
+  }
+
+  used = (size_t)snprintf(json, size, "{\"traceEvents\":[");
+
+  for (r = 0; r < BRF_TRACE_RINGS; r ++)
+  {
+    ring = brf_trace_ring(r);
+
+    // Copy the ring, then drop the events that were overwritten meanwhile...
+    last = atomic_load_explicit(&ring->head, memory_order_acquire);
+    memcpy(events, ring->events, brf_trace_num_events * sizeof(brf_trace_event_t));
+    i    = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    first = last > brf_trace_num_events ? last - brf_trace_num_events : 0;
+    if (i >= brf_trace_num_events && first < i - brf_trace_num_events + 1)
+      first = i - brf_trace_num_events + 1;
+
+    for (i = first; i < last; i ++)
+    {
+      // Make room for another event and the end of the JSON...
+      if (size - used < 256)
+      {
+        if ((temp = realloc(json, size + 65536)) == NULL)
+        {
+          free(events);
+          free(json);
+          return (false);
+        }
+
+        json = temp;
+        size += 65536;
+      }
+
+      event = events + i % brf_trace_num_events;
+      used  += (size_t)snprintf(json + used, size - used, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu.%03u,\"pid\":%d,\"tid\":%d,\"args\":{\"job-id\":%d}}", count ++ ? "," : "", event->name, event->phase, (unsigned long long)(event->time / 1000), (unsigned)(event->time % 1000), event->pid, event->tid, event->job_id);
+    }
+  }
+
+  used += (size_t)snprintf(json + used, size - used, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+  papplClientRespond(client, HTTP_STATUS_OK, NULL, "application/json", 0, used);
+  httpWrite2(papplClientGetHTTP(client), json, used);
+
+  free(events);
+  free(json);
+
+  return (true);
+}
+
+
+//
+// 'brf_trace_get()' - Get the ring of this thread.
+//
+// A free ring is taken on first use.  Rings of threads that exited are
+// released by the key destructor, and rings of filter processes that exited
+// are taken over.
+//
+
+static brf_trace_ring_t *		// O - Ring or `NULL` if none is free
+brf_trace_get(void)
+{
+  brf_trace_ring_t	*ring;		// Current ring
+  int			i,		// Looping var
+			owner,		// Current owner
+			pid = getpid();	// Process ID
+
+
+  if (brf_trace_current)
+    return (brf_trace_current);
+
+  if (!brf_trace_tid)
+  {
+#ifdef __linux__
+    brf_trace_tid = (int)syscall(SYS_gettid);
+#else
+    brf_trace_tid = (int)((uintptr_t)pthread_self() & 0x7fffffff);
+#endif // __linux__
+  }
+
+  for (i = 0; i < BRF_TRACE_RINGS && !brf_trace_current; i ++)
+  {
+    ring  = brf_trace_ring(i);
+    owner = 0;
+
+    if (atomic_compare_exchange_strong(&ring->owner, &owner, brf_trace_tid))
+      brf_trace_current = ring;
+  }
+
+  for (i = 0; i < BRF_TRACE_RINGS && !brf_trace_current; i ++)
+  {
+    ring  = brf_trace_ring(i);
+    owner = atomic_load(&ring->owner);
+
+    if (ring->pid != pid && kill(ring->pid, 0) && errno == ESRCH && atomic_compare_exchange_strong(&ring->owner, &owner, brf_trace_tid))
+      brf_trace_current = ring;
+  }
+
+  if (brf_trace_current)
+  {
+    brf_trace_current->pid = pid;
+    pthread_setspecific(brf_trace_key, brf_trace_current);
+  }
+
+  return (brf_trace_current);
+}
+
+
+//
+// 'brf_trace_ring()' - Get a ring by number.
+//
+
+static brf_trace_ring_t *		// O - Ring
+brf_trace_ring(int i)			// I - Ring number
+{
+  return ((brf_trace_ring_t *)(brf_trace_rings + (size_t)i * brf_trace_ringsize));
+}
+
+
+//
+// 'brf_trace_release()' - Release the ring of a thread that exits.
+//
+// The events stay in the ring until another thread takes it.
+//
+
+static void
+brf_trace_release(brf_trace_ring_t *ring)// I - Ring
+{
+  atomic_store(&ring->owner, 0);
+}
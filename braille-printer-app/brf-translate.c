@@ -0,0 +1,956 @@
+//
+// Parallel text translation for the Braille Printer Application
+//
+// Copyright © 2022 Chandresh Soni
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// When only liblouis is available, "texttobrf" reformats the text with
+// "fmt -WIDTH" and translates the lines with "lou_translate", which handles
+// every line on its own.  The same pipeline is run here, except that the
+// output of "fmt" is split into chunks at line ends and a pool of worker
+// threads translates the chunks with "lou_translate", one process per chunk.
+// The translated chunks are written in document order, so the output is the
+// same as the one of "texttobrf" for any number of workers.  Jobs that
+// "texttobrf" formats with liblouisutdml's "file2brl" go to "texttobrf".
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+
+//
+// Local types...
+//
+
+typedef enum brf_chunk_state_e		// Chunk translation state
+{
+  BRF_CHUNK_PENDING,			// Waiting for a worker
+  BRF_CHUNK_RUNNING,			// Being translated
+  BRF_CHUNK_DONE,			// Translated
+  BRF_CHUNK_FAILED			// Translation failed
+} brf_chunk_state_t;
+
+typedef struct brf_chunk_s		// Chunk of lines
+{
+  char			*text;		// Formatted lines
+  size_t		textlen,	// Length of lines
+			textsize;	// Allocated size of lines
+  char			*output;	// Translated lines
+  size_t		outlen;		// Length of translated lines
+  brf_chunk_state_t	state;		// Translation state
+} brf_chunk_t;
+
+typedef struct brf_translate_s		// Translation state
+{
+  const brf_translate_params_t *params;	// Translation parameters
+  cf_filter_data_t	*data;		// Job and printer data
+  pthread_mutex_t	mutex;		// Mutex for chunk states
+  pthread_cond_t	cond;		// Condition for chunk state changes
+  int			num_chunks,	// Number of chunks
+			alloc_chunks,	// Allocated chunks
+			num_ready,	// Number of complete chunks
+			next_chunk,	// Next chunk for a worker
+			next_write;	// Next chunk to write
+  brf_chunk_t		**chunks;	// Chunks
+  bool			eof,		// All chunks complete?
+			canceled;	// Stop translating?
+} brf_translate_t;
+
+
+//
+// Local functions...
+//
+
+static bool	brf_chunk_add(brf_translate_t *tr);
+static bool	brf_translate_find(char **envp, const char *program);
+static const char *brf_translate_get_option(int num_options, cups_option_t *options, const char *name, const char *keyword);
+static void	brf_translate_ready(brf_translate_t *tr, int num_ready);
+static bool	brf_translate_run(brf_translate_t *tr, brf_chunk_t *chunk);
+static bool	brf_translate_split(brf_translate_t *tr, const char *text, size_t len, bool eof);
+static void	*brf_translate_worker(brf_translate_t *tr);
+static bool	brf_translate_write(brf_translate_t *tr, int fd, bool wait);
+
+
+//
+// 'brfTranslateCanSplit()' - Check whether a job is translated line by line.
+//
+// "texttobrf" formats the text with "file2brl" when a table is selected and
+// liblouisutdml is installed, its pages can't be split.
+//
+
+bool					// O - `true` if translated line by line
+brfTranslateCanSplit(
+    const brf_translate_params_t *params)// I - Translation parameters
+{
+  if (!brf_translate_find(params->envp, "fmt"))
+    return (false);
+
+  if (params->tables[0])
+    return (brf_translate_find(params->envp, "lou_translate") && !brf_translate_find(params->envp, "file2brl"));
+
+  return (true);
+}
+
+
+//
+// 'brfTranslateFilter()' - Filter function that translates text to BRF.
+//
+// The parameters point to a `brf_translate_params_t` structure filled in by
+// brfTranslateGetParams().  The output has no margins, see brfLayoutFilter().
+//
+
+int					// O - Exit status
+brfTranslateFilter(
+    int              inputfd,		// I - File descriptor input stream
+    int              outputfd,		// I - File descriptor output stream
+    int              inputseekable,	// I - Is input stream seekable? (unused)
+    cf_filter_data_t *data,		// I - Job and printer data
+    void             *parameters)	// I - Translation parameters
+{
+  brf_translate_params_t *params = (brf_translate_params_t *)parameters;
+					// Translation parameters
+  brf_translate_t	tr;		// Translation state
+  pthread_t		workers[BRF_TRANSLATE_MAX_WORKERS];
+					// Worker threads
+  int			i,		// Looping var
+			num_workers = 0,// Number of worker threads
+			err,		// Thread creation error
+			fmtpipe[2] = { -1, -1 },
+					// Pipe from fmt
+			status;		// fmt exit status
+  pid_t			pid = 0;	// fmt process ID
+  posix_spawn_file_actions_t actions;	// Child file actions
+  char			width[16],	// Line width argument
+			*argv[3];	// Command-line arguments
+  struct pollfd		pfd;		// Pipe to poll
+  char			buffer[65536];	// Read buffer
+  ssize_t		bytes;		// Bytes read
+  bool			ret = false;	// Return value
+  extern char		**environ;	// Server environment
+
+
+  (void)inputseekable;
+
+  brfTraceBegin("translate", data->job_id);
+
+  memset(&tr, 0, sizeof(tr));
+  tr.params = params;
+  tr.data   = data;
+  pthread_mutex_init(&tr.mutex, NULL);
+  pthread_cond_init(&tr.cond, NULL);
+
+  if (!params)
+  {
+    if (data->logfunc)
+      data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "Translate: No translation parameters.");
+    goto finish;
+  }
+
+  // Start the workers, without tables the chunks are already "translated"...
+  if (params->tables[0])
+  {
+    if ((num_workers = params->num_workers) <= 0)
+      num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_workers > BRF_TRANSLATE_MAX_WORKERS)
+      num_workers = BRF_TRANSLATE_MAX_WORKERS;
+    if (num_workers < 1)
+      num_workers = 1;
+
+    if (data->logfunc)
+      data->logfunc(data->logdata, CF_LOGLEVEL_DEBUG, "Translate: %d workers, tables \"%s\".", num_workers, params->tables);
+
+    for (i = 0; i < num_workers; i ++)
+    {
+      if ((err = pthread_create(workers + i, NULL, (void *(*)(void *))brf_translate_worker, &tr)) != 0)
+      {
+        if (data->logfunc)
+	  data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "Translate: Unable to create worker thread: %s", strerror(err));
+        break;
+      }
+    }
+
+    if ((num_workers = i) == 0)
+      goto finish;
+  }
+
+  // Reformat the text like texttobrf does...
+  if (pipe(fmtpipe))
+  {
+    if (data->logfunc)
+      data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "Translate: Unable to create pipe: %s", strerror(errno));
+    goto finish;
+  }
+
+  fcntl(fmtpipe[0], F_SETFD, FD_CLOEXEC);
+
+  snprintf(width, sizeof(width), "-%d", params->width);
+
+  argv[0] = "fmt";
+  argv[1] = width;
+  argv[2] = NULL;
+
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, inputfd, 0);
+  posix_spawn_file_actions_adddup2(&actions, fmtpipe[1], 1);
+  posix_spawn_file_actions_addclose(&actions, fmtpipe[1]);
+
+  err = posix_spawnp(&pid, "fmt", &actions, NULL, argv, params->envp ? params->envp : environ);
+
+  posix_spawn_file_actions_destroy(&actions);
+  close(fmtpipe[1]);
+
+  if (err)
+  {
+    pid = 0;
+
+    if (data->logfunc)
+      data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "Translate: Unable to run fmt: %s", strerror(err));
+    goto finish;
+  }
+
+  // Split the lines as they come in and write the chunks that are already
+  // translated, so the first pages don't wait for the end of the document...
+  pfd.fd     = fmtpipe[0];
+  pfd.events = POLLIN;
+
+  for (;;)
+  {
+    if (data->iscanceledfunc && (data->iscanceledfunc)(data->iscanceleddata))
+    {
+      if (data->logfunc)
+        data->logfunc(data->logdata, CF_LOGLEVEL_DEBUG, "Translate: Job canceled.");
+      goto finish;
+    }
+
+    if (poll(&pfd, 1, 1000) <= 0)
+      continue;
+
+    if ((bytes = read(fmtpipe[0], buffer, sizeof(buffer))) == 0)
+      break;
+
+    if (bytes < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      if (data->logfunc)
+        data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "Translate: Unable to read from fmt: %s", strerror(errno));
+      goto finish;
+    }
+
+    if (!brf_translate_split(&tr, buffer, (size_t)bytes, false))
+    {
+      if (data->logfunc)
+	data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "Translate: Unable to allocate memory for chunks.");
+      goto finish;
+    }
+
+    if (!brf_translate_write(&tr, outputfd, false))
+      goto finish;
+  }
+
+  while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+
+  pid = 0;
+
+  if (!WIFEXITED(status) || WEXITSTATUS(status))
+  {
+    if (data->logfunc)
+      data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "Translate: fmt failed with status %d.", status);
+    goto finish;
+  }
+
+  if (!brf_translate_split(&tr, NULL, 0, true))
+  {
+    if (data->logfunc)
+      data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "Translate: Unable to allocate memory for chunks.");
+    goto finish;
+  }
+
+  if (data->logfunc)
+    data->logfunc(data->logdata, CF_LOGLEVEL_DEBUG, "Translate: Document has %d chunks.", tr.num_chunks);
+
+  if (!brf_translate_write(&tr, outputfd, true))
+    goto finish;
+
+  ret = true;
+
+  finish:
+
+  // Stop fmt and the workers and clean up...
+  if (pid > 0)
+  {
+    kill(pid, SIGTERM);
+    while (waitpid(pid, NULL, 0) < 0 && errno == EINTR);
+  }
+
+  if (fmtpipe[0] >= 0)
+    close(fmtpipe[0]);
+
+  pthread_mutex_lock(&tr.mutex);
+  tr.canceled = true;
+  pthread_cond_broadcast(&tr.cond);
+  pthread_mutex_unlock(&tr.mutex);
+
+  for (i = 0; i < num_workers; i ++)
+    pthread_join(workers[i], NULL);
+
+  for (i = 0; i < tr.num_chunks; i ++)
+  {
+    if (tr.chunks[i]->output != tr.chunks[i]->text)
+      free(tr.chunks[i]->output);
+    free(tr.chunks[i]->text);
+    free(tr.chunks[i]);
+  }
+
+  free(tr.chunks);
+
+  pthread_cond_destroy(&tr.cond);
+  pthread_mutex_destroy(&tr.mutex);
+
+  close(inputfd);
+  close(outputfd);
+
+  brfTraceEnd("translate", data->job_id);
+
+  return (ret ? 0 : 1);
+}
+
+
+//
+// 'brfTranslateGetParams()' - Get the translation parameters for a job.
+//
+// The line width is computed from the media and the "TextDotDistance",
+// "TextDots" and margin options the same way as in filter/cups-braille.sh.
+// `false` is returned when the job asks for something that only "texttobrf"
+// can do, like locale-based table selection.
+//
+
+bool					// O - `true` on success, `false` if not supported
+brfTranslateGetParams(
+    pappl_pr_options_t     *job_options,// I - Job options
+    int                    num_options,	// I - Number of filter options
+    cups_option_t          *options,	// I - Filter options
+    brf_translate_params_t *params)	// O - Translation parameters
+{
+  int		i,			// Looping var
+		dot_distance,		// Text dot distance in 1/100mm
+		cell_distance,		// Distance between cells in 1/100mm
+		dots,			// Dots per cell
+		width,			// Printable width in 1/100mm
+		top_margin,		// Top margin in lines
+		left_margin,		// Left margin in cells
+		right_margin;		// Right margin in cells
+  const char	*val;			// Option value
+  char		name[32];		// Table option name
+  static const char * const tables[] =	// Table options
+  {
+    "LibLouis",
+    "LibLouis2",
+    "LibLouis3",
+    "LibLouis4"
+  };
+
+
+  memset(params, 0, sizeof(brf_translate_params_t));
+
+  // Cell geometry...
+  val          = brf_translate_get_option(num_options, options, "TextDotDistance", "text-dot-distance");
+  dot_distance = val ? atoi(val) : 250;
+
+  switch (dot_distance)
+  {
+    case 220 :
+        cell_distance = 310;
+        break;
+    case 250 :
+        cell_distance = 350;
+        break;
+    case 320 :
+        cell_distance = 525;
+        break;
+    default :
+        return (false);
+  }
+
+  val  = brf_translate_get_option(num_options, options, "TextDots", "text-dots");
+  dots = val ? atoi(val) : 6;
+
+  if (dots != 6 && dots != 8)
+    return (false);
+
+  width         = job_options->media.size_width - job_options->media.left_margin - job_options->media.right_margin;
+  params->width = (width + cell_distance) / (dot_distance + cell_distance);
+
+  // Margins in cells...
+  brfLayoutGetMargins(num_options, options, &top_margin, &left_margin);
+
+  val          = brf_translate_get_option(num_options, options, "RightMargin", "right-margin");
+  right_margin = val ? atoi(val) : 0;
+
+  if (right_margin < 0 || right_margin > BRF_LAYOUT_MAX_MARGIN)
+    right_margin = 0;
+
+  params->width -= left_margin + right_margin;
+
+  if (params->width < 4)
+    return (false);
+
+  if (params->width > BRF_TRANSLATE_MAX_WIDTH)
+    params->width = BRF_TRANSLATE_MAX_WIDTH;
+
+  // liblouis tables, only explicit table names...
+  for (i = 0; i < (int)(sizeof(tables) / sizeof(tables[0])); i ++)
+  {
+    snprintf(name, sizeof(name), "liblouis%s", tables[i] + 8);
+
+    if ((val = brf_translate_get_option(num_options, options, tables[i], name)) == NULL || !strcmp(val, "None"))
+      continue;
+
+    if (!strncmp(val, "Locale", 6) || !strcmp(val, "HyphLocale") || !isalnum(*val & 255) || strchr(val, ',') || strchr(val, '/'))
+      return (false);
+
+    if (!params->tables[0])
+      papplCopyString(params->tables, "en-us-brf.dis", sizeof(params->tables));
+
+    if (strlen(params->tables) + strlen(val) + 2 > sizeof(params->tables))
+      return (false);
+
+    strncat(params->tables, ",", sizeof(params->tables) - strlen(params->tables) - 1);
+    strncat(params->tables, val, sizeof(params->tables) - strlen(params->tables) - 1);
+  }
+
+  if (params->tables[0])
+  {
+    if (strlen(params->tables) + 21 > sizeof(params->tables))
+      return (false);
+
+    strncat(params->tables, ",braille-patterns.cti", sizeof(params->tables) - strlen(params->tables) - 1);
+  }
+
+  return (true);
+}
+
+
+//
+// 'brf_chunk_add()' - Start a new chunk.
+//
+// The last chunk is handed to the workers.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_chunk_add(brf_translate_t *tr)	// I - Translation state
+{
+  brf_chunk_t	*chunk;			// New chunk
+
+
+  if ((chunk = calloc(1, sizeof(brf_chunk_t))) == NULL)
+    return (false);
+
+  // The workers look at the chunk array, so grow it under the lock...
+  pthread_mutex_lock(&tr->mutex);
+
+  if (tr->num_chunks >= tr->alloc_chunks)
+  {
+    brf_chunk_t **temp;			// New chunks
+
+    if ((temp = realloc(tr->chunks, (size_t)(tr->alloc_chunks + 16) * sizeof(brf_chunk_t *))) == NULL)
+    {
+      pthread_mutex_unlock(&tr->mutex);
+      free(chunk);
+      return (false);
+    }
+
+    tr->chunks       = temp;
+    tr->alloc_chunks += 16;
+  }
+
+  tr->chunks[tr->num_chunks ++] = chunk;
+
+  brf_translate_ready(tr, tr->num_chunks - 1);
+
+  pthread_mutex_unlock(&tr->mutex);
+
+  return (true);
+}
+
+
+//
+// 'brf_translate_find()' - Look for a program in the PATH of the filters.
+//
+
+static bool				// O - `true` if found, `false` otherwise
+brf_translate_find(char       **envp,	// I - Filter environment or `NULL`
+                   const char *program)	// I - Program name
+{
+  const char	*path = NULL,		// Search path
+		*ptr,			// Pointer into search path
+		*end;			// End of current directory
+  char		filename[1024];		// Candidate file
+
+
+  for (; envp && *envp && !path; envp ++)
+  {
+    if (!strncmp(*envp, "PATH=", 5))
+      path = *envp + 5;
+  }
+
+  if (!path)
+    path = getenv("PATH");
+
+  for (ptr = path ? path : "/usr/local/bin:/usr/bin:/bin"; *ptr; ptr = *end ? end + 1 : end)
+  {
+    if ((end = strchr(ptr, ':')) == NULL)
+      end = ptr + strlen(ptr);
+
+    if (end > ptr)
+    {
+      snprintf(filename, sizeof(filename), "%.*s/%s", (int)(end - ptr), ptr, program);
+
+      if (!access(filename, X_OK))
+        return (true);
+    }
+  }
+
+  return (false);
+}
+
+
+//
+// 'brf_translate_get_option()' - Get a PPD or IPP option value.
+//
+
+static const char *			// O - Value or `NULL`
+brf_translate_get_option(
+    int           num_options,		// I - Number of options
+    cups_option_t *options,		// I - Options
+    const char    *name,		// I - PPD option name
+    const char    *keyword)		// I - IPP attribute name
+{
+  const char	*val;			// Option value
+
+
+  if ((val = cupsGetOption(name, num_options, options)) == NULL)
+    val = cupsGetOption(keyword, num_options, options);
+
+  if (val && !strncmp(val, "Custom.", 7))
+    val += 7;
+
+  return (val);
+}
+
+
+//
+// 'brf_translate_ready()' - Hand chunks over to the workers.
+//
+// The caller holds the lock.  Without tables there is nothing to translate
+// and the chunks are done right away.
+//
+
+static void
+brf_translate_ready(
+    brf_translate_t *tr,		// I - Translation state
+    int             num_ready)		// I - Number of complete chunks
+{
+  for (; tr->num_ready < num_ready; tr->num_ready ++)
+  {
+    if (!tr->params->tables[0])
+    {
+      brf_chunk_t *chunk = tr->chunks[tr->num_ready];
+					// Chunk
+
+      chunk->output = chunk->text;
+      chunk->outlen = chunk->textlen;
+      chunk->state  = BRF_CHUNK_DONE;
+    }
+  }
+
+  pthread_cond_broadcast(&tr->cond);
+}
+
+
+//
+// 'brf_translate_run()' - Translate a chunk with "lou_translate".
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_translate_run(brf_translate_t *tr,	// I - Translation state
+                  brf_chunk_t     *chunk)// I - Chunk
+{
+  cf_filter_data_t	*data = tr->data;
+					// Job and printer data
+  int			inpipe[2],	// Pipe to lou_translate
+			outpipe[2];	// Pipe from lou_translate
+  posix_spawn_file_actions_t actions;	// Child file actions
+  pid_t			pid;		// Child process ID
+  int			status;		// Child exit status
+  char			*argv[3];	// Command-line arguments
+  size_t		sent = 0,	// Bytes sent to child
+			outsize = 0;	// Allocated output size
+  ssize_t		bytes;		// Bytes read/written
+  struct pollfd		pfds[2];	// Pipes to poll
+  int			npfds;		// Number of pipes to poll
+  bool			ret = true;	// Return value
+  int			token;		// CPU token
+  extern char		**environ;	// Server environment
+
+
+  if (!brfCPUAcquire(data, &token))
+    return (false);
+
+  if (pipe(inpipe))
+  {
+    brfCPURelease(token);
+    return (false);
+  }
+
+  if (pipe(outpipe))
+  {
+    close(inpipe[0]);
+    close(inpipe[1]);
+    brfCPURelease(token);
+    return (false);
+  }
+
+  fcntl(inpipe[1], F_SETFD, FD_CLOEXEC);
+  fcntl(inpipe[1], F_SETFL, O_NONBLOCK);
+  fcntl(outpipe[0], F_SETFD, FD_CLOEXEC);
+
+  brfTraceBegin("lou_translate", data->job_id);
+
+  argv[0] = "lou_translate";
+  argv[1] = (char *)tr->params->tables;
+  argv[2] = NULL;
+
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, inpipe[0], 0);
+  posix_spawn_file_actions_adddup2(&actions, outpipe[1], 1);
+  posix_spawn_file_actions_addclose(&actions, inpipe[0]);
+  posix_spawn_file_actions_addclose(&actions, outpipe[1]);
+
+  status = posix_spawnp(&pid, "lou_translate", &actions, NULL, argv, tr->params->envp ? tr->params->envp : environ);
+
+  posix_spawn_file_actions_destroy(&actions);
+  close(inpipe[0]);
+  close(outpipe[1]);
+
+  if (status)
+  {
+    if (data->logfunc)
+      data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "Translate: Unable to run lou_translate: %s", strerror(status));
+    close(inpipe[1]);
+    close(outpipe[0]);
+    brfTraceEnd("lou_translate", data->job_id);
+    brfCPURelease(token);
+    return (false);
+  }
+
+  // Feed the chunk and collect the translation at the same time, so neither
+  // side blocks on a full pipe...
+  pfds[0].fd     = outpipe[0];
+  pfds[0].events = POLLIN;
+  pfds[1].fd     = inpipe[1];
+  pfds[1].events = POLLOUT;
+
+  if (chunk->textlen == 0)
+  {
+    close(inpipe[1]);
+    pfds[1].fd = -1;
+  }
+
+  while (pfds[0].fd >= 0)
+  {
+    npfds = pfds[1].fd >= 0 ? 2 : 1;
+
+    if ((bytes = poll(pfds, (nfds_t)npfds, 1000)) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      ret = false;
+      break;
+    }
+
+    // Stop lou_translate when the job is canceled or the document failed...
+    if (tr->canceled || (data->iscanceledfunc && (data->iscanceledfunc)(data->iscanceleddata)))
+    {
+      kill(pid, SIGTERM);
+      ret = false;
+      break;
+    }
+
+    if (bytes == 0)
+      continue;
+
+    if (npfds == 2 && pfds[1].revents)
+    {
+      if ((bytes = write(inpipe[1], chunk->text + sent, chunk->textlen - sent)) > 0)
+        sent += (size_t)bytes;
+      else if (bytes < 0 && errno != EINTR && errno != EAGAIN)
+        ret = false;
+
+      if (sent == chunk->textlen || !ret)
+      {
+        close(inpipe[1]);
+        pfds[1].fd = -1;
+      }
+    }
+
+    if (pfds[0].revents)
+    {
+      if (chunk->outlen == outsize)
+      {
+        char *temp;			// New output buffer
+
+        if ((temp = realloc(chunk->output, outsize + chunk->textlen + 4096)) == NULL)
+	{
+	  ret = false;
+	  break;
+	}
+
+        chunk->output = temp;
+	outsize       += chunk->textlen + 4096;
+      }
+
+      if ((bytes = read(outpipe[0], chunk->output + chunk->outlen, outsize - chunk->outlen)) > 0)
+      {
+        chunk->outlen += (size_t)bytes;
+      }
+      else if (bytes == 0 || (errno != EINTR && errno != EAGAIN))
+      {
+        close(outpipe[0]);
+        pfds[0].fd = -1;
+      }
+    }
+  }
+
+  if (pfds[1].fd >= 0)
+    close(inpipe[1]);
+  if (pfds[0].fd >= 0)
+    close(outpipe[0]);
+
+  while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+
+  brfCPURelease(token);
+
+  if (!WIFEXITED(status) || WEXITSTATUS(status))
+  {
+    if (data->logfunc)
+      data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "Translate: lou_translate failed with status %d.", status);
+    ret = false;
+  }
+
+  brfTraceEnd("lou_translate", data->job_id);
+
+  return (ret);
+}
+
+
+//
+// 'brf_translate_split()' - Split the formatted text into chunks of lines.
+//
+// Chunks only end after a newline, so "lou_translate" sees the same lines
+// as in one pass over the document.  The text may come in any number of
+// pieces, `eof` ends the last chunk.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_translate_split(brf_translate_t *tr,// I - Translation state
+                    const char      *text,
+					// I - Formatted text
+                    size_t          len,// I - Length of formatted text
+                    bool            eof)// I - End of document?
+{
+  brf_chunk_t	*chunk,			// Current chunk
+		*next;			// New chunk
+  char		*partial;		// Partial line at the end
+  size_t	eol,			// End of the last complete line
+		tail;			// Bytes after the last newline
+
+
+  if (tr->num_chunks == 0 && !brf_chunk_add(tr))
+    return (false);
+
+  chunk = tr->chunks[tr->num_chunks - 1];
+
+  if (len > 0)
+  {
+    if (chunk->textlen + len > chunk->textsize)
+    {
+      char	*temp;			// New text buffer
+      size_t	size = chunk->textlen + len + BRF_TRANSLATE_CHUNK / 4;
+					// New size
+
+      if ((temp = realloc(chunk->text, size)) == NULL)
+        return (false);
+
+      chunk->text     = temp;
+      chunk->textsize = size;
+    }
+
+    memcpy(chunk->text + chunk->textlen, text, len);
+    chunk->textlen += len;
+
+    // Move the partial line at the end of a full chunk to the next one
+    // before the chunk is handed to the workers...
+    for (eol = chunk->textlen; chunk->textlen >= BRF_TRANSLATE_CHUNK && eol > 0 && chunk->text[eol - 1] != '\n'; eol --);
+
+    if (chunk->textlen >= BRF_TRANSLATE_CHUNK && eol > 0)
+    {
+      tail = chunk->textlen - eol;
+
+      if ((partial = malloc(tail + BRF_TRANSLATE_CHUNK / 4)) == NULL)
+        return (false);
+
+      memcpy(partial, chunk->text + eol, tail);
+      chunk->textlen -= tail;
+
+      if (!brf_chunk_add(tr))
+      {
+        free(partial);
+        return (false);
+      }
+
+      next           = tr->chunks[tr->num_chunks - 1];
+      next->text     = partial;
+      next->textlen  = tail;
+      next->textsize = tail + BRF_TRANSLATE_CHUNK / 4;
+    }
+  }
+
+  if (eof)
+  {
+    // Hand the rest to the workers and let them finish...
+    pthread_mutex_lock(&tr->mutex);
+    tr->eof = true;
+    brf_translate_ready(tr, tr->num_chunks);
+    pthread_mutex_unlock(&tr->mutex);
+  }
+
+  return (true);
+}
+
+
+//
+// 'brf_translate_worker()' - Translate chunks until the document is done.
+//
+
+static void *				// O - Thread exit status (unused)
+brf_translate_worker(
+    brf_translate_t *tr)		// I - Translation state
+{
+  brf_chunk_t	*chunk;			// Chunk to translate
+  bool		ok;			// Translated?
+
+
+  pthread_mutex_lock(&tr->mutex);
+
+  while (!tr->canceled)
+  {
+    if (tr->next_chunk >= tr->num_ready)
+    {
+      if (tr->eof)
+        break;
+
+      pthread_cond_wait(&tr->cond, &tr->mutex);
+      continue;
+    }
+
+    chunk        = tr->chunks[tr->next_chunk ++];
+    chunk->state = BRF_CHUNK_RUNNING;
+
+    pthread_mutex_unlock(&tr->mutex);
+
+    ok = brf_translate_run(tr, chunk);
+
+    pthread_mutex_lock(&tr->mutex);
+
+    chunk->state = ok ? BRF_CHUNK_DONE : BRF_CHUNK_FAILED;
+    pthread_cond_broadcast(&tr->cond);
+  }
+
+  pthread_mutex_unlock(&tr->mutex);
+
+  return (NULL);
+}
+
+
+//
+// 'brf_translate_write()' - Write translated chunks in document order.
+//
+// When `wait` is `false` only the chunks that are already translated are
+// written.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_translate_write(
+    brf_translate_t *tr,		// I - Translation state
+    int             fd,			// I - Output file descriptor
+    bool            wait)		// I - Wait for all chunks?
+{
+  cf_filter_data_t	*data = tr->data;
+					// Job and printer data
+  brf_chunk_t		*chunk;		// Current chunk
+  brf_chunk_state_t	state;		// Chunk state
+  const char		*ptr;		// Pointer into output
+  size_t		left;		// Bytes left to write
+  ssize_t		bytes;		// Bytes written
+
+
+  for (;;)
+  {
+    pthread_mutex_lock(&tr->mutex);
+
+    while (wait && tr->next_write < tr->num_ready && tr->chunks[tr->next_write]->state < BRF_CHUNK_DONE)
+      pthread_cond_wait(&tr->cond, &tr->mutex);
+
+    if (tr->next_write >= tr->num_ready)
+    {
+      pthread_mutex_unlock(&tr->mutex);
+      return (true);
+    }
+
+    chunk = tr->chunks[tr->next_write];
+    state = chunk->state;
+
+    pthread_mutex_unlock(&tr->mutex);
+
+    if (state < BRF_CHUNK_DONE)
+      return (true);
+    else if (state == BRF_CHUNK_FAILED)
+      return (false);
+
+    for (ptr = chunk->output, left = chunk->outlen; left > 0; ptr += bytes, left -= (size_t)bytes)
+    {
+      if ((bytes = write(fd, ptr, left)) < 0)
+      {
+        if (errno == EINTR || errno == EAGAIN)
+        {
+          bytes = 0;
+          continue;
+        }
+
+        if (data->logfunc)
+          data->logfunc(data->logdata, CF_LOGLEVEL_ERROR, "Translate: Unable to write output: %s", strerror(errno));
+
+        return (false);
+      }
+    }
+
+    // Release the chunk, the output never looks back...
+    if (chunk->output != chunk->text)
+      free(chunk->output);
+    free(chunk->text);
+    chunk->output = chunk->text = NULL;
+
+    tr->next_write ++;
+  }
+}
@@ -0,0 +1,366 @@
+//
+// Asynchronous device writer for the Braille Printer Application
+//
+// Copyright © 2022 Chandresh Soni
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Embossers accept data much more slowly than the filters produce it, so
+// device output is handed to a per-job writer thread through a small ring
+// of buffers.  The producer only blocks when every buffer is waiting to be
+// sent to the device.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+
+
+//
+// Local types...
+//
+
+typedef struct brf_wbuffer_s		// Output buffer
+{
+  char		*data;			// Buffer data
+  size_t	used;			// Bytes used in buffer
+} brf_wbuffer_t;
+
+struct brf_writer_s			// Asynchronous device writer
+{
+  pappl_device_t	*device;	// Output device
+  pappl_job_t		*job;		// Job being printed
+  int			job_id;		// Job ID for tracing
+  pthread_t		thread;		// Writer thread
+  pthread_mutex_t	mutex;		// Mutex for queue
+  pthread_cond_t	cond;		// Condition for queue changes
+  int			num_buffers,	// Number of buffers
+			head,		// Next buffer to send to the device
+			num_queued;	// Number of buffers queued for the device
+  size_t		bufsize;	// Size of each buffer
+  off_t			sent;		// Bytes sent to the device
+  brf_wbuffer_t		*buffers;	// Buffers
+  bool			done,		// No more data will be queued?
+			error;		// Device write error?
+};
+
+
+//
+// Local functions...
+//
+
+static brf_wbuffer_t	*brf_writer_fill(brf_writer_t *writer);
+static bool		brf_writer_queue(brf_writer_t *writer);
+static void		*brf_writer_run(brf_writer_t *writer);
+
+
+//
+// 'brfWriterCreate()' - Create a writer thread for a device.
+//
+
+brf_writer_t *				// O - Writer or `NULL` on error
+brfWriterCreate(
+    pappl_device_t *device,		// I - Output device
+    pappl_job_t    *job,		// I - Job
+    int            num_buffers,		// I - Number of buffers (0 for default)
+    size_t         bufsize)		// I - Size of each buffer (0 for default)
+{
+  brf_writer_t	*writer;		// Writer
+  int		i,			// Looping var
+		err;			// Thread creation error
+
+
+  if (num_buffers < 2)
+    num_buffers = BRF_WRITER_BUFFERS;
+  if (bufsize == 0)
+    bufsize = BRF_WRITER_BUFSIZE;
+
+  if ((writer = (brf_writer_t *)calloc(1, sizeof(brf_writer_t))) == NULL)
+    return (NULL);
+
+  writer->device      = device;
+  writer->job         = job;
+  writer->job_id      = papplJobGetID(job);
+  writer->num_buffers = num_buffers;
+  writer->bufsize     = bufsize;
+
+  if ((writer->buffers = (brf_wbuffer_t *)calloc((size_t)num_buffers, sizeof(brf_wbuffer_t))) == NULL)
+    goto error;
+
+  for (i = 0; i < num_buffers; i ++)
+  {
+    if ((writer->buffers[i].data = malloc(bufsize)) == NULL)
+      goto error;
+  }
+
+  pthread_mutex_init(&writer->mutex, NULL);
+  pthread_cond_init(&writer->cond, NULL);
+
+  if ((err = pthread_create(&writer->thread, NULL, (void *(*)(void *))brf_writer_run, writer)) != 0)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to create device writer thread: %s", strerror(err));
+    pthread_cond_destroy(&writer->cond);
+    pthread_mutex_destroy(&writer->mutex);
+    goto error;
+  }
+
+  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Device writer started with %d buffers of %u bytes.", num_buffers, (unsigned)bufsize);
+
+  return (writer);
+
+  // If we get here something went wrong...
+  error:
+
+  if (writer->buffers)
+  {
+    for (i = 0; i < num_buffers; i ++)
+      free(writer->buffers[i].data);
+
+    free(writer->buffers);
+  }
+
+  free(writer);
+
+  return (NULL);
+}
+
+
+//
+// 'brfWriterFinish()' - Send any remaining data, flush the device, and free
+//                       the writer.
+//
+
+bool					// O - `true` if all data was written, `false` on error
+brfWriterFinish(brf_writer_t *writer)	// I - Writer
+{
+  bool	ret;				// Return value
+  int	i;				// Looping var
+
+
+  if (!writer)
+    return (false);
+
+  // Queue the partially filled buffer, if any, and tell the thread to stop
+  // once the queue has drained...
+  pthread_mutex_lock(&writer->mutex);
+
+  if (!writer->error && writer->num_queued < writer->num_buffers && writer->buffers[(writer->head + writer->num_queued) % writer->num_buffers].used > 0)
+    writer->num_queued ++;
+
+  writer->done = true;
+  pthread_cond_broadcast(&writer->cond);
+  pthread_mutex_unlock(&writer->mutex);
+
+  pthread_join(writer->thread, NULL);
+
+  if ((ret = !writer->error) == true)
+  {
+    brfTraceBegin("device-flush", writer->job_id);
+    papplDeviceFlush(writer->device);
+    brfTraceEnd("device-flush", writer->job_id);
+  }
+
+  pthread_cond_destroy(&writer->cond);
+  pthread_mutex_destroy(&writer->mutex);
+
+  for (i = 0; i < writer->num_buffers; i ++)
+    free(writer->buffers[i].data);
+
+  free(writer->buffers);
+  free(writer);
+
+  return (ret);
+}
+
+
+//
+// 'brfWriterGetSent()' - Get the number of bytes sent to the device.
+//
+
+off_t					// O - Number of bytes
+brfWriterGetSent(brf_writer_t *writer)	// I - Writer
+{
+  off_t	sent;				// Bytes sent
+
+
+  if (!writer)
+    return (0);
+
+  pthread_mutex_lock(&writer->mutex);
+  sent = writer->sent;
+  pthread_mutex_unlock(&writer->mutex);
+
+  return (sent);
+}
+
+
+//
+// 'brfWriterWrite()' - Queue data for the device.
+//
+// The data is copied, so the caller can reuse its buffer immediately.  This
+// function only blocks when all buffers are waiting for the device.
+//
+
+ssize_t					// O - Number of bytes queued or `-1` on error
+brfWriterWrite(brf_writer_t *writer,	// I - Writer
+               const void   *buffer,	// I - Data to write
+               size_t       bytes)	// I - Number of bytes
+{
+  const char	*bufptr = (const char *)buffer;
+					// Pointer into data
+  size_t	count;			// Bytes to copy into current buffer
+  brf_wbuffer_t	*wbuf;			// Current fill buffer
+
+
+  if (!writer)
+    return (-1);
+
+  while (bytes > 0)
+  {
+    if ((wbuf = brf_writer_fill(writer)) == NULL)
+      return (-1);
+
+    if ((count = writer->bufsize - wbuf->used) > bytes)
+      count = bytes;
+
+    memcpy(wbuf->data + wbuf->used, bufptr, count);
+    wbuf->used += count;
+    bufptr     += count;
+    bytes      -= count;
+
+    if (wbuf->used == writer->bufsize && !brf_writer_queue(writer))
+      return (-1);
+  }
+
+  return (bufptr - (const char *)buffer);
+}
+
+
+//
+// 'brf_writer_fill()' - Get the buffer to fill, waiting for one as needed.
+//
+
+static brf_wbuffer_t *			// O - Buffer or `NULL` on error
+brf_writer_fill(brf_writer_t *writer)	// I - Writer
+{
+  brf_wbuffer_t	*wbuf = NULL;		// Buffer
+
+
+  pthread_mutex_lock(&writer->mutex);
+
+  if (!writer->error && writer->num_queued == writer->num_buffers)
+  {
+    // All buffers are waiting for the device...
+    brfTraceBegin("queue-wait", writer->job_id);
+
+    while (!writer->error && writer->num_queued == writer->num_buffers)
+      pthread_cond_wait(&writer->cond, &writer->mutex);
+
+    brfTraceEnd("queue-wait", writer->job_id);
+  }
+
+  if (!writer->error)
+    wbuf = writer->buffers + (writer->head + writer->num_queued) % writer->num_buffers;
+
+  pthread_mutex_unlock(&writer->mutex);
+
+  return (wbuf);
+}
+
+
+//
+// 'brf_writer_queue()' - Queue the current fill buffer for the device.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_writer_queue(brf_writer_t *writer)	// I - Writer
+{
+  bool	ret;				// Return value
+
+
+  pthread_mutex_lock(&writer->mutex);
+
+  if ((ret = !writer->error) == true)
+  {
+    writer->num_queued ++;
+    pthread_cond_broadcast(&writer->cond);
+  }
+
+  pthread_mutex_unlock(&writer->mutex);
+
+  return (ret);
+}
+
+
+//
+// 'brf_writer_run()' - Send queued buffers to the device.
+//
+
+static void *				// O - Thread exit status (unused)
+brf_writer_run(brf_writer_t *writer)	// I - Writer
+{
+  brf_wbuffer_t	*wbuf;			// Current buffer
+  bool		error;			// Write error?
+
+
+  pthread_mutex_lock(&writer->mutex);
+
+  for (;;)
+  {
+    while (!writer->num_queued && !writer->done)
+      pthread_cond_wait(&writer->cond, &writer->mutex);
+
+    if (!writer->num_queued)
+      break;
+
+    // The buffer stays queued while we write it so the producer can't reuse
+    // it...
+    wbuf = writer->buffers + writer->head;
+
+    pthread_mutex_unlock(&writer->mutex);
+
+    if (papplJobIsCanceled(writer->job))
+    {
+      // Drop the queued data so the device is released right away...
+      papplLogJob(writer->job, PAPPL_LOGLEVEL_DEBUG, "Job canceled, discarding queued output.");
+      error = true;
+    }
+    else
+    {
+      brfTraceBegin("device-write", writer->job_id);
+
+      if ((error = papplDeviceWrite(writer->device, wbuf->data, wbuf->used) < 0) == true)
+        papplLogJob(writer->job, PAPPL_LOGLEVEL_ERROR, "Unable to send %u bytes to printer.", (unsigned)wbuf->used);
+
+      brfTraceEnd("device-write", writer->job_id);
+    }
+
+    pthread_mutex_lock(&writer->mutex);
+
+    if (!error)
+      writer->sent += (off_t)wbuf->used;
+
+    wbuf->used   = 0;
+    writer->head = (writer->head + 1) % writer->num_buffers;
+    writer->num_queued --;
+
+    if (error)
+    {
+      // Stop accepting data and let a blocked producer see the error...
+      writer->error      = true;
+      writer->num_queued = 0;
+    }
+
+    pthread_cond_broadcast(&writer->cond);
+
+    if (writer->error)
+      break;
+  }
+
+  pthread_mutex_unlock(&writer->mutex);
+
+  return (NULL);
+}
@@ -0,0 +1,457 @@
+#
+# Generate the native Index driver tables of the Braille Printer Application
+# from the PPD compiler sources.
+#
+# Copyright © 2022 Chandresh Soni
+#
+# Licensed under Apache License v2.0.  See the file "LICENSE" for more
+# information.
+#
+# Usage:
+#
+#   awk -v incdirs="DIR ..." -f drv2c.awk FILE.drv ... > index-models.c
+#
+# Each .drv file describes one Index protocol version ("v3" or "v4" in the
+# file name).  Files named in "#include <...>" lines are looked up in the
+# "incdirs" directories; the ones that cannot be found (media.defs from CUPS
+# and the generated liblouis*.defs) are skipped.  Options of the "Image"
+# group are dropped except for GraphicDotDistance, since only the embosser
+# settings are needed to drive the device.
+#
+
+BEGIN {
+  ninc = split(incdirs, incdir, " ")
+
+  nmodels = 0
+  noptions = 0
+  nmedia = 0
+
+  # Standard sizes from CUPS media.defs, in 1/100th mm...
+  std_pwg["Legal"]  = "na_legal_8.5x14in"; std_w["Legal"]  = 21590; std_l["Legal"]  = 35560
+  std_pwg["Letter"] = "na_letter_8.5x11in"; std_w["Letter"] = 21590; std_l["Letter"] = 27940
+  std_pwg["A3"]     = "iso_a3_297x420mm"; std_w["A3"]     = 29700; std_l["A3"]     = 42000
+  std_pwg["A4"]     = "iso_a4_210x297mm"; std_w["A4"]     = 21000; std_l["A4"]     = 29700
+  std_pwg["A5"]     = "iso_a5_148x210mm"; std_w["A5"]     = 14800; std_l["A5"]     = 21000
+
+  print "//"
+  print "// Index driver tables for the Braille Printer Application"
+  print "//"
+  print "// Generated by drv2c.awk - DO NOT EDIT!"
+  print "//"
+  print ""
+  print "#include \"brf-printer-app.h\""
+  print ""
+}
+
+# Parse each .drv file from the command line...
+FNR == 1 {
+  start_drv(FILENAME)
+  parse_file(FILENAME)
+  end_drv()
+  nextfile
+}
+
+END {
+  print "const brf_drv_model_t brf_index_models[] ="
+  print "{"
+  for (m = 1; m <= nmodels; m ++)
+    print models[m] (m < nmodels ? "," : "")
+  print "};"
+  print ""
+  print "const int brf_index_num_models = (int)(sizeof(brf_index_models) / sizeof(brf_index_models[0]));"
+}
+
+
+#
+# 'start_drv()' - Reset the global state for a new .drv file.
+#
+
+function start_drv(path) {
+  version = (path ~ /v3/) ? 3 : 4
+  manufacturer = ""
+  in_model = 0
+  globals_emitted = 0
+
+  hw_left = hw_bottom = hw_right = hw_top = 0
+  min_w = min_l = 0
+  max_w = max_l = 0
+
+  # Global options and media of this file...
+  delete gopt_index
+  ngopts = 0
+  delete gmedia
+  ngmedia = 0
+  gmedia_default = 0
+}
+
+
+#
+# 'end_drv()' - Finish a .drv file.
+#
+
+function end_drv() {
+  if (in_model)
+    fail("missing closing brace")
+}
+
+
+#
+# 'parse_file()' - Parse a .drv or .defs file.
+#
+
+function parse_file(path,    line, n, i, tok, name, text, inc, found, key) {
+  while ((getline line < path) > 0) {
+    sub(/^[ \t]+/, "", line)
+    sub(/[ \t\r]+$/, "", line)
+
+    if (line == "" || line ~ /^\/\//)
+      continue
+
+    n = tokenize(line, tok)
+
+    if (tok[1] == "#include") {
+      inc = tok[2]
+      gsub(/[<>"]/, "", inc)
+      found = ""
+      for (i = 1; i <= ninc; i ++) {
+        if ((getline key < (incdir[i] "/" inc)) >= 0) {
+          close(incdir[i] "/" inc)
+          found = incdir[i] "/" inc
+          break
+        }
+      }
+      if (found != "")
+        parse_file(found)
+    }
+    else if (tok[1] == "#media") {
+      split(tok[2], name, "/")
+      media_w[name[1]] = ceil_div(tok[3] * 2540, 72)
+      media_l[name[1]] = ceil_div(tok[4] * 2540, 72)
+      media_pwg[name[1]] = sprintf("custom_%s_%sx%sin", tolower(name[1]), tok[3] / 72, tok[4] / 72)
+    }
+    else if (tok[1] == "Manufacturer")
+      manufacturer = tok[2]
+    else if (tok[1] == "HWMargins") {
+      hw_left   = units(tok[2])
+      hw_bottom = units(tok[3])
+      hw_right  = units(tok[4])
+      hw_top    = units(tok[5])
+    }
+    else if (tok[1] == "MinSize") {
+      min_w = units(tok[2])
+      min_l = units(tok[3])
+    }
+    else if (tok[1] == "MaxSize") {
+      max_w = units(tok[2])
+      max_l = units(tok[3])
+    }
+    else if (tok[1] == "MediaSize" || tok[1] == "*MediaSize")
+      add_media(tok[2], tok[1] == "*MediaSize")
+    else if (tok[1] == "Group")
+      group = tok[2]
+    else if (tok[1] == "Option") {
+      split(tok[2], name, "/")
+      text = substr(tok[2], length(name[1]) + 2)
+      if (group ~ /^Image/ && name[1] != "GraphicDotDistance")
+        cur_option = 0
+      else
+        cur_option = find_option(name[1], text == "" ? name[1] : text)
+    }
+    else if ((tok[1] == "Choice" || tok[1] == "*Choice") && cur_option) {
+      split(tok[2], name, "/")
+      text = substr(tok[2], length(name[1]) + 2)
+      add_choice(cur_option, name[1], text == "" ? name[1] : text, tok[1] == "*Choice")
+    }
+    else if (tok[1] == "{")
+      start_model()
+    else if (tok[1] == "}")
+      end_model()
+    else if (tok[1] == "ModelName")
+      model_name = tok[2]
+    else if (tok[1] == "PCFileName")
+      model_ppd = tok[2]
+    else if (tok[1] == "Attribute" && tok[2] == "IndexPaperLength")
+      model_length = tok[4]
+  }
+
+  close(path)
+}
+
+
+#
+# 'tokenize()' - Split a line into whitespace-delimited and quoted tokens.
+#
+
+function tokenize(line, tok,    n, c, cur, inq, i) {
+  n = 0
+  cur = ""
+  inq = 0
+
+  for (i = 1; i <= length(line); i ++) {
+    c = substr(line, i, 1)
+
+    if (c == "\"") {
+      if (inq) {
+        tok[++ n] = cur
+        cur = ""
+      }
+      inq = !inq
+    }
+    else if (!inq && (c == " " || c == "\t")) {
+      if (cur != "")
+        tok[++ n] = cur
+      cur = ""
+    }
+    else
+      cur = cur c
+  }
+
+  if (cur != "")
+    tok[++ n] = cur
+
+  return (n)
+}
+
+
+#
+# 'units()' - Convert a PPD compiler length to 1/100th mm, rounding up.
+#
+
+function units(value,    num) {
+  num = value + 0
+
+  if (value ~ /mm$/)
+    return (int(num * 100 + 0.5))
+  else if (value ~ /cm$/)
+    return (int(num * 1000 + 0.5))
+  else if (value ~ /m$/)
+    return (int(num * 100000 + 0.5))
+  else if (value ~ /in$/)
+    return (int(num * 2540 + 0.5))
+  else if (value ~ /ft$/)
+    return (int(num * 30480 + 0.5))
+  else
+    return (ceil_div(num * 2540, 72))
+}
+
+
+#
+# 'ceil_div()' - Divide and round up.
+#
+
+function ceil_div(a, b) {
+  return (int((a + b - 1) / b))
+}
+
+
+#
+# 'ipp_keyword()' - Convert a PPD option name to an IPP attribute name.
+#
+
+function ipp_keyword(name,    i, c, out) {
+  out = ""
+
+  for (i = 1; i <= length(name); i ++) {
+    c = substr(name, i, 1)
+    if (c ~ /[A-Z]/ && i > 1 && substr(name, i - 1, 1) ~ /[a-z0-9]/)
+      out = out "-"
+    out = out tolower(c)
+  }
+
+  return (out)
+}
+
+
+#
+# 'c_string()' - Quote a string for C.
+#
+
+function c_string(s) {
+  gsub(/\\/, "\\\\", s)
+  gsub(/"/, "\\\"", s)
+  return ("\"" s "\"")
+}
+
+
+#
+# 'find_option()' - Find or create an option in the current scope.
+#
+
+function find_option(name, text,    i) {
+  if (in_model) {
+    for (i = 1; i <= nmopts; i ++)
+      if (opt_name[mopt[i]] == name)
+        return (mopt[i])
+  }
+
+  if ((name in gopt_index) && !in_model)
+    return (gopt_index[name])
+
+  noptions ++
+  opt_name[noptions]    = name
+  opt_text[noptions]    = text
+  opt_nchoices[noptions] = 0
+  opt_default[noptions] = 0
+
+  if (in_model)
+    mopt[++ nmopts] = noptions
+  else {
+    gopt_index[name] = noptions
+    gopt[++ ngopts] = noptions
+  }
+
+  return (noptions)
+}
+
+
+#
+# 'add_choice()' - Add a choice to an option, merging redefinitions.
+#
+
+function add_choice(o, name, text, is_default,    i) {
+  for (i = 1; i <= opt_nchoices[o]; i ++)
+    if (choice_name[o, i] == name)
+      break
+
+  if (i > opt_nchoices[o]) {
+    opt_nchoices[o] = i
+    choice_name[o, i] = name
+    choice_text[o, i] = text
+  }
+
+  if (is_default)
+    opt_default[o] = i - 1
+}
+
+
+#
+# 'add_media()' - Add a media size to the global list.
+#
+
+function add_media(name, is_default) {
+  if (name in std_pwg) {
+    media_w[name]   = std_w[name]
+    media_l[name]   = std_l[name]
+    media_pwg[name] = std_pwg[name]
+  }
+  else if (!(name in media_pwg))
+    fail("unknown media size " name)
+
+  gmedia[++ ngmedia] = name
+  if (is_default)
+    gmedia_default = ngmedia - 1
+}
+
+
+#
+# 'emit_option()' - Write the C tables for an option.
+#
+
+function emit_option(o,    i) {
+  if (opt_emitted[o])
+    return
+
+  opt_emitted[o] = 1
+
+  printf("static const char * const option%d_choices[] = { ", o)
+  for (i = 1; i <= opt_nchoices[o]; i ++)
+    printf("%s%s", c_string(choice_name[o, i]), i < opt_nchoices[o] ? ", " : "")
+  print " };"
+
+  printf("static const char * const option%d_texts[] = { ", o)
+  for (i = 1; i <= opt_nchoices[o]; i ++)
+    printf("%s%s", c_string(choice_text[o, i]), i < opt_nchoices[o] ? ", " : "")
+  print " };"
+
+  printf("static const brf_drv_option_t option%d = { %s, %s, %s, %d, option%d_choices, option%d_texts, %d };\n", o, c_string(opt_name[o]), c_string(ipp_keyword(opt_name[o])), c_string(opt_text[o]), opt_nchoices[o], o, o, opt_default[o])
+  print ""
+}
+
+
+#
+# 'start_model()' - Start a model section.
+#
+
+function start_model(    i) {
+  if (in_model)
+    fail("nested model sections are not supported")
+
+  in_model = 1
+  nmopts = 0
+  delete mopt
+  model_name = ""
+  model_ppd = ""
+  model_length = ""
+  saved_max_w = max_w
+  saved_max_l = max_l
+
+  if (!globals_emitted) {
+    drv_id ++
+    globals_emitted = 1
+
+    printf("static const brf_drv_media_t media%d[] =\n{\n", drv_id)
+    for (i = 1; i <= ngmedia; i ++)
+      printf("  { %s, %s, %d, %d }%s\n", c_string(media_pwg[gmedia[i]]), c_string(gmedia[i]), media_w[gmedia[i]], media_l[gmedia[i]], i < ngmedia ? "," : "")
+    print "};"
+    print ""
+  }
+}
+
+
+#
+# 'end_model()' - Finish a model section and queue its table entry.
+#
+
+function end_model(    i, name, duplex, list, n) {
+  if (!in_model)
+    fail("unexpected closing brace")
+
+  in_model = 0
+
+  if (model_name == "")
+    fail("model without ModelName")
+
+  # Options of the model: globals first, then the model's own, with Duplex
+  # turned into the "sides" attribute...
+  duplex = "false"
+  n = 0
+  list = ""
+
+  for (i = 1; i <= ngopts; i ++) {
+    emit_option(gopt[i])
+    list = list sprintf("%s&option%d", n ++ ? ", " : "", gopt[i])
+  }
+
+  for (i = 1; i <= nmopts; i ++) {
+    if (opt_name[mopt[i]] == "Duplex") {
+      duplex = "true"
+      continue
+    }
+
+    emit_option(mopt[i])
+    list = list sprintf("%s&option%d", n ++ ? ", " : "", mopt[i])
+  }
+
+  nmodels ++
+  printf("static const brf_drv_option_t * const model%d_options[] = { %s };\n\n", nmodels, list)
+
+  name = "index_" tolower(model_name)
+  gsub(/[^a-z0-9]+/, "_", name)
+  sub(/_+$/, "", name)
+
+  models[nmodels] = sprintf("  { %s, %s, %s, %s, %d, %s, %s, %d, %d, %d, %d, %d, %d, %d, %d, %d, media%d, %d, %d, model%d_options }", c_string(name), c_string(manufacturer " " model_name), c_string("MFG:" manufacturer ";MDL:" model_name ";"), c_string(model_ppd), version, duplex, model_length == "" ? "NULL" : c_string(model_length), hw_left, hw_bottom, hw_right, hw_top, min_w, min_l, max_w, max_l, ngmedia, drv_id, gmedia_default, n, nmodels)
+
+  # MaxSize inside a model only applies to that model...
+  max_w = saved_max_w
+  max_l = saved_max_l
+}
+
+
+#
+# 'fail()' - Show an error and exit.
+#
+
+function fail(message) {
+  printf("drv2c.awk: %s:%d: %s\n", FILENAME, FNR, message) > "/dev/stderr"
+  exit 1
+}
@@ -4,13 +4,52 @@
 // Include necessary headers...
 //
 
-#include <pappl/pappl.h>
-#include<math.h>
+#include "brf-printer-app.h"
+#include <math.h>
+
+
+//
+// Constants...
+//
+
+#define BRF_GEN_CELL_WIDTH	600	// Distance between cells in 1/100mm
+#define BRF_GEN_DOT_DISTANCE	250	// Distance between dots of a cell in 1/100mm
+#define BRF_GEN_LINE_HEIGHT	1000	// Distance between lines in 1/100mm
+
+
+//
+// Local types...
+//
+
+typedef struct brf_gen_raster_s		// Raster job state
+{
+  unsigned char		*cells,		// Dot patterns of current line
+			*out;		// Output line
+  unsigned		*xdots;		// Raster column of each dot column
+  unsigned		num_cells,	// Cells per line
+			num_lines,	// Lines per page
+			row,		// Current row of dots on the page
+			ydot;		// Raster line of current row of dots
+  int			top;		// Top margin in 1/100mm
+} brf_gen_raster_t;
+
 
 //
 // Local globals...
 //
 
+static const char brf_gen_dots[64] =
+{					// North American BRF for dots 1-6
+  ' ', 'A', '1', 'B', '\'', 'K', '2', 'L',
+  '@', 'C', 'I', 'F', '/',  'M', 'S', 'P',
+  '\"', 'E', '3', 'H', '9', 'O', '6', 'R',
+  '^', 'D', 'J', 'G', '>',  'N', 'T', 'Q',
+  ',', '*', '5', '<', '-',  'U', '8', 'V',
+  '.', '%', '[', '$', '+',  'X', '!', '&',
+  ';', ':', '4', '\\', '0', 'Z', '7', '(',
+  '_', '?', 'W', ']', '#',  'Y', ')', '='
+};
+
 
 //
 // Local functions...
@@ -19,6 +58,7 @@
 static bool	brf_gen_printfile(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device);
 static bool	brf_gen_rendjob(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device);
 static bool	brf_gen_rendpage(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device, unsigned page);
+static bool	brf_gen_rflush(brf_gen_raster_t *ras, pappl_device_t *device);
 static bool	brf_gen_rstartjob(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device);
 static bool	brf_gen_rstartpage(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device, unsigned page);
 static bool	brf_gen_status(pappl_printer_t *printer);
@@ -60,11 +100,10 @@ brf_gen(
   driver_data->status_cb     = brf_gen_status;
   driver_data->format        = "application/vnd.cups-paged-brf";
 
+  // One pixel per braille dot at the standard dot distance of 2.5mm...
   driver_data->num_resolution = 1;
-  driver_data->x_resolution[0] = 200;
-  driver_data->y_resolution[0] = 200;
-  // driver_data->x_resolution[1] = 300;
-  // driver_data->y_resolution[1] = 300;
+  driver_data->x_resolution[0] = 10;
+  driver_data->y_resolution[0] = 10;
 
   driver_data->x_default = driver_data->y_default = driver_data->x_resolution[0];
 
@@ -119,33 +158,110 @@ brf_gen_printfile(
     pappl_device_t     *device)		// I - Output device
 {
   int		fd;			// Input file
-  ssize_t	bytes;			// Bytes read/written
-  char		buffer[65536];		// Read/write buffer
+  ssize_t	bytes = 0;		// Bytes read/written
+  char		buffer[32768];		// Read buffer
+  unsigned char	clean[2 * sizeof(buffer) + 4],
+					// Cleaned up BRF
+		*bufptr,		// Pointer into clean buffer
+		*ff;			// Form feed in clean buffer
+  size_t	len,			// Bytes to write
+		cleanlen;		// Bytes left in clean buffer
+  brf_sanitize_t sanitize;		// BRF clean-up state
+  off_t		start,			// Start of requested pages
+		end;			// End of requested pages
+  brf_lane_t	lane;			// Scheduling lane of job
+  brf_retain_t	*retain = NULL;		// Output kept for reprints
+  bool		ok = true;		// Was the whole file read?
 
 
   // Copy the raw file...
   papplJobSetImpressions(job, 1);
 
+  if (brfSchedulerWasPrinted(job))
+    return (true);
+
+  // Render the next jobs while this one is embossed...
+  brfRenderAheadKick();
+
+  lane = brfSchedulerGetLane(job);
+
+  if (!brfPageIndexGetJobRange(job, options, &start, &end))
+    return (false);
+
   if ((fd  = open(papplJobGetFilename(job), O_RDONLY)) < 0)
   {
     papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to open print file '%s': %s", papplJobGetFilename(job), strerror(errno));
     return (false);
   }
 
-  while ((bytes = read(fd, buffer, sizeof(buffer))) > 0)
+  if (start > 0 && lseek(fd, start, SEEK_SET) < 0)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to seek in print file '%s': %s", papplJobGetFilename(job), strerror(errno));
+    close(fd);
+    return (false);
+  }
+
+  // Keep the whole document for reprints...
+  if (start == 0 && end < 0)
+    retain = brfRetainCreate(job);
+
+  // Generic embossers get CR LF line endings, but control characters and
+  // 8-bit braille table characters are passed through...
+  brfSanitizeInit(&sanitize, BRF_SANITIZE_CRLF);
+
+  while ((end < 0 || start < end) && (bytes = read(fd, buffer, end < 0 || (end - start) > (off_t)sizeof(buffer) ? sizeof(buffer) : (size_t)(end - start))) > 0)
   {
-    if (papplDeviceWrite(device, buffer, (size_t)bytes) < 0)
+    start    += bytes;
+    cleanlen = brfSanitize(&sanitize, buffer, (size_t)bytes, clean);
+
+    for (bufptr = clean; cleanlen > 0; bufptr += len, cleanlen -= len)
     {
-      papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to send %d bytes to printer.", (int)bytes);
-      close(fd);
-      return (false);
+      // Stop at each page break to let more urgent jobs go first...
+      if (lane != BRF_LANE_URGENT && (ff = memchr(bufptr, '\f', cleanlen)) != NULL)
+        len = (size_t)(ff - bufptr) + 1;
+      else
+        len = cleanlen;
+
+      brfTraceBegin("device-write", papplJobGetID(job));
+
+      if (papplDeviceWrite(device, bufptr, len) < 0)
+      {
+        brfTraceEnd("device-write", papplJobGetID(job));
+        papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to send %d bytes to printer.", (int)len);
+        brfRetainFinish(retain, false);
+        close(fd);
+        return (false);
+      }
+
+      brfTraceEnd("device-write", papplJobGetID(job));
+
+      brfRetainWrite(retain, bufptr, len);
+
+      if (bufptr[len - 1] == '\f' && brfSchedulerShouldYield(job, lane))
+      {
+        papplDeviceFlush(device);
+        brfSchedulerYield(job, lane, device);
+      }
     }
   }
+
+  if (bytes < 0)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to read print file '%s': %s", papplJobGetFilename(job), strerror(errno));
+    ok = false;
+  }
+
   close(fd);
 
-  papplJobSetImpressionsCompleted(job, 1);
+  brfSanitizeFinish(&sanitize, job);
 
-  return (true);
+  // Only keep complete output...
+  brfRetainFinish(retain, ok);
+
+  if (ok)
+    papplJobSetImpressionsCompleted(job, 1);
+
+  return (ok);
 }
 
 
@@ -159,9 +275,23 @@ brf_gen_rendjob(
     pappl_pr_options_t *options,	// I - Job options
     pappl_device_t     *device)		// I - Output device
 {
-  (void)job;
+  brf_gen_raster_t	*ras = (brf_gen_raster_t *)papplJobGetData(job);
+					// Raster job state
+
+
   (void)options;
-  (void)device;
+
+  if (!ras)
+    return (false);
+
+  free(ras->cells);
+  free(ras->out);
+  free(ras->xdots);
+  free(ras);
+
+  papplJobSetData(job, NULL);
+
+  papplDeviceFlush(device);
 
   return (true);
 }
@@ -178,19 +308,56 @@ brf_gen_rendpage(
     pappl_device_t     *device,		// I - Output device
     unsigned           page)		// I - Page number
 {
-  (void)job;
+  brf_gen_raster_t	*ras = (brf_gen_raster_t *)papplJobGetData(job);
+					// Raster job state
+
+
+  (void)options;
   (void)page;
 
-  papplDevicePuts(device, "P1\n");
+  // Send the last line when the raster ends inside of it...
+  return (ras && (!(ras->row % 3) || brf_gen_rflush(ras, device)));
+}
 
 
-  return (true);
+//
+// 'brf_gen_rflush()' - Send a line of braille graphics.
+//
+// Blank cells at the end of the line are not sent.
+//
+
+static bool				// O - `true` on success, `false` on failure
+brf_gen_rflush(brf_gen_raster_t *ras,	// I - Raster job state
+               pappl_device_t   *device)// I - Output device
+{
+  unsigned	x,			// Current cell
+		count;			// Cells to send
+
+
+  for (count = ras->num_cells; count > 0 && !ras->cells[count - 1]; count --);
+
+  for (x = 0; x < count; x ++)
+    ras->out[x] = (unsigned char)brf_gen_dots[ras->cells[x]];
+
+  ras->out[count ++] = '\r';
+  ras->out[count ++] = '\n';
+
+  memset(ras->cells, 0, ras->num_cells);
+
+  // Continue with the first row of the next line...
+  ras->row = (ras->row + 2) / 3 * 3;
+
+  return (papplDeviceWrite(device, ras->out, count) >= 0);
 }
 
 
 //
 // 'Brf_generic_rstartjob()' - Start a job.
 //
+// Generic embossers have no graphic mode, so raster pages are embossed as
+// lines of 6-dot cells, each dot sampled from the raster at its place on the
+// paper.
+//
 
 static bool				// O - `true` on success, `false` on failure
 brf_gen_rstartjob(
@@ -198,15 +365,33 @@ brf_gen_rstartjob(
     pappl_pr_options_t *options,	// I - Job options
     pappl_device_t     *device)		// I - Output device
 {
-  (void)job;
+  brf_gen_raster_t	*ras;		// Raster job state
+
+
   (void)options;
   (void)device;
 
+  if ((ras = (brf_gen_raster_t *)calloc(1, sizeof(brf_gen_raster_t))) == NULL)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to allocate memory for raster job.");
+    return (false);
+  }
+
+  papplLogJob(job, PAPPL_LOGLEVEL_INFO, "Writing graphics to generic embosser as braille cells.");
+
+  papplJobSetData(job, ras);
+
   return (true);
 }
+
+
 //
 // 'brf_gen_rwriteline()' - Write a raster line.
 //
+// Each row of dots takes the raster line at its place on the paper, rows
+// between the lines of cells are skipped.
+//
+
 static bool				// O - `true` on success, `false` on failure
 brf_gen_rwriteline(
     pappl_job_t         *job,		// I - Job
@@ -215,19 +400,43 @@ brf_gen_rwriteline(
     unsigned            y,		// I - Line number
     const unsigned char *line)		// I - Line
 {
-  if (line[0] || memcmp(line, line + 1, options->header.cupsBytesPerLine - 1))
+  brf_gen_raster_t	*ras = (brf_gen_raster_t *)papplJobGetData(job);
+					// Raster job state
+  unsigned		x,		// Current dot column
+			xdot,		// Raster column of dot
+			bit;		// Dot bit of this row
+  bool			black;		// Is the dot black?
+
+
+  if (!ras || !ras->cells)
+    return (false);
+
+  while (y == ras->ydot && ras->row < 3 * ras->num_lines)
   {
-    unsigned		i;		// Looping var
-    const unsigned char	*lineptr;	// Pointer into line
-    unsigned char	buffer[300],
-			*bufptr;	// Pointer into buffer
+    // Dots 1-3 are the left column, 4-6 the right one...
+    for (x = 0; x < 2 * ras->num_cells; x ++)
+    {
+      if ((xdot = ras->xdots[x]) >= options->header.cupsWidth)
+        break;
+
+      if (options->header.cupsBitsPerPixel == 1)
+        black = (line[xdot / 8] & (0x80 >> (xdot & 7))) != 0;
+      else if (options->header.cupsColorSpace == CUPS_CSPACE_SW)
+        black = line[xdot] < 128;
+      else
+        black = line[xdot] >= 128;
+
+      if (black)
+      {
+        bit = 1U << ((ras->row % 3) + 3 * (x & 1));
+        ras->cells[x / 2] |= (unsigned char)bit;
+      }
+    }
 
-    for (i = options->header.cupsBytesPerLine, lineptr = line, bufptr = buffer; i > 0; i --)
-      *bufptr++ = ~*lineptr++;
+    if ((++ ras->row % 3) == 0 && !brf_gen_rflush(ras, device))
+      return (false);
 
-    papplDevicePrintf(device, "GW0,%u,%u,1\n", y, options->header.cupsBytesPerLine);
-    papplDeviceWrite(device, buffer, options->header.cupsBytesPerLine);
-    papplDevicePuts(device, "\n");
+    ras->ydot = (unsigned)(((ras->top + ras->row / 3 * BRF_GEN_LINE_HEIGHT + ras->row % 3 * BRF_GEN_DOT_DISTANCE) * (int)options->header.HWResolution[1] + 1270) / 2540);
   }
 
   return (true);
@@ -237,6 +446,9 @@ brf_gen_rwriteline(
 //
 // 'Brf_generic_rstartpage()' - Start a page.
 //
+// The cells start at the margins of the media, page sizes are in points and
+// distances in hundredths of millimeters.
+//
 
 static bool				// O - `true` on success, `false` on failure
 brf_gen_rstartpage(
@@ -245,20 +457,64 @@ brf_gen_rstartpage(
     pappl_device_t     *device,		// I - Output device
     unsigned           page)		// I - Page number
 {
-  int		ips;			// Inches per second
+  brf_gen_raster_t	*ras = (brf_gen_raster_t *)papplJobGetData(job);
+					// Raster job state
+  int			width,		// Width of page in 1/100mm
+			length,		// Length of page in 1/100mm
+			left,		// Left margin in 1/100mm
+			xres = (int)options->header.HWResolution[0];
+					// Horizontal resolution
+  unsigned		num_cells,	// Cells per line
+			x;		// Looping var
+
+
+  if (!ras)
+    return (false);
 
+  width  = (int)options->header.PageSize[0] * 2540 / 72;
+  length = (int)options->header.PageSize[1] * 2540 / 72;
+  left   = options->media.left_margin;
 
-  (void)job;
-  (void)page;
+  ras->top = options->media.top_margin;
 
-  papplDevicePuts(device, "\nN\n");
+  width  -= left + options->media.right_margin + BRF_GEN_DOT_DISTANCE;
+  length -= ras->top + options->media.bottom_margin + 2 * BRF_GEN_DOT_DISTANCE;
 
+  num_cells      = width > 0 ? (unsigned)(width / BRF_GEN_CELL_WIDTH + 1) : 0;
+  ras->num_lines = length > 0 ? (unsigned)(length / BRF_GEN_LINE_HEIGHT + 1) : 0;
 
- 
-  return (true);
-}
+  if (num_cells != ras->num_cells || !ras->cells)
+  {
+    free(ras->cells);
+    free(ras->out);
+    free(ras->xdots);
 
+    ras->cells     = (unsigned char *)calloc(num_cells + 1, 1);
+    ras->out       = (unsigned char *)malloc(num_cells + 2);
+    ras->xdots     = (unsigned *)calloc(2 * num_cells + 1, sizeof(unsigned));
+    ras->num_cells = num_cells;
 
+    if (!ras->cells || !ras->out || !ras->xdots)
+    {
+      papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to allocate memory for raster page.");
+      free(ras->cells);
+      ras->cells     = NULL;
+      ras->num_cells = 0;
+      return (false);
+    }
+  }
+
+  for (x = 0; x < 2 * num_cells; x ++)
+    ras->xdots[x] = (unsigned)(((left + (int)(x / 2) * BRF_GEN_CELL_WIDTH + (int)(x & 1) * BRF_GEN_DOT_DISTANCE) * xres + 1270) / 2540);
+
+  memset(ras->cells, 0, num_cells);
+
+  ras->row  = 0;
+  ras->ydot = (unsigned)((ras->top * (int)options->header.HWResolution[1] + 1270) / 2540);
+
+  // Pages after the first start with a form feed...
+  return (!page || papplDeviceWrite(device, "\f", 1) >= 0);
+}
 
 
 //
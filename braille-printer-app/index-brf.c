@@ -0,0 +1,1101 @@
+//
+// Index driver for the Braille Printer Application
+//
+// Copyright © 2022 Chandresh Soni
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// The models, media and options come from the tables that drv2c.awk
+// generates from drv/indexv3.drv and drv/indexv4.drv, so no PPD files are
+// needed at run time.  The embosser setup follows driver/index/index.sh,
+// indexv3.sh and indexv4.sh, and BRF text is sent in transparent mode like
+// textbrftoindexv3 does.
+//
+// Raster graphics are encoded straight from the bitmap in the 4-dot graphic
+// mode that imageubrltoindexv4 uses: every byte is one column of four dots,
+// '@' plus dot bits 1 (top) to 8 (bottom), and every line holds four rows of
+// dots at the graphic dot distance.  The printer resolutions are the graphic
+// dot distances rounded down (1.6mm is 15dpi, 2.0mm is 12dpi, 2.5mm is 10dpi),
+// so clients send no more pixels than the embosser has dots, and pages are
+// clipped to the dots that fit on the paper.
+//
+
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+
+
+//
+// Local types...
+//
+
+typedef struct brf_index_raster_s	// Raster job state
+{
+  brf_writer_t		*writer;	// Device writer
+  unsigned char		*band,		// Dot columns of current line
+			*out;		// Output line
+  unsigned		width,		// Width of band in dots
+			rows,		// Rows in current band
+			max_rows;	// Rows of dots on the paper
+  int			distance;	// Graphic dot distance
+} brf_index_raster_t;
+
+//
+// Local globals...
+//
+
+static const char brf_index_dots[64] =	// BRF to Index 6-dot transparent mode
+{
+  '\0', 'V',  ' ',  't',  'S',  'Q',  'W',  '\004',	//  !"#$%&'
+  'g',  'v',  'A',  'T',  '@',  'D',  'P',  '\024',	// ()*+,-./
+  'd',  '\002', '\006', '\"', 'b', 'B', '&',  'f',	// 01234567
+  'F',  '$',  'a',  '`',  'C',  'w',  '4',  'q',	// 89:;<=>?
+  '\020', '\001', '\003', '\021', '1', '!', '\023', '3',// @ABCDEFG
+  '#',  '\022', '2', '\005', '\007', '\025', '5', '%',	// HIJKLMNO
+  '\027', '7', '\'', '\026', '6', 'E',  'G',  'r',	// PQRSTUVW
+  'U',  'u',  'e',  'R',  'c',  's',  '0',  'p'		// XYZ[\]^_
+};
+
+
+//
+// Local functions...
+//
+
+static int	brf_index_distance(int dpi);
+static int	brf_index_dpi(const char *distance);
+static const brf_drv_model_t *brf_index_get_model(pappl_job_t *job);
+static const char *brf_index_get_option(const brf_drv_model_t *model, pappl_pr_options_t *options, const char *name);
+static bool	brf_index_init(pappl_job_t *job, const brf_drv_model_t *model, pappl_pr_options_t *options, int dpi, char *init, size_t initsize);
+static unsigned	brf_index_in(int hmm);
+static bool	brf_index_rflush(pappl_job_t *job, brf_index_raster_t *ras);
+static bool	brf_index_printfile(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device);
+static bool	brf_index_rendjob(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device);
+static bool	brf_index_rendpage(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device, unsigned page);
+static bool	brf_index_rstartjob(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device);
+static bool	brf_index_rstartpage(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device, unsigned page);
+static bool	brf_index_rwriteline(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device, unsigned y, const unsigned char *line);
+static bool	brf_index_status(pappl_printer_t *printer);
+static bool	brf_index_writeline(pappl_job_t *job, brf_writer_t *writer, const unsigned char *line, size_t linelen, bool eol, unsigned *pages, bool *top);
+
+
+//
+// 'brf_index()' - Initialize the driver data for an Index embosser.
+//
+
+bool					// O - `true` on success, `false` on error
+brf_index(
+    pappl_system_t         *system,	// I - System
+    const char             *driver_name,// I - Driver name
+    const char             *device_uri,	// I - Device URI
+    const char             *device_id,	// I - 1284 device ID
+    pappl_pr_driver_data_t *driver_data,// I - Pointer to driver data
+    ipp_t                  **attrs,	// O - Pointer to driver attributes
+    void                   *cbdata)	// I - Callback data (model)
+{
+  const brf_drv_model_t	*model = (const brf_drv_model_t *)cbdata;
+					// Model
+  const brf_drv_option_t *option;	// Current option
+  const brf_drv_media_t	*media;		// Default media size
+  int			i;		// Looping var
+  char			name[256];	// Attribute name
+
+
+  (void)system;
+  (void)driver_name;
+  (void)device_uri;
+  (void)device_id;
+
+  if (!model)
+    return (false);
+
+  driver_data->extension     = (void *)model;
+  driver_data->printfile_cb  = brf_index_printfile;
+  driver_data->rendjob_cb    = brf_index_rendjob;
+  driver_data->rendpage_cb   = brf_index_rendpage;
+  driver_data->rstartjob_cb  = brf_index_rstartjob;
+  driver_data->rstartpage_cb = brf_index_rstartpage;
+  driver_data->rwriteline_cb = brf_index_rwriteline;
+  driver_data->status_cb     = brf_index_status;
+  driver_data->format        = "application/vnd.cups-paged-brf";
+
+  // Raster graphics are embossed one dot per pixel, so the resolutions are
+  // the graphic dot distances...
+  driver_data->num_resolution  = 1;
+  driver_data->x_resolution[0] = driver_data->y_resolution[0] = brf_index_dpi("200");
+  driver_data->x_default       = driver_data->y_default       = driver_data->x_resolution[0];
+
+  for (i = 0; i < model->num_options; i ++)
+  {
+    option = model->options[i];
+
+    if (strcmp(option->name, "GraphicDotDistance"))
+      continue;
+
+    for (driver_data->num_resolution = 0; driver_data->num_resolution < option->num_choices && driver_data->num_resolution < PAPPL_MAX_RESOLUTION; driver_data->num_resolution ++)
+      driver_data->x_resolution[driver_data->num_resolution] = driver_data->y_resolution[driver_data->num_resolution] = brf_index_dpi(option->choices[driver_data->num_resolution]);
+
+    driver_data->x_default = driver_data->y_default = brf_index_dpi(option->choices[option->default_choice]);
+    break;
+  }
+
+  // Sides...
+  if (model->duplex)
+    driver_data->sides_supported = PAPPL_SIDES_ONE_SIDED | PAPPL_SIDES_TWO_SIDED_LONG_EDGE;
+
+  // Media sizes and hardware margins...
+  for (i = 0; i < model->num_media && i < PAPPL_MAX_MEDIA; i ++)
+    driver_data->media[i] = model->media[i].pwg_name;
+
+  driver_data->num_media = i;
+
+  driver_data->left_right = model->left > model->right ? model->left : model->right;
+  driver_data->bottom_top = model->bottom > model->top ? model->bottom : model->top;
+
+  media = model->media + model->default_media;
+
+  papplCopyString(driver_data->media_default.size_name, media->pwg_name, sizeof(driver_data->media_default.size_name));
+  driver_data->media_default.size_width    = media->width;
+  driver_data->media_default.size_length   = media->length;
+  driver_data->media_default.left_margin   = model->left;
+  driver_data->media_default.right_margin  = model->right;
+  driver_data->media_default.bottom_margin = model->bottom;
+  driver_data->media_default.top_margin    = model->top;
+
+  driver_data->num_source = 1;
+  driver_data->source[0]  = "tractor";
+
+  papplCopyString(driver_data->media_default.source, "tractor", sizeof(driver_data->media_default.source));
+  driver_data->media_ready[0] = driver_data->media_default;
+
+  // Options from the .drv files become vendor attributes...
+  if (!*attrs)
+    *attrs = ippNew();
+
+  driver_data->num_vendor = 0;
+
+  for (i = 0; i < model->num_options && driver_data->num_vendor < PAPPL_MAX_VENDOR; i ++)
+  {
+    option = model->options[i];
+
+    driver_data->vendor[driver_data->num_vendor ++] = option->keyword;
+
+    snprintf(name, sizeof(name), "%s-supported", option->keyword);
+    ippAddStrings(*attrs, IPP_TAG_PRINTER, IPP_TAG_KEYWORD, name, option->num_choices, NULL, option->choices);
+
+    snprintf(name, sizeof(name), "%s-default", option->keyword);
+    ippAddString(*attrs, IPP_TAG_PRINTER, IPP_TAG_KEYWORD, name, NULL, option->choices[option->default_choice]);
+  }
+
+  return (true);
+}
+
+
+//
+// 'brf_index_distance()' - Get the graphic dot distance of a resolution.
+//
+
+static int				// O - Dot distance or 0 if none matches
+brf_index_distance(int dpi)		// I - Resolution in dots per inch
+{
+  if (dpi == brf_index_dpi("160"))
+    return (160);
+  else if (dpi == brf_index_dpi("200"))
+    return (200);
+  else if (dpi == brf_index_dpi("250"))
+    return (250);
+  else
+    return (0);
+}
+
+
+//
+// 'brf_index_dpi()' - Convert a graphic dot distance to a resolution.
+//
+// Dot distances are in hundredths of millimeters, for example "200" is 2.0mm
+// or 12dpi.  The resolution is rounded down so that a page of dots is never
+// larger than the paper.
+//
+
+static int				// O - Resolution in dots per inch
+brf_index_dpi(const char *distance)	// I - Dot distance
+{
+  int	hmm = atoi(distance);		// Dot distance in hundredths of mm
+
+
+  return (hmm > 0 ? 2540 / hmm : 12);
+}
+
+
+//
+// 'brf_index_get_model()' - Get the model for a job's printer.
+//
+
+static const brf_drv_model_t *		// O - Model
+brf_index_get_model(pappl_job_t *job)	// I - Job
+{
+  pappl_pr_driver_data_t data;		// Driver data
+
+
+  papplPrinterGetDriverData(papplJobGetPrinter(job), &data);
+
+  return ((const brf_drv_model_t *)data.extension);
+}
+
+
+//
+// 'brf_index_get_option()' - Get the value of a driver option for a job.
+//
+
+static const char *			// O - Choice name or `NULL` if not supported
+brf_index_get_option(
+    const brf_drv_model_t *model,	// I - Model
+    pappl_pr_options_t    *options,	// I - Job options
+    const char            *name)	// I - PPD option name
+{
+  int			i, j;		// Looping vars
+  const brf_drv_option_t *option;	// Current option
+  const char		*value;		// Job value
+
+
+  for (i = 0; i < model->num_options; i ++)
+  {
+    option = model->options[i];
+
+    if (strcmp(option->name, name))
+      continue;
+
+    if ((value = cupsGetOption(option->keyword, options->num_vendor, options->vendor)) != NULL)
+    {
+      for (j = 0; j < option->num_choices; j ++)
+      {
+        if (!strcmp(value, option->choices[j]))
+          return (option->choices[j]);
+      }
+    }
+
+    return (option->choices[option->default_choice]);
+  }
+
+  return (NULL);
+}
+
+
+//
+// 'brf_index_in()' - Convert hundredths of millimeters to an Index inch value.
+//
+// The result is the integer number of inches followed by a digit for the
+// fraction: 0, 1/4, 1/3, 1/2, 2/3, or 3/4.
+//
+
+static unsigned				// O - Index inch value
+brf_index_in(int hmm)			// I - Length in hundredths of millimeters
+{
+  int	in120 = hmm * 12 / 254,		// Length in 1/120th inches
+	frac = in120 % 120;		// Fractional part
+
+
+  if (frac < 30)
+    frac = 0;
+  else if (frac < 40)
+    frac = 1;
+  else if (frac < 60)
+    frac = 2;
+  else if (frac < 80)
+    frac = 3;
+  else if (frac < 90)
+    frac = 4;
+  else
+    frac = 5;
+
+  return ((unsigned)((in120 / 120) * 10 + frac));
+}
+
+
+//
+// 'brf_index_init()' - Build the embosser setup sequence for a job.
+//
+// Firmware before 10.30 has no temporary parameters, so the sequence is
+// empty and the embosser must be configured like the printer.  For raster
+// jobs the graphic dot distance follows the resolution of the raster, so
+// every pixel is one dot.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_index_init(
+    pappl_job_t           *job,		// I - Job
+    const brf_drv_model_t *model,	// I - Model
+    pappl_pr_options_t    *options,	// I - Job options
+    int                   dpi,		// I - Raster resolution or 0 for text
+    char                  *init,	// I - Setup buffer
+    size_t                initsize)	// I - Size of setup buffer
+{
+  const char	*zfolding,		// Z-folding?
+		*sideways,		// Sideways folding?
+		*saddle,		// Saddle stitch?
+		*value;			// Option value
+  bool		duplex;			// Double-sided?
+  int		dp,			// Page mode
+		tdd,			// Text dot distance
+		tcd,			// Text cell distance
+		dots,			// Text dots
+		spacing,		// Line spacing
+		width,			// Printable width
+		length;			// Printable length
+  char		*ptr,			// Pointer into setup buffer
+		*end = init + initsize;	// End of setup buffer
+
+
+  *init = '\0';
+
+  if ((value = brf_index_get_option(model, options, "IndexFirmwareVersion")) == NULL || atoi(value) < 103000)
+    return (true);
+
+  // Temporary parameters, margins are implemented in software...
+  snprintf(init, initsize, "\033DTM0,BI0,FO0");
+  ptr = init + strlen(init);
+
+  // Hardware-assisted multiple copies...
+  if (options->copies > 1)
+  {
+    snprintf(ptr, (size_t)(end - ptr), ",MC%d", options->copies);
+    ptr += strlen(ptr);
+  }
+
+  if ((value = brf_index_get_option(model, options, "IndexMultipleImpact")) != NULL)
+  {
+    snprintf(ptr, (size_t)(end - ptr), ",MI%s", value);
+    ptr += strlen(ptr);
+  }
+
+  // Page mode...
+  duplex   = model->duplex && options->sides != PAPPL_SIDES_ONE_SIDED;
+  zfolding = brf_index_get_option(model, options, "ZFolding");
+  sideways = brf_index_get_option(model, options, "Sideways");
+  saddle   = brf_index_get_option(model, options, "SaddleStitch");
+
+  if (options->sides == PAPPL_SIDES_TWO_SIDED_SHORT_EDGE)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Duplex mode two-sided-short-edge is not supported.");
+    return (false);
+  }
+
+  if (zfolding && !strcmp(zfolding, "True"))
+  {
+    if (saddle && !strcmp(saddle, "True"))
+      dp = 0;
+    else if (sideways && !strcmp(sideways, "True"))
+      dp = duplex ? 6 : 7;
+    else
+      dp = duplex ? 3 : 5;
+  }
+  else if (sideways && !strcmp(sideways, "True"))
+    dp = 0;
+  else if (saddle && !strcmp(saddle, "True"))
+    dp = duplex ? 4 : 8;
+  else
+    dp = duplex ? 2 : 1;
+
+  if (!dp)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unsupported page folding: duplex=%s z-folding=%s sideways=%s saddle-stitch=%s", duplex ? "true" : "false", zfolding ? zfolding : "False", sideways ? sideways : "False", saddle ? saddle : "False");
+    return (false);
+  }
+
+  snprintf(ptr, (size_t)(end - ptr), ",DP%d", dp);
+  ptr += strlen(ptr);
+
+  // Dot spacing...
+  value = brf_index_get_option(model, options, "TextDotDistance");
+  tdd   = value ? atoi(value) : 250;
+
+  switch (tdd)
+  {
+    case 220 :
+        snprintf(ptr, (size_t)(end - ptr), ",TD1");
+        tcd = 310;
+        break;
+    case 250 :
+        snprintf(ptr, (size_t)(end - ptr), ",TD0");
+        tcd = 350;
+        break;
+    case 320 :
+        snprintf(ptr, (size_t)(end - ptr), ",TD2");
+        tcd = 525;
+        break;
+    default :
+        papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unsupported text dot distance %d.", tdd);
+        return (false);
+  }
+  ptr += strlen(ptr);
+
+  value = brf_index_get_option(model, options, "GraphicDotDistance");
+
+  if (dpi > 0)
+  {
+    switch (brf_index_distance(dpi))
+    {
+      case 160 :
+          value = "160";
+          break;
+      case 200 :
+          value = "200";
+          break;
+      case 250 :
+          value = "250";
+          break;
+      default :
+          papplLogJob(job, PAPPL_LOGLEVEL_WARN, "No graphic dot distance matches the %ddpi raster.", dpi);
+          break;
+    }
+  }
+
+  if (!value || !strcmp(value, "200"))
+    snprintf(ptr, (size_t)(end - ptr), ",GD0");
+  else if (!strcmp(value, "250"))
+    snprintf(ptr, (size_t)(end - ptr), ",GD1");
+  else if (!strcmp(value, "160"))
+    snprintf(ptr, (size_t)(end - ptr), ",GD2");
+  else
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unsupported graphic dot distance %s.", value);
+    return (false);
+  }
+  ptr += strlen(ptr);
+
+  // Page numbers are implemented in software...
+  snprintf(ptr, (size_t)(end - ptr), ",PN0");
+  ptr += strlen(ptr);
+
+  value   = brf_index_get_option(model, options, "LineSpacing");
+  spacing = value ? atoi(value) : 500;
+  value   = brf_index_get_option(model, options, "TextDots");
+  dots    = value ? atoi(value) : 6;
+
+  if (model->version == 3)
+  {
+    // Paper size...
+    if (model->paper_length && !strcmp(model->paper_length, "In"))
+      snprintf(ptr, (size_t)(end - ptr), ",PW%u,PL%u", brf_index_in(options->media.size_width), brf_index_in(options->media.size_length));
+    else if (model->paper_length && !strcmp(model->paper_length, "Mm"))
+      snprintf(ptr, (size_t)(end - ptr), ",PW%d,PL%d", options->media.size_width / 100, options->media.size_length / 100);
+    ptr += strlen(ptr);
+
+    // Line spacing...
+    switch (spacing)
+    {
+      case 250 :
+          snprintf(ptr, (size_t)(end - ptr), ",LS0");
+          break;
+      case 375 :
+          snprintf(ptr, (size_t)(end - ptr), ",LS1");
+          break;
+      case 450 :
+          snprintf(ptr, (size_t)(end - ptr), ",LS2");
+          break;
+      case 475 :
+          snprintf(ptr, (size_t)(end - ptr), ",LS3");
+          break;
+      case 500 :
+          snprintf(ptr, (size_t)(end - ptr), ",LS4");
+          break;
+      case 525 :
+          snprintf(ptr, (size_t)(end - ptr), ",LS5");
+          break;
+      case 550 :
+          snprintf(ptr, (size_t)(end - ptr), ",LS6");
+          break;
+      case 750 :
+          snprintf(ptr, (size_t)(end - ptr), ",LS7");
+          break;
+      case 1000 :
+          snprintf(ptr, (size_t)(end - ptr), ",LS8");
+          break;
+      default :
+          if ((value = brf_index_get_option(model, options, "IndexFirmwareVersion")) != NULL && atoi(value) < 120130)
+          {
+            papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unsupported line spacing %d, please upgrade firmware to at least 12.01.3.", spacing);
+            return (false);
+          }
+          else if (spacing < 100)
+          {
+            papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Line spacing %d is too small.", spacing);
+            return (false);
+          }
+
+          snprintf(ptr, (size_t)(end - ptr), ",LS%d", spacing / 10);
+          break;
+    }
+    ptr += strlen(ptr);
+
+    // BRF is already translated, make sure a 6-dot table is used...
+    if (dots == 6)
+      snprintf(ptr, (size_t)(end - ptr), ",BT0");
+  }
+  else
+  {
+    // Printable text area in cells and lines...
+    width  = options->media.size_width - model->left - model->right;
+    length = options->media.size_length - model->top - model->bottom;
+
+    snprintf(ptr, (size_t)(end - ptr), ",CH%d,LP%d", (width + tcd) / (tdd + tcd), (length + spacing) / (tdd * (dots / 2 - 1) + spacing));
+    ptr += strlen(ptr);
+
+    if (spacing != 500 && spacing != 1000)
+    {
+      papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unsupported line spacing %d.", spacing);
+      return (false);
+    }
+
+    snprintf(ptr, (size_t)(end - ptr), ",LS%d", spacing / 10);
+    ptr += strlen(ptr);
+
+    // BRF is already translated, select the 6 or 8-dot table...
+    snprintf(ptr, (size_t)(end - ptr), ",BT%d", dots == 8 ? 6 : 0);
+  }
+  ptr += strlen(ptr);
+
+  snprintf(ptr, (size_t)(end - ptr), ";");
+
+  if (strlen(init) >= initsize - 1)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Embosser setup sequence is too long.");
+    return (false);
+  }
+
+  return (true);
+}
+
+
+//
+// 'brf_index_printfile()' - Print a BRF file.
+//
+
+static bool				// O - `true` on success, `false` on failure
+brf_index_printfile(
+    pappl_job_t        *job,		// I - Job
+    pappl_pr_options_t *options,	// I - Job options
+    pappl_device_t     *device)		// I - Output device
+{
+  const brf_drv_model_t	*model;		// Model
+  int			fd;		// Input file
+  ssize_t		bytes;		// Bytes read
+  unsigned char		buffer[32768],	// Read buffer
+			clean[2 * sizeof(buffer) + 4],
+					// Cleaned up BRF
+			*bufptr,	// Pointer into clean buffer
+			*bufend,	// End of clean buffer
+			line[1024];	// Current line
+  size_t		linelen = 0;	// Length of current line
+  brf_sanitize_t	sanitize;	// BRF clean-up state
+  off_t			start,		// Start of requested pages
+			end;		// End of requested pages
+  unsigned		pages = 0;	// Pages sent
+  size_t		numff;		// Number of leading form feeds
+  char			init[256],	// Embosser setup sequence
+			separator[3],	// Page break before a following job
+			*ptr;		// Pointer into setup sequence
+  int			dp;		// Page mode
+  bool			duplex,		// Printing on both sides?
+			yield,		// Can other jobs go first?
+			top = true;	// At top of page?
+  brf_writer_t		*writer;	// Device writer
+  brf_lane_t		lane;		// Scheduling lane of job
+  bool			ret = true;	// Return value
+
+
+  if (brfSchedulerWasPrinted(job))
+    return (true);
+
+  if ((model = brf_index_get_model(job)) == NULL)
+    return (false);
+
+  // Render the next jobs while this one is embossed...
+  brfRenderAheadKick();
+
+  lane = brfSchedulerGetLane(job);
+
+  if (!brf_index_init(job, model, options, 0, init, sizeof(init)))
+    return (false);
+
+  if (!brfPageIndexGetJobRange(job, options, &start, &end))
+    return (false);
+
+  // Other jobs can only go first at the end of a sheet with duplex, and not
+  // at all in hardware copies and booklets...
+  dp     = (ptr = strstr(init, ",DP")) != NULL ? atoi(ptr + 3) : 0;
+  duplex = dp == 2 || dp == 3 || dp == 6;
+  yield  = options->copies <= 1 && dp != 4 && dp != 8;
+
+  if ((fd = open(papplJobGetFilename(job), O_RDONLY)) < 0)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to open print file '%s': %s", papplJobGetFilename(job), strerror(errno));
+    return (false);
+  }
+
+  if (start > 0 && lseek(fd, start, SEEK_SET) < 0)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to seek in print file '%s': %s", papplJobGetFilename(job), strerror(errno));
+    close(fd);
+    return (false);
+  }
+
+  if ((writer = brfWriterCreate(device, job, 0, 0)) == NULL)
+  {
+    close(fd);
+    return (false);
+  }
+
+  papplLogJob(job, PAPPL_LOGLEVEL_INFO, "Writing text to Index embosser in transparent mode.");
+
+  if (!brfSessionBegin(job, writer, init, "\032"))
+    ret = false;
+
+  // Index embossers only take uppercase ASCII BRF, and CR and SUB are sent
+  // by the driver...
+  brfSanitizeInit(&sanitize, BRF_SANITIZE_ASCII | BRF_SANITIZE_CONTROL | BRF_SANITIZE_FOLD | BRF_SANITIZE_STRIP);
+
+  while (ret && (end < 0 || start < end) && (bytes = read(fd, buffer, end < 0 || (end - start) > (off_t)sizeof(buffer) ? sizeof(buffer) : (size_t)(end - start))) > 0)
+  {
+    start  += bytes;
+    bufend = clean + brfSanitize(&sanitize, buffer, (size_t)bytes, clean);
+
+    for (bufptr = clean; ret && bufptr < bufend; bufptr ++)
+    {
+      if (*bufptr == '\n')
+      {
+        for (numff = 0; numff < linelen && line[numff] == '\f'; numff ++);
+
+        if (numff > 0 && yield && (!duplex || !((pages + numff) & 1)) && brfSchedulerShouldYield(job, lane))
+        {
+          // Finish the page and the document, let more urgent jobs go first,
+          // and then set the embosser up again for the rest of this job...
+          if ((ret = brf_index_writeline(job, writer, line, numff, false, &pages, &top)) == true && (ret = brfSessionClose(job, writer)) == true)
+            ret = brfWriterFinish(writer);
+          else
+            brfWriterFinish(writer);
+
+          writer = NULL;
+
+          if (ret)
+          {
+            brfSchedulerYield(job, lane, device);
+
+            // A job printed ahead may have left its document open...
+            if ((writer = brfWriterCreate(device, job, 0, 0)) == NULL || !brfSessionClose(job, writer) || !brfSessionBegin(job, writer, init, "\032"))
+              ret = false;
+          }
+
+          if (ret)
+            ret = brf_index_writeline(job, writer, line + numff, linelen - numff, true, &pages, &top);
+        }
+        else
+          ret = brf_index_writeline(job, writer, line, linelen, true, &pages, &top);
+
+        linelen = 0;
+      }
+      else if (linelen < sizeof(line))
+        line[linelen ++] = *bufptr;
+      else
+      {
+        papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Line too long.");
+        ret = false;
+      }
+    }
+  }
+
+  close(fd);
+
+  brfSanitizeFinish(&sanitize, job);
+
+  if (ret && linelen > 0)
+    ret = brf_index_writeline(job, writer, line, linelen, false, &pages, &top);
+
+  // End of job, a small job that follows may continue the document after the
+  // last page, or with duplex the last sheet.  Hardware copies and booklets
+  // need a document of their own...
+  snprintf(separator, sizeof(separator), "%s%s", top ? "" : "\f", duplex && ((pages + !top) & 1) ? "\f" : "");
+
+  if (!brfSessionEnd(job, writer, ret && init[0] && yield ? separator : NULL))
+    ret = false;
+
+  if (!brfWriterFinish(writer))
+    ret = false;
+
+  papplJobSetImpressionsCompleted(job, (int)pages + 1);
+
+  return (ret);
+}
+
+
+//
+// 'brf_index_writeline()' - Send a line of BRF text in transparent mode.
+//
+
+static bool				// O - `true` on success, `false` on error
+brf_index_writeline(
+    pappl_job_t         *job,		// I - Job
+    brf_writer_t        *writer,	// I - Device writer
+    const unsigned char *line,		// I - Line
+    size_t              linelen,	// I - Length of line
+    bool                eol,		// I - Line was terminated?
+    unsigned            *pages,		// IO - Page count
+    bool                *top)		// IO - At top of page?
+{
+  const unsigned char	*lineptr,	// Pointer into line
+			*lineend = line + linelen;
+					// End of line
+  unsigned char		out[132],	// Output sequence
+			*outptr = out + 4,
+					// Pointer into output
+			ch;		// Current character
+  bool			leading = true;	// Still at start of line?
+
+
+  for (lineptr = line; lineptr < lineend; lineptr ++)
+  {
+    ch = *lineptr;
+
+    // Interpret leading FFs, the line has already been cleaned up by
+    // brfSanitize()...
+    if (ch == '\f' && leading)
+    {
+      if (brfWriterWrite(writer, "\f", 1) < 0)
+        return (false);
+
+      (*pages) ++;
+      *top = true;
+      continue;
+    }
+
+    leading = false;
+
+    if (ch == '\f')
+    {
+      papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unsupported form feed in the middle of a line in BRF file.");
+      ch = ' ';
+    }
+
+    // Index printers have a bug with lengths between 128 and 255 in the
+    // transparent mode escape sequence, but 127 cells is more than a line...
+    if (outptr >= (out + sizeof(out) - 1))
+    {
+      papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Line too long (%u).", (unsigned)linelen);
+      return (false);
+    }
+
+    *outptr++ = (unsigned char)brf_index_dots[ch - ' '];
+  }
+
+  if (outptr > (out + 4))
+  {
+    // Enter transparent mode for the characters in the line...
+    out[0] = 0x1b;
+    out[1] = '\\';
+    out[2] = (unsigned char)(outptr - out - 4);
+    out[3] = 0;
+
+    if (brfWriterWrite(writer, out, (size_t)(outptr - out)) < 0)
+      return (false);
+
+    *top = false;
+  }
+
+  if (eol)
+  {
+    if (brfWriterWrite(writer, "\r\n", 2) < 0)
+      return (false);
+
+    *top = false;
+  }
+
+  return (true);
+}
+
+
+//
+// 'brf_index_rendjob()' - End a job.
+//
+
+static bool				// O - `true` on success, `false` on failure
+brf_index_rendjob(
+    pappl_job_t        *job,		// I - Job
+    pappl_pr_options_t *options,	// I - Job options
+    pappl_device_t     *device)		// I - Output device
+{
+  brf_index_raster_t	*ras = (brf_index_raster_t *)papplJobGetData(job);
+					// Raster job state
+  bool			ret;		// Return value
+
+
+  (void)options;
+  (void)device;
+
+  if (!ras)
+    return (false);
+
+  // Leave graphic mode and end the document...
+  brfWriterWrite(ras->writer, "\033\006", 2);
+  brfSessionEnd(job, ras->writer, NULL);
+
+  ret = brfWriterFinish(ras->writer);
+
+  free(ras->band);
+  free(ras->out);
+  free(ras);
+
+  papplJobSetData(job, NULL);
+
+  return (ret);
+}
+
+
+//
+// 'brf_index_rendpage()' - End a page.
+//
+
+static bool				// O - `true` on success, `false` on failure
+brf_index_rendpage(
+    pappl_job_t        *job,		// I - Job
+    pappl_pr_options_t *options,	// I - Job options
+    pappl_device_t     *device,		// I - Output device
+    unsigned           page)		// I - Page number
+{
+  brf_index_raster_t	*ras = (brf_index_raster_t *)papplJobGetData(job);
+					// Raster job state
+
+
+  (void)options;
+  (void)device;
+  (void)page;
+
+  // Send the last rows of the page...
+  return (ras && (!ras->rows || brf_index_rflush(job, ras)));
+}
+
+
+//
+// 'brf_index_rflush()' - Send a line of graphics.
+//
+// Blank columns at the end of the line are not sent.
+//
+
+static bool				// O - `true` on success, `false` on failure
+brf_index_rflush(
+    pappl_job_t        *job,		// I - Job
+    brf_index_raster_t *ras)		// I - Raster job state
+{
+  unsigned	x,			// Current column
+		count;			// Columns to send
+
+
+  (void)job;
+
+  for (count = ras->width; count > 0 && !ras->band[count - 1]; count --);
+
+  for (x = 0; x < count; x ++)
+    ras->out[x] = (unsigned char)('@' + ras->band[x]);
+
+  ras->out[count ++] = '\r';
+  ras->out[count ++] = '\n';
+
+  memset(ras->band, 0, ras->width);
+  ras->rows = 0;
+
+  return (brfWriterWrite(ras->writer, ras->out, count) >= 0);
+}
+
+
+//
+// 'brf_index_rstartjob()' - Start a job.
+//
+// Sets the embosser up like for text and enters the 4-dot graphic mode.
+//
+
+static bool				// O - `true` on success, `false` on failure
+brf_index_rstartjob(
+    pappl_job_t        *job,		// I - Job
+    pappl_pr_options_t *options,	// I - Job options
+    pappl_device_t     *device)		// I - Output device
+{
+  const brf_drv_model_t	*model;		// Model
+  brf_index_raster_t	*ras;		// Raster job state
+  char			init[256];	// Embosser setup sequence
+
+
+  if ((model = brf_index_get_model(job)) == NULL)
+    return (false);
+
+  if (!brf_index_init(job, model, options, (int)options->header.HWResolution[0], init, sizeof(init)))
+    return (false);
+
+  if ((ras = (brf_index_raster_t *)calloc(1, sizeof(brf_index_raster_t))) == NULL)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to allocate memory for raster job.");
+    return (false);
+  }
+
+  if ((ras->distance = brf_index_distance((int)options->header.HWResolution[0])) == 0)
+    ras->distance = 200;
+
+  if ((ras->writer = brfWriterCreate(device, job, 0, 0)) == NULL)
+  {
+    free(ras);
+    return (false);
+  }
+
+  papplLogJob(job, PAPPL_LOGLEVEL_INFO, "Writing graphics to Index embosser in 4-dot graphic mode.");
+
+  if (!brfSessionBegin(job, ras->writer, init, "\032") || brfWriterWrite(ras->writer, "\033\007", 2) < 0)
+  {
+    brfWriterFinish(ras->writer);
+    free(ras);
+    return (false);
+  }
+
+  papplJobSetData(job, ras);
+
+  return (true);
+}
+
+
+//
+// 'brf_index_rstartpage()' - Start a page.
+//
+
+static bool				// O - `true` on success, `false` on failure
+brf_index_rstartpage(
+    pappl_job_t        *job,		// I - Job
+    pappl_pr_options_t *options,	// I - Job options
+    pappl_device_t     *device,		// I - Output device
+    unsigned           page)		// I - Page number
+{
+  brf_index_raster_t	*ras = (brf_index_raster_t *)papplJobGetData(job);
+					// Raster job state
+  unsigned		width = options->header.cupsWidth,
+					// Width of page in dots
+			max_width;	// Dots across the paper
+
+
+  (void)device;
+
+  if (!ras)
+    return (false);
+
+  // Clip the raster to the dots that fit on the paper, page sizes are in
+  // points and dot distances in hundredths of millimeters...
+  max_width     = (unsigned)(options->header.PageSize[0] * 2540 / 72 / (unsigned)ras->distance);
+  ras->max_rows = (unsigned)(options->header.PageSize[1] * 2540 / 72 / (unsigned)ras->distance);
+
+  if (width > max_width && max_width > 0)
+    width = max_width;
+
+  if (width != ras->width)
+  {
+    free(ras->band);
+    free(ras->out);
+
+    ras->band  = (unsigned char *)calloc(width + 1, 1);
+    ras->out   = (unsigned char *)malloc(width + 2);
+    ras->width = width;
+
+    if (!ras->band || !ras->out)
+    {
+      papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to allocate memory for raster page.");
+      ras->width = 0;
+      return (false);
+    }
+  }
+
+  ras->rows = 0;
+
+  // Pages after the first start with a form feed...
+  return (!page || brfWriterWrite(ras->writer, "\f", 1) >= 0);
+}
+
+
+//
+// 'brf_index_rwriteline()' - Write a line of graphics.
+//
+
+static bool				// O - `true` on success, `false` on failure
+brf_index_rwriteline(
+    pappl_job_t         *job,		// I - Job
+    pappl_pr_options_t  *options,	// I - Job options
+    pappl_device_t      *device,	// I - Output device
+    unsigned            y,		// I - Line number
+    const unsigned char *line)		// I - Line
+{
+  brf_index_raster_t	*ras = (brf_index_raster_t *)papplJobGetData(job);
+					// Raster job state
+  unsigned		x,		// Current column
+			i,		// Looping var
+			bit,		// Dot bit of this row
+			width;		// Width of line in dots
+  const unsigned char	*lineptr;	// Pointer into line
+  unsigned char		mask;		// Bit in 1-bit line
+
+
+  (void)device;
+
+  if (!ras || !ras->band)
+    return (false);
+
+  if (ras->max_rows > 0 && y >= ras->max_rows)
+    return (true);
+
+  bit   = 1U << ras->rows;
+  width = options->header.cupsWidth < ras->width ? options->header.cupsWidth : ras->width;
+
+  if (options->header.cupsBitsPerPixel == 1)
+  {
+    // 1 is black, skip white bytes...
+    for (x = 0, lineptr = line; x < width; x += 8, lineptr ++)
+    {
+      if (!*lineptr)
+        continue;
+
+      for (i = 0, mask = 0x80; i < 8 && (x + i) < width; i ++, mask >>= 1)
+      {
+        if (*lineptr & mask)
+          ras->band[x + i] |= (unsigned char)bit;
+      }
+    }
+  }
+  else if (options->header.cupsColorSpace == CUPS_CSPACE_SW)
+  {
+    // 0 is black...
+    for (x = 0; x < width; x ++)
+      if (line[x] < 128)
+        ras->band[x] |= (unsigned char)bit;
+  }
+  else
+  {
+    // 255 is black...
+    for (x = 0; x < width; x ++)
+      if (line[x] >= 128)
+        ras->band[x] |= (unsigned char)bit;
+  }
+
+  if (++ ras->rows < 4)
+    return (true);
+
+  return (brf_index_rflush(job, ras));
+}
+
+
+//
+// 'brf_index_status()' - Get current printer status.
+//
+
+static bool				// O - `true` on success, `false` on failure
+brf_index_status(
+    pappl_printer_t *printer)		// I - Printer
+{
+  (void)printer;
+
+  return (true);
+}
@@ -0,0 +1,326 @@
+//
+// Unit test program for the BRF clean-up of the Braille Printer Application
+//
+// Copyright © 2022 Chandresh Soni
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Usage:
+//
+//   ./testsanitize
+//
+// brfSanitize() only takes the SSE2 path for 16 or more bytes, so feeding it
+// one byte at a time gives the output of the scalar code.  A test document
+// with long printable runs, lowercase BRF, control characters, line endings,
+// non-breaking spaces, Unicode braille, other UTF-8, and broken UTF-8 is
+// cleaned up with every combination of flags, in one piece and in pieces
+// of several sizes, which also splits UTF-8 sequences between calls, and
+// the output and counts are compared with the scalar ones.  Some short
+// inputs are also checked against their known output.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+
+
+//
+// Local types...
+//
+
+typedef struct testdata_s		// Output of one clean-up
+{
+  unsigned char	*data;			// Clean data
+  size_t	length;			// Length of clean data
+  unsigned	non_ascii,		// Non-ASCII characters replaced
+		control;		// Control characters replaced
+} testdata_t;
+
+
+//
+// Local functions...
+//
+
+static bool	sanitize(unsigned flags, const unsigned char *doc, size_t doclen, size_t piece, testdata_t *td);
+static bool	test_flags(unsigned flags, const unsigned char *doc, size_t doclen);
+static bool	test_known(void);
+static size_t	write_document(unsigned char *doc, size_t docsize);
+
+
+//
+// 'main()' - Main entry for unit tests.
+//
+
+int					// O - Exit status
+main(void)
+{
+  unsigned char	doc[65536];		// Test document
+  size_t	doclen;			// Length of test document
+  unsigned	flags;			// BRF_SANITIZE_ flags
+  bool		ret = true;		// Test result
+
+
+  doclen = write_document(doc, sizeof(doc));
+
+#ifndef __SSE2__
+  puts("brfSanitize: SSE2 not available, only testing the scalar code.");
+#endif // !__SSE2__
+
+  ret = test_known();
+
+  for (flags = 0; flags < 0x20; flags ++)
+    ret = test_flags(flags, doc, doclen) && ret;
+
+  return (ret ? 0 : 1);
+}
+
+
+//
+// 'sanitize()' - Clean up a document in pieces.
+//
+// A `piece` of 0 uses pieces of varying sizes.
+//
+
+static bool				// O - `true` on success, `false` on error
+sanitize(unsigned            flags,	// I - BRF_SANITIZE_ flags
+         const unsigned char *doc,	// I - Document
+         size_t              doclen,	// I - Length of document
+         size_t              piece,	// I - Size of pieces or `0`
+         testdata_t          *td)	// O - Output
+{
+  brf_sanitize_t	s;		// Sanitizer state
+  size_t		i,		// Offset in document
+			bytes,		// Bytes in this piece
+			count = 0;	// Number of pieces
+
+
+  if ((td->data = malloc(2 * doclen + 4)) == NULL)
+    return (false);
+
+  td->length = 0;
+
+  brfSanitizeInit(&s, flags);
+
+  for (i = 0; i < doclen; i += bytes, count ++)
+  {
+    if (piece)
+      bytes = piece;
+    else
+      bytes = 1 + (count * 7919) % 61;
+
+    if (bytes > (doclen - i))
+      bytes = doclen - i;
+
+    td->length += brfSanitize(&s, doc + i, bytes, td->data + td->length);
+  }
+
+  // Count an incomplete sequence at the end like brfSanitizeFinish()...
+  if (s.utf8_used && (flags & BRF_SANITIZE_ASCII))
+    s.non_ascii ++;
+
+  td->non_ascii = s.non_ascii;
+  td->control   = s.control;
+
+  return (true);
+}
+
+
+//
+// 'test_flags()' - Compare the output for a combination of flags.
+//
+
+static bool				// O - `true` if the same
+test_flags(unsigned            flags,	// I - BRF_SANITIZE_ flags
+           const unsigned char *doc,	// I - Document
+           size_t              doclen)	// I - Length of document
+{
+  testdata_t		scalar,		// Output of the scalar code
+			simd;		// Output in larger pieces
+  size_t		i;		// Looping var
+  static const size_t	pieces[] =	// Sizes of pieces to test
+  {
+    0,
+    15,
+    16,
+    17,
+    31,
+    4096,
+    65536
+  };
+  bool			ret = true;	// Test result
+
+
+  printf("brfSanitize(0x%02x): ", flags);
+  fflush(stdout);
+
+  if (!sanitize(flags, doc, doclen, 1, &scalar))
+  {
+    puts("FAIL (out of memory)");
+    return (false);
+  }
+
+  for (i = 0; i < sizeof(pieces) / sizeof(pieces[0]) && ret; i ++)
+  {
+    if (!sanitize(flags, doc, doclen, pieces[i], &simd))
+    {
+      puts("FAIL (out of memory)");
+      ret = false;
+      break;
+    }
+
+    if (simd.length != scalar.length || memcmp(simd.data, scalar.data, scalar.length))
+    {
+      size_t diff;			// First difference
+
+      for (diff = 0; diff < simd.length && diff < scalar.length && simd.data[diff] == scalar.data[diff]; diff ++);
+
+      printf("FAIL (%u byte pieces: %u bytes instead of %u, first difference at offset %u)\n", (unsigned)pieces[i], (unsigned)simd.length, (unsigned)scalar.length, (unsigned)diff);
+      ret = false;
+    }
+    else if (simd.non_ascii != scalar.non_ascii || simd.control != scalar.control)
+    {
+      printf("FAIL (%u byte pieces: %u/%u replaced instead of %u/%u)\n", (unsigned)pieces[i], simd.non_ascii, simd.control, scalar.non_ascii, scalar.control);
+      ret = false;
+    }
+
+    free(simd.data);
+  }
+
+  if (ret)
+    printf("PASS (%u bytes, %u non-ASCII and %u control characters replaced)\n", (unsigned)scalar.length, scalar.non_ascii, scalar.control);
+
+  free(scalar.data);
+
+  return (ret);
+}
+
+
+//
+// 'test_known()' - Check the output for known inputs.
+//
+// The inputs are long enough for the SSE2 path and each is also cleaned up
+// one byte at a time.
+//
+
+static bool				// O - `true` if all match
+test_known(void)
+{
+  size_t		i,		// Looping var
+			piece;		// Size of pieces
+  testdata_t		td;		// Output
+  bool			ret = true;	// Test result
+  static const struct
+  {
+    unsigned		flags;		// BRF_SANITIZE_ flags
+    const char		*input,		// Input
+			*output;	// Expected output
+  }			known[] =	// Known inputs
+  {
+    { BRF_SANITIZE_CRLF, "ABCDEFGHIJKLMNOPQRSTUVWXYZ\r\nABCDEFGHIJKLMNOPQRSTUVWXYZ\n", "ABCDEFGHIJKLMNOPQRSTUVWXYZ\r\nABCDEFGHIJKLMNOPQRSTUVWXYZ\r\n" },
+    { BRF_SANITIZE_CRLF, "\rABCDEFGHIJKLMNOPQRSTUVWXYZ\n", "\rABCDEFGHIJKLMNOPQRSTUVWXYZ\r\n" },
+    { BRF_SANITIZE_CRLF | BRF_SANITIZE_STRIP, "ABCDEFGHIJKLMNOPQRSTUVWXYZ\r\n\032", "ABCDEFGHIJKLMNOPQRSTUVWXYZ\n" },
+    { BRF_SANITIZE_FOLD, "`abcdefghijklmnopqrstuvwxyz{|}~ ABC", "@ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]_ ABC" },
+    { BRF_SANITIZE_ASCII, "ABCDEFGHIJKLMNOP\342\240\201\342\240\277\302\240\303\251ABCDEFGHIJKLMNOP", "ABCDEFGHIJKLMNOPA=  ABCDEFGHIJKLMNOP" },
+    { 0, "ABCDEFGHIJKLMNOP\303\251\240ABCDEFGHIJKLMNOP", "ABCDEFGHIJKLMNOP\303\251 ABCDEFGHIJKLMNOP" },
+    { BRF_SANITIZE_CONTROL, "ABCDEFGHIJKLMNOP\t\001\177\fABCDEFGHIJKLMNOP", "ABCDEFGHIJKLMNOP   \fABCDEFGHIJKLMNOP" }
+  };
+
+
+  for (i = 0; i < sizeof(known) / sizeof(known[0]); i ++)
+  {
+    for (piece = 1; piece <= strlen(known[i].input); piece += strlen(known[i].input) - 1)
+    {
+      printf("brfSanitize(0x%02x, known input %u, %u byte pieces): ", known[i].flags, (unsigned)i + 1, (unsigned)piece);
+
+      if (!sanitize(known[i].flags, (const unsigned char *)known[i].input, strlen(known[i].input), piece, &td))
+      {
+        puts("FAIL (out of memory)");
+        return (false);
+      }
+
+      if (td.length != strlen(known[i].output) || memcmp(td.data, known[i].output, td.length))
+      {
+        printf("FAIL (got \"%.*s\")\n", (int)td.length, (char *)td.data);
+        ret = false;
+      }
+      else
+        puts("PASS");
+
+      free(td.data);
+    }
+  }
+
+  return (ret);
+}
+
+
+//
+// 'write_document()' - Make a test document.
+//
+// The document mixes long runs of printable ASCII, which take the SSE2 path,
+// with all kinds of bytes the scalar code handles, at every alignment.
+//
+
+static size_t				// O - Length of document
+write_document(unsigned char *doc,	// I - Document buffer
+               size_t        docsize)	// I - Size of document buffer
+{
+  unsigned char	*ptr = doc,		// Pointer into document
+		*end = doc + docsize - 64;
+					// End of document
+  unsigned	seed = 1,		// Pseudo-random number
+		i,			// Looping var
+		len;			// Length of run
+  static const char * const specials[] =// Special sequences
+  {
+    "\r\n",				// CR LF
+    "\n",				// LF
+    "\r",				// CR
+    "\f",				// Form feed
+    "\032",				// SUB
+    "\t",				// Control character
+    "\001",				// Control character
+    "\177",				// DEL
+    "~",				// Tilde
+    "`abcxyz{|}",			// Lowercase BRF
+    "\302\240",				// UTF-8 non-breaking space
+    "\240",				// ISO-8859-1 non-breaking space
+    "\342\240\201",			// U+2801 braille pattern dots-1
+    "\342\243\277",			// U+28FF braille pattern dots-12345678
+    "\303\251",				// U+00E9
+    "\342\202\254",			// U+20AC
+    "\360\237\230\200",			// U+1F600
+    "\302A",				// Incomplete 2-byte sequence
+    "\342\240",				// Incomplete 3-byte sequence
+    "\200",				// Stray continuation byte
+    "\377",				// Invalid byte
+    "\300\201"				// Overlong sequence
+  };
+
+
+  while (ptr < end)
+  {
+    seed = seed * 1103515245 + 12345;
+
+    if ((seed >> 16) % 3)
+    {
+      // Printable BRF, sometimes long enough for several 16 byte blocks...
+      for (i = 0, len = (seed >> 8) % 53; i < len && ptr < end; i ++)
+        *ptr++ = (unsigned char)(' ' + (i * 7 + (seed >> 20)) % 64);
+    }
+    else
+    {
+      const char *sp = specials[(seed >> 18) % (sizeof(specials) / sizeof(specials[0]))];
+					// Special sequence
+
+      len = (unsigned)strlen(sp);
+      memcpy(ptr, sp, len);
+      ptr += len;
+    }
+  }
+
+  return ((size_t)(ptr - doc));
+}
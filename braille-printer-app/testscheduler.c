@@ -0,0 +1,509 @@
+//
+// Unit test program for printing jobs ahead in the Braille Printer
+// Application
+//
+// Copyright © 2022 Chandresh Soni
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Usage:
+//
+//   ./testscheduler [SERVER-EXECUTABLE]
+//
+// Starts "brf-printer-app server" on a loopback port with a scratch spool
+// directory, adds a generic printer with a slow simulated embosser, and
+// prints a large BRF job with a short one submitted while the large one is
+// embossed.  The short job must be printed ahead exactly once, and the
+// embosser must count the pages of both documents and no more.
+//
+
+//
+// Include necessary headers...
+//
+
+#include <cups/cups.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+
+//
+// Constants...
+//
+
+#  define TEST_LARGE_PAGES	40	// Pages of the large job
+#  define TEST_PORT		8766	// Server port
+#  define TEST_SHORT_PAGES	2	// Pages of the short job
+#  define TEST_TIMEOUT		120.0	// Timeout in seconds
+
+
+//
+// Local globals...
+//
+
+static char	test_dir[1024] = "";	// Scratch directory
+static pid_t	test_pid = 0;		// Server process ID
+static char	test_printer[1024] = "",// Printer URI
+		test_resource[256] = "";// Printer resource
+
+
+//
+// Local functions...
+//
+
+static int	count_log(const char *match, int *pages);
+static bool	create_printer(http_t *http);
+static bool	make_brf(const char *filename, int pages);
+static double	now(void);
+static bool	start_server(const char *app);
+static void	stop_server(void);
+static int	submit_job(http_t *http, const char *filename, const char *title);
+static ipp_jstate_t wait_job(http_t *http, int job_id, ipp_jstate_t state, int *impressions);
+
+
+//
+// 'main()' - Main entry for unit tests.
+//
+
+int					// O - Exit status
+main(int  argc,				// I - Number of command-line arguments
+     char *argv[])			// I - Command-line arguments
+{
+  const char	*app = argc > 1 ? argv[1] : "./brf-printer-app";
+					// Server executable
+  char		large[1100],		// Large document
+		small[1100];		// Short document
+  http_t	*http = NULL;		// Connection to server
+  int		large_id,		// Large job ID
+		short_id,		// Short job ID
+		large_impressions,	// Impressions of large job
+		short_impressions,	// Impressions of short job
+		pages = 0,		// Pages counted by the embosser
+		ahead;			// Jobs printed ahead
+  ipp_jstate_t	large_state,		// State of large job
+		short_state;		// State of short job
+  bool		ret = false;		// Test result
+
+
+  snprintf(test_dir, sizeof(test_dir), "%s/testscheduler-XXXXXX", getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+
+  if (!mkdtemp(test_dir))
+  {
+    perror("testscheduler: Unable to create scratch directory");
+    return (1);
+  }
+
+  snprintf(large, sizeof(large), "%s/large.brf", test_dir);
+  snprintf(small, sizeof(small), "%s/short.brf", test_dir);
+
+  if (!make_brf(large, TEST_LARGE_PAGES) || !make_brf(small, TEST_SHORT_PAGES))
+  {
+    perror("testscheduler: Unable to create documents");
+    return (1);
+  }
+
+  if (!start_server(app))
+    goto finish;
+
+  if ((http = httpConnect2("localhost", TEST_PORT, NULL, AF_UNSPEC, HTTP_ENCRYPTION_IF_REQUESTED, 1, 30000, NULL)) == NULL)
+  {
+    fprintf(stderr, "testscheduler: Unable to connect to server: %s\n", cupsLastErrorString());
+    goto finish;
+  }
+
+  if (!create_printer(http))
+    goto finish;
+
+  // Submit the short job while the large one is embossed...
+  fputs("Print-Job(large): ", stdout);
+  fflush(stdout);
+
+  if ((large_id = submit_job(http, large, "large")) <= 0 || wait_job(http, large_id, IPP_JSTATE_PROCESSING, NULL) != IPP_JSTATE_PROCESSING)
+  {
+    printf("FAIL (%s)\n", cupsLastErrorString());
+    goto finish;
+  }
+
+  printf("PASS (job %d)\n", large_id);
+
+  sleep(1);
+
+  fputs("Print-Job(short): ", stdout);
+  fflush(stdout);
+
+  if ((short_id = submit_job(http, small, "short")) <= 0)
+  {
+    printf("FAIL (%s)\n", cupsLastErrorString());
+    goto finish;
+  }
+
+  printf("PASS (job %d)\n", short_id);
+
+  large_state = wait_job(http, large_id, IPP_JSTATE_COMPLETED, &large_impressions);
+  short_state = wait_job(http, short_id, IPP_JSTATE_COMPLETED, &short_impressions);
+
+  fputs("Job states: ", stdout);
+  if (large_state != IPP_JSTATE_COMPLETED || short_state != IPP_JSTATE_COMPLETED || large_impressions <= 0 || short_impressions <= 0)
+  {
+    printf("FAIL (large %d with %d impressions, short %d with %d impressions)\n", (int)large_state, large_impressions, (int)short_state, short_impressions);
+    goto finish;
+  }
+
+  puts("PASS");
+
+  // Stop the server so that all devices are closed and logged...
+  stop_server();
+
+  fputs("Printed ahead once: ", stdout);
+  if ((ahead = count_log("Printing ahead of job", NULL)) != 1)
+  {
+    printf("FAIL (%d times)\n", ahead);
+    goto finish;
+  }
+
+  puts("PASS");
+
+  fputs("Embossed pages: ", stdout);
+  count_log("sim://testscheduler: ", &pages);
+  if (pages != (TEST_LARGE_PAGES + TEST_SHORT_PAGES))
+  {
+    printf("FAIL (%d instead of %d)\n", pages, TEST_LARGE_PAGES + TEST_SHORT_PAGES);
+    goto finish;
+  }
+
+  printf("PASS (%d)\n", pages);
+
+  ret = true;
+
+  finish:
+
+  httpClose(http);
+  stop_server();
+
+  if (!ret)
+    fprintf(stderr, "testscheduler: Server log is in %s/server.log.\n", test_dir);
+
+  return (ret ? 0 : 1);
+}
+
+
+//
+// 'count_log()' - Count matching lines in the server log.
+//
+// With "pages" the number of pages after each match is added up.
+//
+
+static int				// O - Number of matching lines
+count_log(const char *match,		// I - Text to look for
+          int        *pages)		// IO - Pages or `NULL`
+{
+  FILE		*fp;			// Log file
+  char		filename[1100],		// Log filename
+		line[2048],		// Line from log
+		*ptr;			// Match in line
+  int		count = 0,		// Number of matches
+		n;			// Pages in line
+
+
+  snprintf(filename, sizeof(filename), "%s/server.log", test_dir);
+
+  if ((fp = fopen(filename, "r")) == NULL)
+    return (0);
+
+  while (fgets(line, sizeof(line), fp))
+  {
+    if ((ptr = strstr(line, match)) == NULL)
+      continue;
+
+    count ++;
+
+    if (pages && sscanf(ptr + strlen(match), "%d pages", &n) == 1)
+      *pages += n;
+  }
+
+  fclose(fp);
+
+  return (count);
+}
+
+
+//
+// 'create_printer()' - Add a generic printer with a simulated embosser.
+//
+// The embosser is slow and has a small buffer, so the large job takes
+// several seconds and waits at each page.
+//
+
+static bool				// O - `true` on success, `false` on error
+create_printer(http_t *http)		// I - Connection to server
+{
+  ipp_t			*request,	// IPP request
+			*response;	// IPP response
+  ipp_attribute_t	*attr;		// Printer URI
+  char			system_uri[1024],
+					// System URI
+			scheme[32],	// URI scheme
+			userpass[256],	// URI username:password
+			host[256];	// URI hostname
+  int			port;		// URI port
+
+
+  fputs("Create-Printer: ", stdout);
+
+  httpAssembleURI(HTTP_URI_CODING_ALL, system_uri, sizeof(system_uri), "ipp", NULL, "localhost", TEST_PORT, "/ipp/system");
+
+  request = ippNewRequest(IPP_OP_CREATE_PRINTER);
+  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "system-uri", NULL, system_uri);
+  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser());
+  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "printer-service-type", NULL, "print");
+  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "smi55357-driver", NULL, "gen_brf");
+  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "smi55357-device-uri", NULL, "sim://testscheduler?cps=20000&feed=100&buffer=2048");
+  ippAddString(request, IPP_TAG_PRINTER, IPP_TAG_NAME, "printer-name", NULL, "testscheduler");
+
+  response = cupsDoRequest(http, request, "/ipp/system");
+
+  if (ippGetStatusCode(response) > IPP_STATUS_OK_EVENTS_COMPLETE)
+  {
+    printf("FAIL (%s)\n", cupsLastErrorString());
+    ippDelete(response);
+    return (false);
+  }
+
+  if ((attr = ippFindAttribute(response, "printer-uri-supported", IPP_TAG_URI)) != NULL)
+    snprintf(test_printer, sizeof(test_printer), "%s", ippGetString(attr, 0, NULL));
+  else
+    httpAssembleURI(HTTP_URI_CODING_ALL, test_printer, sizeof(test_printer), "ipp", NULL, "localhost", TEST_PORT, "/ipp/print/testscheduler");
+
+  if (httpSeparateURI(HTTP_URI_CODING_ALL, test_printer, scheme, sizeof(scheme), userpass, sizeof(userpass), host, sizeof(host), &port, test_resource, sizeof(test_resource)) < HTTP_URI_STATUS_OK)
+    snprintf(test_resource, sizeof(test_resource), "/ipp/print/testscheduler");
+
+  printf("PASS (%s)\n", test_printer);
+
+  ippDelete(response);
+
+  return (true);
+}
+
+
+//
+// 'make_brf()' - Create a BRF document.
+//
+// 25 lines of 40 cells per page.
+//
+
+static bool				// O - `true` on success, `false` on error
+make_brf(const char *filename,		// I - Filename
+         int        pages)		// I - Number of pages
+{
+  FILE		*fp;			// File
+  int		page,			// Current page
+		line,			// Current line
+		col;			// Current column
+  static const char cells[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789,;:!?-()";
+					// Cells to use
+
+
+  if ((fp = fopen(filename, "w")) == NULL)
+    return (false);
+
+  for (page = 0; page < pages; page ++)
+  {
+    for (line = 0; line < 25; line ++)
+    {
+      for (col = 0; col < 40; col ++)
+        putc(col % 6 == 5 ? ' ' : cells[(page + line + col) % (int)(sizeof(cells) - 1)], fp);
+
+      putc('\n', fp);
+    }
+
+    putc('\f', fp);
+  }
+
+  return (!fclose(fp));
+}
+
+
+//
+// 'now()' - Get the monotonic time in seconds.
+//
+
+static double				// O - Time in seconds
+now(void)
+{
+  struct timespec	ts;		// Current time
+
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ((double)ts.tv_sec + 0.000000001 * (double)ts.tv_nsec);
+}
+
+
+//
+// 'start_server()' - Start the server and wait for its listener.
+//
+
+static bool				// O - `true` on success, `false` on error
+start_server(const char *app)		// I - Server executable
+{
+  char		port[64],		// Port option
+		spool[1100],		// Spool directory option
+		logfile[1100];		// Log file option
+  char		*args[16];		// Server arguments
+  http_t	*http;			// Test connection
+  double	start;			// Start time
+
+
+  snprintf(port, sizeof(port), "server-port=%d", TEST_PORT);
+  snprintf(spool, sizeof(spool), "spool-directory=%s", test_dir);
+  snprintf(logfile, sizeof(logfile), "log-file=%s/server.log", test_dir);
+
+  args[0]  = (char *)app;
+  args[1]  = "server";
+  args[2]  = "-o";
+  args[3]  = port;
+  args[4]  = "-o";
+  args[5]  = "listen-hostname=localhost";
+  args[6]  = "-o";
+  args[7]  = spool;
+  args[8]  = "-o";
+  args[9]  = logfile;
+  args[10] = "-o";
+  args[11] = "log-level=info";
+  args[12] = NULL;
+
+  printf("Starting %s on port %d: ", app, TEST_PORT);
+  fflush(stdout);
+
+  if ((test_pid = fork()) == 0)
+  {
+    // Keep the state file in the scratch directory...
+    unsetenv("SNAP_DATA");
+    setenv("XDG_DATA_HOME", test_dir, 1);
+
+    execv(app, args);
+    perror("testscheduler: Unable to start server");
+    _exit(1);
+  }
+  else if (test_pid < 0)
+  {
+    printf("FAIL (%s)\n", strerror(errno));
+    test_pid = 0;
+    return (false);
+  }
+
+  for (start = now(); (now() - start) < 30.0; usleep(100000))
+  {
+    if (waitpid(test_pid, NULL, WNOHANG) == test_pid)
+    {
+      puts("FAIL (server exited)");
+      test_pid = 0;
+      return (false);
+    }
+
+    if ((http = httpConnect2("localhost", TEST_PORT, NULL, AF_UNSPEC, HTTP_ENCRYPTION_IF_REQUESTED, 1, 1000, NULL)) != NULL)
+    {
+      httpClose(http);
+      puts("PASS");
+      return (true);
+    }
+  }
+
+  puts("FAIL (server did not start listening)");
+
+  return (false);
+}
+
+
+//
+// 'stop_server()' - Stop the server.
+//
+
+static void
+stop_server(void)
+{
+  if (test_pid > 0)
+  {
+    kill(test_pid, SIGTERM);
+    waitpid(test_pid, NULL, 0);
+    test_pid = 0;
+  }
+}
+
+
+//
+// 'submit_job()' - Print a BRF document.
+//
+
+static int				// O - Job ID or 0 on error
+submit_job(http_t     *http,		// I - Connection to server
+           const char *filename,	// I - Document
+           const char *title)		// I - Job name
+{
+  ipp_t		*request,		// IPP request
+		*response;		// IPP response
+  int		job_id = 0;		// Job ID
+
+
+  request = ippNewRequest(IPP_OP_PRINT_JOB);
+  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, test_printer);
+  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser());
+  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "job-name", NULL, title);
+  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_MIMETYPE, "document-format", NULL, "text/vnd.cups-brf");
+
+  response = cupsDoFileRequest(http, request, test_resource, filename);
+
+  if (ippGetStatusCode(response) <= IPP_STATUS_OK_EVENTS_COMPLETE)
+    job_id = ippGetInteger(ippFindAttribute(response, "job-id", IPP_TAG_INTEGER), 0);
+
+  ippDelete(response);
+
+  return (job_id);
+}
+
+
+//
+// 'wait_job()' - Wait for a job to reach a state.
+//
+
+static ipp_jstate_t			// O - Last job state
+wait_job(http_t       *http,		// I - Connection to server
+         int          job_id,		// I - Job ID
+         ipp_jstate_t state,		// I - State to wait for
+         int          *impressions)	// O - Impressions completed or `NULL`
+{
+  ipp_t		*request,		// IPP request
+		*response;		// IPP response
+  ipp_jstate_t	jstate = IPP_JSTATE_PENDING;
+					// Current job state
+  double	start;			// Start time
+
+
+  for (start = now(); (now() - start) < TEST_TIMEOUT; usleep(100000))
+  {
+    request = ippNewRequest(IPP_OP_GET_JOB_ATTRIBUTES);
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, test_printer);
+    ippAddInteger(request, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "job-id", job_id);
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser());
+
+    response = cupsDoRequest(http, request, test_resource);
+    jstate   = (ipp_jstate_t)ippGetInteger(ippFindAttribute(response, "job-state", IPP_TAG_ENUM), 0);
+
+    if (impressions)
+      *impressions = ippGetInteger(ippFindAttribute(response, "job-impressions-completed", IPP_TAG_INTEGER), 0);
+
+    ippDelete(response);
+
+    if (jstate >= state)
+      break;
+  }
+
+  return (jstate);
+}
@@ -0,0 +1,312 @@
+//
+// Unit test program for the parallel text translation of the Braille Printer
+// Application
+//
+// Copyright © 2022 Chandresh Soni
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Usage:
+//
+//   ./testtranslate [TABLES]
+//
+// A multi-page document is translated by brfTranslateFilter() with one and
+// with several workers, and the output is compared with the one of the
+// serial "fmt | lou_translate" pipeline of "texttobrf".  Without "TABLES" the
+// document is only reformatted, and also translated with
+// "en-us-brf.dis,en-us-g2.ctb,braille-patterns.cti" when "lou_translate" is
+// installed.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "brf-printer-app.h"
+
+
+//
+// Local functions...
+//
+
+static char	*read_file(const char *filename, size_t *length);
+static bool	test_translate(const char *docfile, const char *tables);
+static bool	write_document(const char *filename);
+
+
+//
+// 'main()' - Main entry for unit tests.
+//
+
+int					// O - Exit status
+main(int  argc,				// I - Number of command-line arguments
+     char *argv[])			// I - Command-line arguments
+{
+  char		docfile[256];		// Test document
+  int		fd;			// Test document file
+  bool		ret = true;		// Test result
+  brf_translate_params_t params;	// Translation parameters
+
+
+  papplCopyString(docfile, "/tmp/testtranslate-XXXXXX", sizeof(docfile));
+
+  if ((fd = mkstemp(docfile)) < 0)
+  {
+    perror(docfile);
+    return (1);
+  }
+
+  close(fd);
+
+  if (!write_document(docfile))
+  {
+    unlink(docfile);
+    return (1);
+  }
+
+  if (argc > 1)
+  {
+    ret = test_translate(docfile, argv[1]);
+  }
+  else
+  {
+    ret = test_translate(docfile, "");
+
+    memset(&params, 0, sizeof(params));
+    papplCopyString(params.tables, "en-us-brf.dis,en-us-g2.ctb,braille-patterns.cti", sizeof(params.tables));
+
+    if (brfTranslateCanSplit(&params))
+      ret = test_translate(docfile, params.tables) && ret;
+    else
+      puts("brfTranslateFilter(en-us-g2.ctb): SKIP (lou_translate not installed or file2brl installed)");
+  }
+
+  unlink(docfile);
+
+  return (ret ? 0 : 1);
+}
+
+
+//
+// 'read_file()' - Read a file into memory.
+//
+
+static char *				// O - File contents or `NULL` on error
+read_file(const char *filename,		// I - Filename
+          size_t     *length)		// O - Length of contents
+{
+  FILE		*fp;			// File
+  char		*buffer = NULL,		// Contents
+		*temp;			// New buffer
+  size_t	size = 0,		// Allocated size
+		bytes;			// Bytes read
+
+
+  *length = 0;
+
+  if ((fp = fopen(filename, "rb")) == NULL)
+    return (NULL);
+
+  do
+  {
+    if (*length == size)
+    {
+      if ((temp = realloc(buffer, size + 65536)) == NULL)
+      {
+        free(buffer);
+        fclose(fp);
+        return (NULL);
+      }
+
+      buffer = temp;
+      size   += 65536;
+    }
+
+    bytes   = fread(buffer + *length, 1, size - *length, fp);
+    *length += bytes;
+  }
+  while (bytes > 0);
+
+  fclose(fp);
+
+  return (buffer);
+}
+
+
+//
+// 'test_translate()' - Compare the filter output with the serial pipeline.
+//
+
+static bool				// O - `true` if the same
+test_translate(const char *docfile,	// I - Test document
+               const char *tables)	// I - liblouis tables or ""
+{
+  brf_translate_params_t params;	// Translation parameters
+  cf_filter_data_t	data;		// Filter data
+  char			command[2048],	// Serial pipeline
+			outfile[256];	// Filter output file
+  char			*serial,	// Serial output
+			*parallel;	// Filter output
+  size_t		seriallen,	// Length of serial output
+			parallellen,	// Length of filter output
+			i;		// Looping var
+  int			inputfd,	// Filter input
+			outputfd,	// Filter output
+			workers,	// Number of workers
+			status;		// Exit status
+  static const int	num_workers[] =	// Numbers of workers to test
+  {
+    1,
+    4
+  };
+  bool			ret = true;	// Test result
+
+
+  memset(&params, 0, sizeof(params));
+  params.width = 32;
+  papplCopyString(params.tables, tables, sizeof(params.tables));
+
+  // Serial pipeline, like texttobrf...
+  papplCopyString(outfile, "/tmp/testtranslate-XXXXXX", sizeof(outfile));
+
+  if ((outputfd = mkstemp(outfile)) < 0)
+  {
+    perror(outfile);
+    return (false);
+  }
+
+  close(outputfd);
+
+  if (tables[0])
+    snprintf(command, sizeof(command), "fmt -%d <'%s' | lou_translate '%s' >'%s'", params.width, docfile, tables, outfile);
+  else
+    snprintf(command, sizeof(command), "fmt -%d <'%s' >'%s'", params.width, docfile, outfile);
+
+  if ((status = system(command)) != 0 || (serial = read_file(outfile, &seriallen)) == NULL)
+  {
+    printf("%s: FAIL (status %d)\n", command, status);
+    unlink(outfile);
+    return (false);
+  }
+
+  // Parallel translation...
+  for (i = 0; i < sizeof(num_workers) / sizeof(num_workers[0]); i ++)
+  {
+    workers            = num_workers[i];
+    params.num_workers = workers;
+
+    printf("brfTranslateFilter(%s, %d workers): ", tables[0] ? tables : "no tables", workers);
+    fflush(stdout);
+
+    memset(&data, 0, sizeof(data));
+
+    if ((inputfd = open(docfile, O_RDONLY)) < 0)
+    {
+      printf("FAIL (%s)\n", strerror(errno));
+      ret = false;
+      break;
+    }
+
+    if ((outputfd = open(outfile, O_WRONLY | O_TRUNC)) < 0)
+    {
+      printf("FAIL (%s)\n", strerror(errno));
+      close(inputfd);
+      ret = false;
+      break;
+    }
+
+    if (brfTranslateFilter(inputfd, outputfd, 0, &data, &params))
+    {
+      puts("FAIL (filter error)");
+      ret = false;
+      continue;
+    }
+
+    if ((parallel = read_file(outfile, &parallellen)) == NULL)
+    {
+      printf("FAIL (%s)\n", strerror(errno));
+      ret = false;
+      continue;
+    }
+
+    if (parallellen != seriallen || memcmp(parallel, serial, seriallen))
+    {
+      size_t diff;			// First difference
+
+      for (diff = 0; diff < parallellen && diff < seriallen && parallel[diff] == serial[diff]; diff ++);
+
+      printf("FAIL (%u bytes instead of %u, first difference at offset %u)\n", (unsigned)parallellen, (unsigned)seriallen, (unsigned)diff);
+      ret = false;
+    }
+    else
+      printf("PASS (%u bytes)\n", (unsigned)parallellen);
+
+    free(parallel);
+  }
+
+  free(serial);
+  unlink(outfile);
+
+  return (ret);
+}
+
+
+//
+// 'write_document()' - Write a multi-page test document.
+//
+// The document spans several translation chunks and has page breaks, blank
+// lines, indented lines, UTF-8 text, and lines and words longer than the
+// line buffer of "lou_translate".
+//
+
+static bool				// O - `true` on success, `false` on error
+write_document(const char *filename)	// I - Filename
+{
+  FILE		*fp;			// Document file
+  int		para,			// Current paragraph
+		word,			// Current word
+		i;			// Looping var
+  static const char * const words[] =	// Words to use
+  {
+    "the", "braille", "embosser", "and", "with", "paper", "of", "for",
+    "knowledge", "translation", "café", "über", "children", "ought", "people",
+    "because", "through", "letters", "1234", "(quoted)", "e-mail", "don't"
+  };
+
+
+  if ((fp = fopen(filename, "w")) == NULL)
+  {
+    perror(filename);
+    return (false);
+  }
+
+  for (para = 0; para < 2000; para ++)
+  {
+    if (para % 100 == 99)
+      putc('\f', fp);
+
+    if (para % 7 == 3)
+      fputs("    Indented heading line\n", fp);
+
+    for (word = 0; word < 20 + para % 50; word ++)
+      fprintf(fp, "%s%c", words[(para * 7 + word * 3) % (int)(sizeof(words) / sizeof(words[0]))], word % 9 == 8 ? '\n' : ' ');
+
+    if (para % 250 == 125)
+    {
+      // Longer than the 2048 byte line buffer of lou_translate...
+      for (i = 0; i < 3000; i ++)
+        putc('a' + i % 26, fp);
+    }
+
+    fputs("\n\n", fp);
+  }
+
+  if (fclose(fp))
+  {
+    perror(filename);
+    return (false);
+  }
+
+  return (true);
+}